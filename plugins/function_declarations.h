@@ -46,6 +46,7 @@
     __cdecl int Plugin_ParseTokenLength(char* token);               // Tokenize a string - get the token's length
     __cdecl void Plugin_ParseReset(void);               			// Tokenize a string - Reset the parsers position
     __cdecl void Plugin_Cbuf_AddText(const char* text);
+    __cdecl qboolean Plugin_Cbuf_QueueCommand(const char* text);   // Thread safe, executes one command line during the next frame
     
     //      == Cvars ==
     
@@ -63,6 +64,9 @@
     __cdecl qboolean Plugin_Cvar_GetBoolean(CONVAR_T const *var);
     __cdecl float Plugin_Cvar_GetValue(CONVAR_T const *var);
     __cdecl const char* Plugin_Cvar_GetString(CONVAR_T const *var);
+    // The callback gets invoked once per server frame after the value of the cvar has been changed
+    __cdecl qboolean Plugin_Cvar_AddChangeCallback(CONVAR_T const *var, void (*callback)(CONVAR_T *var));
+    __cdecl void Plugin_Cvar_RemoveChangeCallback(CONVAR_T const *var, void (*callback)(CONVAR_T *var));
 
     __cdecl void Plugin_Cvar_VariableStringBuffer(const char* cvarname, char* buff, size_t size);
     __cdecl float Plugin_Cvar_VariableValue( const char *var_name );
@@ -85,6 +89,15 @@
     //Writes the provided buffer into the file named by qpath. This is the most easiest way to write a file
     __cdecl int Plugin_FS_SV_WriteFile( const char *qpath, const void *buffer, int size);
 
+    //Named key/value tables which are shared with scripts. Kept in memory and saved to storage/<table>.db in the background
+    __cdecl qboolean Plugin_Storage_SetString(const char* table, const char* key, const char* value);
+    __cdecl qboolean Plugin_Storage_SetInt(const char* table, const char* key, int value);
+    __cdecl qboolean Plugin_Storage_SetFloat(const char* table, const char* key, float value);
+    __cdecl qboolean Plugin_Storage_GetString(const char* table, const char* key, char* buffer, int bufferSize); //Fails if the key holds no string
+    __cdecl qboolean Plugin_Storage_GetInt(const char* table, const char* key, int* value);
+    __cdecl qboolean Plugin_Storage_GetFloat(const char* table, const char* key, float* value); //Integers get converted
+    __cdecl qboolean Plugin_Storage_Remove(const char* table, const char* key);
+
 
     //      == Networking ==
 
@@ -114,11 +127,13 @@
     __cdecl void Plugin_Error(int code, const char *fmt, ...);               // Notify the server of an error, action depends on code parameter
     __cdecl int Plugin_GetLevelTime();                                       // Self explanatory
     __cdecl int Plugin_GetServerTime();                                      // Self explanatory
+    __cdecl qboolean Plugin_RunJob(void (*func)(void *arg), void (*done)(void *arg), void *arg); // Runs func(arg) on a worker thread, then done(arg) on the main thread. func must not call any other server function
 
 	//	-- Functions for clients --
 	
 	__cdecl void Plugin_DropClient( int clientnum, const char *reason );	// Kicks the client from server
 	__cdecl void Plugin_BanClient( unsigned int clientnum, int seconds, int invokerid, char *reason ); //Bans the client for seconds from server. Seconds can be "-1" to create a permanent ban. invokerid can be 0 or the numeric uid. banreason can be NULL or a valid char* pointer.
+	__cdecl qboolean Plugin_DumpDemoBuffer( unsigned int clientnum, const char *basename ); // Saves the rolling demo buffer (sv_demoBuffer) of this client to a new demo. basename can be NULL
 
     //  -- TCP Connection functions --
     /* 
@@ -191,6 +206,11 @@
     __cdecl playerState_t *Plugin_SV_GameClientNum( int num ); //Retrives the playerState_t* object from a client number
 
     __cdecl gentity_t* Plugin_GetGentityForEntityNum(int entnum);
+
+    //Entity grid which gets updated after every server frame. Results are entity numbers, radius queries return the nearest first
+    __cdecl int Plugin_EntitiesInRadius(const vec3_t origin, float radius, qboolean playersOnly, int* entnums, int maxCount);
+    __cdecl int Plugin_EntitiesInBox(const vec3_t mins, const vec3_t maxs, qboolean playersOnly, int* entnums, int maxCount);
+    __cdecl int Plugin_NearestPlayer(const vec3_t origin, float maxDist, int ignoreEntnum); //Returns -1 if there is none. maxDist <= 0 is unlimited
     __cdecl client_t* Plugin_GetClientForClientNum(int clientnum);
 
     __cdecl const char* Plugin_SL_ConvertToString(int index);
@@ -23,6 +23,8 @@
 
 
 #include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
 
 #include "cmd.h"
 #include "cvar.h"
@@ -33,6 +35,9 @@
 #include "server.h"
 #include "punkbuster.h"
 #include "sys_thread.h"
+#include "sys_main.h"
+#include "qcommon_profile.h"
+#include "cmd_completion.h"
 
 /*
 =============================================================================
@@ -55,6 +60,29 @@ int		cmd_wait;
 cmd_t		cmd_text;
 byte		cmd_text_buf[MAX_CMD_BUFFER];
 
+/*
+Commands queued from other threads. This is a lock free multiple producer
+single consumer queue. Producers only swap the head pointer, Cbuf_Execute on
+the main thread is the only consumer. The stub node keeps the queue
+non-empty so producers never have to touch the tail.
+*/
+#define CBUF_REDIRECT_LENGTH 1024
+
+typedef struct cmdQueueEntry_s{
+	struct cmdQueueEntry_s* volatile next;
+	int uid;
+	int power;
+	int clientnum;
+	unsigned long long timestamp;
+	void (*redirect)(char* outputbuf, qboolean lastcommand);
+	char text[1];
+}cmdQueueEntry_t;
+
+static cmdQueueEntry_t cmd_queueStub;
+static cmdQueueEntry_t* volatile cmd_queueHead = &cmd_queueStub;
+static cmdQueueEntry_t* cmd_queueTail = &cmd_queueStub;
+static char cmd_queueRedirectBuf[CBUF_REDIRECT_LENGTH];
+
 
 /*
 ============
@@ -209,6 +237,142 @@ void Cbuf_ExecuteText (int exec_when, const char *text)
 
 
 
+
+static void Cbuf_PushQueueEntry( cmdQueueEntry_t* entry )
+{
+	cmdQueueEntry_t* prev;
+
+	entry->next = NULL;
+	__sync_synchronize();
+	prev = __sync_lock_test_and_set(&cmd_queueHead, entry);
+	/* Between the swap and this store the consumer sees a gap and waits */
+	prev->next = entry;
+}
+
+
+static cmdQueueEntry_t* Cbuf_PopQueueEntry( void )
+{
+	cmdQueueEntry_t* tail = cmd_queueTail;
+	cmdQueueEntry_t* next = tail->next;
+
+	if(tail == &cmd_queueStub)
+	{
+		if(next == NULL)
+			return NULL;
+
+		cmd_queueTail = next;
+		tail = next;
+		next = next->next;
+	}
+
+	if(next)
+	{
+		cmd_queueTail = next;
+		return tail;
+	}
+
+	if(tail != cmd_queueHead)
+	{
+		/* A producer is halfway through pushing. Pick it up next frame */
+		return NULL;
+	}
+
+	Cbuf_PushQueueEntry(&cmd_queueStub);
+
+	next = tail->next;
+	if(next)
+	{
+		cmd_queueTail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+
+/*
+============
+Cbuf_QueueCommand
+
+Queues one command line for execution with the given invoker and optional
+output redirect. Safe to call from any thread. The command gets executed on
+the main thread during the next Cbuf_Execute.
+============
+*/
+qboolean Cbuf_QueueCommand( const char *text, int uid, int power, int clientnum, void (*redirect)(char* outputbuf, qboolean lastcommand) )
+{
+	cmdQueueEntry_t* entry;
+	int len;
+
+	if(text == NULL)
+		return qfalse;
+
+	len = strlen(text);
+	if(len >= MAX_CMD_LINE)
+		len = MAX_CMD_LINE -1;
+
+	/* Z_Malloc is not thread safe */
+	entry = malloc(sizeof(cmdQueueEntry_t) + len);
+	if(entry == NULL)
+		return qfalse;
+
+	entry->uid = uid;
+	entry->power = power;
+	entry->clientnum = clientnum;
+	entry->redirect = redirect;
+	entry->timestamp = Sys_MicrosecondsMonotonic();
+	Com_Memcpy(entry->text, text, len);
+	entry->text[len] = '\0';
+
+	Cbuf_PushQueueEntry(entry);
+	return qtrue;
+}
+
+
+static void Cbuf_ExecuteQueue( void )
+{
+	static qboolean executing;
+	cmdQueueEntry_t* entry;
+	int oldpower, olduid, oldclnum;
+	unsigned long long latency;
+
+	if(executing || !Sys_IsMainThread())
+		return;
+
+	executing = qtrue;
+
+	while((entry = Cbuf_PopQueueEntry()) != NULL)
+	{
+		latency = Sys_MicrosecondsMonotonic() - entry->timestamp;
+		if(latency > 100000)
+		{
+			Com_DPrintf("Cbuf_ExecuteQueue: \"%s\" was queued for %llu msec\n", entry->text, latency / 1000);
+		}
+
+		oldpower = Cmd_GetInvokerPower();
+		olduid = Cmd_GetInvokerUID();
+		oldclnum = Cmd_GetInvokerClnum();
+		Cmd_SetCurrentInvokerInfo(entry->uid, entry->power, entry->clientnum);
+
+		if(entry->redirect)
+		{
+			Com_BeginRedirect(cmd_queueRedirectBuf, sizeof(cmd_queueRedirectBuf), entry->redirect);
+		}
+
+		Cmd_ExecuteString(entry->text);
+
+		if(entry->redirect)
+		{
+			Com_EndRedirect();
+		}
+
+		Cmd_SetCurrentInvokerInfo(olduid, oldpower, oldclnum);
+		free(entry);
+	}
+
+	executing = qfalse;
+}
+
+
 /*
 ============
 Cbuf_Execute
@@ -226,6 +390,9 @@ void Cbuf_Execute (void)
 	// breaking it for semicolon or newline.
 	qboolean in_star_comment = qfalse;
 	qboolean in_slash_comment = qfalse;
+
+	Cbuf_ExecuteQueue();
+
 	while (cmd_text.cursize)
 	{
 		if ( cmd_wait > 0 ) {
@@ -317,6 +484,7 @@ void __cdecl Cbuf_Execute_WrapperIW(int arg1, int arg2)
 typedef struct cmd_function_s
 {
 	struct cmd_function_s	*next;
+	struct cmd_function_s	*hashNext;
 	const char		*name;
 	const char		*helptext;
 	int			minPower;
@@ -324,9 +492,75 @@ typedef struct cmd_function_s
 	xcommand_t function;
 } cmd_function_t;
 
+/* Deprecated command names which get translated to their new name */
+typedef struct cmdAlias_s
+{
+	const char		*alias;
+	const char		*command;
+	struct cmdAlias_s	*hashNext;
+} cmdAlias_t;
+
+#define CMD_HASH_SIZE 1024
 
 static cmd_function_t *cmd_functions;
+static cmd_function_t *cmd_hashTable[CMD_HASH_SIZE];
+static cmdAlias_t *cmd_aliasHashTable[CMD_HASH_SIZE];
 
+static cmdAlias_t cmd_aliases[] =
+{
+	{ "authlogin", "login" },
+	{ "authChangePassword", "changePassword" },
+	{ "authSetAdmin", "AdminAddAdminWithPassword" },
+	{ "authUnsetAdmin", "AdminRemoveAdmin" },
+	{ "authListAdmins", "adminListAdmins" },
+	{ "cmdpowerlist", "AdminListCommands" },
+	{ "setCmdMinPower", "AdminChangeCommandPower" },
+	{ NULL, NULL }
+};
+
+/*
+================
+Cmd_HashValue
+
+Case insensitive hash of a command name
+================
+*/
+static long Cmd_HashValue( const char *name ) {
+	int		i;
+	long	hash;
+
+	hash = 0;
+	for ( i = 0; name[i] != '\0'; i++ ) {
+		hash += (long)tolower(name[i]) * (i + 119);
+	}
+	return hash & (CMD_HASH_SIZE -1);
+}
+
+static cmd_function_t *Cmd_FindCommandHashed( const char *cmd_name, long hash ) {
+	cmd_function_t *cmd;
+
+	for ( cmd = cmd_hashTable[hash]; cmd; cmd = cmd->hashNext ) {
+		if ( !Q_stricmp( cmd_name, cmd->name ) ) {
+			return cmd;
+		}
+	}
+	return NULL;
+}
+
+static cmd_function_t *Cmd_FindCommand( const char *cmd_name ) {
+	return Cmd_FindCommandHashed( cmd_name, Cmd_HashValue( cmd_name ) );
+}
+
+static void Cmd_InitAliases( void ) {
+	cmdAlias_t *alias;
+	long hash;
+
+	for ( alias = cmd_aliases; alias->alias; alias++ ) {
+		hash = Cmd_HashValue( alias->alias );
+		alias->hashNext = cmd_aliasHashTable[hash];
+		cmd_aliasHashTable[hash] = alias;
+	}
+}
 
 /*
 ============
@@ -336,25 +570,26 @@ Cmd_AddCommand
 qboolean Cmd_AddCommandGeneric( const char *cmd_name, const char* helptext, xcommand_t function, qboolean warn, int power ) {
 
 	cmd_function_t  *cmd;
+	long hash;
+
+	hash = Cmd_HashValue( cmd_name );
 
 	// fail if the command already exists
-	for ( cmd = cmd_functions ; cmd ; cmd = cmd->next ) {
-		if ( !strcmp( cmd_name, cmd->name )) {
-			// allow completion-only commands to be silently doubled
-			if ( function != NULL && warn) {
-				Com_PrintWarning( "Cmd_AddCommand: %s already defined\n", cmd_name );
-			}
-			return qfalse;
+	if ( Cmd_FindCommandHashed( cmd_name, hash ) ) {
+		// allow completion-only commands to be silently doubled
+		if ( function != NULL && warn) {
+			Com_PrintWarning( "Cmd_AddCommand: %s already defined\n", cmd_name );
 		}
+		return qfalse;
 	}
 	// use a small malloc to avoid zone fragmentation
 	if(helptext != NULL)
 	{
-		cmd = S_Malloc( sizeof( cmd_function_t ) + strlen(cmd_name) + 1 + strlen(helptext) + 1);
+		cmd = Z_TagMallocZero( sizeof( cmd_function_t ) + strlen(cmd_name) + 1 + strlen(helptext) + 1, TAG_COMMAND );
 		strcpy((char*)(cmd +1) + strlen(cmd_name) +1, helptext);
 		cmd->helptext = (char*)(cmd +1) + strlen(cmd_name) +1;
 	}else{
-		cmd = S_Malloc( sizeof( cmd_function_t ) + strlen(cmd_name) + 1);
+		cmd = Z_TagMallocZero( sizeof( cmd_function_t ) + strlen(cmd_name) + 1, TAG_COMMAND );
 	}
 	strcpy((char*)(cmd +1), cmd_name);
 	cmd->name = (char*)(cmd +1);
@@ -362,6 +597,9 @@ qboolean Cmd_AddCommandGeneric( const char *cmd_name, const char* helptext, xcom
 	cmd->minPower = power;
 	cmd->next = cmd_functions;
 	cmd_functions = cmd;
+	cmd->hashNext = cmd_hashTable[hash];
+	cmd_hashTable[hash] = cmd;
+	Completion_AddName( cmd->name, COMPLETION_CMD );
 	return qtrue;
 }
 
@@ -389,21 +627,27 @@ Cmd_RemoveCommand
 qboolean Cmd_RemoveCommand( const char *cmd_name ) {
 	cmd_function_t  *cmd, **back;
 
-	back = &cmd_functions;
-	while ( 1 ) {
-		cmd = *back;
-		if ( !cmd ) {
-			// command wasn't active
-			return qfalse;
+	cmd = Cmd_FindCommand( cmd_name );
+	if ( !cmd ) {
+		// command wasn't active
+		return qfalse;
+	}
+
+	for ( back = &cmd_hashTable[Cmd_HashValue( cmd_name )]; *back; back = &(*back)->hashNext ) {
+		if ( *back == cmd ) {
+			*back = cmd->hashNext;
+			break;
 		}
-		if ( !strcmp( cmd_name, cmd->name ) ) {
+	}
+	for ( back = &cmd_functions; *back; back = &(*back)->next ) {
+		if ( *back == cmd ) {
 			*back = cmd->next;
-			Z_Free( cmd );
-			return qtrue;
+			break;
 		}
-		back = &cmd->next;
 	}
-	return qfalse;
+	Completion_RemoveName( cmd->name, COMPLETION_CMD );
+	Z_Free( cmd );
+	return qtrue;
 }
 
 
@@ -493,29 +737,25 @@ qboolean Cmd_SetPower(const char *cmd_name, int power)
     cmd_function_t *cmd;
     if(!cmd_name) return qfalse;
 
-    for(cmd = cmd_functions ; cmd ; cmd = cmd->next){
-        if(!Q_stricmp(cmd_name, cmd->name)){
-            if(cmd->minPower != power){
-                cmd->minPower = power;
-            }
-            return qtrue;
-        }
-    }
-    return qfalse;
+    cmd = Cmd_FindCommand(cmd_name);
+    if(cmd == NULL)
+        return qfalse;
+
+    cmd->minPower = power;
+    return qtrue;
 }
 
 int	Cmd_GetPower(const char* cmd_name)
 {
 
     cmd_function_t *cmd;
-    for(cmd = cmd_functions ; cmd ; cmd = cmd->next){
-        if(!Q_stricmp(cmd_name,cmd->name)){
 
-                if(!cmd->minPower) return 100;
-                else return cmd->minPower;
-        }
-    }
-    return -1; //Don't exist
+    cmd = Cmd_FindCommand(cmd_name);
+    if(cmd == NULL)
+        return -1; //Don't exist
+
+    if(!cmd->minPower) return 100;
+    else return cmd->minPower;
 }
 
 void Cmd_ResetPower()
@@ -875,9 +1115,6 @@ Cmd_CommandCompletion
 */
 void	Cmd_CommandCompletion( void(*callback)(const char *s) , const char* completionstr) {
 
-	cmd_function_t	*cmd;
-
-
 #ifdef PUNKBUSTER
 	char pbcmd[256];
 
@@ -892,9 +1129,7 @@ void	Cmd_CommandCompletion( void(*callback)(const char *s) , const char* complet
 		return;
 	}
 #endif
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next) {
-		callback( cmd->name );
-	}
+	Completion_FindMatches( completionstr, COMPLETION_CMD, callback );
 }
 
 /*
@@ -905,10 +1140,9 @@ Cmd_CompleteArgument
 void Cmd_CompleteArgument( const char *command, char *args, int argNum ) {
 	cmd_function_t	*cmd;
 
-	for( cmd = cmd_functions; cmd; cmd = cmd->next ) {
-		if( !Q_stricmp( command, cmd->name ) && cmd->complete ) {
-			cmd->complete( args, argNum );
-		}
+	cmd = Cmd_FindCommand( command );
+	if( cmd && cmd->complete ) {
+		cmd->complete( args, argNum );
 	}
 }
 
@@ -922,10 +1156,9 @@ Cmd_SetCommandCompletionFunc
 void Cmd_SetCommandCompletionFunc( const char *command, completionFunc_t complete ) {
 	cmd_function_t	*cmd;
 
-	for( cmd = cmd_functions; cmd; cmd = cmd->next ) {
-		if( !Q_stricmp( command, cmd->name ) ) {
-			cmd->complete = complete;
-		}
+	cmd = Cmd_FindCommand( command );
+	if( cmd ) {
+		cmd->complete = complete;
 	}
 }
 
@@ -1025,7 +1258,9 @@ A complete command line has been parsed, so try to execute it
 */
 void	Cmd_ExecuteString( const char *text )
 {
-	cmd_function_t	*cmd, **prev;
+	cmd_function_t	*cmd;
+	cmdAlias_t	*alias;
+	long		hash;
 	char arg0[MAX_TOKEN_CHARS];
 #ifdef PUNKBUSTER
 	/* Trap commands going to PunkBuster here */
@@ -1045,67 +1280,38 @@ void	Cmd_ExecuteString( const char *text )
 	}
 
 	Q_strncpyz(arg0, Cmd_Argv(0), sizeof(arg0));
+	// only the command name, the arguments can hold passwords
+	Prof_LogCommand( arg0 );
 	
 	//Legacy fallback
 	if(!Q_stricmpn(arg0, "dvar", 4))
 	{
 		arg0[0] = 'c';
-	}else if(!Q_stricmpn(arg0, "auth", 4)){
-		if(!Q_stricmp(arg0, "authlogin"))
-		{
-			Q_strncpyz(arg0, "login", sizeof(arg0));
-			Com_PrintWarning("\"authlogin\" is deprecated and will be removed soon. Use \"login\" instead\n");
-		}
-		else if(!Q_stricmp(arg0, "authChangePassword"))
-		{
-			Q_strncpyz(arg0, "changePassword", sizeof(arg0));
-			Com_PrintWarning("\"authchangePassword\" is deprecated and will be removed soon. Use \"changePassword\" instead\n");
-		}
-		else if(!Q_stricmp(arg0, "authSetAdmin"))
-		{
-			Q_strncpyz(arg0, "AdminAddAdminWithPassword", sizeof(arg0));
-			Com_PrintWarning("\"authSetAdmin\" is deprecated and will be removed soon. Use \"AdminAddAdminWithPassword\" instead\n");
-		}
-		else if(!Q_stricmp(arg0, "authUnsetAdmin"))
-		{
-			Q_strncpyz(arg0, "AdminRemoveAdmin", sizeof(arg0));
-			Com_PrintWarning("\"authUnsetAdmin\" is deprecated and will be removed soon. Use \"AdminRemoveAdmin\" instead\n");
-		}
-		else if(!Q_stricmp(arg0, "authListAdmins"))
-		{
-			Q_strncpyz(arg0, "adminListAdmins", sizeof(arg0));
-			Com_PrintWarning("\"authListAdmins\" is deprecated and will be removed soon. Use \"adminListAdmins\" instead\n");
-		}
-	}else if(!Q_stricmp(arg0, "cmdpowerlist")){
-		Q_strncpyz(arg0, "AdminListCommands", sizeof(arg0));
-		Com_PrintWarning("\"cmdpowerlist\" is deprecated and will be removed soon. Use \"AdminListCommands\" instead\n");
 	}
-	else if(!Q_stricmp(arg0, "setCmdMinPower")){
-		Q_strncpyz(arg0, "AdminChangeCommandPower", sizeof(arg0));
-		Com_PrintWarning("\"setCmdMinPower\" is deprecated and will be removed soon. Use \"AdminChangeCommandPower\" instead\n");
+
+	hash = Cmd_HashValue( arg0 );
+
+	for ( alias = cmd_aliasHashTable[hash]; alias; alias = alias->hashNext ) {
+		if ( !Q_stricmp( arg0, alias->alias ) ) {
+			Com_PrintWarning("\"%s\" is deprecated and will be removed soon. Use \"%s\" instead\n", alias->alias, alias->command);
+			Q_strncpyz(arg0, alias->command, sizeof(arg0));
+			hash = Cmd_HashValue( arg0 );
+			break;
+		}
 	}
-	// check registered command functions	
-	for ( prev = &cmd_functions ; *prev ; prev = &cmd->next ) {
-		cmd = *prev;
-		if ( !Q_stricmp( arg0, cmd->name ) ) {
-			// rearrange the links so that the command will be
-			// near the head of the list next time it is used
-			*prev = cmd->next;
-			cmd->next = cmd_functions;
-			cmd_functions = cmd;
-
-			// perform the action
-			if ( !cmd->function ) {
-				// let the cgame or game handle it
-				break;
-			} else {
-				cmd->function ();
-			}
+
+	// check registered command functions
+	cmd = Cmd_FindCommandHashed( arg0, hash );
+	if ( cmd ) {
+		// perform the action
+		if ( cmd->function ) {
+			cmd->function ();
 			Cmd_EndTokenizedString( );
 			return;
 		}
+		// let the cgame or game handle it
 	}
-	
+
 	// check cvars
 	if ( Cvar_Command() ) {
 		Cmd_EndTokenizedString( );
@@ -1185,23 +1391,20 @@ static void Cmd_Help_f( void ) {
 		return;
 	}
 
-	for ( cmd = cmd_functions ; cmd ; cmd = cmd->next ) {
-		if ( Q_stricmp( cmdname, cmd->name ) != 0)
-		{
-			continue;
-		}
-		if(cmd->helptext == NULL)
-		{
-			Com_Printf("For command %s is no help available\n", cmd->name);
-			return;
-		}
-		Com_Printf("Help for %s:\n", cmd->name);
-		Com_Printf("-------------------------------------\n");
-		Com_Printf("%s\n", cmd->helptext);
-		Com_Printf("-------------------------------------\n");
+	cmd = Cmd_FindCommand( cmdname );
+	if ( cmd == NULL ) {
+		Com_Printf( "Help: Couldn't find command: %s\n", cmdname );
 		return;
 	}
-	Com_Printf( "Help: Couldn't find command: %s\n", cmdname );
+	if(cmd->helptext == NULL)
+	{
+		Com_Printf("For command %s is no help available\n", cmd->name);
+		return;
+	}
+	Com_Printf("Help for %s:\n", cmd->name);
+	Com_Printf("-------------------------------------\n");
+	Com_Printf("%s\n", cmd->helptext);
+	Com_Printf("-------------------------------------\n");
 }
 
 
@@ -1267,6 +1470,8 @@ void Cmd_ResetInvokerInfo()
 
 void Cmd_Init( void ) {
 
+	Cmd_InitAliases();
+
 	Cmd_AddPCommand( "cmdlist", Cmd_List_f, 1);
 	Cmd_AddPCommand( "AdminListCommands", Cmd_ListPower_f, 95);
 	Cmd_AddPCommand( "exec",Cmd_Exec_f, 98 );
@@ -47,6 +47,7 @@ void Cbuf_Execute();
 void Cbuf_ExecuteText(int exec_when, const char* text);
 void Cbuf_AddText(const char* text);
 void Cbuf_InsertText( const char *text );
+qboolean Cbuf_QueueCommand( const char *text, int uid, int power, int clientnum, void (*redirect)(char* outputbuf, qboolean lastcommand) );
 
 qboolean Cmd_AddCommand( const char *cmd_name, xcommand_t function );
 qboolean Cmd_AddPCommand( const char *cmd_name, xcommand_t function, int power );
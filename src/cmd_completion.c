@@ -27,6 +27,7 @@
 #include "q_shared.h"
 #include "cmd_completion.h"
 #include "qcommon_io.h"
+#include "qcommon_mem.h"
 
 /*
 ===========================================
@@ -36,6 +37,153 @@ command line completion
 
 #define MAX_TOKEN_CHARS 1024
 
+/*
+===========================================
+Completion trie
+
+All command and cvar names are kept in one case insensitive prefix tree
+so completion only has to visit the names which actually match.
+Nodes are shared by names which only differ in case, so every node which
+ends a name points to the name itself to keep its original case.
+Nodes are never freed. Removing a name just clears its type bit.
+===========================================
+*/
+
+#define COMPLETION_NUM_TYPES 2
+
+typedef struct completionNode_s
+{
+	struct completionNode_s	*child;
+	struct completionNode_s	*sibling;
+	const char		*names[COMPLETION_NUM_TYPES];	// owned by the command or cvar
+	char			c;
+	byte			types;
+} completionNode_t;
+
+#define COMPLETION_NODES_PER_BLOCK 1024
+
+static completionNode_t completionRoot;
+static completionNode_t *completionBlock;
+static int completionBlockUsed = COMPLETION_NODES_PER_BLOCK;
+
+static completionNode_t *Completion_AllocNode( char c )
+{
+	completionNode_t *node;
+
+	if( completionBlockUsed >= COMPLETION_NODES_PER_BLOCK )
+	{
+		completionBlock = Z_TagMallocZero( COMPLETION_NODES_PER_BLOCK * sizeof( completionNode_t ), TAG_COMMAND );
+		completionBlockUsed = 0;
+	}
+	node = &completionBlock[completionBlockUsed];
+	completionBlockUsed++;
+	node->c = c;
+	return node;
+}
+
+static completionNode_t *Completion_FindChild( completionNode_t *node, char c )
+{
+	completionNode_t *child;
+
+	c = tolower( c );
+	for( child = node->child; child; child = child->sibling )
+	{
+		if( tolower( child->c ) == c )
+			return child;
+	}
+	return NULL;
+}
+
+static int Completion_TypeIndex( int type )
+{
+	return type == COMPLETION_CMD ? 0 : 1;
+}
+
+/*
+===============
+Completion_AddName
+
+name has to stay valid until it gets removed again
+===============
+*/
+void Completion_AddName( const char *name, int type )
+{
+	completionNode_t *node, *child;
+	const char *s;
+
+	for( node = &completionRoot, s = name; *s; s++ )
+	{
+		child = Completion_FindChild( node, *s );
+		if( child == NULL )
+		{
+			child = Completion_AllocNode( *s );
+			child->sibling = node->child;
+			node->child = child;
+		}
+		node = child;
+	}
+	node->types |= type;
+	node->names[Completion_TypeIndex( type )] = name;
+}
+
+/*
+===============
+Completion_RemoveName
+===============
+*/
+void Completion_RemoveName( const char *name, int type )
+{
+	completionNode_t *node;
+
+	for( node = &completionRoot; node && *name; name++ )
+	{
+		node = Completion_FindChild( node, *name );
+	}
+	if( node )
+	{
+		node->types &= ~type;
+		node->names[Completion_TypeIndex( type )] = NULL;
+	}
+}
+
+static void Completion_Walk( completionNode_t *node, int typemask, void(*callback)(const char *s) )
+{
+	completionNode_t *child;
+
+	if( node->types & typemask & COMPLETION_CMD )
+	{
+		callback( node->names[Completion_TypeIndex( COMPLETION_CMD )] );
+	}
+	else if( node->types & typemask & COMPLETION_CVAR )
+	{
+		callback( node->names[Completion_TypeIndex( COMPLETION_CVAR )] );
+	}
+	for( child = node->child; child; child = child->sibling )
+	{
+		Completion_Walk( child, typemask, callback );
+	}
+}
+
+/*
+===============
+Completion_FindMatches
+
+Calls callback for every registered name of the given types which starts with prefix
+===============
+*/
+void Completion_FindMatches( const char *prefix, int typemask, void(*callback)(const char *s) )
+{
+	completionNode_t *node;
+
+	for( node = &completionRoot; *prefix; prefix++ )
+	{
+		node = Completion_FindChild( node, *prefix );
+		if( node == NULL )
+			return;
+	}
+	Completion_Walk( node, typemask, callback );
+}
+
 /*
 ==================
 Field_Clear
@@ -241,16 +389,16 @@ void Field_CompleteCommand( char *cmd, qboolean doCommands, qboolean doCvars )
 			Cmd_CommandCompletion( FindMatches, completionString );
 
 		if( doCvars )
-			Cvar_CommandCompletion( FindMatches );
+			Completion_FindMatches( completionString, COMPLETION_CVAR, FindMatches );
 
 		if( !Field_Complete( ) )
 		{
 			// run through again, printing matches
 			if( doCommands )
-				Cmd_CommandCompletion( PrintMatches, completionString );
+				Cmd_CommandCompletion( PrintMatches, shortestMatch );
 
 			if( doCvars )
-				Cvar_CommandCompletion( PrintCvarMatches );
+				Completion_FindMatches( shortestMatch, COMPLETION_CVAR, PrintCvarMatches );
 		}
 	}
 	Cmd_EndTokenizedString( );
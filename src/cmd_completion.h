@@ -47,6 +47,14 @@ typedef struct {
 
 
 
+/* Kinds of names stored in the completion trie */
+#define COMPLETION_CMD	1
+#define COMPLETION_CVAR	2
+
+void Completion_AddName( const char *name, int type );
+void Completion_RemoveName( const char *name, int type );
+void Completion_FindMatches( const char *prefix, int typemask, void(*callback)(const char *s) );
+
 void Cvar_CommandCompletionPrint( cvar_t const *cvar, void* none);
 void Cvar_CommandCompletionFind( cvar_t const *cvar, void* none);
 void Cvar_CompleteCvarName( char *args, int argNum );
@@ -50,6 +50,8 @@
 #include "sys_cod4loader.h"
 #include "httpftp.h"
 #include "huffman.h"
+#include "qcommon_profile.h"
+#include "net_game.h"
 
 #include <string.h>
 #include <setjmp.h>
@@ -162,7 +164,7 @@ void Com_MakeTimedEventArgCached(unsigned int index, unsigned int arg, unsigned
 		Com_Error(ERR_FATAL, "Com_MakeTimedEventArgCached: Bad function argument number. Allowed range is 0 - %d arguments", MAX_TIMEDEVENTARGS);
 
 	timedSysEvent_t  *ev = &timedEventBuffer[index];
-	void *ptr = Z_Malloc(size);
+	void *ptr = Z_TagMalloc(size, TAG_EVENT);
 	Com_Memcpy(ptr, ev->evArguments[arg].arg.p, size);
 	ev->evArguments[arg].size = size;
 	ev->evArguments[arg].arg.p = ptr;
@@ -339,7 +341,7 @@ sysEvent_t* Com_GetSystemEvent( void )
 		int   len;
 
 		len = strlen( s ) + 1;
-		b = Z_Malloc( len );
+		b = Z_TagMalloc( len, TAG_EVENT );
 		strcpy( b, s );
 		Com_QueueEvent( 0, SE_CONSOLE, 0, 0, len, b );
 	}
@@ -559,6 +561,7 @@ void Com_Quit_f( void ) {
 
 			Com_Close();
 		}
+		Sys_ShutdownJobs( );
 		Com_CloseLogFiles( );
 
 		FS_Shutdown(qtrue);
@@ -777,6 +780,9 @@ void Com_Init(char* commandLine){
 
     Cvar_Init();
 
+    Prof_Init();
+    Sys_InitJobs();
+
     Sec_Init();
 
     FS_InitFilesystem();
@@ -869,6 +875,8 @@ void Com_Init(char* commandLine){
     }
     Cmd_AddCommand ("quit", Com_Quit_f);
     Cmd_AddCommand ("writeconfig", Com_WriteConfig_f );
+    Cmd_AddCommand ("hunkusage", Mem_HunkUsage_f );
+    Cmd_AddCommand ("meminfo", Z_MemInfo_f );
 
 //    Com_AddLoggingCommands();
 //    HL2Rcon_AddSourceAdminCommands();
@@ -905,6 +913,11 @@ void Com_Init(char* commandLine){
 
 
     HL2Rcon_Init( );
+
+    if(sv_wwwServe->boolean)
+    {
+        HTTPServer_InitDownloads();
+    }
 /*
     if(sv_webadmin->boolean)
     {
@@ -996,6 +1009,7 @@ __optimize3 void Com_Frame( void ) {
 	unsigned int			usec;
 	static unsigned long long	lastTime;
 	static unsigned int		com_frameNumber;
+	unsigned long long		frameStart, profStart;
 
 
 	jmp_buf* abortframe = (jmp_buf*)Sys_GetValue(2);
@@ -1008,6 +1022,8 @@ __optimize3 void Com_Frame( void ) {
 			Com_Error(0, "Error Cleanup");		
 		}
 		Sys_LeaveCriticalSection(CRIT_ERRORCHECK);
+		/* The aborted frame never reached Prof_EndFrame */
+		Prof_EndIdleFrame();
 	}
 	//
 	// main event loop
@@ -1071,14 +1087,21 @@ __optimize3 void Com_Frame( void ) {
 
 	// mess with msec if needed
 	usec = Com_ModifyUsec(usec);
+	usec = NET_ReplayFrame(usec);
+
+	frameStart = Prof_Begin();
 
 	Cbuf_Execute (0 ,0);
+	Prof_End(PROF_CBUF, frameStart);
 	//
 	// server side
 	//
-	
+	profStart = Prof_Begin();
 	Com_EventLoop();
+	Prof_End(PROF_EVENTLOOP, profStart);
 
+	// notify the subscribers of all cvars changed by commands and packets
+	Cvar_RunChangeCallbacks();
 	
 #ifdef TIMEDEBUG
 	if ( com_speeds->integer ) {
@@ -1086,16 +1109,40 @@ __optimize3 void Com_Frame( void ) {
 	}
 #endif
 	if(!SV_Frame( usec ))
+	{
+		Prof_EndIdleFrame();
 		return;
+	}
 
+	profStart = Prof_Begin();
 	PHandler_Event(PLUGINS_ONFRAME);
+	Prof_End(PROF_PLUGINFRAME, profStart);
 
+	profStart = Prof_Begin();
 	Com_TimedEventLoop();
+	Prof_End(PROF_TIMEDEVENTS, profStart);
+
+	profStart = Prof_Begin();
 	Cbuf_Execute (0 ,0);
+	Prof_End(PROF_CBUF, profStart);
+
+	profStart = Prof_Begin();
 	NET_Sleep(0);
+	Prof_End(PROF_NETPOLL, profStart);
+
+	profStart = Prof_Begin();
 	NET_TcpServerPacketEventLoop();
+	Prof_End(PROF_TCPEVENTS, profStart);
+
+	profStart = Prof_Begin();
 	Sys_RunThreadCallbacks();
+	Prof_End(PROF_THREADCALLBACKS, profStart);
+
+	profStart = Prof_Begin();
 	Cbuf_Execute (0 ,0);
+	Prof_End(PROF_CBUF, profStart);
+
+	Prof_EndFrame(frameStart);
 
 #ifdef TIMEDEBUG
 	if ( com_speeds->integer ) {
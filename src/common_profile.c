@@ -0,0 +1,425 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+    Copyright (C) 1999-2005 Id Software, Inc.
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+#include "q_shared.h"
+#include "qcommon.h"
+#include "qcommon_io.h"
+#include "qcommon_profile.h"
+#include "cvar.h"
+#include "cmd.h"
+#include "sys_main.h"
+#include "sys_thread.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+========================================================================
+
+FRAME PROFILER
+
+Every phase of a server frame is timed with a monotonic microsecond clock.
+The last PROF_WINDOW frames are kept as raw samples so exact percentiles can
+be computed when somebody asks for them, and a rolling log2 histogram is
+updated incrementally. Recording a frame costs a handful of stores.
+
+Frames exceeding com_slowFrameTime are copied into a small ring buffer
+together with their packet counters and the commands they executed.
+
+========================================================================
+*/
+
+#define PROF_WINDOW 1024	//Frames kept for percentiles. Has to be a power of 2
+#define PROF_HISTOGRAM_BUCKETS 12
+#define PROF_HISTOGRAM_BASE 128	//Upper bound of the first bucket in usec
+
+#define MAX_SLOWFRAMES 16
+#define MAX_SLOWFRAME_CMDS 16
+#define MAX_SLOWFRAME_CMDLEN 96
+
+typedef struct{
+	unsigned int samples[PROF_WINDOW];
+	unsigned int buckets[PROF_HISTOGRAM_BUCKETS];
+	unsigned int maxUsec;
+	unsigned long long totalUsec;
+}profPhaseStats_t;
+
+typedef struct{
+	unsigned int phaseUsec[PROF_NUM_PHASES];
+	int packetsIn;
+	int packetsOut;
+	int bytesIn;
+	int bytesOut;
+	int numCmds;
+	char cmds[MAX_SLOWFRAME_CMDS][MAX_SLOWFRAME_CMDLEN];
+}profFrame_t;
+
+typedef struct{
+	time_t realtime;
+	unsigned int frameNum;
+	profFrame_t frame;
+}profSlowFrame_t;
+
+typedef struct{
+	profPhaseStats_t phases[PROF_NUM_PHASES];
+	unsigned int numFrames;
+	profFrame_t current;
+	profSlowFrame_t slowFrames[MAX_SLOWFRAMES];
+	unsigned int numSlowFrames;
+	unsigned int lastSlowFrameWarning;
+}profiler_t;
+
+static profiler_t prof;
+static cvar_t* com_slowFrameTime;
+
+static const char* prof_phaseNames[PROF_NUM_PHASES] = {
+	"frame",
+	"cbuf",
+	"eventloop",
+	"packets",
+	"game",
+	"snapshots",
+	"pings",
+	"timeouts",
+	"heartbeat",
+	"punkbuster",
+	"pluginframe",
+	"timedevents",
+	"netpoll",
+	"tcpevents",
+	"threadcallbacks"
+};
+
+
+static int Prof_Bucket( unsigned int usec )
+{
+	int bucket;
+
+	usec /= PROF_HISTOGRAM_BASE;
+
+	for(bucket = 0; usec && bucket < PROF_HISTOGRAM_BUCKETS -1; bucket++)
+	{
+		usec >>= 1;
+	}
+	return bucket;
+}
+
+unsigned long long Prof_Begin( void )
+{
+	return Sys_MicrosecondsMonotonic();
+}
+
+void Prof_End( profPhase_t phase, unsigned long long start )
+{
+	prof.current.phaseUsec[phase] += Sys_MicrosecondsMonotonic() - start;
+}
+
+void Prof_CountPacketIn( int length )
+{
+	prof.current.packetsIn++;
+	prof.current.bytesIn += length;
+}
+
+void Prof_CountPacketOut( int length )
+{
+	prof.current.packetsOut++;
+	prof.current.bytesOut += length;
+}
+
+/*
+=================
+Prof_LogCommand
+
+Remembers the commands of the running frame in case it turns out to be a slow one.
+Only pass the command name, slow frames are shown to webadmin users
+=================
+*/
+void Prof_LogCommand( const char* text )
+{
+	if(!Sys_IsMainThread())
+	{
+		return;
+	}
+	if(prof.current.numCmds < MAX_SLOWFRAME_CMDS)
+	{
+		Q_strncpyz(prof.current.cmds[prof.current.numCmds], text, MAX_SLOWFRAME_CMDLEN);
+	}
+	prof.current.numCmds++;
+}
+
+static void Prof_RecordSlowFrame( unsigned int totalUsec )
+{
+	profSlowFrame_t* slow;
+	unsigned int now;
+	int i, worst;
+
+	slow = &prof.slowFrames[prof.numSlowFrames % MAX_SLOWFRAMES];
+	slow->realtime = Com_GetRealtime();
+	slow->frameNum = prof.numFrames;
+	Com_Memcpy(&slow->frame, &prof.current, sizeof(slow->frame));
+	prof.numSlowFrames++;
+
+	now = Sys_Milliseconds();
+	if(now - prof.lastSlowFrameWarning < 10000 && prof.lastSlowFrameWarning != 0)
+	{
+		return;
+	}
+	prof.lastSlowFrameWarning = now;
+
+	for(i = PROF_FRAME +1, worst = PROF_FRAME +1; i < PROF_NUM_PHASES; i++)
+	{
+		if(prof.current.phaseUsec[i] > prof.current.phaseUsec[worst])
+		{
+			worst = i;
+		}
+	}
+	Com_PrintWarning("Slow frame: %.2f msec, %s took %.2f msec. Type slowframes for details\n", 
+		(float)totalUsec / 1000.0f, prof_phaseNames[worst], (float)prof.current.phaseUsec[worst] / 1000.0f);
+}
+
+/*
+=================
+Prof_EndFrame
+
+Commits the accumulated phase times of the frame which began at start
+=================
+*/
+void Prof_EndFrame( unsigned long long start )
+{
+	profPhaseStats_t* stats;
+	unsigned int usec, index;
+	int i;
+
+	prof.current.phaseUsec[PROF_FRAME] = Sys_MicrosecondsMonotonic() - start;
+
+	index = prof.numFrames & (PROF_WINDOW -1);
+
+	for(i = 0; i < PROF_NUM_PHASES; i++)
+	{
+		stats = &prof.phases[i];
+		usec = prof.current.phaseUsec[i];
+
+		if(prof.numFrames >= PROF_WINDOW)
+		{
+			stats->buckets[Prof_Bucket(stats->samples[index])]--;
+		}
+		stats->samples[index] = usec;
+		stats->buckets[Prof_Bucket(usec)]++;
+		stats->totalUsec += usec;
+		if(usec > stats->maxUsec)
+		{
+			stats->maxUsec = usec;
+		}
+	}
+	prof.numFrames++;
+
+	if(com_slowFrameTime->integer > 0 && prof.current.phaseUsec[PROF_FRAME] >= com_slowFrameTime->integer * 1000)
+	{
+		Prof_RecordSlowFrame(prof.current.phaseUsec[PROF_FRAME]);
+	}
+	Com_Memset(&prof.current, 0, sizeof(prof.current));
+}
+
+/*
+=================
+Prof_EndIdleFrame
+
+Closes a Com_Frame() which did not run a server frame. It does not count as a frame
+because most of it was spent sleeping, but if its commands or events took long it
+still gets recorded as a slow frame
+=================
+*/
+void Prof_EndIdleFrame( void )
+{
+	unsigned int usec;
+	int i;
+
+	for(i = PROF_FRAME +1, usec = 0; i < PROF_NUM_PHASES; i++)
+	{
+		if(i != PROF_PACKETS)	//Overlaps the other phases
+		{
+			usec += prof.current.phaseUsec[i];
+		}
+	}
+	prof.current.phaseUsec[PROF_FRAME] = usec;
+
+	if(com_slowFrameTime->integer > 0 && usec >= com_slowFrameTime->integer * 1000)
+	{
+		Prof_RecordSlowFrame(usec);
+	}
+	Com_Memset(&prof.current, 0, sizeof(prof.current));
+}
+
+static int Prof_CompareUsec( const void* a, const void* b )
+{
+	unsigned int ua = *(const unsigned int*)a;
+	unsigned int ub = *(const unsigned int*)b;
+
+	if(ua < ub)
+		return -1;
+	if(ua > ub)
+		return 1;
+	return 0;
+}
+
+/*
+=================
+Prof_PrintReport
+
+Percentiles of the rolling window for each phase and the frame time histogram
+=================
+*/
+void Prof_PrintReport( void )
+{
+	static unsigned int sorted[PROF_WINDOW];
+	profPhaseStats_t* stats;
+	unsigned int count, sum, lower, upper;
+	int i, j;
+
+	count = prof.numFrames < PROF_WINDOW ? prof.numFrames : PROF_WINDOW;
+
+	if(count == 0)
+	{
+		Com_Printf("No frames have been profiled yet\n");
+		return;
+	}
+
+	Com_Printf("Last %u of %u frames, times in msec\n", count, prof.numFrames);
+	Com_Printf("phase             p50      p99      max      avg   maxever\n");
+	Com_Printf("---------------- -------- -------- -------- -------- --------\n");
+
+	for(i = 0; i < PROF_NUM_PHASES; i++)
+	{
+		stats = &prof.phases[i];
+		Com_Memcpy(sorted, stats->samples, count * sizeof(sorted[0]));
+		qsort(sorted, count, sizeof(sorted[0]), Prof_CompareUsec);
+
+		for(j = 0, sum = 0; j < count; j++)
+		{
+			sum += sorted[j];
+		}
+		Com_Printf("%-16s %8.2f %8.2f %8.2f %8.2f %8.2f\n", prof_phaseNames[i],
+			(float)sorted[count / 2] / 1000.0f,
+			(float)sorted[(count * 99) / 100] / 1000.0f,
+			(float)sorted[count -1] / 1000.0f,
+			(float)sum / count / 1000.0f,
+			(float)stats->maxUsec / 1000.0f);
+	}
+
+	Com_Printf("\nFrame time histogram:\n");
+	stats = &prof.phases[PROF_FRAME];
+	for(i = 0, lower = 0, upper = PROF_HISTOGRAM_BASE; i < PROF_HISTOGRAM_BUCKETS; i++, lower = upper, upper *= 2)
+	{
+		if(i == PROF_HISTOGRAM_BUCKETS -1)
+		{
+			Com_Printf("%8.2f -      inf msec: %u\n", (float)lower / 1000.0f, stats->buckets[i]);
+		}else{
+			Com_Printf("%8.2f - %8.2f msec: %u\n", (float)lower / 1000.0f, (float)upper / 1000.0f, stats->buckets[i]);
+		}
+	}
+}
+
+/*
+=================
+Prof_PrintSlowFrames
+=================
+*/
+void Prof_PrintSlowFrames( void )
+{
+	profSlowFrame_t* slow;
+	unsigned int i, first;
+	int j;
+	char timestr[64];
+	struct tm *t;
+
+	if(prof.numSlowFrames == 0)
+	{
+		Com_Printf("No frame took longer than %d msec so far\n", com_slowFrameTime->integer);
+		return;
+	}
+
+	first = prof.numSlowFrames > MAX_SLOWFRAMES ? prof.numSlowFrames - MAX_SLOWFRAMES : 0;
+
+	for(i = first; i < prof.numSlowFrames; i++)
+	{
+		slow = &prof.slowFrames[i % MAX_SLOWFRAMES];
+
+		t = localtime(&slow->realtime);
+		strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", t);
+
+		Com_Printf("^3Frame %u at %s: %.2f msec\n", slow->frameNum, timestr, (float)slow->frame.phaseUsec[PROF_FRAME] / 1000.0f);
+		for(j = PROF_FRAME +1; j < PROF_NUM_PHASES; j++)
+		{
+			if(slow->frame.phaseUsec[j] == 0)
+			{
+				continue;
+			}
+			Com_Printf("  %-16s %8.2f msec\n", prof_phaseNames[j], (float)slow->frame.phaseUsec[j] / 1000.0f);
+		}
+		Com_Printf("  packets in: %d (%d bytes) out: %d (%d bytes)\n", slow->frame.packetsIn, slow->frame.bytesIn,
+			slow->frame.packetsOut, slow->frame.bytesOut);
+
+		if(slow->frame.numCmds > 0)
+		{
+			Com_Printf("  %d commands executed:\n", slow->frame.numCmds);
+		}
+		for(j = 0; j < slow->frame.numCmds && j < MAX_SLOWFRAME_CMDS; j++)
+		{
+			Com_Printf("    %s\n", slow->frame.cmds[j]);
+		}
+	}
+}
+
+void Prof_Reset( void )
+{
+	Com_Memset(prof.phases, 0, sizeof(prof.phases));
+	prof.numFrames = 0;
+	prof.numSlowFrames = 0;
+}
+
+static void Prof_Profile_f( void )
+{
+	if(Cmd_Argc() > 1 && !Q_stricmp(Cmd_Argv(1), "reset"))
+	{
+		Prof_Reset();
+		Com_Printf("Frame profiler has been reset\n");
+		return;
+	}
+	Prof_PrintReport();
+}
+
+static void Prof_SlowFrames_f( void )
+{
+	Prof_PrintSlowFrames();
+}
+
+void Prof_Init( void )
+{
+	com_slowFrameTime = Cvar_RegisterInt("com_slowFrameTime", 50, 0, 10000, 0, "Frames taking longer than this many milliseconds get recorded with their phase breakdown for the slowframes command. 0 disables it");
+
+	Cmd_AddCommand("profile", Prof_Profile_f);
+	Cmd_AddCommand("slowframes", Prof_SlowFrames_f);
+}
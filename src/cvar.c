@@ -54,6 +54,46 @@ int			cvar_numIndexes;
 #define FILE_HASH_SIZE		512
 static	cvar_t*		hashTable[FILE_HASH_SIZE];
 
+/* Every flag bit has its own generation counter which gets bumped whenever
+   a cvar carrying this flag changes. Cvar_InfoString caches its results
+   against the sum of the counters of the requested bits */
+#define MAX_CVAR_FLAGBITS	16
+#define MAX_INFOSTRING_CACHE	8
+static unsigned int cvar_flagGenerations[MAX_CVAR_FLAGBITS];
+
+typedef struct{
+	int bit;
+	unsigned int generation;
+	qboolean valid;
+	char info[MAX_INFO_STRING];
+}cvarInfoCache_t;
+
+static cvarInfoCache_t cvar_infoCache[MAX_INFOSTRING_CACHE];
+
+/* Change subscriptions live in a side table indexed like cvar_indexes because
+   cvar_t is shared with the game binary and must keep its layout.
+   Cvar_SetVariant only queues the changed cvar, the subscribers get called
+   once per frame from Cvar_RunChangeCallbacks */
+#define MAX_CVAR_CALLBACKS	512
+
+typedef struct cvarCallback_s{
+	cvarChangeCallback_t callback;
+	void* arg;
+	struct cvarCallback_s* next;
+}cvarCallback_t;
+
+static cvarCallback_t cvar_callbacks[MAX_CVAR_CALLBACKS];
+static cvarCallback_t* cvar_freeCallbacks;
+static qboolean cvar_callbacksInitialized;
+static cvarCallback_t* cvar_subscribers[MAX_CVARS];
+static int cvar_changeQueue[MAX_CVARS];
+static int cvar_changeQueueCount;
+static byte cvar_changeQueued[MAX_CVARS];
+/* While the callbacks run, unsubscribed entries only lose their callback and
+   get unlinked afterwards, so a callback can unsubscribe anyone */
+static qboolean cvar_callbacksRunning;
+static qboolean cvar_callbacksRemoved;
+
 typedef struct{
 		int integer;
 		const char** strings;
@@ -87,6 +127,9 @@ typedef struct{
 
 
 static int Cvar_SetVariant( cvar_t *var, CvarValue value ,qboolean force );
+static void Cvar_FlagsModified( int flags );
+static void Cvar_QueueChange( cvar_t* var );
+static void Cvar_ClearChangeCallbacks( cvar_t* var );
 void Cvar_ValueToStr(cvar_t const *cvar, char* bufvalue, int sizevalue, char* bufreset, int sizereset, char* buflatch, int sizelatch);
 void Cvar_Set2( const char *var_name, const char *value, qboolean force);
 
@@ -288,11 +331,7 @@ Cvar_CommandCompletion
 ============
 */
 void	Cvar_CommandCompletion( void(*callback)(const char *s) ) {
-	cvar_t		*cvar;
-	
-	for ( cvar = cvar_vars ; cvar ; cvar = cvar->next ) {
-		callback( cvar->name );
-	}
+	Completion_FindMatches( "", COMPLETION_CVAR, callback );
 }
 
 
@@ -637,7 +676,7 @@ static cvar_t *Cvar_Register(const char* var_name, cvarType_t type, unsigned sho
 				var->imax = limits.imax;
 				break;
 			case CVAR_STRING:
-				var->resetString = CopyString( value.string );
+				var->resetString = CopyStringTag( value.string, TAG_CVAR );
 		}
 		/* Apply the new description */
 		if(description && description[0])
@@ -646,13 +685,14 @@ static cvar_t *Cvar_Register(const char* var_name, cvarType_t type, unsigned sho
 			{
 				Z_Free( var->description );
 			}
-			var->description = CopyString(description);
+			var->description = CopyStringTag( description, TAG_CVAR );
 		}
 		else
 			var->description = nullstring;
 
 		var->flags |= flags;
 		var->type = type;
+		Cvar_FlagsModified( var->flags );
 
 		// Take the latched value now
 		Cvar_Set2( var_name, latchedStr, qtrue );
@@ -670,7 +710,7 @@ static cvar_t *Cvar_Register(const char* var_name, cvarType_t type, unsigned sho
 		cvar_numIndexes++;
 
 		Com_Memset(var, 0, sizeof(cvar_t));
-		var->name = CopyString (var_name);
+		var->name = CopyStringTag( var_name, TAG_CVAR );
 
 		// link the variable in
 		var->next = cvar_vars;
@@ -678,26 +718,29 @@ static cvar_t *Cvar_Register(const char* var_name, cvarType_t type, unsigned sho
 		hash = generateHashValue(var_name);
 		var->hashNext = hashTable[hash];
 		hashTable[hash] = var;
+		Completion_AddName(var->name, COMPLETION_CVAR);
 
 	}else{
 		safenext = var->next;
 		safehashNext = var->hashNext;
 
 		Com_Memset(var, 0, sizeof(cvar_t));
-		var->name = CopyString (var_name);
+		var->name = CopyStringTag( var_name, TAG_CVAR );
 
 		// variable is already linked in
 		var->next = safenext;
 		var->hashNext = safehashNext;
+		Completion_AddName(var->name, COMPLETION_CVAR);
 	}
 
 	if(description && description[0])
-		var->description = CopyString(description);
+		var->description = CopyStringTag( description, TAG_CVAR );
 	else
 		var->description = nullstring;
 
 	var->flags = flags;
 	var->type = type;
+	Cvar_FlagsModified( flags );
 	var->modified = qtrue; /* Is this true ?*/
 
 	switch(type)
@@ -743,9 +786,9 @@ static cvar_t *Cvar_Register(const char* var_name, cvarType_t type, unsigned sho
 			var->imax = limits.imax;
 			break;
 		case CVAR_STRING:
-			var->string = CopyString( value.string );
-			var->resetString = CopyString( value.string );
-			var->latchedString = CopyString( value.string );
+			var->string = CopyStringTag( value.string, TAG_CVAR );
+			var->resetString = CopyStringTag( value.string, TAG_CVAR );
+			var->latchedString = CopyStringTag( value.string, TAG_CVAR );
 	}
 	cvar_modifiedFlags |= var->flags;
 	return var;
@@ -924,17 +967,20 @@ static int Cvar_SetVariant( cvar_t *var, CvarValue value ,qboolean force ) {
 				if(var->string && var->string != nullstring)
 					Z_Free(var->string);
 
-				var->string = CopyString( value.string );
+				var->string = CopyStringTag( value.string, TAG_CVAR );
 			}
 
 			if(var->latchedString && var->latchedString != nullstring)
 				Z_Free(var->latchedString);
 
-			var->latchedString = CopyString( value.string );
+			var->latchedString = CopyStringTag( value.string, TAG_CVAR );
 	}
 	// note what types of cvars have been modified (userinfo, archive, serverinfo, systeminfo)
 	cvar_modifiedFlags |= var->flags;
 	var->modified = qtrue;
+	Cvar_FlagsModified( var->flags );
+	if(!latched)
+		Cvar_QueueChange( var );
 	return 1;
 }
 
@@ -1141,6 +1187,7 @@ void Cvar_SetAllowCheatOnly( const char *var_name, const char *value) {
 		var->flags &= ~CVAR_CHEAT;
 		Cvar_Set2 (var_name, value, qfalse);
 		var->flags |= CVAR_CHEAT;
+		Cvar_FlagsModified( var->flags );
 	}else{
 		Cvar_Set2 (var_name, value, qfalse);
 	}
@@ -1703,6 +1750,7 @@ void Cvar_SetU_f( void ) {
 		return;
 	}
 	v->flags |= CVAR_USERINFO;
+	Cvar_FlagsModified( CVAR_USERINFO );
 }
 
 /*
@@ -1725,6 +1773,7 @@ void Cvar_SetS_f( void ) {
 		return;
 	}
 	v->flags |= CVAR_SERVERINFO;
+	Cvar_FlagsModified( CVAR_SERVERINFO );
 }
 
 /*
@@ -1904,6 +1953,12 @@ void Cvar_Restart_f( void ) {
 		if ( var->flags & CVAR_USER_CREATED ) {
 			*prev = var->next;
 
+			if ( var->name ) {
+				Completion_RemoveName( var->name, COMPLETION_CVAR );
+			}
+			Cvar_FlagsModified( var->flags );
+			Cvar_ClearChangeCallbacks( var );
+
 			if(var->type == CVAR_STRING)
 			{
 				if(var->string != NULL)
@@ -1948,26 +2003,142 @@ void Cvar_Restart_f( void ) {
 
 /*
 =====================
-Cvar_InfoString
+Cvar_FlagsModified
+
+Invalidates all cached info strings which contain cvars with one of these flags
 =====================
 */
-char	*Cvar_InfoString( int bit ) {
-	static char	info[MAX_INFO_STRING];
-	char value[1024];
+static void Cvar_FlagsModified( int flags ) {
+	int i;
+
+	for (i = 0; i < MAX_CVAR_FLAGBITS; i++) {
+		if (flags & (1 << i)) {
+			cvar_flagGenerations[i]++;
+		}
+	}
+}
 
+static unsigned int Cvar_FlagsGeneration( int flags ) {
+	unsigned int generation;
+	int i;
+
+	for (i = 0, generation = 0; i < MAX_CVAR_FLAGBITS; i++) {
+		if (flags & (1 << i)) {
+			generation += cvar_flagGenerations[i];
+		}
+	}
+	return generation;
+}
+
+/*
+=====================
+Cvar_BuildInfoString
+
+Builds the same string as repeated Info_SetValueForKey() calls would have
+done but in one linear pass. Info_SetValueForKey() prepends every new pair,
+so the pairs end up in reverse order of cvar_vars and on overflow the pairs
+found first in cvar_vars win.
+=====================
+*/
+static void Cvar_BuildInfoString( int bit, char* info ) {
+	/* Every pair takes at least 4 bytes: \k\v */
+	static cvar_t *vars[MAX_INFO_STRING / 4];
+	static int valueOffsets[MAX_INFO_STRING / 4];
+	static char values[MAX_INFO_STRING];
+	char value[MAX_INFO_VALUE];
+	int numvars, i, len, valueslen, valuelen, namelen;
 	cvar_t	*var;
 
-	info[0] = 0;
+	numvars = 0;
+	len = 0;
+	valueslen = 0;
 
 	for (var = cvar_vars ; var ; var = var->next) {
-		if (var->flags & bit) {
-			if(var->type != CVAR_BOOL)
-				Cvar_ValueToStr(var, value, sizeof(value), NULL, 0, NULL, 0);
-			else
-				Com_sprintf(value, sizeof(value), "%d", var->boolean);
-			Info_SetValueForKey (info, var->name, value);
+		if (!(var->flags & bit)) {
+			continue;
+		}
+		if(var->type != CVAR_BOOL)
+			Cvar_ValueToStr(var, value, sizeof(value), NULL, 0, NULL, 0);
+		else
+			Com_sprintf(value, sizeof(value), "%d", var->boolean);
+
+		if (value[0] == '\0') {
+			continue;
+		}
+		if (strpbrk(var->name, "\\;\"") || strpbrk(value, "\\;\"")) {
+			Com_PrintWarning ("Can't use keys or values with a \\, semicolon or \" in infostrings\n");
+			Com_DPrintf("Bad key: %s value: %s\n", var->name, value);
+			continue;
+		}
+		namelen = strlen(var->name);
+		valuelen = strlen(value);
+		if (len + namelen + valuelen + 2 >= MAX_INFO_STRING) {
+			Com_PrintWarning ("Info string length exceeded\n");
+			continue;
+		}
+		len += namelen + valuelen + 2;
+		vars[numvars] = var;
+		valueOffsets[numvars] = valueslen;
+		Com_Memcpy(&values[valueslen], value, valuelen +1);
+		valueslen += valuelen +1;
+		numvars++;
+	}
+
+	for (i = numvars -1, len = 0; i >= 0; i--) {
+		namelen = strlen(vars[i]->name);
+		valuelen = strlen(&values[valueOffsets[i]]);
+		info[len] = '\\';
+		Com_Memcpy(&info[len +1], vars[i]->name, namelen);
+		len += namelen +1;
+		info[len] = '\\';
+		Com_Memcpy(&info[len +1], &values[valueOffsets[i]], valuelen);
+		len += valuelen +1;
+	}
+	info[len] = '\0';
+}
+
+/*
+=====================
+Cvar_InfoString
+=====================
+*/
+char	*Cvar_InfoString( int bit ) {
+	static char	info[MAX_INFO_STRING];
+	cvarInfoCache_t *cache, *slot;
+	unsigned int generation;
+	int i;
+
+	generation = Cvar_FlagsGeneration( bit );
+	slot = NULL;
+
+	for (i = 0; i < MAX_INFOSTRING_CACHE; i++) {
+		cache = &cvar_infoCache[i];
+		if (!cache->valid) {
+			if (slot == NULL) {
+				slot = cache;
+			}
+			continue;
+		}
+		if (cache->bit == bit) {
+			slot = cache;
+			break;
 		}
 	}
+
+	if (slot == NULL) {
+		/* All slots are taken by other bit combinations. This doesn't happen with the stock callers */
+		slot = &cvar_infoCache[MAX_INFOSTRING_CACHE -1];
+	}
+
+	if (!slot->valid || slot->bit != bit || slot->generation != generation) {
+		Cvar_BuildInfoString( bit, slot->info );
+		slot->bit = bit;
+		slot->generation = generation;
+		slot->valid = qtrue;
+	}
+
+	/* Callers are allowed to scribble on the returned buffer */
+	Q_strncpyz( info, slot->info, sizeof(info) );
 	return info;
 }
 
@@ -2238,6 +2409,220 @@ void Cvar_ClearModified(cvar_t* cvar){
 	cvar->modified = 0;
 }
 
+
+/*
+============
+Cvar_AddChangeCallback
+
+Subscribes to value changes of a cvar. The callback runs from
+Cvar_RunChangeCallbacks at most once per frame, no matter how often the
+value was changed in between. Usage:
+sv_fps = Cvar_RegisterInt(...);
+Cvar_AddChangeCallback(sv_fps, SV_FpsChanged, NULL);
+============
+*/
+static int Cvar_CallbackIndex( cvar_t* var )
+{
+	if(var == NULL || var < cvar_indexes || var >= &cvar_indexes[cvar_numIndexes])
+		return -1;
+
+	return var - cvar_indexes;
+}
+
+qboolean Cvar_AddChangeCallback(cvar_t* var, cvarChangeCallback_t callback, void* arg)
+{
+	cvarCallback_t* cb;
+	int i, index;
+
+	if(callback == NULL)
+		return qfalse;
+
+	index = Cvar_CallbackIndex( var );
+	if(index < 0)
+	{
+		Com_PrintError("Cvar_AddChangeCallback: Not a registered cvar\n");
+		return qfalse;
+	}
+
+	if(!cvar_callbacksInitialized)
+	{
+		for(i = 0; i < MAX_CVAR_CALLBACKS -1; i++)
+			cvar_callbacks[i].next = &cvar_callbacks[i +1];
+
+		cvar_callbacks[MAX_CVAR_CALLBACKS -1].next = NULL;
+		cvar_freeCallbacks = cvar_callbacks;
+		cvar_callbacksInitialized = qtrue;
+	}
+
+	if(cvar_freeCallbacks == NULL)
+	{
+		Com_PrintError("Cvar_AddChangeCallback: Exceeded limit of %d callbacks. Can not subscribe to %s\n", MAX_CVAR_CALLBACKS, var->name);
+		return qfalse;
+	}
+
+	cb = cvar_freeCallbacks;
+	cvar_freeCallbacks = cb->next;
+
+	cb->callback = callback;
+	cb->arg = arg;
+	cb->next = cvar_subscribers[index];
+	cvar_subscribers[index] = cb;
+	return qtrue;
+}
+
+
+static void Cvar_FreeChangeCallback( cvarCallback_t** prev )
+{
+	cvarCallback_t* cb = *prev;
+
+	*prev = cb->next;
+	cb->callback = NULL;
+	cb->next = cvar_freeCallbacks;
+	cvar_freeCallbacks = cb;
+}
+
+
+/* Unlinks the entries which got unsubscribed while the callbacks were running */
+static void Cvar_SweepChangeCallbacks( void )
+{
+	cvarCallback_t** prev;
+	int index;
+
+	for(index = 0; index < cvar_numIndexes; index++)
+	{
+		prev = &cvar_subscribers[index];
+
+		while(*prev != NULL)
+		{
+			if((*prev)->callback == NULL)
+				Cvar_FreeChangeCallback( prev );
+			else
+				prev = &(*prev)->next;
+		}
+	}
+	cvar_callbacksRemoved = qfalse;
+}
+
+
+/*
+============
+Cvar_RemoveChangeCallback
+============
+*/
+void Cvar_RemoveChangeCallback(cvar_t* var, cvarChangeCallback_t callback, void* arg)
+{
+	cvarCallback_t** prev;
+	cvarCallback_t* cb;
+	int index;
+
+	index = Cvar_CallbackIndex( var );
+	if(index < 0 || callback == NULL)
+		return;
+
+	prev = &cvar_subscribers[index];
+
+	while((cb = *prev) != NULL)
+	{
+		if(cb->callback == callback && cb->arg == arg)
+		{
+			if(cvar_callbacksRunning)
+			{
+				cb->callback = NULL;
+				cvar_callbacksRemoved = qtrue;
+			}else{
+				Cvar_FreeChangeCallback( prev );
+			}
+			return;
+		}
+		prev = &cb->next;
+	}
+}
+
+
+static void Cvar_ClearChangeCallbacks( cvar_t* var )
+{
+	cvarCallback_t* cb;
+	int index;
+
+	index = Cvar_CallbackIndex( var );
+	if(index < 0)
+		return;
+
+	if(cvar_callbacksRunning)
+	{
+		for(cb = cvar_subscribers[index]; cb != NULL; cb = cb->next)
+			cb->callback = NULL;
+
+		cvar_callbacksRemoved = qtrue;
+		return;
+	}
+
+	while(cvar_subscribers[index] != NULL)
+	{
+		Cvar_FreeChangeCallback( &cvar_subscribers[index] );
+	}
+}
+
+
+static void Cvar_QueueChange( cvar_t* var )
+{
+	int index = Cvar_CallbackIndex( var );
+
+	if(index < 0)
+		return;
+
+	if(cvar_subscribers[index] == NULL || cvar_changeQueued[index])
+		return;
+
+	cvar_changeQueued[index] = qtrue;
+	cvar_changeQueue[cvar_changeQueueCount] = index;
+	cvar_changeQueueCount++;
+}
+
+
+/*
+============
+Cvar_RunChangeCallbacks
+
+Notifies the subscribers of all cvars changed since the last call.
+Changes done by the callbacks themselves get delivered next frame.
+============
+*/
+void Cvar_RunChangeCallbacks( void )
+{
+	cvarCallback_t* cb;
+	int count, i, index;
+
+	count = cvar_changeQueueCount;
+
+	if(count == 0 || cvar_callbacksRunning)
+		return;
+
+	cvar_callbacksRunning = qtrue;
+
+	for(i = 0; i < count; i++)
+	{
+		index = cvar_changeQueue[i];
+		cvar_changeQueued[index] = qfalse;
+
+		for(cb = cvar_subscribers[index]; cb != NULL; cb = cb->next)
+		{
+			if(cb->callback)
+				cb->callback(&cvar_indexes[index], cb->arg);
+		}
+	}
+
+	cvar_callbacksRunning = qfalse;
+	if(cvar_callbacksRemoved)
+		Cvar_SweepChangeCallbacks( );
+
+	cvar_changeQueueCount -= count;
+	if(cvar_changeQueueCount > 0)
+	{
+		memmove(cvar_changeQueue, &cvar_changeQueue[count], cvar_changeQueueCount * sizeof(cvar_changeQueue[0]));
+	}
+}
+
 /*
 ============
 Cvar_Init
@@ -2365,7 +2750,7 @@ void Cvar_ChangeResetValue(cvar_t* var, CvarValue value)
 			if(var->resetString && var->resetString != nullstring)
 				Z_Free(var->resetString);
 
-			var->resetString = CopyString( value.string );
+			var->resetString = CopyStringTag( value.string, TAG_CVAR );
 	}
 
 }
@@ -2374,6 +2759,7 @@ void Cvar_ChangeResetValue(cvar_t* var, CvarValue value)
 void Cvar_AddFlags(cvar_t* var, unsigned short flags)
 {
 	var->flags |= flags;
+	Cvar_FlagsModified( flags );
 }
 
 void Cvar_AddFlagsByName(const char* var_name, unsigned short flags)
@@ -2382,8 +2768,10 @@ void Cvar_AddFlagsByName(const char* var_name, unsigned short flags)
 	if(!var)
 	{
 		Com_PrintError("Cvar_AddFlagsByName: Cvar %s does not exist\n", var_name);
+		return;
 	}
 	var->flags |= flags;
+	Cvar_FlagsModified( flags );
 }
 
 
@@ -175,6 +175,12 @@ cvar_t* Cvar_GetNext(cvar_t* cvar, short flags);
 void Cvar_WriteVariables(fileHandle_t fh);
 void Cvar_SetLatched(const char* name, const char* value);
 
+typedef void (*cvarChangeCallback_t)(cvar_t* var, void* arg);
+
+qboolean Cvar_AddChangeCallback(cvar_t* var, cvarChangeCallback_t callback, void* arg);
+void Cvar_RemoveChangeCallback(cvar_t* var, cvarChangeCallback_t callback, void* arg);
+void Cvar_RunChangeCallbacks( void );
+
 #define Cvar_GetInt Cvar_VariableIntegerValue
 #define Cvar_GetFloat Cvar_VariableValue
 #define Cvar_GetString Cvar_VariableString
@@ -1702,6 +1702,45 @@ int FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp ) {
 	return 0;
 }
 
+/*
+===========
+FS_SV_FOpenOSFileRead
+
+Same search order as FS_SV_FOpenFileRead but returns a plain FILE* which does
+not use up one of the filehandles. For files which stay open for a long time
+===========
+*/
+FILE* FS_SV_FOpenOSFileRead( const char *filename, int *length ) {
+	char ospath[MAX_OSPATH];
+	FILE* f;
+
+	if ( !FS_Initialized() ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	FS_BuildOSPathForThread( fs_homepath->string, filename, "", ospath, 0 );
+	ospath[strlen(ospath)-1] = '\0';
+
+	f = fopen( ospath, "rb" );
+
+	if ( !f && Q_stricmp(fs_homepath->string,fs_basepath->string) ) {
+		FS_BuildOSPathForThread( fs_basepath->string, filename, "", ospath, 0 );
+		ospath[strlen(ospath)-1] = '\0';
+
+		f = fopen( ospath, "rb" );
+	}
+
+	if ( !f ) {
+		*length = 0;
+		return NULL;
+	}
+
+	fseek( f, 0, SEEK_END );
+	*length = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	return f;
+}
+
 
 /*
 ===========
@@ -2394,9 +2433,9 @@ static pack_t *FS_LoadZipFile( char *zipfile, const char *basename ) {
 	}
 
 
-	buildBuffer = Z_Malloc( ( gi.number_entry * sizeof( fileInPack_t ) ) + len );
+	buildBuffer = Z_TagMallocZero( ( gi.number_entry * sizeof( fileInPack_t ) ) + len, TAG_FILESYSTEM );
 	namePtr = ( (char *) buildBuffer ) + gi.number_entry * sizeof( fileInPack_t );
-	fs_headerLongs = Z_Malloc( gi.number_entry * sizeof( int ) );
+	fs_headerLongs = Z_TagMallocZero( gi.number_entry * sizeof( int ), TAG_FILESYSTEM );
 
 	// get the hash table size from the number of files in the zip
 	// because lots of custom pk3 files have less than 32 or 64 files
@@ -2406,7 +2445,7 @@ static pack_t *FS_LoadZipFile( char *zipfile, const char *basename ) {
 		}
 	}
 
-	pack = Z_Malloc( sizeof( pack_t ) + i * sizeof( fileInPack_t * ) );
+	pack = Z_TagMallocZero( sizeof( pack_t ) + i * sizeof( fileInPack_t * ), TAG_FILESYSTEM );
 	pack->hashSize = i;
 	pack->hashTable = ( fileInPack_t ** )( ( (char *) pack ) + sizeof( pack_t ) );
 	for ( i = 0; i < pack->hashSize; i++ ) {
@@ -2912,8 +2951,8 @@ void FS_AddGameDirectory_Single(const char *path, const char *dir_nolocal, qbool
     {
       Q_strncpyz(fs_gamedir, dir, 256);
     }
-    search = (searchpath_t *)Z_Malloc(sizeof(searchpath_t));
-    search->dir = (directory_t *)Z_Malloc(sizeof(directory_t));
+    search = (searchpath_t *)Z_TagMallocZero(sizeof(searchpath_t), TAG_FILESYSTEM);
+    search->dir = (directory_t *)Z_TagMallocZero(sizeof(directory_t), TAG_FILESYSTEM);
     Q_strncpyz(search->dir->path, path, sizeof(search->dir->path));
     Q_strncpyz(search->dir->gamedir, dir, sizeof(search->dir->gamedir));
     search->localized = localized;
@@ -3087,7 +3126,7 @@ void FS_AddIwdFilesForGameDirectory(const char *path, const char *dir)
 		
 		Q_strncpyz(pak->pakGamename, dir, sizeof(pak->pakGamename));
 		
-		search = (searchpath_t *)Z_Malloc(sizeof(searchpath_t));
+		search = (searchpath_t *)Z_TagMallocZero(sizeof(searchpath_t), TAG_FILESYSTEM);
 		search->pack = pak;
 		search->localized = islocalized;
 		search->langIndex = langindex;
@@ -3844,7 +3883,7 @@ void __cdecl FS_AddIwdPureCheckReference(searchpath_t *search)
 	  }
         }
     }
-    newCheck = (fsPureSums_t *)Z_Malloc(sizeof(fsPureSums_t));
+    newCheck = (fsPureSums_t *)Z_TagMallocZero(sizeof(fsPureSums_t), TAG_FILESYSTEM);
     newCheck->next = NULL;
     newCheck->checksum = search->pack->checksum;
     Q_strncpyz(newCheck->baseName, search->pack->pakBasename, sizeof(newCheck->baseName));
@@ -4006,7 +4045,7 @@ int FS_PureServerSetLoadedIwds(const char *paksums, const char *paknames)
   }
   
   for ( i = 0 ; i < numPakNames ; i++ ) {
-	lpakNames[i] = CopyString( Cmd_Argv( i ) );
+	lpakNames[i] = CopyStringTag( Cmd_Argv( i ), TAG_FILESYSTEM );
   }
   
   Cmd_EndTokenizedString();
@@ -194,6 +194,7 @@ void FS_FreeFileKeepBuf( );
 int FS_ReadLine( void *buffer, int len, fileHandle_t f );
 fileHandle_t FS_SV_FOpenFileWrite( const char *filename );
 int FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp );
+FILE* FS_SV_FOpenOSFileRead( const char *filename, int *length );
 fileHandle_t FS_SV_FOpenFileAppend( const char *filename );
 int FS_Write( const void *buffer, int len, fileHandle_t h );
 int FS_ReadFile( const char *qpath, void **buffer );
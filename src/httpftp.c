@@ -17,6 +17,8 @@
 #include "net_game.h"
 #include "net_game_conf.h"
 #include "webadmin.h"
+#include "server.h"
+#include "filesystem.h"
 
 #include <string.h>
 #include <stdint.h>
@@ -72,7 +74,7 @@ static ftRequest_t* FT_CreateRequest(const char* address, const char* url)
 	
 	ftRequest_t* request;
 	
-	request = Z_Malloc(sizeof(ftRequest_t));
+	request = Z_TagMallocZero(sizeof(ftRequest_t), TAG_NETWORK);
 	if(request == NULL)
 		return NULL;
 	
@@ -81,6 +83,8 @@ static ftRequest_t* FT_CreateRequest(const char* address, const char* url)
 	request->finallen = -1;
 	request->socket = -1;
 	request->transfersocket = -1;
+	request->rangeStart = -1;
+	request->rangeEnd = -1;
 	
 	if(address != NULL)
 	{
@@ -98,7 +102,7 @@ static ftRequest_t* FT_CreateRequest(const char* address, const char* url)
 	}
 	
 	/* For proper terminating of string data +1 */
-	buf = Z_Malloc(INITIAL_BUFFERLEN +1);
+	buf = Z_TagMallocZero(INITIAL_BUFFERLEN +1, TAG_NETWORK);
 	if( buf == NULL)
 	{
 		FT_FreeRequest(request);
@@ -106,7 +110,7 @@ static ftRequest_t* FT_CreateRequest(const char* address, const char* url)
 	}
 	MSG_Init(&request->recvmsg, buf, INITIAL_BUFFERLEN);
 	
-	buf = Z_Malloc(INITIAL_BUFFERLEN);
+	buf = Z_TagMallocZero(INITIAL_BUFFERLEN, TAG_NETWORK);
 	if( buf == NULL)
 	{
 		FT_FreeRequest(request);
@@ -162,6 +166,12 @@ static void FT_ResetRequest( ftRequest_t* request )
 	request->contentLength = 0;
 	request->stage = 0;
 	request->protocol = 0;
+	request->file = NULL;
+	request->fileOffset = 0;
+	request->fileEnd = 0;
+	request->rangeStart = -1;
+	request->rangeEnd = -1;
+	request->dlAddress = 0;
 	MSG_Clear(&request->recvmsg);
 	MSG_Clear(&request->sendmsg);
 	MSG_Clear(&request->transfermsg);
@@ -181,7 +191,7 @@ static void FT_AddData(ftRequest_t* request, void* data, int len)
 	{
 		newsize = request->sendmsg.cursize + len;
 	
-		newbuf = Z_Malloc(newsize);
+		newbuf = Z_TagMallocZero(newsize, TAG_NETWORK);
 		if(newbuf == NULL)
 		{
 			MSG_WriteData(&request->sendmsg, data, len);
@@ -247,7 +257,7 @@ static int FT_ReceiveData(ftRequest_t* request)
 	if (newsize)
 	{
 		/* For proper terminating of string data +1 */
-		newbuf = Z_Malloc(newsize +1);
+		newbuf = Z_TagMallocZero(newsize +1, TAG_NETWORK);
 		if(newbuf == NULL)
 		{
 			return -1;
@@ -888,7 +898,7 @@ static int FTP_ReceiveData(ftRequest_t* request)
 	
 	if (newsize)
 	{
-		newbuf = Z_Malloc(newsize +1);
+		newbuf = Z_TagMallocZero(newsize +1, TAG_NETWORK);
 		if(newbuf == NULL)
 		{
 			return -1;
@@ -1076,7 +1086,7 @@ static int FTP_SendReceiveData(ftRequest_t* request)
 					request->headerLength = 0;
 					request->transfertotalreceivedbytes = 0;
 					
-					buf = Z_Malloc(INITIAL_BUFFERLEN +1);
+					buf = Z_TagMallocZero(INITIAL_BUFFERLEN +1, TAG_NETWORK);
 					if( buf == NULL)
 					{
 						Com_PrintWarning("FTP_SendReceiveData: Failed to allocate %d bytes for download file!\n", bytes);
@@ -1313,6 +1323,316 @@ static int FTP_SendReceiveData(ftRequest_t* request)
  =====================================================================
  */
 
+/*
+ Fast download
+
+ iwds and usermaps which clients may download over UDP are served straight
+ from the disk. Clients get limited in the number of concurrent downloads
+ and bandwidth per address.
+*/
+
+#define HTTPSERVER_MAX_DLADDRESSES 64
+#define HTTPSERVER_MAX_SENDCHUNK (256 * 1024)
+
+typedef struct
+{
+	netadr_t remote;
+	int connections;
+	int tokens;
+	int lastRefill;
+}httpDlAddress_t;
+
+static httpDlAddress_t http_dlAddresses[HTTPSERVER_MAX_DLADDRESSES];
+static qboolean http_serverRunning;
+static qboolean http_webadminEnabled;
+
+static void HTTPServer_ParseRange(ftRequest_t* request, const char* line)
+{
+	while(*line == ' ')
+	{
+		line++;
+	}
+	/* Only single byte ranges. Everything else gets the whole file */
+	if(Q_stricmpn(line, "bytes=", 6) || strchr(line, ',') != NULL)
+	{
+		return;
+	}
+	line += 6;
+
+	if(*line == '-')
+	{
+		if(isInteger(line + 1, 0) == qfalse)
+			return;
+		request->rangeStart = -2;
+		request->rangeEnd = atoi(line + 1);
+		return;
+	}
+	if(*line < '0' || *line > '9')
+	{
+		return;
+	}
+	request->rangeStart = atoi(line);
+	request->rangeEnd = -1;
+
+	while(*line >= '0' && *line <= '9')
+	{
+		line++;
+	}
+	if(*line != '-')
+	{
+		request->rangeStart = -1;
+		return;
+	}
+	line++;
+	if(*line >= '0' && *line <= '9')
+	{
+		request->rangeEnd = atoi(line);
+		if(request->rangeEnd < request->rangeStart)
+		{
+			request->rangeStart = -1;
+			request->rangeEnd = -1;
+		}
+	}
+}
+
+static int HTTPServer_AcquireDlAddress(netadr_t* remote)
+{
+	int i, freeslot;
+	httpDlAddress_t* dladr;
+
+	freeslot = -1;
+
+	for(i = 0, dladr = http_dlAddresses; i < HTTPSERVER_MAX_DLADDRESSES; i++, dladr++)
+	{
+		if(dladr->connections <= 0)
+		{
+			if(freeslot == -1)
+				freeslot = i;
+			continue;
+		}
+		if(NET_CompareBaseAdr(remote, &dladr->remote))
+		{
+			if(dladr->connections >= sv_wwwServeMaxPerIP->integer)
+			{
+				return -1;
+			}
+			dladr->connections++;
+			return i;
+		}
+	}
+	if(freeslot == -1)
+	{
+		return -1;
+	}
+	dladr = &http_dlAddresses[freeslot];
+	Com_Memcpy(&dladr->remote, remote, sizeof(dladr->remote));
+	dladr->connections = 1;
+	dladr->tokens = sv_wwwServeRate->integer * 1024;
+	dladr->lastRefill = Sys_Milliseconds();
+	return freeslot;
+}
+
+static void HTTPServer_CloseFile(ftRequest_t* request)
+{
+	if(request->file)
+	{
+		fclose(request->file);
+		request->file = NULL;
+	}
+	if(request->dlAddress > 0)
+	{
+		http_dlAddresses[request->dlAddress -1].connections--;
+		request->dlAddress = 0;
+	}
+}
+
+static void HTTPServer_BuildHeader(ftRequest_t* request, const char* status, const char* headerlines, int contentLength)
+{
+	int headerlen;
+	byte* newbuf;
+	char header[MAX_STRING_CHARS];
+
+	headerlen = Com_sprintf(header, sizeof(header),
+					  "HTTP/1.1 %s\r\n"
+					  "Connection: close\r\n"
+					  "Content-Length: %d\r\n"
+					  "%s"
+					  "\r\n", status, contentLength, headerlines);
+
+	newbuf = Z_TagMallocZero(headerlen, TAG_NETWORK);
+	if(newbuf == NULL)
+	{
+		return;
+	}
+	if(request->sendmsg.data)
+	{
+		Z_Free(request->sendmsg.data);
+	}
+	MSG_Init(&request->sendmsg, newbuf, headerlen);
+	MSG_WriteData(&request->sendmsg, header, headerlen);
+}
+
+/*
+ Returns qfalse if this is no request for a downloadable file. Otherwise the
+ response header is built and the file is ready to be sent
+*/
+static qboolean HTTPServer_ServeFile(ftRequest_t* request)
+{
+	char path[MAX_QPATH];
+	char headerlines[MAX_STRING_CHARS];
+	char* query;
+	const char* ext;
+	int size, start, end, slot;
+
+	if(!sv_wwwServe->boolean || (request->mode != HTTP_GET && request->mode != HTTP_HEAD) || request->url[0] != '/')
+	{
+		return qfalse;
+	}
+
+	Q_strncpyz(path, &request->url[1], sizeof(path));
+	query = strchr(path, '?');
+	if(query)
+	{
+		*query = '\0';
+	}
+	HTTP_DecodeURL(path);
+
+	ext = strrchr(path, '.');
+	if(ext == NULL || (Q_stricmp(ext, ".iwd") && Q_stricmp(ext, ".ff")) || strstr(path, "..") || strchr(path, '\\') || strchr(path, ':'))
+	{
+		return qfalse;
+	}
+	if(!FS_VerifyPak(path))
+	{
+		return qfalse;
+	}
+
+	slot = HTTPServer_AcquireDlAddress(&request->remote);
+	if(slot < 0)
+	{
+		HTTPServer_BuildHeader(request, "503 Service Unavailable", "Retry-After: 5\r\n", 0);
+		return qtrue;
+	}
+	request->dlAddress = slot +1;
+
+	request->file = FS_SV_FOpenOSFileRead(path, &size);
+	if(request->file == NULL)
+	{
+		HTTPServer_CloseFile(request);
+		HTTPServer_BuildHeader(request, "404 Not Found", "", 0);
+		return qtrue;
+	}
+
+	start = 0;
+	end = size;
+
+	if(request->rangeStart == -2)
+	{
+		start = size - request->rangeEnd;
+		if(start < 0)
+			start = 0;
+	}else if(request->rangeStart >= 0){
+		start = request->rangeStart;
+		if(request->rangeEnd >= 0 && request->rangeEnd < size)
+			end = request->rangeEnd + 1;
+	}
+
+	if(request->rangeStart != -1 && start >= end)
+	{
+		HTTPServer_CloseFile(request);
+		Com_sprintf(headerlines, sizeof(headerlines), "Content-Range: bytes */%d\r\n", size);
+		HTTPServer_BuildHeader(request, "416 Range Not Satisfiable", headerlines, 0);
+		return qtrue;
+	}
+
+	if(request->rangeStart != -1)
+	{
+		Com_sprintf(headerlines, sizeof(headerlines), "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\nContent-Range: bytes %d-%d/%d\r\n", start, end -1, size);
+		HTTPServer_BuildHeader(request, "206 Partial Content", headerlines, end - start);
+	}else{
+		HTTPServer_BuildHeader(request, "200 OK", "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\n", size);
+	}
+
+	Com_DPrintf("HTTP download of %s (%d-%d) for %s\n", path, start, end, NET_AdrToString(&request->remote));
+
+	if(request->mode == HTTP_HEAD)
+	{
+		HTTPServer_CloseFile(request);
+		return qtrue;
+	}
+	request->fileOffset = start;
+	request->fileEnd = end;
+	return qtrue;
+}
+
+/*
+ Sends the next part of the file as far as the bandwidth limit allows.
+ Returns qtrue if the connection has to be closed
+*/
+static qboolean HTTPServer_WriteFile(ftRequest_t* request, netadr_t* from)
+{
+	httpDlAddress_t* dladr;
+	int len, bytes, now, rate;
+
+	len = request->fileEnd - request->fileOffset;
+	if(len > HTTPSERVER_MAX_SENDCHUNK)
+	{
+		len = HTTPSERVER_MAX_SENDCHUNK;
+	}
+
+	dladr = &http_dlAddresses[request->dlAddress -1];
+	rate = sv_wwwServeRate->integer * 1024;
+
+	if(rate > 0)
+	{
+		now = Sys_Milliseconds();
+		if(now - dladr->lastRefill >= 1000)
+		{
+			dladr->tokens = rate;
+		}else{
+			dladr->tokens += (long long)(now - dladr->lastRefill) * rate / 1000;
+			if(dladr->tokens > rate)
+				dladr->tokens = rate;
+		}
+		dladr->lastRefill = now;
+
+		if(len > dladr->tokens)
+			len = dladr->tokens;
+		if(len <= 0)
+			return qfalse;
+	}
+
+	bytes = NET_TcpSendFile(from->sock, request->file, request->fileOffset, len);
+	if(bytes < 0)
+	{
+		return qtrue;
+	}
+
+	request->fileOffset += bytes;
+	if(rate > 0)
+	{
+		dladr->tokens -= bytes;
+	}
+
+	if(request->fileOffset >= request->fileEnd)
+	{
+		/* The header has announced that the connection gets closed */
+		HTTPServer_CloseFile(request);
+		return qtrue;
+	}
+	return qfalse;
+}
+
+void HTTPServer_InitDownloads()
+{
+	if(!http_serverRunning)
+	{
+		HTTPServer_Init();
+		http_webadminEnabled = qfalse;
+	}
+}
+
+
 int HTTPServer_ReadMessage(netadr_t* from, msg_t* msg, ftRequest_t* request)
 {
 	
@@ -1338,7 +1658,7 @@ int HTTPServer_ReadMessage(netadr_t* from, msg_t* msg, ftRequest_t* request)
 			newsize = 2 * request->recvmsg.maxsize + msg->cursize;
 		}
 		
-		newbuf = Z_Malloc(newsize);
+		newbuf = Z_TagMallocZero(newsize, TAG_NETWORK);
 		if(newbuf == NULL)
 		{
 			return -1;
@@ -1448,6 +1768,10 @@ int HTTPServer_ReadMessage(netadr_t* from, msg_t* msg, ftRequest_t* request)
 				}
 
 			}
+			else if(!Q_stricmpn("Range:", line, 6))
+			{
+				HTTPServer_ParseRange(request, &line[6]);
+			}
 			else if(!Q_stricmpn("Cookie:", line, 7))
 			{
 				
@@ -1501,7 +1825,7 @@ void HTTPServer_BuildMessage( ftRequest_t* request, char* status, char* message,
 					  "\r\n", status, len, sessionkey);
 	
 	
-	newbuf = Z_Malloc(headerlen + len);
+	newbuf = Z_TagMallocZero(headerlen + len, TAG_NETWORK);
 	if(newbuf == NULL)
 	{	
 		return;
@@ -1529,7 +1853,17 @@ qboolean HTTPServer_WriteMessage( ftRequest_t* request, netadr_t* from)
 		return qtrue;
 	}
 	request->sentBytes += bytes;
-	return qfalse;
+
+	if(request->sentBytes < request->sendmsg.cursize)
+	{
+		return qfalse;
+	}
+	if(request->file)
+	{
+		return HTTPServer_WriteFile(request, from);
+	}
+	/* Everything is sent and all responses carry "Connection: close" */
+	return qtrue;
 }
 
 
@@ -1654,8 +1988,13 @@ qboolean HTTPServer_Event(netadr_t* from, msg_t* msg, int connectionId)
 		}
 	}
 	/* Received full message */
-	if(request->sendmsg.cursize == 0)
+	if(request->sendmsg.cursize == 0 && HTTPServer_ServeFile(request) == qfalse)
 	{
+		if(http_webadminEnabled == qfalse)
+		{
+			HTTPServer_BuildHeader(request, "404 Not Found", "", 0);
+			return HTTPServer_WriteMessage(request, from);
+		}
 		HTTPServer_ReadSessionId(request, sessionkey, sizeof(sessionkey));
 		HTTPServer_ParseBody(request, values);
 		Com_Printf("SessionID is: %s\n",  sessionkey);
@@ -1713,6 +2052,7 @@ void HTTPServer_Disconnect(netadr_t* from, int connectionId)
 	if(connectionId)
 	{
 		request = (ftRequest_t*)connectionId;
+		HTTPServer_CloseFile(request);
 		FT_FreeRequest(request);
 
 	}
@@ -1721,7 +2061,15 @@ void HTTPServer_Disconnect(netadr_t* from, int connectionId)
 void HTTPServer_Init()
 {
 	char magic[] = { 'h','t','t','p' };
-	
+
+	http_webadminEnabled = qtrue;
+
+	if(http_serverRunning)
+	{
+		return;
+	}
+	http_serverRunning = qtrue;
+
 	/* Register the events */
 	NET_TCPAddEventType( HTTPServer_Event, HTTPServer_AuthEvent, HTTPServer_Disconnect, *(int*)magic);
 
@@ -53,6 +53,13 @@ typedef struct
 	int stage;
 	ftprotocols_t protocol;
 	netadr_t remote;
+	/* Files served by the HTTP-Server */
+	FILE* file;
+	int fileOffset;
+	int fileEnd;
+	int rangeStart;		/* -1 if no range got requested, -2 if rangeEnd is a suffix length */
+	int rangeEnd;
+	int dlAddress;		/* Slot for per address limits + 1 */
 }ftRequest_t;
 
 typedef enum
@@ -75,6 +82,7 @@ ftRequest_t* FileDownloadRequest( const char* url);
 int FileDownloadSendReceive( ftRequest_t* request );
 const char* FileDownloadGenerateProgress( ftRequest_t* request );
 void HTTPServer_Init();
+void HTTPServer_InitDownloads();
 ftRequest_t* HTTPRequest(const char* url, const char* method, msg_t* msg, const char* additionalheaderlines);
 int HTTP_SendReceiveData(ftRequest_t*);
 void HTTP_BuildNewRequest( ftRequest_t* request, const char* method, msg_t* msg, const char* additionalheaderlines);
@@ -30,16 +30,27 @@
 #include "net_game.h"
 #include "net_game_conf.h"
 #include "plugin_handler.h"
+#include "qcommon_profile.h"
+#include "filesystem.h"
+#include "cmd.h"
+#include "sys_main.h"
+#include "netchan.h"
 
-void NET_UDPPacketEvent(netadr_t* from, void* data, int len, int buflen)
+static void NET_UDPDispatch(netadr_t* from, void* data, int len, int buflen)
 {
 
         msg_t msg;
+        unsigned long long profStart;
 
         qboolean returnNow = qfalse;
-        PHandler_Event(PLUGINS_ONUDPNETEVENT, from, data, len, &returnNow);
+
+        Prof_CountPacketIn(len);
+        profStart = Prof_Begin();
+
+        PHandler_EventUdpNet(PLUGINS_ONUDPNETEVENT, from, data, len, &returnNow);
         if(returnNow)
         {
+            Prof_End(PROF_PACKETS, profStart);
             return;
         }
 
@@ -52,6 +63,337 @@ void NET_UDPPacketEvent(netadr_t* from, void* data, int len, int buflen)
         msg.overflowed = qfalse;
 
         SV_PacketEvent(from, &msg);
+
+        Prof_End(PROF_PACKETS, profStart);
+}
+
+
+/*
+=================
+Packet capture and replay
+
+"netcapture <file>" writes every inbound datagram with its source address and
+the time since the capture began into fs_homepath. "netreplay <file> [fast]"
+feeds a capture back into SV_PacketEvent while the live sockets are ignored
+and everything the server sends is swallowed. Replay runs on virtual time,
+which follows the wall clock or advances by exactly one server frame per
+frame in fast mode. The frame profiler gets reset at the start so "profile"
+shows the frame times of the replay alone.
+
+The capture header carries the connect cookie secret, so clients connecting
+during a capture pass the challenge check when replayed. Connections which
+existed before the capture began can't be restored and their packets are
+dropped as unknown. Captures contain rcon passwords and that secret, don't
+hand them out.
+
+Format, little endian: "NETCAPT" version, cookie secret, then records of
+msec (4), address type (1), address (4 or 16), port (2), length (2), data.
+=================
+*/
+
+#define NETCAPTURE_MAGIC "NETCAPT"
+#define NETCAPTURE_VERSION 1
+
+extern byte net_cookieSecret[58];
+
+typedef struct
+{
+    fileHandle_t file;
+    unsigned int startTime;
+    int packets;
+    int bytes;
+}netCapture_t;
+
+typedef struct
+{
+    fileHandle_t file;
+    qboolean active;
+    qboolean fast;
+    unsigned long long virtualUsec;
+    unsigned long long wallStart;
+    unsigned long long baseMsec;        //com_frameTime and com_uFrameTime when the replay started
+    unsigned long long baseUsec;
+    unsigned long long leadUsec;        //How far a fast replay has moved the frame time ahead of the clock
+    unsigned int nextTime;              //msec of the record waiting in buffer
+    int nextLength;
+    netadr_t nextFrom;
+    int packets;
+    int frames;
+    byte buffer[MAX_MSGLEN];
+}netReplay_t;
+
+static netCapture_t net_capture;
+static netReplay_t net_replay;
+
+static void NET_PutLong(byte* p, unsigned int v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static unsigned int NET_GetLong(const byte* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void NET_CaptureWrite(netadr_t* from, const void* data, int len)
+{
+    byte header[4 + 1 + 16 + 2 + 2];
+    int addrlen, pos;
+
+    if(from->type == NA_IP)
+        addrlen = 4;
+    else if(from->type == NA_IP6)
+        addrlen = 16;
+    else
+        return;
+
+    NET_PutLong(header, Sys_Milliseconds() - net_capture.startTime);
+    header[4] = from->type;
+    Com_Memcpy(&header[5], from->ip6, addrlen);
+    pos = 5 + addrlen;
+    Com_Memcpy(&header[pos], &from->port, 2);
+    header[pos + 2] = len & 0xff;
+    header[pos + 3] = (len >> 8) & 0xff;
+
+    FS_Write(header, pos + 4, net_capture.file);
+    FS_Write(data, len, net_capture.file);
+    net_capture.packets++;
+    net_capture.bytes += len;
+}
+
+static void NET_CaptureStop( void )
+{
+    if(!net_capture.file)
+        return;
+
+    FS_FCloseFile(net_capture.file);
+    net_capture.file = 0;
+    Com_Printf("Capture stopped after %d packets, %d bytes\n", net_capture.packets, net_capture.bytes);
+}
+
+void NET_Capture_f( void )
+{
+    char filename[MAX_OSPATH];
+    byte header[sizeof(NETCAPTURE_MAGIC) + 4 + sizeof(net_cookieSecret)];
+
+    if(Cmd_Argc() != 2)
+    {
+        if(net_capture.file)
+        {
+            NET_CaptureStop();
+            return;
+        }
+        Com_Printf("Usage: netcapture <filename>. Without a filename a running capture gets stopped\n");
+        return;
+    }
+
+    if(net_replay.active)
+    {
+        Com_Printf("Can not capture during a replay\n");
+        return;
+    }
+    NET_CaptureStop();
+
+    Com_sprintf(filename, sizeof(filename), "%s", Cmd_Argv(1));
+    COM_DefaultExtension(filename, sizeof(filename), ".ncap");
+
+    net_capture.file = FS_SV_FOpenFileWrite(filename);
+    if(!net_capture.file)
+    {
+        Com_PrintError("Could not open %s for writing\n", filename);
+        return;
+    }
+
+    Com_Memcpy(header, NETCAPTURE_MAGIC, sizeof(NETCAPTURE_MAGIC));
+    NET_PutLong(&header[sizeof(NETCAPTURE_MAGIC)], NETCAPTURE_VERSION);
+    Com_Memcpy(&header[sizeof(NETCAPTURE_MAGIC) + 4], net_cookieSecret, sizeof(net_cookieSecret));
+    FS_Write(header, sizeof(header), net_capture.file);
+
+    net_capture.startTime = Sys_Milliseconds();
+    net_capture.packets = 0;
+    net_capture.bytes = 0;
+    Com_Printf("Capturing inbound packets to %s\n", filename);
+}
+
+/* Reads the next record into the buffer. Returns qfalse at the end of the file */
+static qboolean NET_ReplayReadRecord( void )
+{
+    byte header[4 + 1 + 16 + 2 + 2];
+    int addrlen;
+
+    if(FS_Read(header, 5, net_replay.file) != 5)
+        return qfalse;
+
+    Com_Memset(&net_replay.nextFrom, 0, sizeof(net_replay.nextFrom));
+    net_replay.nextTime = NET_GetLong(header);
+    net_replay.nextFrom.type = header[4];
+
+    if(net_replay.nextFrom.type == NA_IP)
+        addrlen = 4;
+    else if(net_replay.nextFrom.type == NA_IP6)
+        addrlen = 16;
+    else
+        return qfalse;
+
+    if(FS_Read(&header[5], addrlen + 4, net_replay.file) != addrlen + 4)
+        return qfalse;
+
+    Com_Memcpy(net_replay.nextFrom.ip6, &header[5], addrlen);
+    Com_Memcpy(&net_replay.nextFrom.port, &header[5 + addrlen], 2);
+    net_replay.nextLength = header[5 + addrlen + 2] | (header[5 + addrlen + 3] << 8);
+
+    if(net_replay.nextLength > sizeof(net_replay.buffer))
+        return qfalse;
+
+    return FS_Read(net_replay.buffer, net_replay.nextLength, net_replay.file) == net_replay.nextLength;
+}
+
+static void NET_ReplayStop( void )
+{
+    unsigned long long wall;
+
+    if(!net_replay.active)
+        return;
+
+    FS_FCloseFile(net_replay.file);
+    net_replay.file = 0;
+    net_replay.active = qfalse;
+    //The secret of the capture is known to whoever has the file
+    NET_CookieInit();
+
+    //The frame time must not run backwards when it goes back to the real clock
+    if(net_replay.baseUsec + net_replay.virtualUsec > Sys_MicrosecondsLong() + net_replay.leadUsec)
+        net_replay.leadUsec = net_replay.baseUsec + net_replay.virtualUsec - Sys_MicrosecondsLong();
+
+    wall = Sys_MicrosecondsMonotonic() - net_replay.wallStart;
+    Com_Printf("Replayed %d packets in %d frames, %.2f sec virtual time, %.2f sec wall time\n", net_replay.packets,
+                net_replay.frames, (float)net_replay.virtualUsec / 1000000.0f, (float)wall / 1000000.0f);
+    Prof_PrintReport();
+}
+
+void NET_Replay_f( void )
+{
+    char filename[MAX_OSPATH];
+    byte header[sizeof(NETCAPTURE_MAGIC) + 4 + sizeof(net_cookieSecret)];
+
+    if(Cmd_Argc() < 2)
+    {
+        Com_Printf("Usage: netreplay <filename> [fast] or netreplay stop\n");
+        return;
+    }
+    if(!Q_stricmp(Cmd_Argv(1), "stop"))
+    {
+        NET_ReplayStop();
+        return;
+    }
+    if(!com_sv_running->boolean)
+    {
+        Com_Printf("Start a map before replaying a capture\n");
+        return;
+    }
+
+    NET_CaptureStop();
+    NET_ReplayStop();
+
+    Com_sprintf(filename, sizeof(filename), "%s", Cmd_Argv(1));
+    COM_DefaultExtension(filename, sizeof(filename), ".ncap");
+
+    if(FS_SV_FOpenFileRead(filename, &net_replay.file) < (int)sizeof(header) || !net_replay.file)
+    {
+        if(net_replay.file)
+            FS_FCloseFile(net_replay.file);
+        net_replay.file = 0;
+        Com_PrintError("Could not open %s\n", filename);
+        return;
+    }
+
+    if(FS_Read(header, sizeof(header), net_replay.file) != sizeof(header) || memcmp(header, NETCAPTURE_MAGIC, sizeof(NETCAPTURE_MAGIC))
+        || NET_GetLong(&header[sizeof(NETCAPTURE_MAGIC)]) != NETCAPTURE_VERSION || !NET_ReplayReadRecord())
+    {
+        FS_FCloseFile(net_replay.file);
+        net_replay.file = 0;
+        Com_PrintError("%s is not a packet capture or it is empty\n", filename);
+        return;
+    }
+
+    Com_Memcpy(net_cookieSecret, &header[sizeof(NETCAPTURE_MAGIC) + 4], sizeof(net_cookieSecret));
+
+    net_replay.active = qtrue;
+    net_replay.fast = Cmd_Argc() > 2 && !Q_stricmp(Cmd_Argv(2), "fast");
+    net_replay.virtualUsec = 0;
+    net_replay.baseMsec = com_frameTime;
+    net_replay.baseUsec = com_uFrameTime;
+    net_replay.packets = 0;
+    net_replay.frames = 0;
+    net_replay.wallStart = Sys_MicrosecondsMonotonic();
+    Prof_Reset();
+
+    Com_Printf("Replaying %s%s\n", filename, net_replay.fast ? " as fast as possible" : "");
+}
+
+qboolean NET_ReplayActive( void )
+{
+    return net_replay.active;
+}
+
+/*
+=================
+NET_ReplayFrame
+
+Called once per Com_Frame with the elapsed time. Delivers the packets which
+are due by the virtual time and returns the time the frame has to simulate.
+While replaying, com_frameTime and com_uFrameTime follow the virtual time so
+rate limits and challenge timeouts see the same time as the recorded server
+=================
+*/
+unsigned int NET_ReplayFrame( unsigned int usec )
+{
+    if(!net_replay.active)
+    {
+        com_uFrameTime += net_replay.leadUsec;
+        com_frameTime += net_replay.leadUsec / 1000;
+        return usec;
+    }
+
+    if(net_replay.fast)
+        usec = sv.frameusec;
+
+    net_replay.virtualUsec += usec;
+    net_replay.frames++;
+
+    com_uFrameTime = net_replay.baseUsec + net_replay.virtualUsec;
+    com_frameTime = net_replay.baseMsec + net_replay.virtualUsec / 1000;
+
+    while((unsigned long long)net_replay.nextTime * 1000 <= net_replay.virtualUsec)
+    {
+        NET_UDPDispatch(&net_replay.nextFrom, net_replay.buffer, net_replay.nextLength, sizeof(net_replay.buffer));
+        net_replay.packets++;
+
+        if(!net_replay.active)
+            return usec;
+
+        if(!NET_ReplayReadRecord())
+        {
+            NET_ReplayStop();
+            break;
+        }
+    }
+    return usec;
+}
+
+void NET_UDPPacketEvent(netadr_t* from, void* data, int len, int buflen)
+{
+        //The live sockets stay quiet while a capture gets replayed
+        if(net_replay.active)
+            return;
+
+        if(net_capture.file)
+            NET_CaptureWrite(from, data, len);
+
+        NET_UDPDispatch(from, data, len, buflen);
 }
 
 
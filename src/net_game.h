@@ -31,6 +31,11 @@
 void NET_UDPPacketEvent(netadr_t* from, void* data, int len, int buflen);
 unsigned int NET_TimeGetTime();
 
+void NET_Capture_f( void );
+void NET_Replay_f( void );
+qboolean NET_ReplayActive( void );
+unsigned int NET_ReplayFrame( unsigned int usec );
+
 void NET_TCPConnectionClosed(netadr_t* adr, int connectionId, int serviceId);
 tcpclientstate_t NET_TCPAuthPacketEvent(netadr_t* remote, byte* bufData, int cursize, int* connectionId, int *serviceId);
 void NET_TCPPacketEvent(netadr_t* remote, byte* bufData, int cursize, int connectionId, int serviceId);
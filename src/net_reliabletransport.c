@@ -3,14 +3,25 @@
 #include "qcommon.h"
 #include "msg.h"
 #include "sys_net.h"
+#include "cmd.h"
+#include "cvar.h"
 
 #define MAX_PACKETLEN           1400        // max size of a network packet
-#define DEFAULT_BUFFER_SIZE		32
+#define DEFAULT_BUFFER_SIZE		64
+#define RELIABLE_INITIAL_WINDOW	2
+#define RELIABLE_INITIAL_RTO	1000
+#define RELIABLE_MIN_RTO		200	//Transmit runs once per server frame, a shorter timer can't fire in time anyway
+#define RELIABLE_MAX_RTO		8000
+#define RELIABLE_DUPACK_THRESHOLD	3
 
 #include "net_reliabletransport.h"
 #include <string.h>
 #include <stdlib.h>
 
+extern cvar_t *showpackets;
+
+typedef struct reliablesim_s reliablesim_t;
+
 
 
 
@@ -75,70 +86,274 @@ void ReliableMessageWriteSelectiveAcklist(framedata_t *frame, msg_t* msg)
 	msg->data[numbytepos] = count;
 }
 
-//This function sends one new sequence
-void ReliableMessagesTransmitNextFragment(netreliablemsg_t *chan)
+static reliablesim_t *rm_sim;
+
+static void ReliableSimSendPacket(reliablesim_t *sim, netreliablemsg_t *chan, msg_t *buf);
+
+static void ReliableMessageSendPacket(netreliablemsg_t *chan, msg_t *buf)
+{
+	if(rm_sim)
+	{
+		ReliableSimSendPacket(rm_sim, chan, buf);
+		return;
+	}
+	NET_SendPacket( chan->sock, buf->cursize, buf->data, &chan->remoteAddress );
+}
+
+static void ReliableMessageWriteHeader(netreliablemsg_t *chan, msg_t *buf, int sequence)
+{
+	MSG_WriteLong(buf, 0xfffffff0);
+	MSG_WriteShort(buf, chan->qport);
+	MSG_WriteLong(buf, sequence);
+	MSG_WriteLong(buf, chan->rxwindow.sequence); //Acknowledge for the other end
+	ReliableMessageWriteSelectiveAcklist(&chan->rxwindow, buf);
+	MSG_WriteShort(buf, chan->rxwindow.windowsize);
+}
+
+static void ReliableMessageSendAck(netreliablemsg_t *chan)
 {
-	int sequence;
 	msg_t buf;
 	byte data[MAX_PACKETLEN];
-	
+
+	MSG_Init(&buf, data, sizeof(data));
+	//Writing -1 as sequence means this is only an ACK packet
+	ReliableMessageWriteHeader(chan, &buf, -1);
+	MSG_WriteShort(&buf, 0);
+	ReliableMessageSendPacket( chan, &buf );
+	chan->txwindow.packets++;
+	chan->nextacktime = chan->time + 350;
+}
+
+static void ReliableMessageSendFragment(netreliablemsg_t *chan, int sequence)
+{
+	msg_t buf;
+	byte data[MAX_PACKETLEN];
+	fragment_t *fragment = &chan->txwindow.fragments[sequence % chan->txwindow.bufferlen];
+
+	MSG_Init(&buf, data, sizeof(data));
+	ReliableMessageWriteHeader(chan, &buf, sequence);
+	MSG_WriteShort(&buf, fragment->len); //Fragment size
+	MSG_WriteData(&buf, fragment->data, fragment->len);
+
+	ReliableMessageSendPacket( chan, &buf );
+	chan->txwindow.packets++;
+	chan->nextacktime = chan->time + 350;
+
+	if(fragment->transmits > 0)
+	{
+		chan->cc.retransmits++;
+	}
+	fragment->transmits++;
+	fragment->senttime = chan->time;
+	chan->cc.fragmentssent++;
+
+	if(showpackets->boolean)
+	{
+		Com_Printf("Sending SEQ: %d ACK: %d CWND: %d RTO: %d\n", sequence, chan->rxwindow.sequence, chan->cc.cwnd, chan->cc.rto);
+	}
+}
+
+/*
+A fragment counts as lost when its retransmission timer expired or when at least
+RELIABLE_DUPACK_THRESHOLD fragments sent after it got selectively acknowledged and
+it is older than a quarter RTT beyond the smoothed RTT. The age check keeps reordered
+fragments from being sent twice. The second rule only applies once per fragment,
+after that only the timer is used.
+*/
+static qboolean ReliableMessageFragmentLost(netreliablemsg_t *chan, fragment_t *fragment, int sackedabove)
+{
+	int age = chan->time - fragment->senttime;
+
+	if(age >= chan->cc.rto)
+	{
+		return qtrue;
+	}
+	if(fragment->transmits == 1 && sackedabove >= RELIABLE_DUPACK_THRESHOLD && age > chan->cc.srtt + chan->cc.srtt / 4)
+	{
+		return qtrue;
+	}
+	return qfalse;
+}
+
+//Multiplicative decrease. Happens at most once per window of data
+static void ReliableMessageReduceWindow(netreliablemsg_t *chan, int sequence, qboolean timeout)
+{
+	reliablecongestion_t *cc = &chan->cc;
+
+	if(sequence < cc->recover)
+	{
+		return;
+	}
+	cc->ssthresh = cc->cwnd / 2;
+	if(cc->ssthresh < 2)
+	{
+		cc->ssthresh = 2;
+	}
+	if(timeout)
+	{
+		//The pipe has drained. Start over with slow start and back off the timer
+		cc->cwnd = 1;
+		cc->rto *= 2;
+		if(cc->rto > RELIABLE_MAX_RTO)
+		{
+			cc->rto = RELIABLE_MAX_RTO;
+		}
+	}else{
+		cc->cwnd = cc->ssthresh;
+	}
+	cc->cwndacks = 0;
+	cc->recover = chan->txwindow.sequence;
+}
+
+static int ReliableMessageSendWindow(netreliablemsg_t *chan)
+{
+	int window = chan->cc.cwnd;
+
+	if(window > chan->cc.remotewindow)
+	{
+		window = chan->cc.remotewindow;
+	}
+	if(window > chan->txwindow.bufferlen)
+	{
+		window = chan->txwindow.bufferlen;
+	}
+	return window;
+}
+
+/*
+Sends lost fragments first and new ones afterwards, as many as the congestion window
+allows. Sends a plain acknowledge when no fragment went out but the remote end waits for one
+*/
+void ReliableMessagesTransmitNextFragment(netreliablemsg_t *chan)
+{
+	framedata_t *tx = &chan->txwindow;
+	fragment_t *fragment;
+	int sequence, totalsacked, sackedabove, inflight, sent;
+	qboolean timeout;
+
 	if(chan->remoteAddress.type <= NA_BAD){
 		return;
 	}
-	
-	MSG_Init(&buf, data, sizeof(data));
 
-	if(chan->txwindow.acknowledge == chan->txwindow.sequence)
+	totalsacked = 0;
+	for(sequence = tx->acknowledge; sequence < tx->sequence; ++sequence)
+	{
+		if(tx->fragments[sequence % tx->bufferlen].ack == sequence)
+		{
+			totalsacked++;
+		}
+	}
+
+	//Fragments which are on the wire and not considered lost
+	inflight = 0;
+	sackedabove = totalsacked;
+	for(sequence = tx->acknowledge; sequence < tx->sequence; ++sequence)
+	{
+		fragment = &tx->fragments[sequence % tx->bufferlen];
+		if(fragment->ack == sequence)
+		{
+			sackedabove--;
+			continue;
+		}
+		if(fragment->transmits == 0)
+		{
+			//New fragments go out in order, so nothing above was sent yet
+			break;
+		}
+		if(!ReliableMessageFragmentLost(chan, fragment, sackedabove))
+		{
+			inflight++;
+		}
+	}
+
+	sent = 0;
+	sackedabove = totalsacked;
+	for(sequence = tx->acknowledge; sequence < tx->sequence && inflight < ReliableMessageSendWindow(chan); ++sequence)
 	{
-		//Let the remote end still know about the current acknowledge state even when nothing is going to be sent 
-		if(chan->nextacktime < chan->time)
+		fragment = &tx->fragments[sequence % tx->bufferlen];
+		if(fragment->ack == sequence)
 		{
-			MSG_WriteLong(&buf, 0xfffffff0);
-			//Writing -1 as sequence means this is only an ACK packet
-			MSG_WriteShort(&buf, chan->qport);
-			MSG_WriteLong(&buf, -1);
-			MSG_WriteLong(&buf, chan->rxwindow.sequence);
-			ReliableMessageWriteSelectiveAcklist(&chan->rxwindow, &buf);
-			MSG_WriteShort(&buf, chan->txwindow.windowsize);
-			MSG_WriteShort(&buf, 0);
-			NET_SendPacket( chan->sock, buf.cursize, buf.data, &chan->remoteAddress );	
-			chan->txwindow.packets++;
-			chan->nextacktime = chan->time + 350;
+			sackedabove--;
+			continue;
 		}
+		if(fragment->transmits > 0)
+		{
+			if(!ReliableMessageFragmentLost(chan, fragment, sackedabove))
+			{
+				continue;
+			}
+			timeout = (chan->time - fragment->senttime >= chan->cc.rto);
+			ReliableMessageReduceWindow(chan, sequence, timeout);
+		}
+		ReliableMessageSendFragment(chan, sequence);
+		inflight++;
+		sent++;
+	}
+
+	//Let the remote end still know about the current acknowledge state even when nothing is going to be sent
+	if(sent == 0 && chan->nextacktime <= chan->time)
+	{
+		ReliableMessageSendAck(chan);
+	}
+}
+
+//Updates RTT estimation and grows the congestion window for every newly acknowledged fragment
+static void ReliableMessageFragmentAcknowledged(netreliablemsg_t *chan, int sequence)
+{
+	reliablecongestion_t *cc = &chan->cc;
+	fragment_t *fragment = &chan->txwindow.fragments[sequence % chan->txwindow.bufferlen];
+	int sample, delta;
+
+	if(fragment->ack == sequence)
+	{
 		return;
 	}
-	if(chan->txwindow.frame < chan->txwindow.acknowledge)
+	fragment->ack = sequence;
+
+	//Karn's algorithm: a retransmitted fragment can not tell which copy got acknowledged
+	if(fragment->transmits == 1)
+	{
+		sample = chan->time - fragment->senttime;
+		if(sample < 1)
+		{
+			sample = 1;
+		}
+		if(cc->srtt == 0)
+		{
+			cc->srtt = sample;
+			cc->rttvar = sample / 2;
+		}else{
+			delta = sample - cc->srtt;
+			if(delta < 0)
+			{
+				delta = -delta;
+			}
+			cc->rttvar = (3 * cc->rttvar + delta) / 4;
+			cc->srtt = (7 * cc->srtt + sample) / 8;
+		}
+		cc->rto = cc->srtt + 4 * cc->rttvar;
+		if(cc->rto < RELIABLE_MIN_RTO)
+		{
+			cc->rto = RELIABLE_MIN_RTO;
+		}
+		if(cc->rto > RELIABLE_MAX_RTO)
+		{
+			cc->rto = RELIABLE_MAX_RTO;
+		}
+	}
+
+	//Additive increase: one fragment per RTT, or one per acknowledge during slow start
+	if(cc->cwnd < cc->ssthresh)
 	{
-		chan->txwindow.frame = chan->txwindow.acknowledge;
+		cc->cwnd++;
+	}else if(++cc->cwndacks >= cc->cwnd){
+		cc->cwnd++;
+		cc->cwndacks = 0;
 	}
-	
-	sequence = chan->txwindow.frame;
-	if(chan->txwindow.fragments[sequence % chan->txwindow.bufferlen].ack == sequence)
+	if(cc->cwnd > chan->txwindow.bufferlen)
 	{
-		//Already received by the remote end
-		Com_Printf("Send: Skip over %d\n", sequence);
-	}else{
-		MSG_WriteLong(&buf, 0xfffffff0);
-		MSG_WriteShort(&buf, chan->qport);
-		MSG_WriteLong(&buf, sequence);
-		MSG_WriteLong(&buf, chan->rxwindow.sequence); //Acknowledge for the other end
-		ReliableMessageWriteSelectiveAcklist(&chan->rxwindow, &buf);
-		MSG_WriteShort(&buf, chan->txwindow.windowsize);
-		MSG_WriteShort(&buf, chan->txwindow.fragments[sequence % chan->txwindow.bufferlen].len); //Fragment size
-		MSG_WriteData(&buf, chan->txwindow.fragments[sequence % chan->txwindow.bufferlen].data, 
-							chan->txwindow.fragments[sequence % chan->txwindow.bufferlen].len);
-							
-		NET_SendPacket( chan->sock, buf.cursize, buf.data, &chan->remoteAddress );
-		chan->txwindow.packets++;
-		chan->nextacktime = chan->time + 350;
-		Com_Printf("Sending SEQ: %d ACK: %d\n", sequence, chan->rxwindow.sequence);
-	}
-	++chan->txwindow.frame;
-	if(chan->txwindow.frame >= chan->txwindow.sequence)
-	{
-		chan->txwindow.frame = chan->txwindow.acknowledge;
+		cc->cwnd = chan->txwindow.bufferlen;
 	}
-	
 }
 
 //Assuming you have already read the port
@@ -147,16 +362,17 @@ void ReliableMessagesReceiveNextFragment(netreliablemsg_t *chan, msg_t* buf)
 	int sequence, acknowledge;
 	unsigned int numselectiveack, windowsize, fragmentsize, length, startack;
 	int i, j;
-	
+	qboolean staleack;
+
 	if(chan->remoteAddress.type <= NA_BAD){
 		return;
 	}
-	
+
 	sequence = MSG_ReadLong(buf);
 	acknowledge = MSG_ReadLong(buf);
 
 	chan->rxwindow.packets++;
-	
+
 	//if fragment out of window size?
 	if(sequence >= chan->rxwindow.sequence + chan->rxwindow.windowsize)
 	{
@@ -167,20 +383,17 @@ void ReliableMessagesReceiveNextFragment(netreliablemsg_t *chan, msg_t* buf)
 		Com_PrintError("Illegible reliable acknowledge - got: %d current: %d\n", acknowledge, chan->txwindow.acknowledge);
 		return;
 	}
-	if(acknowledge < chan->txwindow.acknowledge)
-	{
-		Com_PrintError("Too old reliable acknowledge %d > %d\n", chan->txwindow.acknowledge, acknowledge);
-		return;
-	}
 	if(acknowledge > chan->txwindow.sequence){
 		Com_PrintError("Invalid reliable acknowledge. acknowledge(%d) > sequence(%d)\n", acknowledge, chan->txwindow.sequence);
 		return;
 	}
-	
+	//A reordered packet. Its acknowledge information is outdated but the fragment is still good
+	staleack = (acknowledge < chan->txwindow.acknowledge);
+
 	numselectiveack = MSG_ReadByte(buf);
 	if(numselectiveack > 3 )
 	{
-		Com_PrintError("Bad selective acknowledge count: %d\n", numselectiveack);	
+		Com_PrintError("Bad selective acknowledge count: %d\n", numselectiveack);
 		return;
 	}
 	for(i = 0; i < numselectiveack; ++i)
@@ -191,40 +404,53 @@ void ReliableMessagesReceiveNextFragment(netreliablemsg_t *chan, msg_t* buf)
 			Com_PrintError("Selective acknowledge %d is out of windowsize acknowledge %d\n", startack + length, acknowledge);
 			return;
 		}
-		Com_Printf("SACK: %d %d\n", startack, length);
+		if(staleack)
+		{
+			continue;
+		}
 		for(j = 0; j < length; ++j)
 		{
-			chan->txwindow.fragments[(startack +j) % chan->txwindow.bufferlen].ack = startack +j;
+			ReliableMessageFragmentAcknowledged(chan, startack + j);
 		}
 	}
 
 	windowsize = MSG_ReadShort(buf);
 	fragmentsize = MSG_ReadShort(buf);
-	
-	Com_Printf("^5Received ACK %d SEQ: %d\n", acknowledge, sequence);
-	
+
+	if(showpackets->boolean)
+	{
+		Com_Printf("^5Received ACK %d SEQ: %d\n", acknowledge, sequence);
+	}
+
 	if(fragmentsize > MAX_FRAGMENT_SIZE){
 		Com_PrintError("Invalid fragmentsize (%d)\n", fragmentsize);
 		return;
 	}
-	
-	if(chan->txwindow.acknowledge < acknowledge){
+
+	if(!staleack){
+		chan->cc.remotewindow = windowsize;
 		//Acknowledge all received data
+		for(i = chan->txwindow.acknowledge; i < acknowledge; ++i)
+		{
+			ReliableMessageFragmentAcknowledged(chan, i);
+		}
 		chan->txwindow.acknowledge = acknowledge;
-		Com_Printf("^5Acknowledge is now %d Top is now: %d Remaining fragments are %d\n", chan->txwindow.acknowledge, chan->txwindow.sequence, chan->txwindow.sequence - chan->txwindow.acknowledge);
 	}
-	
+
 	if(sequence == -1){
 		return;
 	}
-		//if old fragment?
+	//Acknowledge with the next transmit, also duplicates so a lost acknowledge gets repeated
+	chan->nextacktime = chan->time;
+
+	//if old fragment?
 	if(sequence < chan->rxwindow.sequence)
 	{
 		return;
 	}
-	
+
 	chan->rxwindow.fragments[sequence % chan->rxwindow.bufferlen].len = fragmentsize;
-	MSG_ReadData(buf, chan->rxwindow.fragments[sequence % chan->rxwindow.bufferlen].data, 
+	MSG_ReadData(buf, chan->rxwindow.fragments[sequence % chan->rxwindow.bufferlen].data,
 					chan->rxwindow.fragments[sequence % chan->rxwindow.bufferlen].len);
 	chan->rxwindow.fragments[sequence % chan->rxwindow.bufferlen].ack = sequence;
 
@@ -302,6 +528,7 @@ int ReliableMessageSend(netreliablemsg_t *chan, byte* indata, int len)
 		index = chan->txwindow.sequence % chan->txwindow.bufferlen;
 		memcpy(chan->txwindow.fragments[index].data, indata + i * MAX_FRAGMENT_SIZE, slen);
 		chan->txwindow.fragments[index].len = slen;
+		chan->txwindow.fragments[index].transmits = 0;
 		
 		len -= slen;
 		sentlen += slen;
@@ -316,6 +543,7 @@ void ReliableMessageSetup(netreliablemsg_t *chan, int qport, int netsrc, netadr_
 {
 	fragment_t* dynrxmem;
 	fragment_t* dyntxmem;
+	int i;
 	
 	memset(chan, 0, sizeof(netreliablemsg_t));
 	dynrxmem = malloc(sizeof(fragment_t) * DEFAULT_BUFFER_SIZE);
@@ -338,6 +566,15 @@ void ReliableMessageSetup(netreliablemsg_t *chan, int qport, int netsrc, netadr_
 	
 	memset(chan->txwindow.fragments, -1, chan->txwindow.bufferlen * sizeof(fragment_t));
 	memset(chan->rxwindow.fragments, -1, chan->rxwindow.bufferlen * sizeof(fragment_t));
+	//Nothing was sent yet
+	for(i = 0; i < chan->txwindow.bufferlen; ++i)
+	{
+		chan->txwindow.fragments[i].transmits = 0;
+	}
+	chan->cc.cwnd = RELIABLE_INITIAL_WINDOW;
+	chan->cc.ssthresh = chan->txwindow.bufferlen;
+	chan->cc.rto = RELIABLE_INITIAL_RTO;
+	chan->cc.remotewindow = chan->rxwindow.windowsize;
 	memcpy(&chan->remoteAddress, remote, sizeof(netadr_t));
 	chan->sock = netsrc;
 	chan->qport = qport;
@@ -407,4 +644,266 @@ void Net_TestingFunction(netreliablemsg_t *chan)
 		}
 	}
 }
+
+
+/*
+=============================================================================
+
+Loopback test bench
+
+Runs a sender and a receiver through a simulated link with packet loss, latency,
+reordering and a bandwidth limited bottleneck queue. Time is simulated so a
+transfer of several megabytes finishes instantly.
+
+=============================================================================
+*/
+
+#define SIM_MAX_PACKETS		4096
+#define SIM_QUEUE_MSEC		200		//Bottleneck queue holds this much data before it drops
+#define SIM_TIME_LIMIT		(30*60*1000)
+
+typedef struct
+{
+	int delivertime;
+	int dest;
+	int len;
+	byte data[MAX_PACKETLEN];
+}simpacket_t;
+
+struct reliablesim_s
+{
+	simpacket_t packets[SIM_MAX_PACKETS];
+	int numpackets;
+	int time;
+	int loss;           //Percent of packets dropped at random
+	int latency;        //One way delay in msec
+	int reorder;        //Percent of packets which get delayed behind later ones
+	int rate;           //Bottleneck rate in bytes per second, 0 is unlimited
+	unsigned long long linkfree[2]; //Usec when each direction of the bottleneck is idle again
+	unsigned int seed;
+	netreliablemsg_t *endpoints[2];
+	int packetssent[2];
+	int bytessent[2];
+	int randomdrops;
+	int queuedrops;
+};
+
+static int ReliableSimRandom(reliablesim_t *sim, int range)
+{
+	sim->seed = sim->seed * 1103515245 + 12345;
+	return ((sim->seed >> 16) & 0x7fff) % range;
+}
+
+static void ReliableSimSendPacket(reliablesim_t *sim, netreliablemsg_t *chan, msg_t *buf)
+{
+	simpacket_t *packet;
+	unsigned long long now, start;
+	int dir;
+
+	dir = (chan == sim->endpoints[0]) ? 0 : 1;
+
+	sim->packetssent[dir]++;
+	sim->bytessent[dir] += buf->cursize;
+
+	if(ReliableSimRandom(sim, 100) < sim->loss)
+	{
+		sim->randomdrops++;
+		return;
+	}
+
+	now = (unsigned long long)sim->time * 1000;
+	start = sim->linkfree[dir];
+	if(start < now)
+	{
+		start = now;
+	}
+	if(start - now > SIM_QUEUE_MSEC * 1000 || sim->numpackets >= SIM_MAX_PACKETS)
+	{
+		sim->queuedrops++;
+		return;
+	}
+	if(sim->rate > 0)
+	{
+		sim->linkfree[dir] = start + (unsigned long long)(buf->cursize + 28) * 1000000 / sim->rate;
+	}else{
+		sim->linkfree[dir] = start;
+	}
+
+	packet = &sim->packets[sim->numpackets++];
+	packet->dest = 1 - dir;
+	packet->len = buf->cursize;
+	packet->delivertime = sim->linkfree[dir] / 1000 + sim->latency;
+	if(ReliableSimRandom(sim, 100) < sim->reorder)
+	{
+		packet->delivertime += 1 + ReliableSimRandom(sim, sim->latency + 10);
+	}
+	memcpy(packet->data, buf->data, buf->cursize);
+}
+
+static void ReliableSimDeliver(reliablesim_t *sim)
+{
+	simpacket_t *packet;
+	msg_t msg;
+	int i, keep;
+
+	keep = 0;
+	for(i = 0; i < sim->numpackets; ++i)
+	{
+		packet = &sim->packets[i];
+		if(packet->delivertime > sim->time)
+		{
+			if(keep != i)
+			{
+				memcpy(&sim->packets[keep], packet, sizeof(simpacket_t));
+			}
+			keep++;
+			continue;
+		}
+		MSG_InitReadOnly(&msg, packet->data, packet->len);
+		MSG_BeginReading(&msg);
+		MSG_ReadLong(&msg);
+		MSG_ReadShort(&msg);
+		ReliableMessagesReceiveNextFragment(sim->endpoints[packet->dest], &msg);
+	}
+	sim->numpackets = keep;
+}
+
+static byte ReliableSimPattern(int offset)
+{
+	return (offset * 7 + (offset >> 11)) & 0xff;
+}
+
+/*
+reliablebench <loss%> <latency msec> <reorder%> <rate KB/s> <megabytes> [frame msec]
+*/
+void ReliableMessageBench_f(void)
+{
+	reliablesim_t *sim;
+	netreliablemsg_t sender, receiver;
+	netadr_t adr;
+	byte *chunk;
+	int total, sendpos, recvpos, chunklen, numbytes, framemsec, nextframe, i, errors;
+	int uniquefragments;
+
+	if(Cmd_Argc() < 6)
+	{
+		Com_Printf("Usage: reliablebench <loss%%> <latency msec> <reorder%%> <rate KB/s, 0 = unlimited> <megabytes> [frame msec]\n");
+		return;
+	}
+
+	sim = malloc(sizeof(reliablesim_t));
+	chunk = malloc(DEFAULT_BUFFER_SIZE * MAX_FRAGMENT_SIZE);
+	if(sim == NULL || chunk == NULL)
+	{
+		free(sim);
+		free(chunk);
+		Com_PrintError("reliablebench: Out of memory\n");
+		return;
+	}
+	memset(sim, 0, sizeof(reliablesim_t));
+
+	sim->loss = atoi(Cmd_Argv(1));
+	sim->latency = atoi(Cmd_Argv(2));
+	sim->reorder = atoi(Cmd_Argv(3));
+	sim->rate = atoi(Cmd_Argv(4)) * 1024;
+	total = atoi(Cmd_Argv(5)) * 1024 * 1024;
+	framemsec = 50;
+	if(Cmd_Argc() > 6)
+	{
+		framemsec = atoi(Cmd_Argv(6));
+	}
+	if(sim->loss < 0 || sim->loss > 90 || sim->latency < 0 || sim->reorder < 0 || sim->rate < 0 || total <= 0 || framemsec < 1)
+	{
+		Com_PrintError("reliablebench: Invalid arguments\n");
+		free(sim);
+		free(chunk);
+		return;
+	}
+	sim->seed = 1;
+
+	memset(&adr, 0, sizeof(adr));
+	adr.type = NA_LOOPBACK;
+	ReliableMessageSetup(&sender, 1, NS_SERVER, &adr);
+	ReliableMessageSetup(&receiver, 2, NS_CLIENT, &adr);
+	sim->endpoints[0] = &sender;
+	sim->endpoints[1] = &receiver;
+
+	rm_sim = sim;
+
+	sendpos = 0;
+	recvpos = 0;
+	errors = 0;
+	nextframe = 0;
+
+	for(sim->time = 0; recvpos < total && sim->time < SIM_TIME_LIMIT; ++sim->time)
+	{
+		ReliableSimDeliver(sim);
+
+		if(sim->time < nextframe)
+		{
+			continue;
+		}
+		nextframe = sim->time + framemsec;
+
+		ReliableMessageSetCurrentTime(&sender, sim->time);
+		ReliableMessageSetCurrentTime(&receiver, sim->time);
+
+		chunklen = total - sendpos;
+		if(chunklen > DEFAULT_BUFFER_SIZE * MAX_FRAGMENT_SIZE)
+		{
+			chunklen = DEFAULT_BUFFER_SIZE * MAX_FRAGMENT_SIZE;
+		}
+		for(i = 0; i < chunklen; ++i)
+		{
+			chunk[i] = ReliableSimPattern(sendpos + i);
+		}
+		sendpos += ReliableMessageSend(&sender, chunk, chunklen);
+
+		numbytes = ReliableMessageReceive(&receiver, chunk, DEFAULT_BUFFER_SIZE * MAX_FRAGMENT_SIZE);
+		for(i = 0; i < numbytes; ++i)
+		{
+			if(chunk[i] != ReliableSimPattern(recvpos + i))
+			{
+				errors++;
+			}
+		}
+		recvpos += numbytes;
+
+		ReliableMessagesTransmitNextFragment(&sender);
+		ReliableMessagesTransmitNextFragment(&receiver);
+	}
+
+	rm_sim = NULL;
+
+	uniquefragments = (total + MAX_FRAGMENT_SIZE - 1) / MAX_FRAGMENT_SIZE;
+
+	Com_Printf("loss %d%%, latency %d msec, reorder %d%%, rate %d KB/s, frame %d msec\n",
+		sim->loss, sim->latency, sim->reorder, sim->rate / 1024, framemsec);
+	if(recvpos < total)
+	{
+		Com_Printf("^1Transfer did not finish within %d simulated seconds. Received %d of %d bytes\n", SIM_TIME_LIMIT / 1000, recvpos, total);
+	}else{
+		Com_Printf("Transferred %d KB in %d msec: %d KB/s", total / 1024, sim->time, (int)((long long)total * 1000 / 1024 / sim->time));
+		if(sim->rate > 0)
+		{
+			Com_Printf(", %d%% of the link", (int)((long long)total * 1000 * 100 / sim->rate / sim->time));
+		}
+		Com_Printf("\n");
+	}
+	Com_Printf("Fragments: %d sent for %d unique, %d retransmits, %d%% overhead\n", sender.cc.fragmentssent, uniquefragments,
+		sender.cc.retransmits, uniquefragments > 0 ? sender.cc.retransmits * 100 / uniquefragments : 0);
+	Com_Printf("Packets: %d data, %d acknowledge, %d lost at random, %d dropped by the bottleneck queue\n",
+		sim->packetssent[0], sim->packetssent[1], sim->randomdrops, sim->queuedrops);
+	Com_Printf("Final state: cwnd %d ssthresh %d srtt %d rttvar %d rto %d\n", sender.cc.cwnd, sender.cc.ssthresh,
+		sender.cc.srtt, sender.cc.rttvar, sender.cc.rto);
+	if(errors)
+	{
+		Com_PrintError("%d bytes did not match the sent data\n", errors);
+	}
+
+	ReliableMessageDisconnect(&sender);
+	ReliableMessageDisconnect(&receiver);
+	free(sim);
+	free(chunk);
+}
 #endif
\ No newline at end of file
@@ -7,7 +7,7 @@ typedef struct
 	byte data[MAX_FRAGMENT_SIZE];
 	int len;
 	int ack;
-	int packetnum;
+	int transmits;   //How often this fragment went out. Only fragments sent once give a valid RTT sample
 	int senttime;
 }fragment_t;
 
@@ -23,10 +23,25 @@ typedef struct
 	int packets;
 }framedata_t;
 
+typedef struct
+{
+	int cwnd;          //Congestion window in fragments
+	int ssthresh;      //Slow start threshold in fragments
+	int cwndacks;      //Fragments acknowledged since the last increase during congestion avoidance
+	int recover;       //Window is reduced at most once until this sequence got acknowledged
+	int srtt;          //Smoothed round trip time in msec. 0 until the first sample arrived
+	int rttvar;        //Round trip time variation in msec
+	int rto;           //Retransmission timeout in msec
+	int remotewindow;  //Window size the remote end has advertised
+	int fragmentssent; //Data fragments sent including retransmissions
+	int retransmits;   //Data fragments sent again
+}reliablecongestion_t;
+
 typedef struct
 {
 	framedata_t txwindow;
 	framedata_t rxwindow;
+	reliablecongestion_t cc;
 	int sock;
 	netadr_t remoteAddress;
 	int time;
@@ -38,7 +53,8 @@ void ReliableMessagesTransmitNextFragment(netreliablemsg_t *chan);
 void ReliableMessagesReceiveNextFragment(netreliablemsg_t *chan, msg_t* buf);
 int ReliableMessageReceive(netreliablemsg_t *chan, byte* outdata, int len);
 int ReliableMessageSend(netreliablemsg_t *chan, byte* indata, int len);
-void ReliableMessageSetup(netreliablemsg_t *chan, int netsrc, int qport, netadr_t* remote);
+void ReliableMessageSetup(netreliablemsg_t *chan, int qport, int netsrc, netadr_t* remote);
 void Net_TestingFunction(netreliablemsg_t *chan);
 void ReliableMessageDisconnect(netreliablemsg_t *chan);
 void ReliableMessageSetCurrentTime(netreliablemsg_t *chan, int time);
+void ReliableMessageBench_f(void);
@@ -32,6 +32,8 @@
 #include "plugin_handler.h"
 #include "net_game_conf.h"
 #include "sha.h"
+#include "qcommon_profile.h"
+#include "net_game.h"
 
 #include <string.h>
 #include <stdarg.h>
@@ -470,7 +472,7 @@ qboolean NET_SendPacket( netsrc_t sock, int length, const void *data, netadr_t *
 
 	qboolean returnNow = qfalse;
 
-	PHandler_Event(PLUGINS_ONUDPNETSEND, to, data, length, &returnNow);
+	PHandler_EventUdpNet(PLUGINS_ONUDPNETSEND, to, data, length, &returnNow);
 
 	if(returnNow){
 		return qtrue;
@@ -490,6 +492,11 @@ qboolean NET_SendPacket( netsrc_t sock, int length, const void *data, netadr_t *
 	if ( to->type == NA_BAD ) {
 		return qfalse;
 	}
+	Prof_CountPacketOut(length);
+	// a replayed capture gets answered into the void
+	if ( NET_ReplayActive() ) {
+		return qtrue;
+	}
 	return Sys_SendPacket( length, data, to );
 }
 
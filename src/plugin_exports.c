@@ -22,6 +22,8 @@
 
 
 #include "plugin_handler.h"
+#include "sys_thread.h"
+#include "varstorage.h"
 
 /*=========================================*
  *                                         *
@@ -58,6 +60,64 @@ P_P_F void Plugin_Free(void *ptr)
     }
     PHandler_Free(pID,ptr);
 }
+
+typedef struct{
+    int pID;
+    void (*func)(void *arg);
+    void (*done)(void *arg);
+    void *arg;
+}pluginJob_t;
+
+static void PHandler_JobMain(void *arg)
+{
+    pluginJob_t *job = arg;
+
+    job->func(job->arg);
+}
+
+static void PHandler_JobDone(void *arg)
+{
+    pluginJob_t *job = arg;
+
+    --pluginFunctions.plugins[job->pID].activeJobs;
+    if(job->done != NULL){
+        pluginFunctions.hasControl = job->pID;
+        job->done(job->arg);
+        pluginFunctions.hasControl = PLUGIN_UNKNOWN;
+    }
+    free(job);
+}
+
+P_P_F qboolean Plugin_RunJob(void (*func)(void *arg), void (*done)(void *arg), void *arg)
+{
+    pluginJob_t *job;
+    volatile int pID = PHandler_CallerID();
+
+    if(pID<0){
+        Com_PrintError("Plugin_RunJob called from unknown plugin!\n");
+        return qfalse;
+    }
+    if(pluginFunctions.initializing_plugin){
+        Com_PrintError("Plugin_RunJob: Jobs can not be started before OnInit has returned\n");
+        return qfalse;
+    }
+    job = malloc(sizeof(pluginJob_t));
+    if(job == NULL)
+        return qfalse;
+
+    job->pID = pID;
+    job->func = func;
+    job->done = done;
+    job->arg = arg;
+    ++pluginFunctions.plugins[pID].activeJobs;
+    if(Sys_JobRun(PHandler_JobMain, PHandler_JobDone, job) == NULL){
+        --pluginFunctions.plugins[pID].activeJobs;
+        free(job);
+        return qfalse;
+    }
+    return qtrue;
+}
+
 P_P_F void Plugin_Error(int code, const char *fmt, ...)
 {
     va_list argptr;
@@ -135,6 +195,11 @@ P_P_F void Plugin_AddCommand(char *name, xcommand_t xcommand, int power)
    // pluginFunctions.plugins[pID].
 
 
+}
+/* Can be called from any thread. Runs the command on the main thread as console */
+P_P_F qboolean Plugin_Cbuf_QueueCommand(const char *text)
+{
+    return Cbuf_QueueCommand(text, -1, 100, -1, NULL);
 }
 P_P_F qboolean Plugin_TcpConnect( int connection, const char* remote)
 {
@@ -304,6 +369,19 @@ P_P_F const char* Plugin_GetPlayerGUID(unsigned int clientslot)
     return cl->pbguid;
 }
 
+P_P_F qboolean Plugin_DumpDemoBuffer(unsigned int clientslot, const char* basename)
+{
+    int PID = PHandler_CallerID();
+	mvabuf;
+
+    if(clientslot >= sv_maxclients->integer)
+    {
+        PHandler_Error(PID,P_ERROR_DISABLE, va("Plugin tried to dump the demo buffer of bad client: %d\n", clientslot));
+        return qfalse;
+    }
+    return SV_DemoBufferDump(&svs.clients[clientslot], basename);
+}
+
 P_P_F void Plugin_SetPlayerGUID(unsigned int clientslot, const char* guid)
 {
     client_t *cl;
@@ -502,6 +580,38 @@ P_P_F const char* Plugin_Cvar_GetString(void *cvar)
     return var->string;
 }
 
+P_P_F qboolean Plugin_Cvar_AddChangeCallback(void *cvar, void (*callback)(void *cvar))
+{
+    int PID = PHandler_CallerID();
+
+    if(PID < 0)
+    {
+        Com_PrintError("Plugin_Cvar_AddChangeCallback called from not within a plugin!\n");
+        return qfalse;
+    }
+
+    if(cvar == NULL || callback == NULL)
+    {
+        PHandler_Error(PID, P_ERROR_DISABLE, "Plugin tried to subscribe to Cvar with NULL-Pointer\n");
+        return qfalse;
+    }
+
+    return PHandler_CvarAddChangeCallback(PID, cvar, callback);
+}
+
+P_P_F void Plugin_Cvar_RemoveChangeCallback(void *cvar, void (*callback)(void *cvar))
+{
+    int PID = PHandler_CallerID();
+
+    if(PID < 0)
+    {
+        Com_PrintError("Plugin_Cvar_RemoveChangeCallback called from not within a plugin!\n");
+        return;
+    }
+
+    PHandler_CvarRemoveChangeCallback(PID, cvar, callback);
+}
+
 P_P_F void Plugin_DropClient( unsigned int clientnum, const char *reason )
 {
     if(clientnum > sv_maxclients->integer)
@@ -598,3 +708,90 @@ P_P_F int Plugin_FS_SV_WriteFile( const char *qpath, const void *buffer, int siz
 {
     return FS_SV_HomeWriteFile( qpath, buffer, size);
 }
+
+P_P_F qboolean Plugin_Storage_SetString(const char* table, const char* key, const char* value)
+{
+    vsValue_t v;
+    v.string = (char*)value;
+    return HStorage_TableSet(table, key, VSVAR_STRING, &v);
+}
+
+P_P_F qboolean Plugin_Storage_SetInt(const char* table, const char* key, int value)
+{
+    vsValue_t v;
+    v.integer = value;
+    return HStorage_TableSet(table, key, VSVAR_INTEGER, &v);
+}
+
+P_P_F qboolean Plugin_Storage_SetFloat(const char* table, const char* key, float value)
+{
+    vsValue_t v;
+    v.floatVar = value;
+    return HStorage_TableSet(table, key, VSVAR_FLOAT, &v);
+}
+
+P_P_F qboolean Plugin_Storage_GetString(const char* table, const char* key, char* buffer, int bufferSize)
+{
+    vsValue_t v;
+    varType_t type;
+
+    if(!HStorage_TableGet(table, key, &type, &v) || type != VSVAR_STRING)
+    {
+        return qfalse;
+    }
+    Q_strncpyz(buffer, v.string, bufferSize);
+    return qtrue;
+}
+
+P_P_F qboolean Plugin_Storage_GetInt(const char* table, const char* key, int* value)
+{
+    vsValue_t v;
+    varType_t type;
+
+    if(!HStorage_TableGet(table, key, &type, &v) || type != VSVAR_INTEGER)
+    {
+        return qfalse;
+    }
+    *value = v.integer;
+    return qtrue;
+}
+
+P_P_F qboolean Plugin_Storage_GetFloat(const char* table, const char* key, float* value)
+{
+    vsValue_t v;
+    varType_t type;
+
+    if(!HStorage_TableGet(table, key, &type, &v))
+    {
+        return qfalse;
+    }
+    if(type == VSVAR_FLOAT)
+    {
+        *value = v.floatVar;
+    }else if(type == VSVAR_INTEGER){
+        *value = v.integer;
+    }else{
+        return qfalse;
+    }
+    return qtrue;
+}
+
+P_P_F qboolean Plugin_Storage_Remove(const char* table, const char* key)
+{
+    return HStorage_TableRemove(table, key);
+}
+
+P_P_F int Plugin_EntitiesInRadius(const vec3_t origin, float radius, qboolean playersOnly, int* entnums, int maxCount)
+{
+    return SV_EntityGridRadius(origin, radius, playersOnly, entnums, maxCount);
+}
+
+P_P_F int Plugin_EntitiesInBox(const vec3_t mins, const vec3_t maxs, qboolean playersOnly, int* entnums, int maxCount)
+{
+    return SV_EntityGridBox(mins, maxs, playersOnly, entnums, maxCount);
+}
+
+P_P_F int Plugin_NearestPlayer(const vec3_t origin, float maxDist, int ignoreEntnum)
+{
+    return SV_EntityGridNearestPlayer(origin, maxDist, ignoreEntnum);
+}
@@ -67,6 +67,8 @@ char PHandler_Events[PLUGINS_ITEMCOUNT][32]={
     "OnFilesystemStarted"
 };
 
+static cvar_t *sv_pluginProfile;
+
 void PHandler_Init() // Initialize the Plugin Handler's data structures and add commands
 {
     pluginFunctions.loadedPlugins=0;
@@ -80,6 +82,9 @@ void PHandler_Init() // Initialize the Plugin Handler's data structures and add
     Cmd_AddCommand("unloadPlugin", PHandler_UnLoadPlugin_f);
     Cmd_AddCommand("plugins", PHandler_PluginList_f);
     Cmd_AddCommand("pluginInfo", PHandler_PluginInfo_f);
+    Cmd_AddCommand("pluginprofile", PHandler_PluginProfile_f);
+
+    sv_pluginProfile = Cvar_RegisterBool("sv_pluginProfile", qfalse, 0, "Time every plugin event handler for the pluginprofile command");
 
     Com_Printf("-------- Plugins initialization completed --------\n");
 }
@@ -271,6 +276,7 @@ void PHandler_Load(char* name) // Load a plugin, safe for use
     pluginFunctions.plugins[i].OnUnload = Sys_GetProcedure("OnUnload");
     pluginFunctions.plugins[i].loaded = qtrue;
     pluginFunctions.plugins[i].enabled = qtrue;
+    pluginFunctions.plugins[i].heap.loadTime = Sys_Milliseconds();
     Q_strncpyz(pluginFunctions.plugins[i].name, name, sizeof(pluginFunctions.plugins[i].name));
     pluginFunctions.initializing_plugin = qtrue;
 
@@ -288,6 +294,7 @@ void PHandler_Load(char* name) // Load a plugin, safe for use
     pluginFunctions.initializing_plugin = qfalse;
     pluginFunctions.loadedPlugins++;
     pluginFunctions.plugins[i].lib_handle = lib_handle;
+    PHandler_RebuildSubscribers();
 
     if(pluginFunctions.plugins[i].OnInfoRequest){
         Com_DPrintf("Fetching plugin information...\n");
@@ -318,7 +325,9 @@ void PHandler_Load(char* name) // Load a plugin, safe for use
         pluginFunctions.hasControl = PLUGIN_UNKNOWN;
         Com_Printf("Error in plugin's OnInit function!\nPlugin load failed.\n");
         pluginFunctions.initializing_plugin = qfalse;
+        PHandler_FreeAll(i);
         memset(pluginFunctions.plugins + i,0x00,sizeof(plugin_t));    // We need to remove all references so we can dlclose.
+        PHandler_RebuildSubscribers();
         Sys_CloseLibrary(lib_handle);
         return;
     }
@@ -350,6 +359,11 @@ void PHandler_Unload(int id) // Unload a plugin, safe for use.
             Com_PrintError("PHandler_Unload: Cannot unload a script-library plugin!\n");
             return;
         }
+        if(pluginFunctions.plugins[id].activeJobs > 0){
+            // The workers would call into the unloaded library
+            Com_PrintError("PHandler_Unload: Plugin #%d has %d jobs running, try again later\n", id, pluginFunctions.plugins[id].activeJobs);
+            return;
+        }
         unloading = qtrue; // Preventing endless recursion...
         if(pluginFunctions.plugins[id].OnUnload != NULL){
             pluginFunctions.hasControl = id;
@@ -357,6 +371,8 @@ void PHandler_Unload(int id) // Unload a plugin, safe for use.
             pluginFunctions.hasControl = PLUGIN_UNKNOWN;
         }
         unloading = qfalse;
+        PHandler_CvarRemoveAllChangeCallbacks(id);
+        PHandler_FreeAll(id);
         // Remove all server commands of the plugin
         for(i=0;i<pluginFunctions.plugins[id].cmds;i++){
             if(pluginFunctions.plugins[id].cmd[i].xcommand!=NULL){
@@ -367,6 +383,7 @@ void PHandler_Unload(int id) // Unload a plugin, safe for use.
         }
         lib_handle = pluginFunctions.plugins[id].lib_handle;                // Save the lib handle
         Com_Memset(&(pluginFunctions.plugins[id]), 0x00, sizeof(plugin_t));     // Wipe out all the data
+        PHandler_RebuildSubscribers();
         Sys_CloseLibrary(lib_handle);                                                // Close the dll as there are no more references to it
         --pluginFunctions.loadedPlugins;
     }else{
@@ -398,9 +415,63 @@ void PHandler_UnloadByName(char *name) // Unload a plugin, safe for use
 }
 
 
+/*
+=================
+Event dispatch
+
+Only the plugins which export a handler for an event are in its subscriber
+list, so events nobody listens to cost a single compare. The list is rebuilt
+whenever a plugin gets loaded or unloaded. The packet and usercmd events run
+for every datagram and move command and have typed entry points which skip
+the varargs.
+
+With sv_pluginProfile set each handler call is timed and accounted to its
+plugin, "pluginprofile" shows the totals.
+=================
+*/
+
+void PHandler_RebuildSubscribers( void )
+{
+    int i, eventID;
+
+    for(eventID = 0; eventID < PLUGINS_ITEMCOUNT; eventID++){
+        pluginFunctions.numSubscribers[eventID] = 0;
+        for(i = 0; i < MAX_PLUGINS; i++){
+            if(pluginFunctions.plugins[i].loaded && pluginFunctions.plugins[i].OnEvent[eventID] != NULL)
+                pluginFunctions.subscribers[eventID][pluginFunctions.numSubscribers[eventID]++] = i;
+        }
+    }
+}
+
+static unsigned long long PHandler_BeginCall(int pID)
+{
+    pluginFunctions.hasControl = pID;
+    if(sv_pluginProfile != NULL && sv_pluginProfile->boolean)
+        return Sys_MicrosecondsMonotonic();
+    return 0;
+}
+
+static void PHandler_EndCall(int pID, int eventID, unsigned long long start)
+{
+    plugin_t *plugin;
+    unsigned int usec;
+
+    pluginFunctions.hasControl = PLUGIN_UNKNOWN;
+    if(start == 0)
+        return;
+
+    plugin = &pluginFunctions.plugins[pID];
+    usec = Sys_MicrosecondsMonotonic() - start;
+    plugin->eventUsec[eventID] += usec;
+    plugin->eventCalls[eventID]++;
+    if(usec > plugin->eventMaxUsec[eventID])
+        plugin->eventMaxUsec[eventID] = usec;
+}
+
 void PHandler_Event(int eventID,...) // Fire a plugin event, safe for use
 {
-    int i=0;
+    int i, pID;
+    unsigned long long start;
 
     if(!pluginFunctions.enabled)
             return;
@@ -410,6 +481,9 @@ void PHandler_Event(int eventID,...) // Fire a plugin event, safe for use
         return;
     }
 
+    if(pluginFunctions.numSubscribers[eventID] == 0)
+        return;
+
     va_list argptr;
 
     va_start(argptr, eventID);
@@ -422,11 +496,79 @@ void PHandler_Event(int eventID,...) // Fire a plugin event, safe for use
 
     va_end(argptr);
 
-    for(i=0;i < pluginFunctions.loadedPlugins; i++){
-        if(pluginFunctions.plugins[i].OnEvent[eventID]!= NULL){
-            pluginFunctions.hasControl = i;
-            (*pluginFunctions.plugins[i].OnEvent[eventID])(arg_0, arg_1, arg_2, arg_3, arg_4, arg_5);
-    	    pluginFunctions.hasControl = PLUGIN_UNKNOWN;
+    for(i = 0; i < pluginFunctions.numSubscribers[eventID]; i++){
+        pID = pluginFunctions.subscribers[eventID][i];
+        start = PHandler_BeginCall(pID);
+        (*pluginFunctions.plugins[pID].OnEvent[eventID])(arg_0, arg_1, arg_2, arg_3, arg_4, arg_5);
+        PHandler_EndCall(pID, eventID, start);
+    }
+}
+
+/* PLUGINS_ONUDPNETEVENT and PLUGINS_ONUDPNETSEND */
+void PHandler_EventUdpNet(int eventID, netadr_t *adr, const void *data, int len, qboolean *returnNow)
+{
+    int i, pID;
+    unsigned long long start;
+
+    if(!pluginFunctions.enabled || pluginFunctions.numSubscribers[eventID] == 0)
+        return;
+
+    for(i = 0; i < pluginFunctions.numSubscribers[eventID]; i++){
+        pID = pluginFunctions.subscribers[eventID][i];
+        start = PHandler_BeginCall(pID);
+        (*pluginFunctions.plugins[pID].OnEvent[eventID])(adr, data, len, returnNow);
+        PHandler_EndCall(pID, eventID, start);
+    }
+}
+
+void PHandler_EventClientMove(client_t *cl, usercmd_t *ucmd)
+{
+    int i, pID;
+    unsigned long long start;
+
+    if(!pluginFunctions.enabled || pluginFunctions.numSubscribers[PLUGINS_ONCLIENTMOVECOMMAND] == 0)
+        return;
+
+    for(i = 0; i < pluginFunctions.numSubscribers[PLUGINS_ONCLIENTMOVECOMMAND]; i++){
+        pID = pluginFunctions.subscribers[PLUGINS_ONCLIENTMOVECOMMAND][i];
+        start = PHandler_BeginCall(pID);
+        (*pluginFunctions.plugins[pID].OnEvent[PLUGINS_ONCLIENTMOVECOMMAND])(cl, ucmd);
+        PHandler_EndCall(pID, PLUGINS_ONCLIENTMOVECOMMAND, start);
+    }
+}
+
+void PHandler_PluginProfile_f( void )
+{
+    plugin_t *plugin;
+    int i, eventID;
+    unsigned long long total;
+
+    if(Cmd_Argc() > 1 && !Q_stricmp(Cmd_Argv(1), "reset")){
+        for(i = 0; i < MAX_PLUGINS; i++){
+            plugin = &pluginFunctions.plugins[i];
+            memset(plugin->eventUsec, 0, sizeof(plugin->eventUsec));
+            memset(plugin->eventMaxUsec, 0, sizeof(plugin->eventMaxUsec));
+            memset(plugin->eventCalls, 0, sizeof(plugin->eventCalls));
+        }
+        Com_Printf("Plugin profile has been reset\n");
+        return;
+    }
+    if(!sv_pluginProfile->boolean)
+        Com_Printf("sv_pluginProfile is not set, the numbers below are not getting updated\n");
+
+    Com_Printf("plugin               event                        calls    total ms   avg usec   max usec\n");
+    for(i = 0; i < MAX_PLUGINS; i++){
+        plugin = &pluginFunctions.plugins[i];
+        if(!plugin->loaded)
+            continue;
+        for(eventID = 0, total = 0; eventID < PLUGINS_ITEMCOUNT; eventID++){
+            if(plugin->eventCalls[eventID] == 0)
+                continue;
+            total += plugin->eventUsec[eventID];
+            Com_Printf("%-20s %-26s %9u %11.2f %10.1f %10u\n", plugin->name, PHandler_Events[eventID], plugin->eventCalls[eventID],
+                    (float)plugin->eventUsec[eventID] / 1000.0f, (float)plugin->eventUsec[eventID] / plugin->eventCalls[eventID],
+                    plugin->eventMaxUsec[eventID]);
         }
+        Com_Printf("%-20s %-26s %9s %11.2f\n", plugin->name, "all events", "", (float)total / 1000.0f);
     }
 }
@@ -55,8 +55,10 @@ typedef void convariable_t; //For plugins
 #include "../plugins/plugin_declarations.h"
 #include "plugin_events.h"
 
-#define PLUGIN_MAX_MALLOCS 50
+#define PLUGIN_HEAP_CLASSES 8       // Size classes of 16 up to 2048 bytes, bigger blocks come from malloc
+#define PLUGIN_HEAP_CHUNKSIZE 65536 // Small blocks get carved from chunks of this size
 #define PLUGIN_MAX_SOCKETS 4
+#define PLUGIN_MAX_CVARCALLBACKS 16
 
 // plugins com
 #define PLUGIN_COM_MAXNAMELEN 28    // Max 27 chars + \0
@@ -76,9 +78,15 @@ typedef struct{
 }pluginCmd_t;
 
 typedef struct{
-    size_t size;
-    void *ptr;
-}pluginMem_t;
+    void *freeList[PLUGIN_HEAP_CLASSES];
+    void *chunks;               // Singly linked, all of them get freed on unload
+    byte *chunkPos;             // Unused rest of the newest chunk
+    byte *chunkEnd;
+    void *largeBlocks;          // Doubly linked list of blocks bigger than the biggest class
+    size_t peakMem;
+    unsigned int totalMallocs;
+    int loadTime;
+}pluginHeap_t;
 
 typedef struct{
     char name[PLUGIN_COM_MAXNAMELEN];
@@ -91,6 +99,12 @@ typedef struct{
     qboolean (*packetEventHandler)(netadr_t *from, msg_t* msg);
 }pluginTcpClientSocket_t;
 
+typedef struct{
+    cvar_t* cvar;
+    void (*callback)(convariable_t* cvar);
+    int pID;
+}pluginCvarCallback_t;
+
 typedef struct{
     int (*OnInit)();            // Initialization function
     void (*OnInfoRequest)();    // Info gathering function
@@ -107,14 +121,21 @@ typedef struct{
     
     char name[MAX_QPATH];
     
-    pluginMem_t memory[PLUGIN_MAX_MALLOCS];
+    pluginHeap_t heap;
     pluginTcpClientSocket_t sockets[PLUGIN_MAX_SOCKETS];
+    pluginCvarCallback_t cvarCallbacks[PLUGIN_MAX_CVARCALLBACKS];
     
     pluginExport_t exportedFunctions[PLUGIN_MAX_EXPORTS];
     int exports;
     
     size_t usedMem;
     int mallocs;
+    int activeJobs;             // Jobs of Plugin_RunJob whose completion did not run yet
+
+    // Time spent in the event handlers while sv_pluginProfile is set
+    unsigned long long eventUsec[PLUGINS_ITEMCOUNT];
+    unsigned int eventMaxUsec[PLUGINS_ITEMCOUNT];
+    unsigned int eventCalls[PLUGINS_ITEMCOUNT];
     
     qboolean loaded;
     qboolean enabled;
@@ -132,6 +153,9 @@ typedef struct{
     qboolean enabled;
     qboolean initializing_plugin;
     int hasControl;
+    // IDs of the plugins which have a handler for each event, see PHandler_RebuildSubscribers
+    int subscribers[PLUGINS_ITEMCOUNT][MAX_PLUGINS];
+    int numSubscribers[PLUGINS_ITEMCOUNT];
 }pluginWrapper_t;
 
 extern pluginWrapper_t pluginFunctions; // defined in plugin_handler.c
@@ -144,6 +168,9 @@ void PHandler_Unload(int id);
 void PHandler_UnloadByName(char *name);
 int PHandler_GetID(char *name);
 void PHandler_Event(int, ...);
+void PHandler_EventUdpNet(int eventID, netadr_t *adr, const void *data, int len, qboolean *returnNow);
+void PHandler_EventClientMove(client_t *cl, usercmd_t *ucmd);
+void PHandler_RebuildSubscribers( void );
 void PHandler_Init();
 void *PHandler_Malloc(int,size_t);
 void PHandler_Free(int,void *);
@@ -153,6 +180,9 @@ qboolean PHandler_TcpConnect(int,const char *,int);
 int PHandler_TcpGetData(int, int, void*, int);
 qboolean PHandler_TcpSendData(int,int, void*, int);
 void PHandler_TcpCloseConnection(int,int);
+qboolean PHandler_CvarAddChangeCallback(int pID, cvar_t* var, void (*callback)(convariable_t*));
+void PHandler_CvarRemoveChangeCallback(int pID, cvar_t* var, void (*callback)(convariable_t*));
+void PHandler_CvarRemoveAllChangeCallbacks(int pID);
 int PHandler_CallerID();
 void PHandler_ChatPrintf(int,char *,...);
 void PHandler_CmdExecute_f( void ); // fake server command for use in plugin commands
@@ -166,6 +196,7 @@ void PHandler_LoadPlugin_f( void );
 void PHandler_UnLoadPlugin_f( void );
 void PHandler_PluginList_f( void );
 void PHandler_PluginInfo_f( void );
+void PHandler_PluginProfile_f( void );
 
 #endif /*PLUGIN_HANDLER_H*/
 
@@ -23,6 +23,8 @@
 
 #include "plugin_handler.h"
 #include "sys_main.h"
+
+#include <stddef.h>
 /*==========================================*
  *                                          *
  *   Plugin Handler's internal functions    *
@@ -112,6 +114,80 @@ void PHandler_TcpCloseConnection(int pID, int connection)
     ptcs->sock = -1;
 }
 
+/* 
+============
+ Cvar module
+============
+*/
+
+static void PHandler_CvarChanged(cvar_t* var, void* arg)
+{
+    pluginCvarCallback_t* pcc = arg;
+
+    if(!pluginFunctions.enabled || !pluginFunctions.plugins[pcc->pID].enabled)
+        return;
+
+    pluginFunctions.hasControl = pcc->pID;
+    pcc->callback(var);
+    pluginFunctions.hasControl = PLUGIN_UNKNOWN;
+}
+
+qboolean PHandler_CvarAddChangeCallback(int pID, cvar_t* var, void (*callback)(convariable_t*))
+{
+    int i;
+    pluginCvarCallback_t* pcc = pluginFunctions.plugins[pID].cvarCallbacks;
+
+    for(i = 0; i < PLUGIN_MAX_CVARCALLBACKS; i++)
+    {
+        if(pcc[i].cvar == NULL)
+            break;
+    }
+    if(i == PLUGIN_MAX_CVARCALLBACKS)
+    {
+        Com_PrintError("Plugin_Cvar_AddChangeCallback: Exceeded limit of %d cvar callbacks for plugin ID: #%d\n", PLUGIN_MAX_CVARCALLBACKS, pID);
+        return qfalse;
+    }
+    if(!Cvar_AddChangeCallback(var, PHandler_CvarChanged, &pcc[i]))
+    {
+        return qfalse;
+    }
+    pcc[i].cvar = var;
+    pcc[i].callback = callback;
+    pcc[i].pID = pID;
+    return qtrue;
+}
+
+void PHandler_CvarRemoveChangeCallback(int pID, cvar_t* var, void (*callback)(convariable_t*))
+{
+    int i;
+    pluginCvarCallback_t* pcc = pluginFunctions.plugins[pID].cvarCallbacks;
+
+    for(i = 0; i < PLUGIN_MAX_CVARCALLBACKS; i++)
+    {
+        if(pcc[i].cvar == var && pcc[i].callback == callback)
+        {
+            Cvar_RemoveChangeCallback(var, PHandler_CvarChanged, &pcc[i]);
+            Com_Memset(&pcc[i], 0, sizeof(pluginCvarCallback_t));
+            return;
+        }
+    }
+}
+
+void PHandler_CvarRemoveAllChangeCallbacks(int pID)
+{
+    int i;
+    pluginCvarCallback_t* pcc = pluginFunctions.plugins[pID].cvarCallbacks;
+
+    for(i = 0; i < PLUGIN_MAX_CVARCALLBACKS; i++)
+    {
+        if(pcc[i].cvar != NULL)
+        {
+            Cvar_RemoveChangeCallback(pcc[i].cvar, PHandler_CvarChanged, &pcc[i]);
+            Com_Memset(&pcc[i], 0, sizeof(pluginCvarCallback_t));
+        }
+    }
+}
+
 /* 
 =====================================
  Functionality providers for exports
@@ -190,61 +266,177 @@ void PHandler_RemoveCommand(int pID,char *name)
 
 }
 
-void *PHandler_Malloc(int pID,size_t size)
+/*
+===========
+Plugin heap
+
+Every plugin allocates from its own heap. Blocks up to 2048 bytes including
+their header come from power of two size classes which are carved from 64 kB
+chunks and recycled through per class free lists. Bigger blocks are malloc'd
+and linked into a list. Alloc and free are O(1) and unloading a plugin
+releases whatever it still holds by freeing its chunks and big blocks.
+
+The header in front of each block names its owner and class, so freeing an
+unknown or already freed pointer gets detected instead of corrupting the heap.
+===========
+*/
+
+#define PLUGIN_BLOCK_MAGIC 0x504c4d41
+#define PLUGIN_BLOCK_FREED 0x46524545
+#define PLUGIN_BLOCK_LARGE 0xffff
+
+typedef struct{
+    unsigned int magic;
+    unsigned short sizeClass;
+    unsigned short pID;
+}pluginBlock_t;
+
+typedef struct pluginLargeBlock_s{
+    struct pluginLargeBlock_s *prev;
+    struct pluginLargeBlock_s *next;
+    size_t size;
+    size_t pad;                 // Keeps the user pointer 8 byte aligned
+    pluginBlock_t block;
+}pluginLargeBlock_t;
+
+typedef struct pluginChunk_s{
+    struct pluginChunk_s *next;
+    size_t pad;
+}pluginChunk_t;
+
+static void *PHandler_HeapCarve(pluginHeap_t *heap, int blockSize)
 {
-    int i;
-    Com_DPrintf("Attempting to allocate %dB of memory for plugin #%d...\n",size,pID);
-    //Plugin identified, find the first free spot in it's allocated pointers table
-    for(i=0;i<PLUGIN_MAX_MALLOCS;i++){
-        if(pluginFunctions.plugins[pID].memory[i].ptr==NULL){
-            pluginFunctions.plugins[pID].memory[i].ptr = malloc(size);
-            pluginFunctions.plugins[pID].memory[i].size = size;
-            pluginFunctions.plugins[pID].usedMem += size;
-            ++pluginFunctions.plugins[pID].mallocs;
-            Com_DPrintf("Allocating %dB of memory for plugin #%d.\n",size,pID);
-            return pluginFunctions.plugins[pID].memory[i].ptr;
+    pluginChunk_t *chunk;
+    byte *block;
+
+    if(heap->chunkEnd - heap->chunkPos < blockSize){
+        chunk = malloc(sizeof(pluginChunk_t) + PLUGIN_HEAP_CHUNKSIZE);
+        if(chunk == NULL)
+            return NULL;
+        chunk->next = heap->chunks;
+        heap->chunks = chunk;
+        heap->chunkPos = (byte*)(chunk + 1);
+        heap->chunkEnd = heap->chunkPos + PLUGIN_HEAP_CHUNKSIZE;
+    }
+    block = heap->chunkPos;
+    heap->chunkPos += blockSize;
+    return block;
+}
 
+void *PHandler_Malloc(int pID,size_t size)
+{
+    plugin_t *plugin = &pluginFunctions.plugins[pID];
+    pluginHeap_t *heap = &plugin->heap;
+    pluginBlock_t *block;
+    pluginLargeBlock_t *large;
+    size_t blockSize;
+    int sizeClass;
+
+    if(size + sizeof(pluginBlock_t) <= (16 << (PLUGIN_HEAP_CLASSES -1))){
+        for(sizeClass = 0, blockSize = 16; blockSize < size + sizeof(pluginBlock_t); sizeClass++)
+            blockSize <<= 1;
+
+        block = heap->freeList[sizeClass];
+        if(block != NULL)
+            heap->freeList[sizeClass] = *(void**)(block + 1);
+        else
+            block = PHandler_HeapCarve(heap, blockSize);
+    }else{
+        sizeClass = PLUGIN_BLOCK_LARGE;
+        blockSize = size + sizeof(pluginLargeBlock_t);
+        large = malloc(blockSize);
+        block = NULL;
+        if(large != NULL){
+            large->size = blockSize;
+            large->prev = NULL;
+            large->next = heap->largeBlocks;
+            if(large->next)
+                large->next->prev = large;
+            heap->largeBlocks = large;
+            block = &large->block;
         }
-
     }
-    Com_Printf("Plugins: Warning! Memory allocations limit reached for plugin #%d!\n",pID);
-    return NULL;
+    if(block == NULL){
+        Com_PrintWarning("Plugins: Out of memory allocating %d bytes for plugin #%d!\n", (int)size, pID);
+        return NULL;
+    }
+
+    block->magic = PLUGIN_BLOCK_MAGIC;
+    block->sizeClass = sizeClass;
+    block->pID = pID;
+
+    plugin->usedMem += blockSize;
+    ++plugin->mallocs;
+    ++heap->totalMallocs;
+    if(plugin->usedMem > heap->peakMem)
+        heap->peakMem = plugin->usedMem;
+
+    return block + 1;
 }
 void PHandler_Free(int pID, void *ptr)
 {
+    plugin_t *plugin = &pluginFunctions.plugins[pID];
+    pluginHeap_t *heap = &plugin->heap;
+    pluginBlock_t *block;
+    pluginLargeBlock_t *large;
 
-    int i;
     if(ptr==NULL){
         Com_DPrintf("Plugins: Warning! Plugin #%d tried freeing a NULL pointer! Called Plugin_Free() twice?\n",pID);
         return;
     }
-    //Plugin identified, find the first free spot in it's allocated pointers table
-    for(i=0;i<PLUGIN_MAX_MALLOCS;i++){
-        if(pluginFunctions.plugins[pID].memory[i].ptr==ptr){
-            free(ptr);
-            pluginFunctions.plugins[pID].memory[i].ptr = NULL;
-            pluginFunctions.plugins[pID].usedMem -= pluginFunctions.plugins[pID].memory[i].size;
-            --pluginFunctions.plugins[pID].mallocs;
-            return;
-        }
+    block = (pluginBlock_t*)ptr - 1;
+    if(block->magic != PLUGIN_BLOCK_MAGIC || block->pID != pID){
+        if(block->magic == PLUGIN_BLOCK_FREED)
+            Com_DPrintf("Plugins: Warning! Plugin %d tried freeing a pointer twice!\n",pID);
+        else
+            Com_DPrintf("Plugins: Warning! Plugin %d tried freeing an unknown pointer!\n",pID);
+        return;
     }
-    Com_DPrintf("Plugins: Warning! Plugin %d tried freeing an unknown pointer!\n",pID);
-
+    block->magic = PLUGIN_BLOCK_FREED;
+    --plugin->mallocs;
+
+    if(block->sizeClass == PLUGIN_BLOCK_LARGE){
+        large = (pluginLargeBlock_t*)((byte*)block - offsetof(pluginLargeBlock_t, block));
+        if(large->prev)
+            large->prev->next = large->next;
+        else
+            heap->largeBlocks = large->next;
+        if(large->next)
+            large->next->prev = large->prev;
+        plugin->usedMem -= large->size;
+        free(large);
+        return;
+    }
+    plugin->usedMem -= 16 << block->sizeClass;
+    *(void**)(block + 1) = heap->freeList[block->sizeClass];
+    heap->freeList[block->sizeClass] = block;
 }
 
 void PHandler_FreeAll(int pID)
 {
-    int i;
+    pluginHeap_t *heap;
+    pluginChunk_t *chunk;
+    pluginLargeBlock_t *large;
+
     if(pID<0){
         Com_Printf("Plugins: Error! Tried to free all memory of an unknown plugin!\n");
         return;
     }
-    for(i=0;i<PLUGIN_MAX_MALLOCS;++i){
-        if(pluginFunctions.plugins[pID].memory[i].ptr!=NULL){
-            free(pluginFunctions.plugins[pID].memory[i].ptr);
-            pluginFunctions.plugins[pID].memory[i].ptr=NULL;
-        }
+    heap = &pluginFunctions.plugins[pID].heap;
+    if(pluginFunctions.plugins[pID].mallocs > 0)
+        Com_DPrintf("Plugins: Plugin #%d left %d blocks allocated.\n", pID, pluginFunctions.plugins[pID].mallocs);
+
+    while(heap->chunks != NULL){
+        chunk = heap->chunks;
+        heap->chunks = chunk->next;
+        free(chunk);
+    }
+    while(heap->largeBlocks != NULL){
+        large = heap->largeBlocks;
+        heap->largeBlocks = large->next;
+        free(large);
     }
+    memset(heap, 0, sizeof(pluginHeap_t));
     pluginFunctions.plugins[pID].usedMem = 0;
     pluginFunctions.plugins[pID].mallocs = 0;
     Com_DPrintf("Plugins: Memory for plugin #%d has been freed.\n",pID);
@@ -347,13 +539,15 @@ void PHandler_PluginInfo_f()
 void PHandler_PluginList_f()
 {
     int i,j;
+    pluginHeap_t *heap;
+    float seconds;
     if(pluginFunctions.loadedPlugins == 0){
         Com_Printf("No plugins are loaded.\n");
     }
     else{
         Com_Printf("\nLoaded plugins:\n\n");
-        Com_Printf("*----------------------------------------------------------------------------------*\n");
-        Com_Printf("| ID |         name         | enabled? | memory allocations | total all. mem. in B |\n");
+        Com_Printf("*-----------------------------------------------------------------------------------------------*\n");
+        Com_Printf("| ID |         name         | enabled? | blocks  | memory in B | peak memory | allocs/sec |\n");
         for(i=0,j=0;i<pluginFunctions.loadedPlugins;++i,++j){
             while(j<MAX_PLUGINS){    // ORing might be dangerous when the compiler uses optimalization...
                 if(pluginFunctions.plugins[j].loaded)
@@ -364,11 +558,14 @@ void PHandler_PluginList_f()
                 i=j;
                 break;
             }
-            Com_Printf("| %-3d| %-21s| %-9s| %-19d| %-21d|\n",j,pluginFunctions.plugins[j].name,pluginFunctions.plugins[j].enabled==0 ? "no" : "yes",pluginFunctions.plugins[j].mallocs,pluginFunctions.plugins[j].usedMem);
+            heap = &pluginFunctions.plugins[j].heap;
+            seconds = (Sys_Milliseconds() - heap->loadTime) / 1000.0f;
+            Com_Printf("| %-3d| %-21s| %-9s| %-8d| %-12d| %-12d| %-11.1f|\n",j,pluginFunctions.plugins[j].name,pluginFunctions.plugins[j].enabled==0 ? "no" : "yes",
+                    pluginFunctions.plugins[j].mallocs,(int)pluginFunctions.plugins[j].usedMem,(int)heap->peakMem,seconds > 1.0f ? heap->totalMallocs / seconds : (float)heap->totalMallocs);
 
         }
         
-        Com_Printf("*----------------------------------------------------------------------------------*\n");
+        Com_Printf("*-----------------------------------------------------------------------------------------------*\n");
         Com_Printf("\nTotal of %d loaded plugins.\n",i);
     }
     
@@ -21,27 +21,49 @@
 */
 
 #include <string.h>
+#include <stdint.h>
 #include "q_shared.h"
 #include "qcommon_mem.h"
 #include "qcommon.h"
+#include "qcommon_io.h"
+#include "cvar.h"
+#include "sys_main.h"
 
 #ifdef COD4X17A
     #define MEM_SIZE 150 //Megabyte
 #else
     cvar_t* com_hunkMegs;
 #endif
+cvar_t* com_hunkHugePages;
 
+static void* mem_hunkBase;
+static unsigned int mem_hunkSize;
+static int mem_hunkHighWater;
 
+/*
+Returns memory aligned to align which has to be a power of two. The pointer
+malloc returned is stored right in front of the block for Mem_AlignedFree
+*/
 void* Mem_AlignedAlloc(unsigned int align, unsigned int size)
 {
     void* newmem;
+    void** alignedmem;
 
-    newmem = calloc(1, size + align);
+    newmem = calloc(1, size + align + sizeof(void*));
     if(newmem == NULL)
         return NULL;
 
-    return (void*)((unsigned int)newmem + ((unsigned int)newmem % align));
+    alignedmem = (void**)(((uintptr_t)newmem + sizeof(void*) + align -1) & ~(uintptr_t)(align -1));
+    alignedmem[-1] = newmem;
+    return alignedmem;
+}
+
+void Mem_AlignedFree(void* ptr)
+{
+    if(ptr == NULL)
+        return;
 
+    free(((void**)ptr)[-1]);
 }
 
 void Mem_Init()
@@ -55,14 +77,523 @@ void Mem_Init()
     com_hunkMegs = Cvar_RegisterInt("com_hunkMegs", 250, 150, 600, CVAR_LATCH, "Number of megabytes allocated for the hunk memory");
     sizeofmemory = 1024*1024 * (com_hunkMegs->integer);
 #endif
-    memory = Mem_AlignedAlloc(0x1000, sizeofmemory);
-    memset(memory, 0, sizeofmemory);
+    com_hunkHugePages = Cvar_RegisterBool("com_hunkHugePages", qfalse, CVAR_LATCH, "Back the hunk memory with huge pages where the operating system supports it");
+
+    /* The pages are zero and only use physical memory once they get touched */
+    memory = Sys_MemoryReserve(sizeofmemory, com_hunkHugePages->boolean);
+    if(memory == NULL)
+    {
+        Com_PrintWarning("Mem_Init: Couldn't reserve the hunk, falling back to allocate it\n");
+        memory = Mem_AlignedAlloc(0x1000, sizeofmemory);
+        if(memory == NULL)
+        {
+            Sys_OutOfMemError(__FILE__, __LINE__);
+        }
+    }
+    mem_hunkBase = memory;
+    mem_hunkSize = sizeofmemory;
+
     memset((void*)0x1407e7a0, 0, 0x21C);
     *(int**)(0x1407e7a0) = memory;
     *(int*)(0x1407e8b8) = sizeofmemory;
 
 }
 
+/*
+========================
+Mem_ReportHighWater
+
+The hunk gets committed lazily, so the pages which are resident are the most
+of it which got ever used. Printed after each level load to size com_hunkMegs
+========================
+*/
+void Mem_ReportHighWater( void )
+{
+    int resident;
+
+    if(mem_hunkBase == NULL)
+        return;
+
+    resident = Sys_MemoryResidentBytes(mem_hunkBase, mem_hunkSize);
+    if(resident < 0)
+        return;
+
+    if(resident > mem_hunkHighWater)
+        mem_hunkHighWater = resident;
+
+    Com_Printf("Hunk: %.1f MB of %d MB in use, high-water mark %.1f MB\n", (float)resident / (1024*1024),
+                mem_hunkSize / (1024*1024), (float)mem_hunkHighWater / (1024*1024));
+}
+
+void Mem_HunkUsage_f( void )
+{
+    if(mem_hunkBase == NULL)
+    {
+        Com_Printf("The hunk is not allocated\n");
+        return;
+    }
+    if(Sys_MemoryResidentBytes(mem_hunkBase, mem_hunkSize) < 0)
+    {
+        Com_Printf("Hunk: %d MB, the resident size is unknown on this system\n", mem_hunkSize / (1024*1024));
+        return;
+    }
+    Mem_ReportHighWater( );
+}
+
+
+/*
+==============================================================================
+
+ZONE MEMORY
+
+Small allocations are served from size-class slabs, so cvar strings, command
+nodes and event buffers which get allocated and freed all the time don't go
+through the system allocator. A slab is a 64 KB aligned block holding slots of
+one size, whatever memory is not found in a slab has come from malloc.
+Z_Free accepts any pointer which came from malloc as well, that's what the old
+Z_Free was and some callers still depend on it.
+
+Every allocation is accounted to a tag so the subsystem holding the memory can
+be found with "meminfo". The allocator is used from the main thread almost
+exclusively, a spinlock covers the few other callers.
+
+==============================================================================
+*/
+
+#define ZONE_SLAB_SHIFT 16
+#define ZONE_SLAB_SIZE (1 << ZONE_SLAB_SHIFT)
+#define ZONE_SLABS_PER_CHUNK 16
+#define ZONE_MAX_POOLED 1024
+#define ZONE_SLAB_HASH 1024
+#define ZONE_LARGE_HASH 4096
+
+typedef struct zoneSlab_s
+{
+    byte* base;
+    struct zoneSlab_s* next;            //Partial list of its class or the empty list
+    struct zoneSlab_s* prev;
+    struct zoneSlab_s* hashNext;
+    void* freeList;
+    int sizeClass;                      //-1 while the slab is on the empty list
+    int slotSize;
+    int numSlots;
+    int usedSlots;
+    int touchedSlots;                   //Slots beyond this were never handed out
+    byte tags[ZONE_SLAB_SIZE / 16];
+}zoneSlab_t;
+
+typedef struct zoneLarge_s
+{
+    void* ptr;
+    int size;
+    int tag;
+    struct zoneLarge_s* next;
+}zoneLarge_t;
+
+typedef struct
+{
+    int liveBytes;
+    int liveBlocks;
+    int peakBytes;
+    int levelBytes;
+    unsigned int allocs;
+}zoneTagStats_t;
+
+static const int zone_classSizes[] = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024 };
+#define ZONE_NUM_CLASSES (int)(sizeof(zone_classSizes) / sizeof(zone_classSizes[0]))
+
+static const char* zone_tagNames[TAG_COUNT] = { "general", "string", "cvar", "command", "event",
+                                                "filesystem", "network", "download", "script", "asset" };
+
+static struct
+{
+    qboolean initialized;
+    byte classForSize[ZONE_MAX_POOLED / 16 + 1];
+    zoneSlab_t* partial[ZONE_NUM_CLASSES];
+    zoneSlab_t* empty;
+    zoneSlab_t* slabHash[ZONE_SLAB_HASH];
+    zoneLarge_t* largeHash[ZONE_LARGE_HASH];
+    zoneTagStats_t tags[TAG_COUNT];
+    int numChunks;
+    int numSlabs[ZONE_NUM_CLASSES];
+    qboolean levelSnapshot;
+}zone;
+
+static volatile int zone_lock;
+
+static void Z_Lock( void )
+{
+    while(__sync_lock_test_and_set(&zone_lock, 1))
+        ;
+}
+
+static void Z_Unlock( void )
+{
+    __sync_lock_release(&zone_lock);
+}
+
+static void Z_InitPools( void )
+{
+    int i, c;
+
+    for(i = 0, c = 0; i <= ZONE_MAX_POOLED / 16; i++)
+    {
+        while(zone_classSizes[c] < i * 16)
+            c++;
+        zone.classForSize[i] = c;
+    }
+    zone.initialized = qtrue;
+}
+
+static unsigned int Z_SlabHash(const void* ptr)
+{
+    return ((uintptr_t)ptr >> ZONE_SLAB_SHIFT) & (ZONE_SLAB_HASH -1);
+}
+
+static zoneSlab_t* Z_FindSlab(const void* ptr)
+{
+    zoneSlab_t* slab;
+    byte* base = (byte*)((uintptr_t)ptr & ~(uintptr_t)(ZONE_SLAB_SIZE -1));
+
+    for(slab = zone.slabHash[Z_SlabHash(base)]; slab; slab = slab->hashNext)
+    {
+        if(slab->base == base)
+            return slab;
+    }
+    return NULL;
+}
+
+static void Z_ListRemove(zoneSlab_t** list, zoneSlab_t* slab)
+{
+    if(slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if(slab->next)
+        slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+static void Z_ListInsert(zoneSlab_t** list, zoneSlab_t* slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if(*list)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+/* Slabs get carved from chunks which are never handed back, empty slabs are
+   shared between all size classes instead */
+static qboolean Z_AllocChunk( void )
+{
+    byte* chunk;
+    zoneSlab_t* slab;
+    int i;
+
+    chunk = Mem_AlignedAlloc(ZONE_SLAB_SIZE, ZONE_SLABS_PER_CHUNK * ZONE_SLAB_SIZE);
+    if(chunk == NULL)
+        return qfalse;
+
+    for(i = 0; i < ZONE_SLABS_PER_CHUNK; i++)
+    {
+        slab = malloc(sizeof(zoneSlab_t));
+        if(slab == NULL)
+            return i > 0;
+        slab->base = chunk + i * ZONE_SLAB_SIZE;
+        slab->sizeClass = -1;
+        slab->hashNext = zone.slabHash[Z_SlabHash(slab->base)];
+        zone.slabHash[Z_SlabHash(slab->base)] = slab;
+        Z_ListInsert(&zone.empty, slab);
+    }
+    zone.numChunks++;
+    return qtrue;
+}
+
+static zoneSlab_t* Z_NewSlab(int sizeClass)
+{
+    zoneSlab_t* slab;
+
+    if(zone.empty == NULL && !Z_AllocChunk())
+        return NULL;
+
+    slab = zone.empty;
+    Z_ListRemove(&zone.empty, slab);
+    slab->sizeClass = sizeClass;
+    slab->slotSize = zone_classSizes[sizeClass];
+    slab->numSlots = ZONE_SLAB_SIZE / slab->slotSize;
+    slab->usedSlots = 0;
+    slab->touchedSlots = 0;
+    slab->freeList = NULL;
+    zone.numSlabs[sizeClass]++;
+    Z_ListInsert(&zone.partial[sizeClass], slab);
+    return slab;
+}
+
+static void* Z_PoolAlloc(int size, int tag)
+{
+    zoneSlab_t* slab;
+    void* ptr;
+    int slot, sizeClass;
+
+    sizeClass = zone.classForSize[(size + 15) >> 4];
+    slab = zone.partial[sizeClass];
+    if(slab == NULL)
+    {
+        slab = Z_NewSlab(sizeClass);
+        if(slab == NULL)
+            return NULL;
+    }
+
+    if(slab->freeList)
+    {
+        ptr = slab->freeList;
+        slab->freeList = *(void**)ptr;
+    }else{
+        ptr = slab->base + slab->touchedSlots * slab->slotSize;
+        slab->touchedSlots++;
+    }
+    slab->usedSlots++;
+    if(slab->usedSlots == slab->numSlots)
+        Z_ListRemove(&zone.partial[sizeClass], slab);
+
+    slot = ((byte*)ptr - slab->base) / slab->slotSize;
+    slab->tags[slot] = tag;
+    zone.tags[tag].liveBytes += slab->slotSize;
+    zone.tags[tag].liveBlocks++;
+    return ptr;
+}
+
+static void Z_PoolFree(zoneSlab_t* slab, void* ptr)
+{
+    int slot, sizeClass;
+    zoneTagStats_t* stats;
+
+    slot = ((byte*)ptr - slab->base) / slab->slotSize;
+    stats = &zone.tags[slab->tags[slot]];
+    stats->liveBytes -= slab->slotSize;
+    stats->liveBlocks--;
+
+    sizeClass = slab->sizeClass;
+    if(slab->usedSlots == slab->numSlots)
+        Z_ListInsert(&zone.partial[sizeClass], slab);
+
+    *(void**)ptr = slab->freeList;
+    slab->freeList = ptr;
+    slab->usedSlots--;
+
+    /* Keep one slab per class around so a single alloc/free pair doesn't
+       bounce a slab between the class and the empty list */
+    if(slab->usedSlots == 0 && (slab->next || slab->prev))
+    {
+        Z_ListRemove(&zone.partial[sizeClass], slab);
+        slab->sizeClass = -1;
+        zone.numSlabs[sizeClass]--;
+        Z_ListInsert(&zone.empty, slab);
+    }
+}
+
+static void Z_TrackLarge(void* ptr, int size, int tag)
+{
+    zoneLarge_t* node;
+    zoneLarge_t** link;
+    unsigned int hash = ((uintptr_t)ptr >> 4) & (ZONE_LARGE_HASH -1);
+
+    /* A block which got released with free() leaves its node behind, the
+       address showing up again means the old node is stale */
+    for(link = &zone.largeHash[hash]; *link; link = &(*link)->next)
+    {
+        if((*link)->ptr == ptr)
+        {
+            node = *link;
+            zone.tags[node->tag].liveBytes -= node->size;
+            zone.tags[node->tag].liveBlocks--;
+            *link = node->next;
+            free(node);
+            break;
+        }
+    }
+
+    node = malloc(sizeof(zoneLarge_t));
+    if(node == NULL)
+        return;
+    node->ptr = ptr;
+    node->size = size;
+    node->tag = tag;
+    node->next = zone.largeHash[hash];
+    zone.largeHash[hash] = node;
+    zone.tags[tag].liveBytes += size;
+    zone.tags[tag].liveBlocks++;
+}
+
+static void Z_UntrackLarge(void* ptr)
+{
+    zoneLarge_t* node;
+    zoneLarge_t** link;
+    unsigned int hash = ((uintptr_t)ptr >> 4) & (ZONE_LARGE_HASH -1);
+
+    for(link = &zone.largeHash[hash]; *link; link = &(*link)->next)
+    {
+        if((*link)->ptr == ptr)
+        {
+            node = *link;
+            zone.tags[node->tag].liveBytes -= node->size;
+            zone.tags[node->tag].liveBlocks--;
+            *link = node->next;
+            free(node);
+            return;
+        }
+    }
+}
+
+/*
+========================
+Z_TagMalloc
+
+Returns uninitialized memory, use Z_TagMallocZero or Z_Malloc where the
+caller depends on zeroed memory
+========================
+*/
+void* Z_TagMalloc(int size, memtag_t tag)
+{
+    void* ptr;
+    zoneTagStats_t* stats;
+
+    if(size < 0)
+        Com_Error(ERR_FATAL, "Z_TagMalloc: bad size %d", size);
+    if(tag < 0 || tag >= TAG_COUNT)
+        tag = TAG_GENERAL;
+
+    Z_Lock();
+    if(!zone.initialized)
+        Z_InitPools();
+
+    if(size <= ZONE_MAX_POOLED)
+    {
+        ptr = Z_PoolAlloc(size, tag);
+    }else{
+        ptr = malloc(size);
+        if(ptr)
+            Z_TrackLarge(ptr, size, tag);
+    }
+
+    if(ptr)
+    {
+        stats = &zone.tags[tag];
+        stats->allocs++;
+        if(stats->liveBytes > stats->peakBytes)
+            stats->peakBytes = stats->liveBytes;
+    }
+    Z_Unlock();
+
+    if(ptr == NULL)
+    {
+        Com_Error(ERR_FATAL, "System is out of memory!\n");
+        return NULL;
+    }
+    return ptr;
+}
+
+void* Z_TagMallocZero(int size, memtag_t tag)
+{
+    void* ptr = Z_TagMalloc(size, tag);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void* Z_Malloc(int size)
+{
+    return Z_TagMallocZero(size, TAG_GENERAL);
+}
+
+void Z_Free(void* ptr)
+{
+    zoneSlab_t* slab;
+
+    if(ptr == NULL)
+        return;
+
+    Z_Lock();
+    slab = zone.initialized ? Z_FindSlab(ptr) : NULL;
+    if(slab && slab->sizeClass >= 0)
+    {
+        Z_PoolFree(slab, ptr);
+        Z_Unlock();
+        return;
+    }
+    if(zone.initialized)
+        Z_UntrackLarge(ptr);
+    Z_Unlock();
+    free(ptr);
+}
+
+/*
+========================
+Z_LevelReport
+
+Called after each level load. A tag which holds more memory than it held at
+the previous level load is likely leaking, compared after the level is up so
+the numbers of both levels include the same kind of allocations
+========================
+*/
+void Z_LevelReport( void )
+{
+    int i, growth;
+    qboolean header = qfalse;
+
+    Z_Lock();
+    for(i = 0; i < TAG_COUNT; i++)
+    {
+        growth = zone.tags[i].liveBytes - zone.tags[i].levelBytes;
+        zone.tags[i].levelBytes = zone.tags[i].liveBytes;
+
+        if(!zone.levelSnapshot || growth <= 0)
+            continue;
+        if(!header)
+        {
+            Com_DPrintf("Zone memory grown since the previous level:\n");
+            header = qtrue;
+        }
+        Com_DPrintf("  %-10s +%d bytes, %d bytes in %d blocks\n", zone_tagNames[i], growth,
+                    zone.tags[i].liveBytes, zone.tags[i].liveBlocks);
+    }
+    zone.levelSnapshot = qtrue;
+    Z_Unlock();
+}
+
+void Z_MemInfo_f( void )
+{
+    int i, total, slabs, used, reserved;
+    zoneSlab_t* slab;
+    zoneTagStats_t stats[TAG_COUNT];
+
+    Z_Lock();
+    memcpy(stats, zone.tags, sizeof(stats));
+    reserved = zone.numChunks * ZONE_SLABS_PER_CHUNK * ZONE_SLAB_SIZE;
+    for(i = 0, slabs = 0; i < ZONE_NUM_CLASSES; i++)
+        slabs += zone.numSlabs[i];
+    for(i = 0, used = 0; i < ZONE_SLAB_HASH; i++)
+    {
+        for(slab = zone.slabHash[i]; slab; slab = slab->hashNext)
+        {
+            if(slab->sizeClass >= 0)
+                used += slab->usedSlots * slab->slotSize;
+        }
+    }
+    Z_Unlock();
+
+    Com_Printf("tag         live bytes   blocks   peak bytes   level delta   allocs\n");
+    Com_Printf("----------  ----------  -------  -----------  ------------  --------\n");
+    for(i = 0, total = 0; i < TAG_COUNT; i++)
+    {
+        Com_Printf("%-10s  %10d  %7d  %11d  %+12d  %8u\n", zone_tagNames[i], stats[i].liveBytes, stats[i].liveBlocks,
+                    stats[i].peakBytes, stats[i].liveBytes - stats[i].levelBytes, stats[i].allocs);
+        total += stats[i].liveBytes;
+    }
+    Com_Printf("%d bytes in use, %d KB in %d slabs of %d KB reserved for the pools (%d bytes used)\n",
+                total, slabs * ZONE_SLAB_SIZE / 1024, slabs, reserved / 1024, used);
+}
+
 
 /*
 ========================
@@ -72,32 +603,21 @@ CopyString
 		memory from a memstatic_t might be returned
 ========================
 */
-char *CopyString( const char *in ) {
+char *CopyStringTag( const char *in, memtag_t tag ) {
 	char    *out;
+	int     len;
 
-/*	if ( !in[0] )
-		return "";
-*/
-	out = Z_Malloc( strlen( in ) + 1 );
-	strcpy( out, in );
+	len = strlen( in ) + 1;
+	out = Z_TagMalloc( len, tag );
+	memcpy( out, in, len );
 	return out;
 }
 
-void __cdecl Sys_OutOfMemError(const char* filename, int line)
-{
-	Com_Error(ERR_FATAL, "System is out of memory! Filename: %s, Line: %d\n", filename, line);
+char *CopyString( const char *in ) {
+	return CopyStringTag( in, TAG_STRING );
 }
 
-void* Z_Malloc(int size)
+void __cdecl Sys_OutOfMemError(const char* filename, int line)
 {
-	void *allocmem;
-	allocmem = malloc(size);
-	if(!allocmem)
-	{
-		Com_Error(ERR_FATAL, "System is out of memory!\n");
-		return NULL;
-	}
-	memset(allocmem, 0, size);
-	return allocmem;
+	Com_Error(ERR_FATAL, "System is out of memory! Filename: %s, Line: %d\n", filename, line);
 }
-
@@ -28,6 +28,21 @@
 #include <stdlib.h>
 #include "q_shared.h"
 
+typedef enum
+{
+	TAG_GENERAL,
+	TAG_STRING,
+	TAG_CVAR,
+	TAG_COMMAND,
+	TAG_EVENT,
+	TAG_FILESYSTEM,
+	TAG_NETWORK,
+	TAG_DOWNLOAD,
+	TAG_SCRIPT,
+	TAG_ASSET,
+	TAG_COUNT
+}memtag_t;
+
 void __cdecl Com_InitHunkMemory(void);
 void __cdecl Hunk_InitDebugMemory(void);
 void __cdecl Hunk_ClearTempMemory(void);
@@ -35,14 +50,23 @@ void __cdecl Hunk_ClearTempMemoryHigh(void);
 void* __cdecl Hunk_AllocateTempMemory(int size);
 void __cdecl Hunk_FreeTempMemory(void *buffer);
 void* __cdecl Z_Malloc( int size);
+void* Z_TagMalloc( int size, memtag_t tag );
+void* Z_TagMallocZero( int size, memtag_t tag );
+void Z_Free( void* ptr );
+void Z_LevelReport( void );
+void Z_MemInfo_f( void );
 void __cdecl Mem_Init(void);
+void* Mem_AlignedAlloc(unsigned int align, unsigned int size);
+void Mem_AlignedFree(void* ptr);
+void Mem_ReportHighWater(void);
+void Mem_HunkUsage_f(void);
 void __cdecl Mem_BeginAlloc(const char*, qboolean);
 void __cdecl Mem_EndAlloc(const char*, int);
 void* __cdecl TempMalloc( int );
 char *CopyString( const char *in );
+char *CopyStringTag( const char *in, memtag_t tag );
 void __cdecl PMem_Free(const char*, unsigned int);
 void __cdecl Sys_OutOfMemError(const char* filename, int line);
-#define Z_Free free
 #define S_Malloc Z_Malloc
 
 #endif
@@ -0,0 +1,66 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+    Copyright (C) 1999-2005 Id Software, Inc.
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+#ifndef __QCOMMON_PROFILE_H__
+#define __QCOMMON_PROFILE_H__
+
+#include "q_shared.h"
+
+/*
+ Phases of one server frame that are timed by the frame profiler.
+ Keep in sync with prof_phaseNames in common_profile.c
+*/
+typedef enum{
+	PROF_FRAME,				// the whole Com_Frame() which ran a server frame
+	PROF_CBUF,				// Cbuf_Execute() calls of Com_Frame
+	PROF_EVENTLOOP,			// Com_EventLoop()
+	PROF_PACKETS,			// inbound UDP packets. Overlaps the phase which received them
+	PROF_GAME,				// G_RunFrame()
+	PROF_SNAPSHOTS,			// SV_SendClientMessages()
+	PROF_PINGS,				// SV_CalcPings()
+	PROF_TIMEOUTS,			// SV_CheckTimeouts()
+	PROF_HEARTBEAT,			// SV_MasterHeartbeat()
+	PROF_PUNKBUSTER,		// PbServerProcessEvents()
+	PROF_PLUGINFRAME,		// PLUGINS_ONFRAME event
+	PROF_TIMEDEVENTS,		// Com_TimedEventLoop()
+	PROF_NETPOLL,			// NET_Sleep(0) after the server frame
+	PROF_TCPEVENTS,			// NET_TcpServerPacketEventLoop()
+	PROF_THREADCALLBACKS,	// Sys_RunThreadCallbacks()
+	PROF_NUM_PHASES
+}profPhase_t;
+
+void Prof_Init( void );
+unsigned long long Prof_Begin( void );
+void Prof_End( profPhase_t phase, unsigned long long start );
+void Prof_EndFrame( unsigned long long start );
+void Prof_EndIdleFrame( void );
+void Prof_CountPacketIn( int length );
+void Prof_CountPacketOut( int length );
+void Prof_LogCommand( const char* text );
+void Prof_PrintReport( void );
+void Prof_Reset( void );
+void Prof_PrintSlowFrames( void );
+
+#endif
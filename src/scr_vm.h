@@ -407,6 +407,7 @@ void __cdecl Scr_AddArray( void );
 void __cdecl Scr_MakeArray( void );
 void __cdecl Scr_Notify( gentity_t*, unsigned short, unsigned int);
 void __cdecl Scr_NotifyNum( int, unsigned int, unsigned int, unsigned int);
+void Scr_NotifyLevel(int constString, unsigned int numArgs);
 /*Not working :(  */
 void __cdecl Scr_PrintPrevCodePos( int printDest, const char* unk, qboolean unk2 );
 int __cdecl Scr_GetFunctionHandle( const char* scriptName, const char* labelName);
@@ -495,6 +496,8 @@ int Scr_FS_Read( void *buffer, int len, fileHandle_t f );
 int Scr_FS_Write( const void *buffer, int len, fileHandle_t h );
 int Scr_FS_Seek( fileHandle_t f, long offset, int origin );
 qboolean Scr_FileExists( const char* filename );
+int Scr_FS_ReadFileAsync( const char* qpath, int entnum );
+int Scr_FS_WriteFileAsync( const char* qpath, fsMode_t mode, char* data, int len, int entnum );
 
 void GScr_MakeCvarServerInfo(void);
 void GScr_SetCvar();
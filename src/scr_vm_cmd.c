@@ -26,6 +26,7 @@
 #include "qcommon_io.h"
 #include "qcommon_mem.h"
 #include "scr_vm.h"
+#include "scr_vm_profile.h"
 
 #include <string.h>
 
@@ -53,7 +54,7 @@ qboolean Scr_AddFunction( const char *cmd_name, xfunction_t function, qboolean d
 	}
 
 	// use a small malloc to avoid zone fragmentation
-	cmd = Z_Malloc( sizeof( scr_function_t ) + strlen(cmd_name) + 1);
+	cmd = Z_TagMallocZero( sizeof( scr_function_t ) + strlen(cmd_name) + 1, TAG_SCRIPT );
 	strcpy((char*)(cmd +1), cmd_name);
 	cmd->name = (char*)(cmd +1);
 	cmd->function = function;
@@ -129,7 +130,7 @@ __cdecl void* Scr_GetFunction( const char** v_functionName, qboolean* v_develope
 		{
 			*v_developer = cmd->developer;
 			*v_functionName = cmd->name;
-			return cmd->function;
+			return Scr_ProfWrapFunction(cmd->name, cmd->function, qfalse);
 		}
 	}
 	return NULL;
@@ -156,7 +157,7 @@ qboolean Scr_AddMethod( const char *cmd_name, xfunction_t function, qboolean dev
 	}
 
 	// use a small malloc to avoid zone fragmentation
-	cmd = Z_Malloc( sizeof( scr_function_t ) + strlen(cmd_name) + 1);
+	cmd = Z_TagMallocZero( sizeof( scr_function_t ) + strlen(cmd_name) + 1, TAG_SCRIPT );
 	strcpy((char*)(cmd +1), cmd_name);
 	cmd->name = (char*)(cmd +1);
 	cmd->function = function;
@@ -231,7 +232,7 @@ __cdecl void* Scr_GetMethod( const char** v_functionName, qboolean* v_developer
 		{
 			*v_developer = cmd->developer;
 			*v_functionName = cmd->name;
-			return cmd->function;
+			return Scr_ProfWrapFunction(cmd->name, cmd->function, qtrue);
 		}
 	}
 	return NULL;
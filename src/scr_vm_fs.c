@@ -26,6 +26,10 @@
 #include "filesystem.h"
 #include "scr_vm.h"
 #include "cvar.h"
+#include "server.h"
+#include "misc.h"
+#include "sys_thread.h"
+#include "qcommon_mem.h"
 
 #include <string.h>
 
@@ -462,4 +466,224 @@ int Scr_FS_Seek( fileHandle_t f, long offset, int origin ) {
 
 
 
+/*
+========================================================================================
+
+Asynchronous file calls
+
+A file is read or written as a whole on a worker thread so the game frame never
+waits for the disk. The result is delivered as notify on level or on the entity
+which started the request. Requests for the same file run in the order they were
+made.
+
+========================================================================================
+*/
+
+#define MAX_SCRIPT_ASYNCFILES		32
+#define MAX_SCRIPT_ASYNCFILESIZE	(1024*1024)
+
+typedef struct{
+	int id;
+	int entnum;			//-1 notifies level
+	int serverid;		//Results of a previous level are thrown away
+	fsMode_t mode;
+	char filename[MAX_QPATH];
+	char ospath[2][MAX_OSPATH];	//fs_homepath and fs_basepath. Second one is empty if both are equal
+	char* data;
+	int len;
+	qboolean success;
+	job_t* job;
+}scr_asyncFile_t;
+
+static scr_asyncFile_t* scr_asyncFiles[MAX_SCRIPT_ASYNCFILES];
+static int scr_asyncFileNextId;
+
+static void Scr_FS_AsyncReadJob( void* arg ) {
+	scr_asyncFile_t* req = arg;
+	FILE* fh = NULL;
+	int i;
+
+	for(i = 0; i < 2 && fh == NULL; i++){
+		if(req->ospath[i][0])
+			fh = fopen(req->ospath[i], "rb");
+	}
+	if(fh == NULL)
+		return;
+
+	fseek(fh, 0, SEEK_END);
+	req->len = ftell(fh);
+	fseek(fh, 0, SEEK_SET);
+
+	if(req->len < 0 || req->len > MAX_SCRIPT_ASYNCFILESIZE){
+		fclose(fh);
+		return;
+	}
+	req->data = Z_TagMalloc(req->len + 1, TAG_SCRIPT);
+	if(fread(req->data, 1, req->len, fh) == req->len){
+		req->data[req->len] = '\0';
+		req->success = qtrue;
+	}
+	fclose(fh);
+}
+
+static void Scr_FS_AsyncWriteJob( void* arg ) {
+	scr_asyncFile_t* req = arg;
+	FILE* fh = NULL;
+	int i;
+
+	for(i = 0; i < 2 && fh == NULL; i++){
+		if(req->ospath[i][0] && !FS_CreatePath(req->ospath[i]))
+			fh = fopen(req->ospath[i], req->mode == FS_APPEND ? "ab" : "wb");
+	}
+	if(fh == NULL)
+		return;
+
+	if(fwrite(req->data, 1, req->len, fh) == req->len)
+		req->success = qtrue;
+
+	if(fclose(fh) != 0)
+		req->success = qfalse;
+}
+
+/*
+Pushes the lines of the read file as array. \r\n and \n line endings are both accepted
+*/
+static void Scr_FS_AddLineArray( char* data ) {
+	char* line;
+	char* end;
+
+	Scr_MakeArray();
+
+	line = data;
+	while(*line){
+		end = strchr(line, '\n');
+		if(end){
+			*end = '\0';
+			if(end > line && end[-1] == '\r')
+				end[-1] = '\0';
+		}
+
+		Scr_AddString(line);
+		Scr_AddArray();
+
+		if(end == NULL)
+			break;
+		line = end + 1;
+	}
+}
+
+static void Scr_FS_AsyncDone( void* arg ) {
+	scr_asyncFile_t* req = arg;
+	gentity_t* ent = NULL;
+	int i, constString;
+
+	for(i = 0; i < MAX_SCRIPT_ASYNCFILES; i++){
+		if(scr_asyncFiles[i] == req)
+			scr_asyncFiles[i] = NULL;
+	}
 
+	if(sv.state != SS_GAME || req->serverid != sv_serverid->integer){
+		Com_DPrintf("Scr_FS_AsyncDone: Level has changed, dropping result for %s\n", req->filename);
+		Z_Free(req->data);
+		Z_Free(req);
+		return;
+	}
+	if(req->entnum >= 0){
+		ent = &g_entities[req->entnum];
+		if(!ent->inuse){
+			Z_Free(req->data);
+			Z_Free(req);
+			return;
+		}
+	}
+
+	if(req->mode == FS_READ){
+		if(req->success)
+			Scr_FS_AddLineArray(req->data);
+		else
+			Scr_AddUndefined();
+		constString = Scr_AllocString("fs_readdone");
+	}else{
+		Scr_AddBool(req->success);
+		constString = Scr_AllocString("fs_writedone");
+	}
+	Scr_AddInt(req->id);
+
+	if(ent)
+		Scr_Notify(ent, constString, 2);
+	else
+		Scr_NotifyLevel(constString, 2);
+
+	SL_RemoveRefToString(constString);
+
+	Z_Free(req->data);
+	Z_Free(req);
+}
+
+/*
+=================
+Scr_FS_AsyncFile
+
+Takes ownership of data. Returns the request id or 0 if the request could not be started
+=================
+*/
+static int Scr_FS_AsyncFile( const char* qpath, fsMode_t mode, char* data, int len, int entnum ) {
+	scr_asyncFile_t* req;
+	scr_asyncFile_t* previous = NULL;
+	int i, slot = -1;
+
+	if ( !FS_Initialized() ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	for(i = 0; i < MAX_SCRIPT_ASYNCFILES; i++){
+		if(scr_asyncFiles[i] == NULL){
+			if(slot == -1)
+				slot = i;
+			continue;
+		}
+		//The newest request for this file, ours has to wait for it
+		if(!Q_stricmp(scr_asyncFiles[i]->filename, qpath) && (previous == NULL || scr_asyncFiles[i]->id > previous->id))
+			previous = scr_asyncFiles[i];
+	}
+	if(slot == -1){
+		Com_PrintScriptRuntimeWarning("Scr_FS_AsyncFile: Too many pending file requests\n");
+		Z_Free(data);
+		return 0;
+	}
+
+	req = Z_TagMallocZero(sizeof(scr_asyncFile_t), TAG_SCRIPT);
+	req->id = ++scr_asyncFileNextId;
+	req->entnum = entnum;
+	req->serverid = sv_serverid->integer;
+	req->mode = mode;
+	req->data = data;
+	req->len = len;
+	Q_strncpyz(req->filename, qpath, sizeof(req->filename));
+
+	FS_BuildOSPathForThread( fs_homepath->string, "", qpath, req->ospath[0], 0);
+	if (Q_stricmp(fs_homepath->string, fs_basepath->string))
+		FS_BuildOSPathForThread( fs_basepath->string, "", qpath, req->ospath[1], 0);
+
+	req->job = Sys_JobCreate(mode == FS_READ ? Scr_FS_AsyncReadJob : Scr_FS_AsyncWriteJob, Scr_FS_AsyncDone, req);
+	if(req->job == NULL){
+		Z_Free(req->data);
+		Z_Free(req);
+		return 0;
+	}
+	//Every request is chained to the newest one, so no job ever gets more than one dependent
+	if(previous)
+		Sys_JobDepend(req->job, previous->job);
+
+	scr_asyncFiles[slot] = req;
+	Sys_JobSubmit(req->job);
+	return req->id;
+}
+
+int Scr_FS_ReadFileAsync( const char* qpath, int entnum ) {
+	return Scr_FS_AsyncFile(qpath, FS_READ, NULL, 0, entnum);
+}
+
+int Scr_FS_WriteFileAsync( const char* qpath, fsMode_t mode, char* data, int len, int entnum ) {
+	return Scr_FS_AsyncFile(qpath, mode, data, len, entnum);
+}
@@ -35,6 +35,8 @@
 #include "misc.h"
 #include "sha256.h"
 #include "sv_auth.h"
+#include "qcommon_mem.h"
+#include "varstorage.h"
 
 #include <string.h>
 #include <time.h>
@@ -589,211 +591,222 @@ void PlayerCmd_GetGeoLocation(scr_entref_t arg){
 
 /*
 ============
-GScr_StrTokByPixLen
+Glyph widths
 
-Returns an array of the string that got sperated in tokens.
-It will count the width of given string and will tokenize it so that it will never exceed the given limit.
-This function tries to separate the string so that words remains complete
-Usage: array = StrTokByPixLen(string <string>, codPixelCount <float>);
+Width of every character of the default HUD font in half pixels at fontsize 2.5.
+Color codes are not printed and have no width. A UTF-8 sequence counts as one glyph
+with the width of its first byte.
 ============
 */
 
 #define MAX_LINEBREAKS 32
+#define GLYPH_DEFAULT_HALFWIDTH 12
+
+typedef struct{
+    byte halfWidth;
+    const char* glyphs;
+}glyphWidthGroup_t;
+
+static const glyphWidthGroup_t scr_defaultFontGroups[] = {
+    { 2, "'" },
+    { 4, "ijl.,:;_%" },
+    { 5, "fI-|" },
+    { 6, "tr!/\\\"" },
+    { 7, "()[]" },
+    { 8, "T{}*" },
+    { 9, "acgksvxzFJLYZ" },
+    { 10, " dhnAPSVX?" },
+    { 11, "BDGKOQRU0123456789$<>=+^~" },
+    { 12, "HN#" },
+    { 13, "w&" },
+    { 14, "WM@" },
+    { 15, "m" },
+    { 0, NULL }
+};
+
+static byte scr_defaultFontWidths[256];
+
+static const byte* Scr_GetFontWidths( ){
+    const glyphWidthGroup_t* group;
+    const char* c;
+
+    if(scr_defaultFontWidths['a'] == 0){
+        memset(scr_defaultFontWidths, GLYPH_DEFAULT_HALFWIDTH, sizeof(scr_defaultFontWidths));
+        for(group = scr_defaultFontGroups; group->glyphs; group++){
+            for(c = group->glyphs; *c; c++)
+                scr_defaultFontWidths[(byte)*c] = group->halfWidth;
+        }
+    }
+    return scr_defaultFontWidths;
+}
 
-void GScr_StrTokByPixLen(){
+static qboolean Scr_IsColorCode( const char* s ){
+    return s[0] == '^' && s[1] >= '0' && s[1] <= '9';
+}
 
-    char buffer[2048];
-    char *string = buffer;
+/*
+Number of bytes of the glyph at s. Broken UTF-8 sequences are taken byte by byte
+*/
+static int Scr_GlyphLen( const char* s ){
+    const byte* u = (const byte*)s;
+    int len, i;
+
+    if(u[0] < 0xC0)
+        return 1;
+    else if(u[0] < 0xE0)
+        len = 2;
+    else if(u[0] < 0xF0)
+        len = 3;
+    else if(u[0] < 0xF8)
+        len = 4;
+    else
+        return 1;
 
-    if(Scr_GetNumParam() != 2){
-        Scr_Error("Usage: StrTokByPixLen(<string>, <float>)");
+    for(i = 1; i < len; i++){
+        if((u[i] & 0xC0) != 0x80)
+            return 1;
     }
-    char* src = Scr_GetString(0);
-    if(!src)
-        return;
-    else
-        Q_strncpyz(buffer, src, sizeof(buffer));
+    return len;
+}
+
+static int Scr_StringHalfPixels( const char* s ){
+    const byte* widths = Scr_GetFontWidths();
+    int halfPixels = 0;
+
+    while(*s){
+        if(Scr_IsColorCode(s)){
+            s += 2;
+            continue;
+        }
+        halfPixels += widths[(byte)*s];
+        s += Scr_GlyphLen(s);
+    }
+    return halfPixels;
+}
 
-    char* countstring = string;
-    char* lastWordSpace = string;
 
-    int lineBreakIndex = 0;
+typedef struct{
+    const byte* widths;     //NULL counts glyphs instead of their width
+    int limit;
+    int minBreak;           //A line only gets broken at a space behind this width. Otherwise the word gets cut
+    qboolean carryColor;    //Every line begins with the last color code of the line before
+}scrWrap_t;
 
-    int lWSHalfPixelCounter = 0;
-    int halfPixelCounter = 0;
+static void Scr_AddWrappedLine( const char* start, const char* end, char color ){
+    char line[MAX_STRING_CHARS];
+    int len, pos = 0;
 
-    int maxHalfPixel = 2.0 * Scr_GetFloat(1);
+    if(color){
+        line[pos++] = '^';
+        line[pos++] = color;
+    }
+    len = end - start;
+    if(len > sizeof(line) - pos - 1)
+        len = sizeof(line) - pos - 1;
 
-    Scr_MakeArray();
+    memcpy(&line[pos], start, len);
+    line[pos + len] = '\0';
 
-    while( *countstring ){
-        switch(*countstring){
-
-        case '\'':
-            halfPixelCounter += 2;
-        break;
-
-        case 'i':
-        case 'j':
-        case 'l':
-        case '.':
-        case ',':
-        case ':':
-        case ';':
-        case '_':
-        case '%':
-            halfPixelCounter += 4;
-        break;
-
-        case 'f':
-        case 'I':
-        case '-':
-        case '|':
-            halfPixelCounter += 5;
-        break;
-
-        case 't':
-        case 'r':
-        case '!':
-        case '/':
-        case '\\':
-        case '"':
-            halfPixelCounter += 6;
-        break;
-
-        case '(':
-        case ')':
-        case '[':
-        case ']':
-            halfPixelCounter += 7;
-        break;
-
-        case 'T':
-        case '{':
-        case '}':
-        case '*':
-            halfPixelCounter += 8;
-        break;
-
-        case 'a':
-        case 'c':
-        case 'g':
-        case 'k':
-        case 's':
-        case 'v':
-        case 'x':
-        case 'z':
-        case 'F':
-        case 'J':
-        case 'L':
-        case 'Y':
-        case 'Z':
-            halfPixelCounter += 9;
-        break;
-
-        case ' ': /*Save the positions of the last recent wordspacer*/
-            lWSHalfPixelCounter = halfPixelCounter;
-            lastWordSpace = countstring;
-        case 'd':
-        case 'h':
-        case 'n':
-        case 'A':
-        case 'P':
-        case 'S':
-        case 'V':
-        case 'X':
-        case '?':
-            halfPixelCounter += 10;
-        break;
-
-        case 'B':
-        case 'D':
-        case 'G':
-        case 'K':
-        case 'O':
-        case 'Q':
-        case 'R':
-        case 'U':
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-        case '$':
-        case '<':
-        case '>':
-        case '=':
-        case '+':
-        case '^':
-        case '~':
-            halfPixelCounter += 11;
-        break;
-
-        case 'H':
-        case 'N':
-        case '#':
-            halfPixelCounter += 12;
-        break;
-
-        case 'w':
-        case '&':
-            halfPixelCounter += 13;
-        break;
-
-        case 'W':
-        case 'M':
-        case '@':
-            halfPixelCounter += 14;
-        break;
-
-        case 'm':
-            halfPixelCounter += 15;
+    Scr_AddString(line);
+    Scr_AddArray();
+}
 
-        default:
-            halfPixelCounter += 12;
+/*
+============
+Scr_AddWrappedLines
+
+Splits the string into lines which do not exceed wrap->limit and adds them to the array on top of the stack.
+Words remain complete where possible. Color codes and UTF-8 sequences never get split.
+After MAX_LINEBREAKS lines the rest is cut off
+============
+*/
+
+static void Scr_AddWrappedLines( const char* string, const scrWrap_t* wrap ){
+    const char *start, *s, *space;
+    int width, spaceWidth, glyphWidth, lines;
+    char color, spaceColor, lineColor;
+
+    lineColor = color = spaceColor = '7';
+    start = s = string;
+    space = NULL;
+    width = spaceWidth = 0;
+    lines = 0;
+
+    while(*s){
+
+        if(Scr_IsColorCode(s)){
+            color = s[1];
+            s += 2;
+            continue;
         }
 
-        if(halfPixelCounter >= maxHalfPixel){
-            if(lineBreakIndex >= MAX_LINEBREAKS){
-                break; //Cut here - no overrun
+        glyphWidth = wrap->widths ? wrap->widths[(byte)*s] : 1;
+
+        if(width + glyphWidth > wrap->limit && width > 0){
+
+            if(lines >= MAX_LINEBREAKS){
+                break;
             }
-            if(lWSHalfPixelCounter >= maxHalfPixel / 3){ //we have a space between words inside the upper half string length
-                *lastWordSpace = 0;			//terminate it
-                Scr_AddString(string);	//setting the beginning of string in our array
-                Scr_AddArray();
-
-                string = &lastWordSpace[1];
-                countstring = &lastWordSpace[1];
-                lWSHalfPixelCounter = 0;
-                halfPixelCounter = 0;
-
-            }else{ 					//we couln't find a space inside the upper half string length
-                *countstring = 0;			//Mhh it is complicated to seperate the complete string here. We will just thrash one character
-                Scr_AddString(string);
-                Scr_AddArray();
-
-                string = &countstring[1];
-                countstring = &countstring[1];
-                lWSHalfPixelCounter = 0;
-                halfPixelCounter = 0;
+            if(space && spaceWidth >= wrap->minBreak){
+                //Break at the last space which gets dropped
+                Scr_AddWrappedLine(start, space, wrap->carryColor ? lineColor : 0);
+                start = s = space + 1;
+                color = spaceColor;
+            }else{
+                Scr_AddWrappedLine(start, s, wrap->carryColor ? lineColor : 0);
+                start = s;
             }
-            lineBreakIndex++;
-        }else{
-            countstring++;
+            lineColor = color;
+            space = NULL;
+            width = spaceWidth = 0;
+            lines++;
+            continue;
+        }
+
+        if(*s == ' '){
+            space = s;
+            spaceWidth = width;
+            spaceColor = color;
         }
+        width += glyphWidth;
+        s += Scr_GlyphLen(s);
     }
-    if(*string){
-        Scr_AddString(string);
-        Scr_AddArray();
+
+    if(s > start){
+        Scr_AddWrappedLine(start, s, wrap->carryColor ? lineColor : 0);
     }
 }
 
 
+/*
+============
+GScr_StrTokByPixLen
+
+Returns an array of the string that got sperated in tokens.
+It will count the width of given string and will tokenize it so that it will never exceed the given limit.
+This function tries to separate the string so that words remains complete
+Usage: array = StrTokByPixLen(string <string>, codPixelCount <float>);
+============
+*/
+
+void GScr_StrTokByPixLen(){
+    scrWrap_t wrap;
+
+    if(Scr_GetNumParam() != 2){
+        Scr_Error("Usage: StrTokByPixLen(<string>, <float>)");
+    }
+    char* string = Scr_GetString(0);
+
+    wrap.widths = Scr_GetFontWidths();
+    wrap.limit = 2.0 * Scr_GetFloat(1);
+    wrap.minBreak = wrap.limit / 3;
+    wrap.carryColor = qfalse;
+
+    Scr_MakeArray();
+    Scr_AddWrappedLines(string, &wrap);
+}
+
+
 
 /*
 ============
@@ -807,270 +820,203 @@ Usage: array = StrTokByLen(string <string>, maxcharacter count <int>);
 */
 
 void GScr_StrTokByLen(){
-
-    char buffer[2048];
-    unsigned char lastColor = '7';
-    char *outputstr = buffer;
+    scrWrap_t wrap;
 
     if(Scr_GetNumParam() != 2){
         Scr_Error("Usage: StrTokByLen(<string>, <int>)");
     }
-    char* src = Scr_GetString(0);
-
-    char* inputstr = src;
+    char* string = Scr_GetString(0);
 
-    int lineBreakIndex = 0;
-    int i = 0;
-    int j = 0;
-    int overflowcnt = 2;
-    int lSCounter = 0;
-    int lSCounterReal = 0;
-    int limit = Scr_GetInt(1);
+    wrap.widths = NULL;
+    wrap.limit = Scr_GetInt(1);
+    wrap.minBreak = wrap.limit / 2;
+    wrap.carryColor = qtrue;
 
     Scr_MakeArray();
-    outputstr[0] = '^';
-    outputstr[1] = lastColor;
-    outputstr[2] = 0;
+    Scr_AddWrappedLines(string, &wrap);
+}
 
 
-    while( inputstr[i]){
 
-        if(overflowcnt >= (sizeof(buffer) -4)){
-            outputstr[i] = 0;
-            outputstr[i+1] = 0;
-            outputstr[i+2] = 0;
-            break;
-        }
+/*
+============
+GScr_StrPixLen
 
-        if( inputstr[i] == ' '){ /*Save the positions of the last recent wordspacer*/
-            lSCounter = i;
-            lSCounterReal = j;
-        }
+This function measures the average length of a given string if it would getting printed
+Usage: float = StrPixLen(string <string>);
+============
+*/
 
-        if(inputstr[i] == '^' && inputstr[i+1] >= '0' && inputstr[i+1] <= '9'){
-            outputstr[i+2] = inputstr[i];
-            i++;
-            lastColor = inputstr[i];
-            outputstr[i+2] = inputstr[i];
-            i++;
-            overflowcnt += 2;
-            continue;
-        }
+void GScr_StrPixLen(){
 
+    if(Scr_GetNumParam() != 1){
+        Scr_Error("Usage: StrPixLen(<string>)");
+    }
 
-        if( j >= limit){
-            if(lineBreakIndex >= MAX_LINEBREAKS){
-                break; //Cut here - no overrun
-            }
+    Scr_AddFloat((float)Scr_StringHalfPixels(Scr_GetString(0)) / 2.0);
+}
 
 
-            if(lSCounterReal >= (limit / 2)){ //we have a space between words inside the upper half string length
-                outputstr[lSCounter+2] = 0;
-                Scr_AddString(outputstr);	//setting the beginning of string in our array
-                Scr_AddArray();
-
-                inputstr = &inputstr[lSCounter+1];
-                outputstr = &outputstr[i+3];
-                outputstr[0] = '^';
-                outputstr[1] = lastColor;
-                outputstr[2] = 0;
-                overflowcnt += 3;
-
-                lSCounter = 0;
-                lSCounterReal = 0;
-                i = 0;
-                j = 0;
-
-            }else{ 	//we couln't find a space inside the upper half string length
-                outputstr[i+2] = 0; //Exception if broken inside colorcode is needed
-                Scr_AddString(outputstr);
-                Scr_AddArray();
-
-                inputstr = &inputstr[i];
-                outputstr = &outputstr[i+3];
-                outputstr[0] = '^';
-                outputstr[1] = lastColor;
-                outputstr[2] = 0;
-                overflowcnt += 3;
-
-                lSCounter = 0;
-                lSCounterReal = 0;
-                i = 0;
-                j = 0;
-            }
-            lineBreakIndex++;
-        }else{
-            j++;
-            outputstr[i+2] = inputstr[i];
-            i++;
-            overflowcnt++;
+/*
+============
+GScr_StrWrap
 
-        }
+Wraps all given strings to the given pixel width at once and returns all lines in one array.
+Each line begins with the color code which was active where the line before ended
+Usage: array = StrWrap(float <codPixelCount>, string <string>, ...);
+============
+*/
+
+void GScr_StrWrap(){
+    scrWrap_t wrap;
+    int i, numParam;
+
+    numParam = Scr_GetNumParam();
+
+    if(numParam < 2){
+        Scr_Error("Usage: StrWrap(<float>, <string>, ...)");
+    }
+
+    wrap.widths = Scr_GetFontWidths();
+    wrap.limit = 2.0 * Scr_GetFloat(0);
+    wrap.minBreak = wrap.limit / 3;
+    wrap.carryColor = qtrue;
+
+    Scr_MakeArray();
+    for(i = 1; i < numParam; i++){
+        Scr_AddWrappedLines(Scr_GetString(i), &wrap);
     }
+}
+
+
+/*
+============
+GScr_StrSplit
+
+Splits a string at every occurrence of separator. Empty fields are kept.
+Usage: array = StrSplit(string <string>, string <separator>);
+============
+*/
 
+void GScr_StrSplit(){
+    char field[MAX_STRING_CHARS];
+    char *string, *separator, *end;
+    int seplen, len;
 
-    if( outputstr[2] ){
-        outputstr[i+2] = 0;
-        Scr_AddString(outputstr);
+    if(Scr_GetNumParam() != 2){
+        Scr_Error("Usage: StrSplit(<string>, <separator>)");
+    }
+    string = Scr_GetString(0);
+    separator = Scr_GetString(1);
+    seplen = strlen(separator);
+
+    if(seplen == 0){
+        Scr_Error("StrSplit(): separator can not be empty");
+        return;
+    }
+
+    Scr_MakeArray();
+
+    while((end = strstr(string, separator)) != NULL){
+        len = end - string;
+        if(len >= sizeof(field))
+            len = sizeof(field) -1;
+        memcpy(field, string, len);
+        field[len] = '\0';
+        Scr_AddString(field);
         Scr_AddArray();
+        string = end + seplen;
     }
+    Scr_AddString(string);
+    Scr_AddArray();
 }
 
 
+/*
+============
+GScr_StrJoin
+
+Joins all given strings into one string with separator in between.
+Usage: string = StrJoin(string <separator>, string <string>, ...);
+============
+*/
+
+void GScr_StrJoin(){
+    char buffer[8192];
+    int i, numParam;
+
+    numParam = Scr_GetNumParam();
+
+    if(numParam < 2){
+        Scr_Error("Usage: StrJoin(<separator>, <string>, ...)");
+    }
+
+    char* separator = Scr_GetString(0);
+
+    buffer[0] = '\0';
+    for(i = 1; i < numParam; i++){
+        if(i > 1)
+            Q_strcat(buffer, sizeof(buffer), separator);
+        Q_strcat(buffer, sizeof(buffer), Scr_GetString(i));
+    }
+    Scr_AddString(buffer);
+}
+
 
 /*
 ============
-GScr_StrPixLen
+GScr_StrToUpper / GScr_StrToLower
 
-This function measures the average length of a given string if it would getting printed
-Usage: float = StrPixLen(string <string>);
+Changes the case of the ASCII letters. Color codes and other characters remain.
+Called with one string the result is a string, with more strings it is an array of all results.
+Usage: string = StrToUpper(string <string>);
+Usage: array = StrToUpper(string <string>, string <string>, ...);
 ============
 */
 
-void GScr_StrPixLen(){
+static void Scr_AddStringCase(const char* string, qboolean upper){
+    char buffer[MAX_STRING_CHARS];
+    int i;
 
-    if(Scr_GetNumParam() != 1){
-        Scr_Error("Usage: StrPixLen(<string>)");
+    for(i = 0; string[i] && i < sizeof(buffer) -1; i++){
+        if(upper && string[i] >= 'a' && string[i] <= 'z')
+            buffer[i] = string[i] - ('a' - 'A');
+        else if(!upper && string[i] >= 'A' && string[i] <= 'Z')
+            buffer[i] = string[i] + ('a' - 'A');
+        else
+            buffer[i] = string[i];
     }
-    char* string = Scr_GetString(0);
+    buffer[i] = '\0';
+    Scr_AddString(buffer);
+}
 
-    int halfPixelCounter = 0;
-
-    while( *string ){
-        switch(*string){
-
-        case '\'':
-            halfPixelCounter += 2;
-        break;
-
-        case 'i':
-        case 'j':
-        case 'l':
-        case '.':
-        case ',':
-        case ':':
-        case ';':
-        case '_':
-        case '%':
-            halfPixelCounter += 4;
-        break;
-
-        case 'f':
-        case 'I':
-        case '-':
-        case '|':
-            halfPixelCounter += 5;
-        break;
-
-        case 't':
-        case 'r':
-        case '!':
-        case '/':
-        case '\\':
-        case '"':
-            halfPixelCounter += 6;
-        break;
-
-        case '(':
-        case ')':
-        case '[':
-        case ']':
-            halfPixelCounter += 7;
-        break;
-
-        case 'T':
-        case '{':
-        case '}':
-        case '*':
-            halfPixelCounter += 8;
-        break;
-
-        case 'a':
-        case 'c':
-        case 'g':
-        case 'k':
-        case 's':
-        case 'v':
-        case 'x':
-        case 'z':
-        case 'F':
-        case 'J':
-        case 'L':
-        case 'Y':
-        case 'Z':
-            halfPixelCounter += 9;
-        break;
-
-        case ' ': /*Save the positions of the last recent wordspacer*/
-        case 'd':
-        case 'h':
-        case 'n':
-        case 'A':
-        case 'P':
-        case 'S':
-        case 'V':
-        case 'X':
-        case '?':
-            halfPixelCounter += 10;
-        break;
-
-        case 'B':
-        case 'D':
-        case 'G':
-        case 'K':
-        case 'O':
-        case 'Q':
-        case 'R':
-        case 'U':
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-        case '$':
-        case '<':
-        case '>':
-        case '=':
-        case '+':
-        case '^':
-        case '~':
-            halfPixelCounter += 11;
-        break;
-
-        case 'H':
-        case 'N':
-        case '#':
-            halfPixelCounter += 12;
-        break;
-
-        case 'w':
-        case '&':
-            halfPixelCounter += 13;
-        break;
-
-        case 'W':
-        case 'M':
-        case '@':
-            halfPixelCounter += 14;
-        break;
-
-        case 'm':
-            halfPixelCounter += 15;
+static void GScr_StrCaseInternal(qboolean upper){
+    int i, numParam;
 
-        default:
-            halfPixelCounter += 12;
-        }
-        string++;
+    numParam = Scr_GetNumParam();
+
+    if(numParam < 1){
+        Scr_Error(upper ? "Usage: StrToUpper(<string>, ...)" : "Usage: StrToLower(<string>, ...)");
+    }
 
+    if(numParam == 1){
+        Scr_AddStringCase(Scr_GetString(0), upper);
+        return;
+    }
+
+    Scr_MakeArray();
+    for(i = 0; i < numParam; i++){
+        Scr_AddStringCase(Scr_GetString(i), upper);
+        Scr_AddArray();
     }
-    float result = (float)halfPixelCounter / 2.0;
+}
 
-    Scr_AddFloat(result);
+void GScr_StrToUpper(){
+    GScr_StrCaseInternal(qtrue);
+}
+
+void GScr_StrToLower(){
+    GScr_StrCaseInternal(qfalse);
 }
 
 
@@ -1521,6 +1467,345 @@ void GScr_FS_Remove(){
 
 
 
+/*
+============
+GScr_FS_ReadFileAsync
+
+Reads a whole file inside current FS_GameDir on a worker thread. The server does not wait for it.
+Returns a request id greater 0 or 0 if the request could not be started.
+When the file has been read "fs_readdone" gets notified on level with the request id and an array
+of all lines. The array is undefined if the file could not be read.
+Called on an entity the notify goes to this entity instead.
+Usage: int = FS_ReadFileAsync(string <filename>)
+Usage: int = self FS_ReadFileAsync(string <filename>)
+============
+*/
+
+static void GScr_FS_ReadFileAsyncInternal(int entnum){
+
+    if(Scr_GetNumParam() != 1)
+        Scr_Error("Usage: FS_ReadFileAsync(<filename>)\n");
+
+    Scr_AddInt(Scr_FS_ReadFileAsync(Scr_GetString(0), entnum));
+}
+
+void GScr_FS_ReadFileAsync(){
+    GScr_FS_ReadFileAsyncInternal(-1);
+}
+
+void GScr_FS_ReadFileAsyncEnt(scr_entref_t arg){
+
+    if(HIWORD(arg)){
+        Scr_ObjectError("Not an entity");
+        return;
+    }
+    GScr_FS_ReadFileAsyncInternal(LOWORD(arg));
+}
+
+
+/*
+============
+GScr_FS_WriteFileAsync
+
+Writes all given lines at once into a file inside current FS_GameDir on a worker thread.
+Mode can be either "write" or "append".
+Returns a request id greater 0 or 0 if the request could not be started.
+When the file has been written "fs_writedone" gets notified on level with the request id and true
+on success otherwise false. Called on an entity the notify goes to this entity instead.
+Usage: int = FS_WriteFileAsync(string <filename>, string <mode>, string <line>, ...)
+Usage: int = self FS_WriteFileAsync(string <filename>, string <mode>, string <line>, ...)
+============
+*/
+
+static void GScr_FS_WriteFileAsyncInternal(int entnum){
+    int i, numParam, len, pos;
+    fsMode_t mode;
+    char* data;
+    char* line;
+
+    numParam = Scr_GetNumParam();
+
+    if(numParam < 3)
+        Scr_Error("Usage: FS_WriteFileAsync(<filename>, <mode>, <line>, ...)\n");
+
+    char* filename = Scr_GetString(0);
+    char* modestr = Scr_GetString(1);
+
+    if(!Q_stricmp(modestr, "write")){
+        mode = FS_WRITE;
+    }else if(!Q_stricmp(modestr, "append")){
+        mode = FS_APPEND;
+    }else{
+        Scr_Error("FS_WriteFileAsync(): invalid mode. Valid modes are: write, append\n");
+        return;
+    }
+
+    len = 0;
+    for(i = 2; i < numParam; i++)
+        len += strlen(Scr_GetString(i)) + 1;
+
+    data = Z_TagMalloc(len, TAG_SCRIPT);
+
+    pos = 0;
+    for(i = 2; i < numParam; i++){
+        line = Scr_GetString(i);
+        strcpy(&data[pos], line);
+        pos += strlen(line);
+        data[pos++] = '\n';
+    }
+
+    Scr_AddInt(Scr_FS_WriteFileAsync(filename, mode, data, len, entnum));
+}
+
+void GScr_FS_WriteFileAsync(){
+    GScr_FS_WriteFileAsyncInternal(-1);
+}
+
+void GScr_FS_WriteFileAsyncEnt(scr_entref_t arg){
+
+    if(HIWORD(arg)){
+        Scr_ObjectError("Not an entity");
+        return;
+    }
+    GScr_FS_WriteFileAsyncInternal(LOWORD(arg));
+}
+
+
+/*
+============
+GScr_Storage_Set
+
+Stores a value under a key inside a named table. Tables are kept in memory and saved
+to storage/<table>.db and storage/<table>.log inside fs_homepath in the background.
+Values can be int, float, string or vector.
+Returns true on success otherwise false
+Usage: bool = Storage_Set(string <table>, string <key>, <value>)
+============
+*/
+
+void GScr_Storage_Set(){
+    varType_t type;
+    vsValue_t value;
+
+    if(Scr_GetNumParam() != 3)
+        Scr_Error("Usage: Storage_Set(<table>, <key>, <value>)\n");
+
+    char* table = Scr_GetString(0);
+    char* key = Scr_GetString(1);
+
+    switch(Scr_GetType(2)){
+        case 2:
+        case 3:
+            type = VSVAR_STRING;
+            value.string = Scr_GetString(2);
+            break;
+        case 4:
+            type = VSVAR_VECTOR;
+            Scr_GetVector(2, value.vector);
+            break;
+        case 5:
+            type = VSVAR_FLOAT;
+            value.floatVar = Scr_GetFloat(2);
+            break;
+        case 6:
+            type = VSVAR_INTEGER;
+            value.integer = Scr_GetInt(2);
+            break;
+        default:
+            Scr_Error("Storage_Set(): value has to be int, float, string or vector\n");
+            return;
+    }
+
+    Scr_AddBool(HStorage_TableSet(table, key, type, &value));
+}
+
+
+/*
+============
+GScr_Storage_Get
+
+Returns the value which is stored under a key inside a named table or undefined if there is none.
+Usage: value = Storage_Get(string <table>, string <key>)
+============
+*/
+
+void GScr_Storage_Get(){
+    varType_t type;
+    vsValue_t value;
+
+    if(Scr_GetNumParam() != 2)
+        Scr_Error("Usage: Storage_Get(<table>, <key>)\n");
+
+    if(!HStorage_TableGet(Scr_GetString(0), Scr_GetString(1), &type, &value)){
+        Scr_AddUndefined();
+        return;
+    }
+
+    switch(type){
+        case VSVAR_STRING:
+            Scr_AddString(value.string);
+            break;
+        case VSVAR_VECTOR:
+            Scr_AddVector(value.vector);
+            break;
+        case VSVAR_FLOAT:
+            Scr_AddFloat(value.floatVar);
+            break;
+        case VSVAR_INTEGER:
+            Scr_AddInt(value.integer);
+            break;
+        case VSVAR_BOOLEAN:
+            Scr_AddBool(value.boolean);
+            break;
+        default:
+            Scr_AddUndefined();
+            break;
+    }
+}
+
+
+/*
+============
+GScr_Storage_Remove
+
+Removes a key from a named table.
+Returns true if the key existed otherwise false
+Usage: bool = Storage_Remove(string <table>, string <key>)
+============
+*/
+
+void GScr_Storage_Remove(){
+
+    if(Scr_GetNumParam() != 2)
+        Scr_Error("Usage: Storage_Remove(<table>, <key>)\n");
+
+    Scr_AddBool(HStorage_TableRemove(Scr_GetString(0), Scr_GetString(1)));
+}
+
+
+/*
+============
+Entity grid queries
+
+All of them see the entity origins from the end of the last server frame.
+============
+*/
+
+static void Scr_AddEntityNumArray(int* list, int count){
+    int i;
+
+    Scr_MakeArray();
+    for(i = 0; i < count; i++){
+        Scr_AddEntity(&g_entities[list[i]]);
+        Scr_AddArray();
+    }
+}
+
+/*
+============
+GScr_PlayersInRadius
+
+Returns an array of all players which are not spectating within radius of origin. The nearest comes first.
+Usage: array = PlayersInRadius(vector <origin>, float <radius>);
+============
+*/
+
+void GScr_PlayersInRadius(){
+    vec3_t origin;
+    int list[MAX_CLIENTS];
+
+    if(Scr_GetNumParam() != 2)
+        Scr_Error("Usage: PlayersInRadius(<origin>, <radius>)\n");
+
+    Scr_GetVector(0, origin);
+    Scr_AddEntityNumArray(list, SV_EntityGridRadius(origin, Scr_GetFloat(1), qtrue, list, MAX_CLIENTS));
+}
+
+/*
+============
+GScr_EntitiesInRadius
+
+Returns an array of all entities within radius of origin. The nearest comes first.
+Usage: array = EntitiesInRadius(vector <origin>, float <radius>);
+============
+*/
+
+void GScr_EntitiesInRadius(){
+    vec3_t origin;
+    int list[MAX_GENTITIES];
+
+    if(Scr_GetNumParam() != 2)
+        Scr_Error("Usage: EntitiesInRadius(<origin>, <radius>)\n");
+
+    Scr_GetVector(0, origin);
+    Scr_AddEntityNumArray(list, SV_EntityGridRadius(origin, Scr_GetFloat(1), qfalse, list, MAX_GENTITIES));
+}
+
+/*
+============
+GScr_EntitiesInBox
+
+Returns an array of all entities whose origin is inside the box. With playersonly set only players are returned.
+Usage: array = EntitiesInBox(vector <mins>, vector <maxs>, [bool <playersonly>]);
+============
+*/
+
+void GScr_EntitiesInBox(){
+    vec3_t mins, maxs;
+    int list[MAX_GENTITIES];
+    qboolean playersOnly = qfalse;
+    int numParam;
+
+    numParam = Scr_GetNumParam();
+
+    if(numParam != 2 && numParam != 3)
+        Scr_Error("Usage: EntitiesInBox(<mins>, <maxs>, [playersonly])\n");
+
+    Scr_GetVector(0, mins);
+    Scr_GetVector(1, maxs);
+    if(numParam == 3)
+        playersOnly = Scr_GetInt(2);
+
+    Scr_AddEntityNumArray(list, SV_EntityGridBox(mins, maxs, playersOnly, list, MAX_GENTITIES));
+}
+
+/*
+============
+GScr_NearestPlayer
+
+Returns the nearest player which is not spectating or undefined if there is none.
+maxdist limits the search. The entity ignore is never returned.
+Usage: entity = NearestPlayer(vector <origin>, [float <maxdist>], [entity <ignore>]);
+============
+*/
+
+void GScr_NearestPlayer(){
+    vec3_t origin;
+    float maxDist = 0;
+    int ignoreNum = -1;
+    int numParam, num;
+
+    numParam = Scr_GetNumParam();
+
+    if(numParam < 1 || numParam > 3)
+        Scr_Error("Usage: NearestPlayer(<origin>, [maxdist], [ignore])\n");
+
+    Scr_GetVector(0, origin);
+    if(numParam > 1)
+        maxDist = Scr_GetFloat(1);
+    if(numParam > 2)
+        ignoreNum = Scr_GetEntity(2)->s.number;
+
+    num = SV_EntityGridNearestPlayer(origin, maxDist, ignoreNum);
+    if(num < 0){
+        Scr_AddUndefined();
+        return;
+    }
+    Scr_AddEntity(&g_entities[num]);
+}
+
+
+
 /*
 ============
 GScr_FS_InitParamList
@@ -46,6 +46,11 @@ void PlayerCmd_GetGeoLocation(scr_entref_t arg);
 void GScr_StrTokByPixLen();
 void GScr_StrTokByLen();
 void GScr_StrPixLen();
+void GScr_StrWrap();
+void GScr_StrSplit();
+void GScr_StrJoin();
+void GScr_StrToUpper();
+void GScr_StrToLower();
 void GScr_StrColorStrip();
 void GScr_StrRepl();
 void GScr_CopyString();
@@ -61,6 +66,17 @@ void GScr_FS_TestFile();
 void GScr_FS_ReadLine();
 void GScr_FS_WriteLine();
 void GScr_FS_Remove();
+void GScr_FS_ReadFileAsync();
+void GScr_FS_WriteFileAsync();
+void GScr_FS_ReadFileAsyncEnt(scr_entref_t);
+void GScr_FS_WriteFileAsyncEnt(scr_entref_t);
+void GScr_Storage_Set();
+void GScr_Storage_Get();
+void GScr_Storage_Remove();
+void GScr_PlayersInRadius();
+void GScr_EntitiesInRadius();
+void GScr_EntitiesInBox();
+void GScr_NearestPlayer();
 void GScr_SpawnBot();
 void GScr_RemoveAllBots();
 void GScr_RemoveBot();
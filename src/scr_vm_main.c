@@ -24,6 +24,7 @@
 #include "q_shared.h"
 #include "scr_vm.h"
 #include "scr_vm_functions.h"
+#include "scr_vm_profile.h"
 #include "qcommon_io.h"
 #include "cvar.h"
 #include "misc.h"
@@ -257,6 +258,15 @@ void Scr_AddStockFunctions(){
 	Scr_AddFunction("fs_readline", GScr_FS_ReadLine, 0);
 	Scr_AddFunction("fs_writeline", GScr_FS_WriteLine, 0);
 	Scr_AddFunction("fs_remove", GScr_FS_Remove, 0);
+	Scr_AddFunction("fs_readfileasync", GScr_FS_ReadFileAsync, 0);
+	Scr_AddFunction("fs_writefileasync", GScr_FS_WriteFileAsync, 0);
+	Scr_AddFunction("storage_set", GScr_Storage_Set, 0);
+	Scr_AddFunction("storage_get", GScr_Storage_Get, 0);
+	Scr_AddFunction("storage_remove", GScr_Storage_Remove, 0);
+	Scr_AddFunction("playersinradius", GScr_PlayersInRadius, 0);
+	Scr_AddFunction("entitiesinradius", GScr_EntitiesInRadius, 0);
+	Scr_AddFunction("entitiesinbox", GScr_EntitiesInBox, 0);
+	Scr_AddFunction("nearestplayer", GScr_NearestPlayer, 0);
 	Scr_AddFunction("getrealtime", GScr_GetRealTime, 0);
 	Scr_AddFunction("timetostring", GScr_TimeToString, 0);
 	Scr_AddFunction("strtokbypixlen", GScr_StrTokByPixLen, 0);
@@ -265,6 +275,11 @@ void Scr_AddStockFunctions(){
 	Scr_AddFunction("copystr", GScr_CopyString, 0);
 	Scr_AddFunction("strrepl", GScr_StrRepl, 0);
 	Scr_AddFunction("strtokbylen", GScr_StrTokByLen, 0);
+	Scr_AddFunction("strwrap", GScr_StrWrap, 0);
+	Scr_AddFunction("strsplit", GScr_StrSplit, 0);
+	Scr_AddFunction("strjoin", GScr_StrJoin, 0);
+	Scr_AddFunction("strtoupper", GScr_StrToUpper, 0);
+	Scr_AddFunction("strtolower", GScr_StrToLower, 0);
 	Scr_AddFunction("exec", GScr_CbufAddText, 0);
 	Scr_AddFunction("execex", GScr_CbufAddTextEx, 0);
 	Scr_AddFunction("sha256", GScr_SHA256, 0);
@@ -279,6 +294,8 @@ void Scr_AddStockMethods(){
 	Scr_AddMethod("getpower", PlayerCmd_GetPower, 0);
 	Scr_AddMethod("setpower", PlayerCmd_SetPower, 0);
 	Scr_AddMethod("setuid", PlayerCmd_SetUid, 0);
+	Scr_AddMethod("fs_readfileasync", GScr_FS_ReadFileAsyncEnt, 0);
+	Scr_AddMethod("fs_writefileasync", GScr_FS_WriteFileAsyncEnt, 0);
 	Scr_AddMethod("giveweapon", (void*)0x80abc48, 0);
 	Scr_AddMethod("takeweapon", (void*)0x80abbb4, 0);
 	Scr_AddMethod("takeallweapons", (void*)0x80abb0e, 0);
@@ -1188,8 +1205,12 @@ int GetArraySize(int aHandle)
 /* only for debug */
 __regparm3 void VM_Notify_Hook(int entid, int constString, variableValue_t* arguments)
 {
+    int profDepth;
+
     Com_Printf("^2Notify Entitynum: %d, EventString: %s\n", entid, SL_ConvertToString(constString));
+    profDepth = Scr_ProfNotifyBegin(constString);
     VM_Notify(entid, constString, arguments);
+    Scr_ProfNotifyEnd(profDepth);
 }
 
 void Scr_InitSystem()
@@ -1217,6 +1238,7 @@ void Scr_NotifyInternal(int varNum, int constString, int numArgs)
   variableValue_t *curArg;
   int z;
   int ctype;
+  int profDepth;
 
   Scr_ClearArguments();
   curArg = scrVmPub.argumentVariables - numArgs;
@@ -1226,7 +1248,9 @@ void Scr_NotifyInternal(int varNum, int constString, int numArgs)
     ctype = curArg->varType;
     curArg->varType = 8;
     scrVmPub.field_18 = 0;
+    profDepth = Scr_ProfNotifyBegin(constString);
     VM_Notify(varNum, constString, scrVmPub.argumentVariables);
+    Scr_ProfNotifyEnd(profDepth);
     curArg->varType = ctype;
   }
   while( scrVmPub.argumentVariables != curArg )
@@ -1286,6 +1310,7 @@ void RuntimeError(char *a3, int arg4, char *message, char *a4)
 {
 	int errtype;
 
+	Scr_ProfRuntimeError();
 
 	if ( !scrVarPub.field_6 && !scrVmPub.field_16 )
 	{
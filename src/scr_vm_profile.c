@@ -0,0 +1,919 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+    Copyright (C) 1999-2005 Id Software, Inc.
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+
+#include "q_shared.h"
+#include "qcommon.h"
+#include "qcommon_io.h"
+#include "cvar.h"
+#include "cmd.h"
+#include "filesystem.h"
+#include "misc.h"
+#include "scr_vm.h"
+#include "scr_vm_profile.h"
+#include "sys_main.h"
+#include "sys_thread.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/*
+========================================================================
+
+SCRIPT PROFILER
+
+Builtin functions and methods are resolved when the scripts get compiled.
+With scr_profile enabled at that time every builtin is handed out as a small
+thunk which keeps a stack of what is running: the game frame, the notifies
+raised from C code and the builtins below them. Time spent in script code
+itself is accounted to the scope it was started from.
+
+scr_profile 1 times every scope with the monotonic microsecond clock and
+keeps total and self time per builtin and per notify event.
+scr_profile 2 leaves the calls alone and lets a thread look at the stack
+once per millisecond. It costs next to nothing but has no call times.
+
+Both modes collect complete stacks which can be written out in the folded
+format that flamegraph tools read. The number of script threads sleeping in
+wait and waittill is counted once per second from the variable pool.
+
+========================================================================
+*/
+
+#define SCR_PROF_MAX_BUILTINS 500	//Per functions and methods. Has to match the thunks below
+#define SCR_PROF_MAX_EVENTS 512		//Has to be a power of 2
+#define SCR_PROF_MAX_DEPTH 32
+#define SCR_PROF_MAX_STACKS 4096	//Has to be a power of 2
+#define SCR_PROF_REPORT_LINES 20
+
+#define SCR_PROF_ID_EVENTS (2 * SCR_PROF_MAX_BUILTINS)
+#define SCR_PROF_ID_ROOT (SCR_PROF_ID_EVENTS + SCR_PROF_MAX_EVENTS)
+#define SCR_PROF_NUM_IDS (SCR_PROF_ID_ROOT +1)
+
+//Layout of the variable type field as the script VM uses it
+#define SCR_VAR_STAT_MASK 0x60
+#define SCR_VAR_TYPE_MASK 0x1f
+#define SCR_VAR_THREAD 14
+#define SCR_VAR_NOTIFY_THREAD 15
+#define SCR_VAR_TIME_THREAD 16
+#define SCR_VAR_CHILD_THREAD 17
+
+typedef enum{
+	SCR_PROF_OFF,
+	SCR_PROF_INSTRUMENTED,
+	SCR_PROF_SAMPLED
+}scrProfMode_t;
+
+typedef struct{
+	char name[64];
+	xfunction_t function;
+	qboolean method;
+	unsigned int calls;
+	unsigned int errors;
+	unsigned int maxUsec;
+	unsigned int samples;		//Stack samples this builtin was part of
+	unsigned int selfSamples;	//Stack samples this builtin was on top
+	unsigned long long totalUsec;
+	unsigned long long selfUsec;
+}scrProfBuiltin_t;
+
+typedef struct{
+	char name[64];
+	int constString;
+	unsigned int count;
+	unsigned int maxUsec;
+	unsigned int samples;
+	unsigned long long totalUsec;
+}scrProfEvent_t;
+
+typedef struct{
+	unsigned long long weight;
+	unsigned int hash;
+	short depth;
+	short ids[SCR_PROF_MAX_DEPTH];
+}scrProfStack_t;
+
+typedef struct{
+	volatile int depth;
+	volatile short ids[SCR_PROF_MAX_DEPTH];
+	unsigned long long startUsec[SCR_PROF_MAX_DEPTH];
+	unsigned long long childUsec[SCR_PROF_MAX_DEPTH];
+}scrProfScopes_t;
+
+typedef struct{
+	volatile scrProfMode_t mode;
+	scrProfScopes_t scopes;
+
+	int numFunctions;
+	int numMethods;
+	scrProfBuiltin_t builtins[2 * SCR_PROF_MAX_BUILTINS];
+	scrProfEvent_t events[SCR_PROF_MAX_EVENTS];
+	int numEvents;
+
+	scrProfStack_t stacks[SCR_PROF_MAX_STACKS];
+	int numStacks;
+	unsigned long long droppedWeight;	//Stacks which did not fit into the table anymore
+
+	unsigned int numFrames;
+	unsigned int numSamples;
+	unsigned int scriptErrors;			//Runtime errors outside of builtins
+	unsigned int startTime;
+
+	unsigned int lastThreadCount;
+	int waittillThreads, waitThreads, otherThreads;
+	int maxWaittillThreads, maxWaitThreads, maxOtherThreads;
+
+	threadid_t samplerThread;
+	qboolean samplerRunning;
+}scrProfiler_t;
+
+static scrProfiler_t scr_prof;
+static cvar_t* scr_profile;
+
+
+/*
+=================
+Scr_ProfFold
+
+Adds weight to the stack ids[0 .. depth -1]. Caller holds CRIT_MISC
+=================
+*/
+static void Scr_ProfFold( const short* ids, int depth, unsigned long long weight )
+{
+	scrProfStack_t* stack;
+	unsigned int hash, index;
+	int i;
+
+	for(i = 0, hash = 5381; i < depth; i++)
+	{
+		hash = hash * 33 + ids[i];
+	}
+
+	for(index = hash & (SCR_PROF_MAX_STACKS -1); ; index = (index +1) & (SCR_PROF_MAX_STACKS -1))
+	{
+		stack = &scr_prof.stacks[index];
+
+		if(stack->depth == 0)
+		{
+			if(scr_prof.numStacks >= SCR_PROF_MAX_STACKS / 2)
+			{
+				scr_prof.droppedWeight += weight;
+				return;
+			}
+			stack->hash = hash;
+			stack->depth = depth;
+			Com_Memcpy(stack->ids, ids, depth * sizeof(ids[0]));
+			scr_prof.numStacks++;
+			break;
+		}
+		if(stack->hash == hash && stack->depth == depth && !memcmp(stack->ids, ids, depth * sizeof(ids[0])))
+		{
+			break;
+		}
+	}
+	stack->weight += weight;
+}
+
+static int Scr_ProfPush( int id )
+{
+	int depth = scr_prof.scopes.depth;
+
+	if(depth < 0 || depth >= SCR_PROF_MAX_DEPTH)
+	{
+		return -1;
+	}
+	scr_prof.scopes.ids[depth] = id;
+	scr_prof.scopes.childUsec[depth] = 0;
+	if(scr_prof.mode == SCR_PROF_INSTRUMENTED)
+	{
+		scr_prof.scopes.startUsec[depth] = Sys_MicrosecondsMonotonic();
+	}
+	scr_prof.scopes.depth = depth +1;
+	return depth;
+}
+
+/*
+=================
+Scr_ProfPop
+
+Closes the scope at depth and everything above it which did not get closed.
+Returns the time spent in this scope or 0 if it was not timed
+=================
+*/
+static unsigned int Scr_ProfPop( int depth )
+{
+	unsigned long long elapsed, self;
+	short ids[SCR_PROF_MAX_DEPTH];
+
+	if(depth < 0 || depth >= scr_prof.scopes.depth)
+	{
+		return 0;
+	}
+	if(scr_prof.mode != SCR_PROF_INSTRUMENTED)
+	{
+		scr_prof.scopes.depth = depth;
+		return 0;
+	}
+
+	elapsed = Sys_MicrosecondsMonotonic() - scr_prof.scopes.startUsec[depth];
+	self = elapsed > scr_prof.scopes.childUsec[depth] ? elapsed - scr_prof.scopes.childUsec[depth] : 0;
+
+	if(depth > 0)
+	{
+		scr_prof.scopes.childUsec[depth -1] += elapsed;
+	}
+	Com_Memcpy(ids, (const void*)scr_prof.scopes.ids, (depth +1) * sizeof(ids[0]));
+	scr_prof.scopes.depth = depth;
+
+	if(ids[depth] < SCR_PROF_ID_EVENTS)
+	{
+		scr_prof.builtins[ids[depth]].selfUsec += self;
+	}
+
+	Sys_EnterCriticalSection(CRIT_MISC);
+	Scr_ProfFold(ids, depth +1, self);
+	Sys_LeaveCriticalSection(CRIT_MISC);
+
+	return elapsed;
+}
+
+static void Scr_ProfCallBuiltin( int id, scr_entref_t entref )
+{
+	scrProfBuiltin_t* builtin = &scr_prof.builtins[id];
+	unsigned int usec;
+	int depth;
+
+	if(scr_prof.mode == SCR_PROF_OFF)
+	{
+		if(builtin->method)
+		{
+			((void (*)(scr_entref_t))builtin->function)(entref);
+		}else{
+			builtin->function();
+		}
+		return;
+	}
+
+	builtin->calls++;
+	depth = Scr_ProfPush(id);
+
+	if(builtin->method)
+	{
+		((void (*)(scr_entref_t))builtin->function)(entref);
+	}else{
+		builtin->function();
+	}
+
+	usec = Scr_ProfPop(depth);
+	builtin->totalUsec += usec;
+	if(usec > builtin->maxUsec)
+	{
+		builtin->maxUsec = usec;
+	}
+}
+
+/*
+ One thunk per slot. The VM calls builtins without telling which one it called
+ so every slot needs its own entry point. Numbering starts at 1000 to avoid
+ octal constants.
+*/
+#define SCR_PROF_REPEAT10(m, n) m(n##0) m(n##1) m(n##2) m(n##3) m(n##4) m(n##5) m(n##6) m(n##7) m(n##8) m(n##9)
+#define SCR_PROF_REPEAT100(m, n) SCR_PROF_REPEAT10(m, n##0) SCR_PROF_REPEAT10(m, n##1) SCR_PROF_REPEAT10(m, n##2) \
+	SCR_PROF_REPEAT10(m, n##3) SCR_PROF_REPEAT10(m, n##4) SCR_PROF_REPEAT10(m, n##5) SCR_PROF_REPEAT10(m, n##6) \
+	SCR_PROF_REPEAT10(m, n##7) SCR_PROF_REPEAT10(m, n##8) SCR_PROF_REPEAT10(m, n##9)
+#define SCR_PROF_REPEAT500(m) SCR_PROF_REPEAT100(m, 10) SCR_PROF_REPEAT100(m, 11) SCR_PROF_REPEAT100(m, 12) \
+	SCR_PROF_REPEAT100(m, 13) SCR_PROF_REPEAT100(m, 14)
+
+#define SCR_PROF_THUNK(n) \
+	static void Scr_ProfFunctionThunk##n( void ){ Scr_ProfCallBuiltin(n - 1000, 0); } \
+	static void Scr_ProfMethodThunk##n( scr_entref_t entref ){ Scr_ProfCallBuiltin(n - 1000 + SCR_PROF_MAX_BUILTINS, entref); }
+#define SCR_PROF_FUNCTIONTHUNK(n) Scr_ProfFunctionThunk##n,
+#define SCR_PROF_METHODTHUNK(n) (xfunction_t)Scr_ProfMethodThunk##n,
+
+SCR_PROF_REPEAT500(SCR_PROF_THUNK)
+
+static const xfunction_t scr_profFunctionThunks[SCR_PROF_MAX_BUILTINS] = { SCR_PROF_REPEAT500(SCR_PROF_FUNCTIONTHUNK) };
+static const xfunction_t scr_profMethodThunks[SCR_PROF_MAX_BUILTINS] = { SCR_PROF_REPEAT500(SCR_PROF_METHODTHUNK) };
+
+
+/*
+=================
+Scr_ProfWrapFunction
+
+Called while scripts get compiled. Returns what the VM should call for this builtin
+=================
+*/
+xfunction_t Scr_ProfWrapFunction( const char* name, xfunction_t function, qboolean method )
+{
+	scrProfBuiltin_t* builtins;
+	int *count, i;
+
+	if(function == NULL || scr_profile == NULL || scr_profile->integer == SCR_PROF_OFF)
+	{
+		return function;
+	}
+
+	if(method)
+	{
+		builtins = &scr_prof.builtins[SCR_PROF_MAX_BUILTINS];
+		count = &scr_prof.numMethods;
+	}else{
+		builtins = scr_prof.builtins;
+		count = &scr_prof.numFunctions;
+	}
+
+	for(i = 0; i < *count; i++)
+	{
+		if(builtins[i].function == function && !Q_stricmp(builtins[i].name, name))
+		{
+			break;
+		}
+	}
+
+	if(i == *count)
+	{
+		if(*count >= SCR_PROF_MAX_BUILTINS)
+		{
+			Com_DPrintf("Scr_ProfWrapFunction: No free slot for %s, it won't get profiled\n", name);
+			return function;
+		}
+		Q_strncpyz(builtins[i].name, name, sizeof(builtins[i].name));
+		builtins[i].function = function;
+		builtins[i].method = method;
+		(*count)++;
+	}
+	return method ? scr_profMethodThunks[i] : scr_profFunctionThunks[i];
+}
+
+static scrProfEvent_t* Scr_ProfGetEvent( int constString )
+{
+	scrProfEvent_t* event;
+	const char* name;
+	unsigned int index;
+
+	name = SL_ConvertToString(constString);
+
+	for(index = constString & (SCR_PROF_MAX_EVENTS -1); ; index = (index +1) & (SCR_PROF_MAX_EVENTS -1))
+	{
+		event = &scr_prof.events[index];
+
+		if(event->name[0] == '\0')
+		{
+			if(scr_prof.numEvents >= SCR_PROF_MAX_EVENTS / 2)
+			{
+				return NULL;
+			}
+			Q_strncpyz(event->name, name, sizeof(event->name));
+			event->constString = constString;
+			scr_prof.numEvents++;
+			return event;
+		}
+		//String indices get reused after a map change
+		if(event->constString == constString && !Q_stricmp(event->name, name))
+		{
+			return event;
+		}
+	}
+}
+
+/*
+=================
+Scr_ProfNotifyBegin / Scr_ProfNotifyEnd
+
+Wrap a notify which is raised from C code. The waiting threads run within
+=================
+*/
+int Scr_ProfNotifyBegin( int constString )
+{
+	scrProfEvent_t* event;
+
+	if(scr_prof.mode == SCR_PROF_OFF)
+	{
+		return -1;
+	}
+
+	event = Scr_ProfGetEvent(constString);
+	if(event == NULL)
+	{
+		return -1;
+	}
+	event->count++;
+	return Scr_ProfPush(SCR_PROF_ID_EVENTS + (event - scr_prof.events));
+}
+
+void Scr_ProfNotifyEnd( int depth )
+{
+	scrProfEvent_t* event;
+	unsigned int usec;
+
+	if(depth < 0 || depth >= scr_prof.scopes.depth)
+	{
+		return;
+	}
+	event = &scr_prof.events[scr_prof.scopes.ids[depth] - SCR_PROF_ID_EVENTS];
+
+	usec = Scr_ProfPop(depth);
+	event->totalUsec += usec;
+	if(usec > event->maxUsec)
+	{
+		event->maxUsec = usec;
+	}
+}
+
+/*
+=================
+Scr_ProfRuntimeError
+
+The VM leaves the builtin which raised the error with a longjmp, so its thunk never returns.
+Charges the error to it and closes the builtins left on top of the stack
+=================
+*/
+void Scr_ProfRuntimeError( void )
+{
+	int depth;
+
+	if(scr_prof.mode == SCR_PROF_OFF)
+	{
+		return;
+	}
+
+	depth = scr_prof.scopes.depth -1;
+
+	if(depth < 0 || scr_prof.scopes.ids[depth] >= SCR_PROF_ID_EVENTS)
+	{
+		scr_prof.scriptErrors++;
+		return;
+	}
+	scr_prof.builtins[scr_prof.scopes.ids[depth]].errors++;
+
+	while(depth >= 0 && scr_prof.scopes.ids[depth] < SCR_PROF_ID_EVENTS)
+	{
+		scr_prof.builtins[scr_prof.scopes.ids[depth]].totalUsec += Scr_ProfPop(depth);
+		depth--;
+	}
+}
+
+/*
+=================
+Scr_ProfSampleStack
+
+Runs in the sampler thread. The stack can change while it gets copied, the ids stay valid either way
+=================
+*/
+static void Scr_ProfSampleStack( void )
+{
+	short ids[SCR_PROF_MAX_DEPTH];
+	int depth, i, j, id;
+
+	depth = scr_prof.scopes.depth;
+	if(depth <= 0)
+	{
+		return;
+	}
+	if(depth > SCR_PROF_MAX_DEPTH)
+	{
+		depth = SCR_PROF_MAX_DEPTH;
+	}
+	for(i = 0; i < depth; i++)
+	{
+		ids[i] = scr_prof.scopes.ids[i];
+		if(ids[i] < 0 || ids[i] >= SCR_PROF_NUM_IDS)
+		{
+			return;
+		}
+	}
+
+	Sys_EnterCriticalSection(CRIT_MISC);
+
+	for(i = 0; i < depth; i++)
+	{
+		id = ids[i];
+		//Recursion counts once per sample
+		for(j = 0; j < i && ids[j] != id; j++);
+		if(j < i)
+		{
+			continue;
+		}
+		if(id < SCR_PROF_ID_EVENTS)
+		{
+			scr_prof.builtins[id].samples++;
+		}else if(id < SCR_PROF_ID_ROOT){
+			scr_prof.events[id - SCR_PROF_ID_EVENTS].samples++;
+		}
+	}
+	if(ids[depth -1] < SCR_PROF_ID_EVENTS)
+	{
+		scr_prof.builtins[ids[depth -1]].selfSamples++;
+	}
+	Scr_ProfFold(ids, depth, 1);
+	scr_prof.numSamples++;
+
+	Sys_LeaveCriticalSection(CRIT_MISC);
+}
+
+static void* Scr_ProfSamplerThread( void* arg )
+{
+	while(qtrue)
+	{
+		if(scr_prof.mode == SCR_PROF_SAMPLED)
+		{
+			Scr_ProfSampleStack();
+		}
+		Sys_SleepMSec(1);
+	}
+	return NULL;
+}
+
+static void Scr_ProfCountThreads( void )
+{
+	unsigned int type;
+	int i;
+
+	scr_prof.waittillThreads = scr_prof.waitThreads = scr_prof.otherThreads = 0;
+
+	for(i = 1; i < 32768; i++)
+	{
+		type = scrVarGlob.variables[i].type;
+
+		if((type & SCR_VAR_STAT_MASK) == 0)
+		{
+			continue;
+		}
+		switch(type & SCR_VAR_TYPE_MASK)
+		{
+			case SCR_VAR_NOTIFY_THREAD:
+				scr_prof.waittillThreads++;
+				break;
+			case SCR_VAR_TIME_THREAD:
+				scr_prof.waitThreads++;
+				break;
+			case SCR_VAR_THREAD:
+			case SCR_VAR_CHILD_THREAD:
+				scr_prof.otherThreads++;
+				break;
+		}
+	}
+	if(scr_prof.waittillThreads > scr_prof.maxWaittillThreads)
+	{
+		scr_prof.maxWaittillThreads = scr_prof.waittillThreads;
+	}
+	if(scr_prof.waitThreads > scr_prof.maxWaitThreads)
+	{
+		scr_prof.maxWaitThreads = scr_prof.waitThreads;
+	}
+	if(scr_prof.otherThreads > scr_prof.maxOtherThreads)
+	{
+		scr_prof.maxOtherThreads = scr_prof.otherThreads;
+	}
+}
+
+static void Scr_ProfReset( void )
+{
+	int i;
+
+	Sys_EnterCriticalSection(CRIT_MISC);
+
+	for(i = 0; i < 2 * SCR_PROF_MAX_BUILTINS; i++)
+	{
+		scr_prof.builtins[i].calls = 0;
+		scr_prof.builtins[i].errors = 0;
+		scr_prof.builtins[i].maxUsec = 0;
+		scr_prof.builtins[i].samples = 0;
+		scr_prof.builtins[i].selfSamples = 0;
+		scr_prof.builtins[i].totalUsec = 0;
+		scr_prof.builtins[i].selfUsec = 0;
+	}
+	Com_Memset(scr_prof.events, 0, sizeof(scr_prof.events));
+	scr_prof.numEvents = 0;
+	Com_Memset(scr_prof.stacks, 0, sizeof(scr_prof.stacks));
+	scr_prof.numStacks = 0;
+	scr_prof.droppedWeight = 0;
+	scr_prof.numFrames = 0;
+	scr_prof.numSamples = 0;
+	scr_prof.scriptErrors = 0;
+	scr_prof.maxWaittillThreads = scr_prof.maxWaitThreads = scr_prof.maxOtherThreads = 0;
+	scr_prof.startTime = Sys_Milliseconds();
+
+	Sys_LeaveCriticalSection(CRIT_MISC);
+}
+
+/*
+=================
+Scr_ProfBeginFrame / Scr_ProfEndFrame
+
+Wrap G_RunFrame(). Everything the scripts do during the frame is found below it
+=================
+*/
+void Scr_ProfBeginFrame( void )
+{
+	scrProfMode_t mode;
+
+	mode = (scrProfMode_t)scr_profile->integer;
+
+	if(mode != scr_prof.mode)
+	{
+		if(mode != SCR_PROF_OFF)
+		{
+			Scr_ProfReset();
+		}
+		if(mode == SCR_PROF_SAMPLED && !scr_prof.samplerRunning)
+		{
+			scr_prof.samplerRunning = Sys_CreateNewThread(Scr_ProfSamplerThread, &scr_prof.samplerThread, NULL);
+			if(!scr_prof.samplerRunning)
+			{
+				Com_PrintWarning("Scr_ProfBeginFrame: Could not create the sampler thread\n");
+			}
+		}
+		scr_prof.mode = mode;
+	}
+
+	scr_prof.scopes.depth = 0;
+
+	if(scr_prof.mode == SCR_PROF_OFF)
+	{
+		return;
+	}
+	scr_prof.numFrames++;
+	Scr_ProfPush(SCR_PROF_ID_ROOT);
+}
+
+void Scr_ProfEndFrame( void )
+{
+	unsigned int now;
+
+	if(scr_prof.mode == SCR_PROF_OFF)
+	{
+		return;
+	}
+	Scr_ProfPop(0);
+	scr_prof.scopes.depth = 0;
+
+	now = Sys_Milliseconds();
+	if(now - scr_prof.lastThreadCount >= 1000)
+	{
+		scr_prof.lastThreadCount = now;
+		Scr_ProfCountThreads();
+	}
+}
+
+static void Scr_ProfAppendName( char* line, int size, int id )
+{
+	if(id < SCR_PROF_ID_EVENTS)
+	{
+		Q_strcat(line, size, scr_prof.builtins[id].name);
+	}else if(id < SCR_PROF_ID_ROOT){
+		Q_strcat(line, size, "notify:");
+		Q_strcat(line, size, scr_prof.events[id - SCR_PROF_ID_EVENTS].name);
+	}else{
+		Q_strcat(line, size, "G_RunFrame");
+	}
+}
+
+static qboolean scr_profSortSampled;
+
+static int Scr_ProfCompareBuiltins( const void* a, const void* b )
+{
+	const scrProfBuiltin_t* ba = &scr_prof.builtins[*(const int*)a];
+	const scrProfBuiltin_t* bb = &scr_prof.builtins[*(const int*)b];
+	unsigned long long valueA, valueB;
+
+	if(scr_profSortSampled)
+	{
+		valueA = ba->selfSamples;
+		valueB = bb->selfSamples;
+	}else{
+		valueA = ba->selfUsec;
+		valueB = bb->selfUsec;
+	}
+	if(valueA > valueB)
+		return -1;
+	if(valueA < valueB)
+		return 1;
+	return 0;
+}
+
+static int Scr_ProfCompareEvents( const void* a, const void* b )
+{
+	const scrProfEvent_t* ea = &scr_prof.events[*(const int*)a];
+	const scrProfEvent_t* eb = &scr_prof.events[*(const int*)b];
+	unsigned long long valueA, valueB;
+
+	if(scr_profSortSampled)
+	{
+		valueA = ea->samples;
+		valueB = eb->samples;
+	}else{
+		valueA = ea->totalUsec;
+		valueB = eb->totalUsec;
+	}
+	if(valueA > valueB)
+		return -1;
+	if(valueA < valueB)
+		return 1;
+	return 0;
+}
+
+/*
+=================
+Scr_ProfPrintReport
+
+Most expensive builtins and notify events and how many script threads are sleeping
+=================
+*/
+static void Scr_ProfPrintReport( void )
+{
+	static int order[2 * SCR_PROF_MAX_BUILTINS];
+	scrProfBuiltin_t* b;
+	scrProfEvent_t* e;
+	int i, count;
+
+	if(scr_prof.mode == SCR_PROF_OFF)
+	{
+		Com_Printf("Script profiler is off. Set scr_profile to 1 (timed) or 2 (sampled) and load a map\n");
+		return;
+	}
+	if(scr_prof.numFunctions + scr_prof.numMethods == 0)
+	{
+		Com_Printf("No builtins are profiled yet. They get profiled with the next map load\n");
+	}
+
+	Sys_EnterCriticalSection(CRIT_MISC);
+
+	scr_profSortSampled = scr_prof.mode == SCR_PROF_SAMPLED;
+
+	Com_Printf("%s script profile of %u frames in %.1f sec\n", scr_profSortSampled ? "Sampled" : "Timed",
+		scr_prof.numFrames, (float)(Sys_Milliseconds() - scr_prof.startTime) / 1000.0f);
+
+	for(i = 0, count = 0; i < 2 * SCR_PROF_MAX_BUILTINS; i++)
+	{
+		if(scr_prof.builtins[i].calls > 0)
+		{
+			order[count++] = i;
+		}
+	}
+	qsort(order, count, sizeof(order[0]), Scr_ProfCompareBuiltins);
+
+	if(scr_profSortSampled)
+	{
+		Com_Printf("\n%u samples\n", scr_prof.numSamples);
+		Com_Printf("builtin                           calls     self %%   total %%  errors\n");
+		Com_Printf("------------------------------ ---------- -------- -------- -------\n");
+	}else{
+		Com_Printf("\nbuiltin                           calls  self msec total msec max usec  errors\n");
+		Com_Printf("------------------------------ ---------- ---------- ---------- -------- -------\n");
+	}
+	for(i = 0; i < count && i < SCR_PROF_REPORT_LINES; i++)
+	{
+		b = &scr_prof.builtins[order[i]];
+		if(scr_profSortSampled)
+		{
+			Com_Printf("%-30s %10u %8.2f %8.2f %7u\n", b->name, b->calls,
+				scr_prof.numSamples ? 100.0f * b->selfSamples / scr_prof.numSamples : 0.0f,
+				scr_prof.numSamples ? 100.0f * b->samples / scr_prof.numSamples : 0.0f, b->errors);
+		}else{
+			Com_Printf("%-30s %10u %10.2f %10.2f %8u %7u\n", b->name, b->calls, (float)b->selfUsec / 1000.0f,
+				(float)b->totalUsec / 1000.0f, b->maxUsec, b->errors);
+		}
+	}
+
+	for(i = 0, count = 0; i < SCR_PROF_MAX_EVENTS; i++)
+	{
+		if(scr_prof.events[i].name[0])
+		{
+			order[count++] = i;
+		}
+	}
+	qsort(order, count, sizeof(order[0]), Scr_ProfCompareEvents);
+
+	if(scr_profSortSampled)
+	{
+		Com_Printf("\nnotify                            count  samples %%\n");
+		Com_Printf("------------------------------ ---------- ---------\n");
+	}else{
+		Com_Printf("\nnotify                            count total msec max usec\n");
+		Com_Printf("------------------------------ ---------- ---------- --------\n");
+	}
+	for(i = 0; i < count && i < SCR_PROF_REPORT_LINES; i++)
+	{
+		e = &scr_prof.events[order[i]];
+		if(scr_profSortSampled)
+		{
+			Com_Printf("%-30s %10u %9.2f\n", e->name, e->count,
+				scr_prof.numSamples ? 100.0f * e->samples / scr_prof.numSamples : 0.0f);
+		}else{
+			Com_Printf("%-30s %10u %10.2f %8u\n", e->name, e->count, (float)e->totalUsec / 1000.0f, e->maxUsec);
+		}
+	}
+
+	Com_Printf("\nScript threads in waittill: %d (peak %d) wait: %d (peak %d) other: %d (peak %d)\n",
+		scr_prof.waittillThreads, scr_prof.maxWaittillThreads, scr_prof.waitThreads, scr_prof.maxWaitThreads,
+		scr_prof.otherThreads, scr_prof.maxOtherThreads);
+	Com_Printf("Runtime errors outside of builtins: %u\n", scr_prof.scriptErrors);
+
+	Sys_LeaveCriticalSection(CRIT_MISC);
+}
+
+/*
+=================
+Scr_ProfWriteFolded
+
+One line per stack: the scopes separated by ';' and the usec or samples spent on top of it
+=================
+*/
+static void Scr_ProfWriteFolded( const char* filename )
+{
+	scrProfStack_t* stack;
+	fileHandle_t f;
+	char line[2048];
+	int i, j, lines;
+	mvabuf;
+
+	f = FS_SV_FOpenFileWrite(filename);
+	if(f == 0)
+	{
+		Com_PrintError("Scr_ProfWriteFolded: Could not open %s for writing\n", filename);
+		return;
+	}
+
+	Sys_EnterCriticalSection(CRIT_MISC);
+
+	for(i = 0, lines = 0; i < SCR_PROF_MAX_STACKS; i++)
+	{
+		stack = &scr_prof.stacks[i];
+		if(stack->depth == 0 || stack->weight == 0)
+		{
+			continue;
+		}
+		line[0] = '\0';
+		for(j = 0; j < stack->depth; j++)
+		{
+			if(j > 0)
+			{
+				Q_strcat(line, sizeof(line), ";");
+			}
+			Scr_ProfAppendName(line, sizeof(line), stack->ids[j]);
+		}
+		Q_strcat(line, sizeof(line), va(" %llu\n", stack->weight));
+		FS_Write(line, strlen(line), f);
+		lines++;
+	}
+	if(scr_prof.droppedWeight > 0)
+	{
+		Com_PrintWarning("Stack table was full, %llu usec or samples have not been recorded\n", scr_prof.droppedWeight);
+	}
+
+	Sys_LeaveCriticalSection(CRIT_MISC);
+
+	FS_FCloseFile(f);
+	Com_Printf("Wrote %d stacks to %s\n", lines, filename);
+}
+
+static void Scr_ProfScriptProfile_f( void )
+{
+	if(Cmd_Argc() > 1 && !Q_stricmp(Cmd_Argv(1), "reset"))
+	{
+		Scr_ProfReset();
+		Com_Printf("Script profiler has been reset\n");
+		return;
+	}
+	if(Cmd_Argc() > 1 && !Q_stricmp(Cmd_Argv(1), "folded"))
+	{
+		Scr_ProfWriteFolded(Cmd_Argc() > 2 ? Cmd_Argv(2) : "scriptprofile.folded");
+		return;
+	}
+	if(Cmd_Argc() > 1)
+	{
+		Com_Printf("Usage: scriptprofile [reset | folded <filename>]\n");
+		return;
+	}
+	Scr_ProfPrintReport();
+}
+
+void Scr_ProfInit( void )
+{
+	scr_profile = Cvar_RegisterInt("scr_profile", 0, 0, 2, 0, "Script profiler. 1 times every builtin and notify, 2 samples the script stack every millisecond. Builtins get profiled from the next map load on");
+
+	Cmd_AddCommand("scriptprofile", Scr_ProfScriptProfile_f);
+}
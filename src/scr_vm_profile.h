@@ -0,0 +1,41 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+    Copyright (C) 1999-2005 Id Software, Inc.
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+
+#ifndef __SCR_VM_PROFILE_H__
+#define __SCR_VM_PROFILE_H__
+
+#include "q_shared.h"
+#include "scr_vm.h"
+
+void Scr_ProfInit( void );
+void Scr_ProfBeginFrame( void );
+void Scr_ProfEndFrame( void );
+xfunction_t Scr_ProfWrapFunction( const char* name, xfunction_t function, qboolean method );
+int Scr_ProfNotifyBegin( int constString );
+void Scr_ProfNotifyEnd( int depth );
+void Scr_ProfRuntimeError( void );
+
+#endif
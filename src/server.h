@@ -596,6 +596,9 @@ void SV_SendClientSnapshot( client_t *cl );
 
 qboolean SV_Acceptclient(int);
 client_t* SV_ReadPackets(netadr_t *from, unsigned int qport);
+void SV_ClientMapInsert( client_t *cl );
+void SV_ClientMapRemove( client_t *cl );
+qboolean SV_ClientMapAllowDisconnectReply( netadr_t *from, unsigned int qport );
 void SV_GetVoicePacket(netadr_t *from, msg_t* msg);
 void SV_UserVoice(client_t* cl, msg_t* msg);
 void SV_PreGameUserVoice(client_t* cl, msg_t* msg);
@@ -626,9 +629,29 @@ void SV_WriteDemoMessageForClient( byte *msg, int dataLen, client_t *client );
 void SV_StopRecord( client_t *cl );
 void SV_RecordClient( client_t* cl, char* basename );
 void SV_DemoSystemShutdown( void );
+void SV_DemoSystemFrame( void );
+void SV_ServerRecord( const char* basename );
+void SV_StopServerRecord( void );
+void SV_ServerDemoWriteSnapshot( byte* data, int len, int frame );
+void SV_ServerDemoWriteCommand( client_t* cl, int cmdtype, const char* cmd );
 void SV_WriteDemoArchive(client_t *client);
+void SV_DemoBufferStart( client_t* cl );
+void SV_DemoBufferFree( client_t* cl );
+qboolean SV_DemoBufferNeedsKeyframe( client_t* cl );
+void SV_DemoBufferKeyframe( client_t* cl );
+qboolean SV_DemoBufferDump( client_t* cl, const char* basename );
 
 void SV_SendClientVoiceData(client_t *client);
+unsigned int SV_PaceFragments( void );
+void SV_PacerClientConnected( client_t *client, int rtt );
+void SV_GamestateBegin( client_t *client );
+void SV_GamestateComplete( client_t *client );
+void SV_GamestateTimes_f( void );
+
+void SV_EntityGridUpdate( void );
+int SV_EntityGridRadius( const vec3_t origin, float radius, qboolean playersOnly, int* list, int maxCount );
+int SV_EntityGridBox( const vec3_t mins, const vec3_t maxs, qboolean playersOnly, int* list, int maxCount );
+int SV_EntityGridNearestPlayer( const vec3_t origin, float maxDist, int ignoreNum );
 
 void SV_InitCvarsOnce( void );
 
@@ -723,8 +746,15 @@ void SV_GetConfigstring( int index, char *buffer, int bufferSize );
 extern cvar_t* sv_protocol;
 extern cvar_t* sv_padPackets;
 extern cvar_t* sv_demoCompletedCmd;
+extern cvar_t* sv_demoSyncInterval;
+extern cvar_t* sv_demoBuffer;
+extern cvar_t* sv_demoBufferSize;
+extern cvar_t* sv_demoBufferKeyframe;
 extern cvar_t* sv_mapDownloadCompletedCmd;
 extern cvar_t* sv_wwwBaseURL;
+extern cvar_t* sv_wwwServe;
+extern cvar_t* sv_wwwServeMaxPerIP;
+extern cvar_t* sv_wwwServeRate;
 extern cvar_t* sv_maxPing;
 extern cvar_t* sv_minPing;
 extern cvar_t* sv_authorizemode;
@@ -733,6 +763,9 @@ extern cvar_t* sv_privatePassword;
 extern cvar_t* sv_reconnectlimit;
 extern cvar_t* sv_wwwDlDisconnected;
 extern cvar_t* sv_allowDownload;
+extern cvar_t* sv_downloadWindow;
+extern cvar_t* sv_fragmentPacing;
+extern cvar_t* sv_downloadCacheSize;
 extern cvar_t* sv_wwwDownload;
 extern cvar_t* sv_autodemorecord;
 extern cvar_t* sv_modStats;
@@ -45,6 +45,7 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stdlib.h>
 
 //AntiDoS
 /*
@@ -394,7 +395,7 @@ __optimize3 __regparm1 void SV_DirectConnect( netadr_t *from ) {
 	int			c;
 
 	// see if the challenge is valid
-	int		ping;
+	int		ping = -1;
 	for (c=0 ; c < MAX_CHALLENGES ; c++) {
 		if (NET_CompareAdr(from, &svse.challenges[c].adr)) {
 			if ( challenge == svse.challenges[c].challenge ) {
@@ -807,6 +808,7 @@ __optimize3 __regparm1 void SV_DirectConnect( netadr_t *from ) {
 	Netchan_Setup( NS_SERVER, &newcl->netchan, *from, qport,
 			 newcl->unsentBuffer, sizeof(newcl->unsentBuffer),
 			 newcl->fragmentBuffer, sizeof(newcl->fragmentBuffer));
+	SV_ClientMapInsert( newcl );
 
 #ifdef COD4X17A
 	svse.challenges[c].connected = qtrue;
@@ -822,6 +824,16 @@ __optimize3 __regparm1 void SV_DirectConnect( netadr_t *from ) {
 	newcl->lastPacketTime = svs.time;
 	newcl->lastConnectTime = svs.time;
 
+#ifdef COD4X17A
+	if(ping < 0 && svse.challenges[c].pingTime)
+	{
+		ping = com_frameTime - svse.challenges[c].pingTime;
+	}
+	SV_PacerClientConnected( newcl, ping );
+#else
+	SV_PacerClientConnected( newcl, -1 );
+#endif
+
 #ifndef COD4X17A
 #ifdef COD4X18UPDATE
 	if(newcl->needupdate)
@@ -1057,6 +1069,8 @@ static void SV_UpdateUserinfo_f( client_t *cl ) {
 }*/
 
 
+static void SV_CloseDownload( client_t *cl );
+
 /*
 =====================
 SV_DropClient
@@ -1082,6 +1096,8 @@ __cdecl void SV_DropClient( client_t *drop, const char *reason ) {
 	{
 		SV_StopRecord(drop);
 	}
+	SV_DemoBufferFree(drop);
+	SV_CloseDownload(drop);
 	Q_strncpyz(clientName, drop->name, sizeof(clientName));
 
 	clientnum = drop - svs.clients;
@@ -1334,10 +1350,9 @@ __optimize3 __regparm3 void SV_UserMove( client_t *cl, msg_t *msg, qboolean delt
 
 		SV_ClientThink( cl, &cmds[ i ] );
 	
-		PHandler_Event(PLUGINS_ONCLIENTMOVECOMMAND, cl, &cmds[ i ]);
+		PHandler_EventClientMove(cl, &cmds[ i ]);
 
-		if(cl->demorecording && !cl->demowaiting)
-			SV_WriteDemoArchive(cl);
+		SV_WriteDemoArchive(cl);
 	}
 }
 
@@ -1357,6 +1372,7 @@ void SV_ClientEnterWorld( client_t *client, usercmd_t *cmd ) {
 */
 	Com_DPrintf( "Going from CS_PRIMED to CS_ACTIVE for %s\n", client->name );
 	client->state = CS_ACTIVE;
+	SV_GamestateComplete( client );
 
 	// set up the entity for the client
 	clientNum = client - svs.clients;
@@ -1386,6 +1402,8 @@ void SV_ClientEnterWorld( client_t *client, usercmd_t *cmd ) {
 	//Set gravity, speed... to system default
 	Pmove_ExtendedInitForClient(client);
 
+	SV_DemoBufferStart(client);
+
 	if(sv_autodemorecord->boolean && !client->demorecording && (client->netchan.remoteAddress.type == NA_IP || client->netchan.remoteAddress.type == NA_IP6))
 	{
 		if(psvs.useuids){
@@ -1657,11 +1675,24 @@ void SV_SetUid(unsigned int clnum, unsigned int uid){
 ==================
 SV_WWWRedirect
 
-Send the client the full url of the http/ftp download server
+Send the client the full url of the http/ftp download server.
+Returns qfalse if there is no url to send, the file has to go over UDP then.
+The address the server is bound to can not be used for the builtin HTTP
+server as it is 0.0.0.0 or a private address in most setups
 ==================
 */
 
-void SV_WWWRedirect(client_t *cl, msg_t *msg){
+qboolean SV_WWWRedirect(client_t *cl, msg_t *msg){
+
+    static int lastWarning;
+
+    if(!*sv_wwwBaseURL->string){
+        if(svs.time - lastWarning > 60000 || lastWarning == 0){
+            lastWarning = svs.time;
+            Com_PrintWarning("sv_wwwDownload is enabled but sv_wwwBaseURL is not set. Sending downloads over UDP\n");
+        }
+        return qfalse;
+    }
 
     Com_sprintf(cl->wwwDownloadURL, sizeof(cl->wwwDownloadURL), "%s/%s", sv_wwwBaseURL->string, cl->downloadName);
 
@@ -1683,6 +1714,339 @@ void SV_WWWRedirect(client_t *cl, msg_t *msg){
 
     cl->download = 0;
     *cl->downloadName = 0;
+    return qtrue;
+}
+
+
+/*
+===============================================================================
+
+Download block cache
+
+All clients downloading the same file share one copy of it. The file is
+read once, sequentially, only as far as the furthest client needs it, and
+the blocks get written from the cache straight into the client messages.
+Files are kept for a while after the last download has finished as players
+usually join shortly after each other.
+
+===============================================================================
+*/
+
+#define MAX_DOWNLOAD_CACHE		16
+#define MAX_DOWNLOAD_CACHE_WINDOW	64	// upper limit for sv_downloadWindow
+#define DOWNLOAD_CACHE_READSIZE	(32 * MAX_DOWNLOAD_BLKSIZE)
+#define DOWNLOAD_CACHE_KEEPTIME	300000
+#define DOWNLOAD_RTO_MIN		150
+#define DOWNLOAD_RTO_MAX		5000
+
+typedef struct{
+	char name[MAX_QPATH];
+	byte* data;
+	int size;
+	int loaded;		// bytes read from disk so far
+	fileHandle_t file;	// open until the file is completely loaded
+	int refcount;
+	int lastUsed;
+	qboolean broken;	// a read has failed, don't hand it out again
+}downloadCache_t;
+
+typedef struct{
+	downloadCache_t* cache;
+	int xmitTime[MAX_DOWNLOAD_CACHE_WINDOW];	// 0 if this block has been retransmitted
+	int firstNewBlock;	// blocks below this one have been sent before
+	int srtt;
+	int rttvar;
+	int rto;
+}clientDownload_t;
+
+static downloadCache_t sv_downloadCache[MAX_DOWNLOAD_CACHE];
+static clientDownload_t sv_clientDownloads[MAX_CLIENTS];
+
+
+static void SV_DownloadCacheFree( downloadCache_t* entry )
+{
+	if(entry->file)
+	{
+		FS_FCloseFile( entry->file );
+	}
+	if(entry->data)
+	{
+		free( entry->data );
+	}
+	Com_Memset( entry, 0, sizeof(downloadCache_t) );
+}
+
+static int SV_DownloadCacheMemory( )
+{
+	int i, total;
+
+	for(i = 0, total = 0; i < MAX_DOWNLOAD_CACHE; i++)
+	{
+		if(sv_downloadCache[i].data)
+			total += sv_downloadCache[i].size;
+	}
+	return total;
+}
+
+/*
+==================
+SV_DownloadCacheAcquire
+
+Returns the cache entry for this file. Takes the ownership of the file handle
+if a new entry got created. Returns NULL if the file can not be cached
+==================
+*/
+static downloadCache_t* SV_DownloadCacheAcquire( const char* name, fileHandle_t *file, int size )
+{
+	downloadCache_t *entry, *freeEntry, *oldest;
+	int i, limit;
+
+	limit = sv_downloadCacheSize->integer * 1024 * 1024;
+
+	if(size > limit)
+	{
+		return NULL;
+	}
+
+	freeEntry = NULL;
+
+	for(i = 0, entry = sv_downloadCache; i < MAX_DOWNLOAD_CACHE; i++, entry++)
+	{
+		if(entry->data == NULL)
+		{
+			if(freeEntry == NULL)
+				freeEntry = entry;
+			continue;
+		}
+
+		if(!entry->broken && entry->size == size && !Q_stricmp(entry->name, name))
+		{
+			if(entry->refcount == 0 && svs.time - entry->lastUsed > DOWNLOAD_CACHE_KEEPTIME)
+			{
+				// might have been replaced on disk
+				SV_DownloadCacheFree( entry );
+				freeEntry = entry;
+				break;
+			}
+			entry->refcount++;
+			entry->lastUsed = svs.time;
+			return entry;
+		}
+
+		if(entry->refcount == 0 && svs.time - entry->lastUsed > DOWNLOAD_CACHE_KEEPTIME)
+		{
+			SV_DownloadCacheFree( entry );
+			if(freeEntry == NULL)
+				freeEntry = entry;
+		}
+	}
+
+	// evict unused files until it fits
+	while(freeEntry == NULL || SV_DownloadCacheMemory( ) + size > limit)
+	{
+		oldest = NULL;
+		for(i = 0, entry = sv_downloadCache; i < MAX_DOWNLOAD_CACHE; i++, entry++)
+		{
+			if(entry->data && entry->refcount == 0 && (oldest == NULL || entry->lastUsed - oldest->lastUsed < 0))
+				oldest = entry;
+		}
+		if(oldest == NULL)
+		{
+			return NULL;
+		}
+		SV_DownloadCacheFree( oldest );
+		if(freeEntry == NULL)
+			freeEntry = oldest;
+	}
+
+	freeEntry->data = malloc( size );
+	if(freeEntry->data == NULL)
+	{
+		return NULL;
+	}
+	Q_strncpyz(freeEntry->name, name, sizeof(freeEntry->name));
+	freeEntry->size = size;
+	freeEntry->loaded = 0;
+	freeEntry->file = *file;
+	freeEntry->refcount = 1;
+	freeEntry->lastUsed = svs.time;
+	freeEntry->broken = qfalse;
+	*file = 0;
+	return freeEntry;
+}
+
+static void SV_DownloadCacheRelease( downloadCache_t* entry )
+{
+	entry->refcount--;
+	entry->lastUsed = svs.time;
+	if(entry->refcount <= 0)
+	{
+		entry->refcount = 0;
+		if(entry->broken)
+			SV_DownloadCacheFree( entry );
+	}
+}
+
+/*
+==================
+SV_DownloadCacheLoad
+
+Makes sure the first bytes of the file are in memory. Returns the number of
+bytes available which is less only if the file could not be read. The entry
+is marked broken then and the downloads using it have to be aborted
+==================
+*/
+static int SV_DownloadCacheLoad( downloadCache_t* entry, int bytes )
+{
+	int len, read;
+
+	if(bytes > entry->size)
+		bytes = entry->size;
+
+	while(entry->loaded < bytes)
+	{
+		len = entry->size - entry->loaded;
+		if(len > DOWNLOAD_CACHE_READSIZE)
+			len = DOWNLOAD_CACHE_READSIZE;
+
+		read = FS_Read( entry->data + entry->loaded, len, entry->file );
+		if(read <= 0)
+		{
+			Com_PrintWarning("SV_DownloadCacheLoad: Failed to read %s\n", entry->name);
+			entry->broken = qtrue;
+			break;
+		}
+		entry->loaded += read;
+	}
+
+	if((entry->loaded == entry->size || entry->broken) && entry->file)
+	{
+		FS_FCloseFile( entry->file );
+		entry->file = 0;
+	}
+	return entry->loaded;
+}
+
+static void SV_DownloadResetRTT( clientDownload_t* dl )
+{
+	Com_Memset(dl->xmitTime, 0, sizeof(dl->xmitTime));
+	dl->firstNewBlock = 0;
+	dl->srtt = 0;
+	dl->rttvar = 0;
+	dl->rto = 1000;
+}
+
+/*
+==================
+SV_DownloadAck
+
+Takes a round trip sample from an acknowledged block. Retransmitted blocks
+are skipped as we don't know which transmission got acknowledged
+==================
+*/
+static void SV_DownloadAck( client_t* cl, int block )
+{
+	clientDownload_t* dl = &sv_clientDownloads[cl - svs.clients];
+	int *xmitTime = &dl->xmitTime[block % MAX_DOWNLOAD_CACHE_WINDOW];
+	int sample, delta;
+
+	if(*xmitTime == 0)
+	{
+		return;
+	}
+	sample = svs.time - *xmitTime;
+	*xmitTime = 0;
+
+	if(sample < 0)
+	{
+		return;
+	}
+
+	if(dl->srtt == 0)
+	{
+		dl->srtt = sample;
+		dl->rttvar = sample / 2;
+	}else{
+		delta = sample - dl->srtt;
+		if(delta < 0)
+			delta = -delta;
+		dl->rttvar = (3 * dl->rttvar + delta) / 4;
+		dl->srtt = (7 * dl->srtt + sample) / 8;
+	}
+
+	dl->rto = dl->srtt + 4 * dl->rttvar;
+	if(dl->rto < DOWNLOAD_RTO_MIN)
+		dl->rto = DOWNLOAD_RTO_MIN;
+	if(dl->rto > DOWNLOAD_RTO_MAX)
+		dl->rto = DOWNLOAD_RTO_MAX;
+}
+
+/*
+==================
+SV_DownloadRetransmit
+
+Go back to the first unacknowledged block
+==================
+*/
+static void SV_DownloadRetransmit( client_t* cl )
+{
+	clientDownload_t* dl = &sv_clientDownloads[cl - svs.clients];
+
+	Com_Memset(dl->xmitTime, 0, sizeof(dl->xmitTime));
+	cl->downloadXmitBlock = cl->downloadClientBlock;
+}
+
+static int SV_DownloadBlockSize( client_t* cl, int block )
+{
+	downloadCache_t* cache = sv_clientDownloads[cl - svs.clients].cache;
+	int size;
+
+	if(cache == NULL)
+	{
+		return cl->downloadBlockSize[block % MAX_DOWNLOAD_WINDOW];
+	}
+
+	size = cache->size - block * MAX_DOWNLOAD_BLKSIZE;
+	if(size > MAX_DOWNLOAD_BLKSIZE)
+		return MAX_DOWNLOAD_BLKSIZE;
+	if(size < 0)
+		return 0;
+	return size;
+}
+
+/*
+==================
+SV_DownloadFillCacheWindow
+
+Makes all blocks of the window available. Returns qfalse if the file could
+not be read, the client has been told the full size already
+==================
+*/
+static qboolean SV_DownloadFillCacheWindow( client_t* cl, downloadCache_t* cache )
+{
+	int endBlock, eofBlock;
+
+	endBlock = cl->downloadClientBlock + sv_downloadWindow->integer;
+
+	SV_DownloadCacheLoad( cache, endBlock * MAX_DOWNLOAD_BLKSIZE );
+	if( cache->broken )
+	{
+		return qfalse;
+	}
+
+	// the block after the last data block is the empty EOF block
+	eofBlock = (cache->size + MAX_DOWNLOAD_BLKSIZE -1) / MAX_DOWNLOAD_BLKSIZE;
+	if(endBlock > eofBlock + 1)
+		endBlock = eofBlock + 1;
+
+	if(cl->downloadCurrentBlock < endBlock)
+		cl->downloadCurrentBlock = endBlock;
+
+	cl->downloadCount = cl->downloadCurrentBlock * MAX_DOWNLOAD_BLKSIZE;
+	if(cl->downloadCount > cache->size)
+		cl->downloadCount = cache->size;
+	cl->downloadEOF = cl->downloadCurrentBlock > eofBlock;
+	return qtrue;
 }
 
 
@@ -1696,8 +2060,9 @@ Fill up msg with data
 */
 
 __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
-	int curindex;
+	int curindex, blockSize;
 	char errorMessage[1024];
+	clientDownload_t *dl = &sv_clientDownloads[cl - svs.clients];
 
 	if ( !*cl->downloadName ) {
 		return; // Nothing being downloaded
@@ -1707,7 +2072,7 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 		return;
 	}
 
-	if ( !cl->download ) {
+	if ( !cl->download && !dl->cache ) {
 		// We open the file here
 
 		// DHM - Nerve
@@ -1755,8 +2120,9 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 				cl->wwwDl_var03 = 0;
 				return;
 			}
-			SV_WWWRedirect(cl, msg);
-			return;
+			if(SV_WWWRedirect(cl, msg)){
+				return;
+			}
 		}
 
 		// Init
@@ -1765,15 +2131,40 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 		cl->downloadEOF = qfalse;
 
 		cl->wwwDownloadStarted = 0;
+
+		SV_DownloadResetRTT( dl );
+
+		// share the file with other clients downloading it
+		dl->cache = SV_DownloadCacheAcquire( cl->downloadName, &cl->download, cl->downloadSize );
+		if ( dl->cache && cl->download ) {
+			FS_FCloseFile( cl->download );
+			cl->download = 0;
+		}
 	}
 
-	while ( cl->downloadCurrentBlock - cl->downloadClientBlock < MAX_DOWNLOAD_WINDOW && cl->downloadSize != cl->downloadCount ) {
+	if ( dl->cache && !SV_DownloadFillCacheWindow( cl, dl->cache ) ) {
+		// the client would save a truncated file
+		Com_Printf( "clientDownload: %d : \"%s\" could not be read\n", cl - svs.clients, cl->downloadName );
+		Com_sprintf( errorMessage, sizeof( errorMessage ), "EXE_AUTODL_FILENOTONSERVER\x15%s", cl->downloadName );
+
+		MSG_WriteByte( msg, svc_download );
+		MSG_WriteLong( msg, 0 ); // client is expecting block zero
+		MSG_WriteLong( msg, -1 ); // illegal file size
+		MSG_WriteString( msg, errorMessage );
+
+		cl->wwwDl_var01 = 0;
+		// the broken entry gets freed once its last download is closed
+		SV_CloseDownload( cl );
+		return;
+	}
+
+	while ( !dl->cache && cl->downloadCurrentBlock - cl->downloadClientBlock < MAX_DOWNLOAD_WINDOW && cl->downloadSize != cl->downloadCount ) {
 
 		curindex = ( cl->downloadCurrentBlock % MAX_DOWNLOAD_WINDOW );
 
 		// Perform any reads that we need to
 		if ( !cl->downloadBlocks[curindex] ) {
-			cl->downloadBlocks[curindex] = Z_Malloc( MAX_DOWNLOAD_BLKSIZE);
+			cl->downloadBlocks[curindex] = Z_TagMalloc( MAX_DOWNLOAD_BLKSIZE, TAG_DOWNLOAD );
 			if ( !cl->downloadBlocks[curindex]) {//Crash fix for download subsystem
 				SV_DropClient(cl, "Failed to allocate a new chunk of memory for the serverdownloadsystem");
 				return;
@@ -1795,7 +2186,7 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 	}
 
 	// Check to see if we have eof condition and add the EOF block
-	if (cl->downloadCount == cl->downloadSize && !cl->downloadEOF && cl->downloadCurrentBlock - cl->downloadClientBlock < MAX_DOWNLOAD_WINDOW ) {
+	if (!dl->cache && cl->downloadCount == cl->downloadSize && !cl->downloadEOF && cl->downloadCurrentBlock - cl->downloadClientBlock < MAX_DOWNLOAD_WINDOW ) {
 
 		cl->downloadBlockSize[cl->downloadCurrentBlock % MAX_DOWNLOAD_WINDOW] = 0;
 		cl->downloadCurrentBlock++;
@@ -1815,10 +2206,13 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 	if ( cl->downloadXmitBlock == cl->downloadCurrentBlock ) {
 	// We have transmitted the complete window, should we start resending?
 
-		//FIXME:  This uses a hardcoded one second timeout for lost blocks
-		//the timeout should be based on client rate somehow
-		if ( svs.time - cl->downloadSendTime > 1000 ) {
-			cl->downloadXmitBlock = cl->downloadClientBlock;
+		// The timeout follows the round trip time of the acknowledges
+		if ( svs.time - cl->downloadSendTime > dl->rto ) {
+			SV_DownloadRetransmit( cl );
+			dl->rto *= 2;
+			if ( dl->rto > DOWNLOAD_RTO_MAX ) {
+				dl->rto = DOWNLOAD_RTO_MAX;
+			}
 		} else {
 			return;
 		}
@@ -1835,10 +2229,16 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 		MSG_WriteLong( msg, cl->downloadSize );
 	}
 
-	MSG_WriteShort( msg, cl->downloadBlockSize[curindex] );
+	blockSize = SV_DownloadBlockSize( cl, cl->downloadXmitBlock );
+
+	MSG_WriteShort( msg, blockSize );
 
 	// Write the block
-	if ( cl->downloadBlockSize[curindex] ) {
+	if ( blockSize && dl->cache ) {
+
+		MSG_WriteData( msg, dl->cache->data + cl->downloadXmitBlock * MAX_DOWNLOAD_BLKSIZE, blockSize );
+
+	} else if ( blockSize ) {
 		if ( !cl->downloadBlocks[curindex]) {//Crash evaluation for download subsystem
 			Com_PrintError("FATAL Server error in SV_WriteDownloadToClient.\nClient: %i, Name: %s, File: %s, CLDlBlock: %i, DlSize: %i, DlBlkSize: %i, DlSendTime: %i, ServerTime: %i, XmitBlock: %i, ClientState: %i, CurIndex: %i",
 			cl - svs.clients, cl->name, cl->downloadName, cl->downloadClientBlock, cl->downloadSize, cl->downloadBlockSize[curindex], cl->downloadSendTime, svs.time, cl->downloadXmitBlock, cl->state, curindex);
@@ -1851,6 +2251,12 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 
 	Com_DPrintf( "clientDownload: %d : writing block %d\n", cl - svs.clients, cl->downloadXmitBlock );
 
+	// only first transmissions give usable round trip samples
+	if ( cl->downloadXmitBlock >= dl->firstNewBlock ) {
+		dl->xmitTime[cl->downloadXmitBlock % MAX_DOWNLOAD_CACHE_WINDOW] = svs.time;
+		dl->firstNewBlock = cl->downloadXmitBlock + 1;
+	}
+
 	// Move on to the next block
 	// It will get sent with next snap shot.  The rate will keep us in line.
 	cl->downloadXmitBlock++;
@@ -1920,6 +2326,9 @@ void SV_SendClientGameState( client_t *client ) {
 
 	Com_DPrintf( "SV_SendClientGameState() for %s\n", client->name );
 	Com_DPrintf( "Going from CS_CONNECTED to CS_PRIMED for %s\n", client->name );
+	if ( client->state == CS_CONNECTED ) {
+		SV_GamestateBegin( client );
+	}
 	client->state = CS_PRIMED;
 	client->pureAuthentic = 0;
 
@@ -1972,6 +2381,7 @@ clear/free any download vars
 */
 static void SV_CloseDownload( client_t *cl ) {
 	int i;
+	clientDownload_t *dl = &sv_clientDownloads[cl - svs.clients];
 
 	// EOF
 	if ( cl->download ) {
@@ -1980,6 +2390,11 @@ static void SV_CloseDownload( client_t *cl ) {
 	cl->download = 0;
 	*cl->downloadName = 0;
 
+	if ( dl->cache ) {
+		SV_DownloadCacheRelease( dl->cache );
+		dl->cache = NULL;
+	}
+
 	// Free the temporary buffer space
 	for ( i = 0; i < MAX_DOWNLOAD_WINDOW; i++ ) {
 		if ( cl->downloadBlocks[i] ) {
@@ -2302,12 +2717,13 @@ void SV_NextDownload_f( client_t *cl ) {
 		Com_DPrintf( "clientDownload: %d : client acknowledge of block %d\n", cl - svs.clients, block );
 
 		// Find out if we are done.  A zero-length block indicates EOF
-		if ( cl->downloadBlockSize[cl->downloadClientBlock % MAX_DOWNLOAD_WINDOW] == 0 ) {
+		if ( SV_DownloadBlockSize( cl, cl->downloadClientBlock ) == 0 ) {
 			Com_Printf( "clientDownload: %d : file \"%s\" completed\n", cl - svs.clients, cl->downloadName );
 			SV_CloseDownload( cl );
 			return;
 		}
 
+		SV_DownloadAck( cl, block );
 		cl->downloadSendTime = svs.time;
 		cl->downloadClientBlock++;
 		return;
@@ -2332,7 +2748,7 @@ void SV_RetransmitDownload_f( client_t *cl ) {
 	int block = atoi( SV_Cmd_Argv( 1 ) );
 
 	if ( block == cl->downloadClientBlock ) {
-		cl->downloadXmitBlock = block;
+		SV_DownloadRetransmit( cl );
 	}
 }
 
@@ -2639,26 +3055,38 @@ void SV_WriteClientVoiceData(msg_t *msg, client_t *client)
 	
 }
 
+/*
+==================
+SV_SendClientVoiceData
+
+All recipients share one buffer which already carries the out of band header,
+so the message is built once in place and handed to NET_SendPacket without
+the copy NET_OutOfBandData would make. A full queue of 40 packets needs a bit
+more than 10 KB.
+==================
+*/
+#define VOICE_MSG_MAXLEN (4 + 2 + 1 + sizeof(((client_t*)0)->voicedata) / sizeof(voices_t) * (2 + sizeof(((voices_t*)0)->data)))
+
 void SV_SendClientVoiceData(client_t *client)
 {
-	
+	static byte buff[VOICE_MSG_MAXLEN];
 	msg_t msg;
-	byte buff[0x20000];
-	
+
 	if ( client->state < CS_ACTIVE || client->unsentVoiceData == 0)
 	{
 		return;
 	}
-    MSG_Init(&msg, buff, sizeof(buff));
-    MSG_WriteString(&msg, "v");
-    SV_WriteClientVoiceData(&msg, client);
-    if ( msg.overflowed )
-    {
+	MSG_Init(&msg, buff, sizeof(buff));
+	MSG_WriteLong(&msg, -1);
+	MSG_WriteString(&msg, "v");
+	SV_WriteClientVoiceData(&msg, client);
+	if ( msg.overflowed )
+	{
 		Com_PrintWarning( "WARNING: voice msg overflowed for %s\n", client->shortname);
 		return;
-    }
-    NET_OutOfBandData(NS_SERVER, &client->netchan.remoteAddress, msg.data, msg.cursize);
-    client->unsentVoiceData = 0;
+	}
+	NET_SendPacket(NS_SERVER, msg.cursize, msg.data, &client->netchan.remoteAddress);
+	client->unsentVoiceData = 0;
 }
 
 void SV_GetVoicePacket(netadr_t *from, msg_t *msg)
@@ -2682,12 +3110,300 @@ void SV_GetVoicePacket(netadr_t *from, msg_t *msg)
 	}
 }
 
-client_t* SV_ReadPackets(netadr_t *from, unsigned int qport)
+/*
+==================
+Address to client lookup
+
+Maps the base address and qport of a client to its slot with an open
+addressing hash table (linear probing, backward shift deletion).
+The UDP port is not part of the key, so a translated port needs no rehash.
+Hits get validated against the client slot. Entries left behind by clients
+going to CS_FREE are therefore harmless and removed on the next lookup.
+Unknown senders go into a small negative cache so floods of sequenced junk
+packets neither scan all slots nor get a "disconnect" reply for every packet.
+==================
+*/
+#define CLIENTMAP_SIZE				256		// Must be a power of 2 and well above MAX_CLIENTS
+#define CLIENTMAP_NEGCACHE_SIZE		256		// Must be a power of 2
+#define CLIENTMAP_NEGCACHE_TIME		1000	// msec
+
+typedef struct{
+	netadrtype_t type;
+	byte ip6[16];
+	unsigned short qport;
+	short slot;		// -1 = empty
+}clientMapEntry_t;
+
+typedef struct{
+	netadrtype_t type;
+	byte ip6[16];
+	unsigned short qport;
+	qboolean valid;
+	int time;		// time of the last "disconnect" reply
+}clientMapNegEntry_t;
+
+static clientMapEntry_t sv_clientMap[CLIENTMAP_SIZE];
+static clientMapNegEntry_t sv_clientMapNeg[CLIENTMAP_NEGCACHE_SIZE];
+static qboolean sv_clientMapInitialized;
+
+static void SV_ClientMapInit( )
+{
+	int i;
+
+	for(i = 0; i < CLIENTMAP_SIZE; i++)
+	{
+		sv_clientMap[i].slot = -1;
+	}
+	Com_Memset(sv_clientMapNeg, 0, sizeof(sv_clientMapNeg));
+	sv_clientMapInitialized = qtrue;
+}
+
+static int SV_ClientMapAddrLen( netadrtype_t type )
+{
+	if(type == NA_IP || type == NA_TCP)
+		return 4;
+	if(type == NA_IP6 || type == NA_TCP6)
+		return 16;
+	return 0;
+}
+
+static unsigned int SV_ClientMapHash( netadrtype_t type, const byte *ip6, unsigned short qport )
+{
+	unsigned int hash = 2166136261u;
+	int i, len;
+
+	len = SV_ClientMapAddrLen(type);
+
+	for(i = 0; i < len; i++)
+	{
+		hash = (hash ^ ip6[i]) * 16777619u;
+	}
+	hash = (hash ^ type) * 16777619u;
+	hash = (hash ^ (qport & 0xff)) * 16777619u;
+	hash = (hash ^ (qport >> 8)) * 16777619u;
+	return hash;
+}
+
+static qboolean SV_ClientMapKeyEqual( netadrtype_t type, const byte *ip6, unsigned short qport, netadr_t *adr, unsigned short adrqport )
+{
+	if(type != adr->type || qport != adrqport)
+		return qfalse;
+
+	return memcmp(ip6, adr->ip6, SV_ClientMapAddrLen(type)) == 0;
+}
+
+static void SV_ClientMapDeleteIndex( unsigned int index )
+{
+	unsigned int next, ideal;
+
+	sv_clientMap[index].slot = -1;
+
+	// shift the following entries of this cluster back so lookups don't need tombstones
+	next = (index + 1) & (CLIENTMAP_SIZE -1);
+
+	while(sv_clientMap[next].slot != -1)
+	{
+		ideal = SV_ClientMapHash(sv_clientMap[next].type, sv_clientMap[next].ip6, sv_clientMap[next].qport) & (CLIENTMAP_SIZE -1);
+
+		// move the entry if the hole lies cyclically between its ideal position and its current position
+		if(((next - ideal) & (CLIENTMAP_SIZE -1)) >= ((next - index) & (CLIENTMAP_SIZE -1)))
+		{
+			sv_clientMap[index] = sv_clientMap[next];
+			sv_clientMap[next].slot = -1;
+			index = next;
+		}
+		next = (next + 1) & (CLIENTMAP_SIZE -1);
+	}
+}
+
+static int SV_ClientMapFindIndex( netadr_t *adr, unsigned short qport )
+{
+	unsigned int index;
+	int i;
+
+	index = SV_ClientMapHash(adr->type, adr->ip6, qport) & (CLIENTMAP_SIZE -1);
+
+	for(i = 0; i < CLIENTMAP_SIZE; i++, index = (index + 1) & (CLIENTMAP_SIZE -1))
+	{
+		if(sv_clientMap[index].slot == -1)
+			return -1;
+
+		if(SV_ClientMapKeyEqual(sv_clientMap[index].type, sv_clientMap[index].ip6, sv_clientMap[index].qport, adr, qport))
+			return index;
+	}
+	return -1;
+}
+
+static clientMapNegEntry_t* SV_ClientMapNegEntry( netadr_t *adr, unsigned short qport )
+{
+	return &sv_clientMapNeg[SV_ClientMapHash(adr->type, adr->ip6, qport) & (CLIENTMAP_NEGCACHE_SIZE -1)];
+}
+
+static void SV_ClientMapRemoveNeg( netadr_t *adr, unsigned short qport )
+{
+	clientMapNegEntry_t *neg = SV_ClientMapNegEntry(adr, qport);
+
+	if(neg->valid && SV_ClientMapKeyEqual(neg->type, neg->ip6, neg->qport, adr, qport))
+	{
+		neg->valid = qfalse;
+	}
+}
+
+/*
+==================
+SV_ClientMapRemove
+
+Removes a client from the address lookup
+==================
+*/
+void SV_ClientMapRemove( client_t *cl )
+{
+	int index;
+
+	if(!sv_clientMapInitialized)
+		return;
+
+	index = SV_ClientMapFindIndex(&cl->netchan.remoteAddress, cl->netchan.qport);
+
+	if(index >= 0 && sv_clientMap[index].slot == cl - svs.clients)
+	{
+		SV_ClientMapDeleteIndex(index);
+	}
+}
+
+static qboolean SV_ClientMapInsertIndex( netadr_t *adr, unsigned short qport, int slot )
+{
+	unsigned int index;
+	int i;
+
+	index = SV_ClientMapHash(adr->type, adr->ip6, qport) & (CLIENTMAP_SIZE -1);
+
+	for(i = 0; i < CLIENTMAP_SIZE; i++, index = (index + 1) & (CLIENTMAP_SIZE -1))
+	{
+		if(sv_clientMap[index].slot == -1)
+		{
+			sv_clientMap[index].type = adr->type;
+			Com_Memcpy(sv_clientMap[index].ip6, adr->ip6, sizeof(sv_clientMap[index].ip6));
+			sv_clientMap[index].qport = qport;
+			sv_clientMap[index].slot = slot;
+			return qtrue;
+		}
+	}
+	return qfalse;
+}
+
+/*
+==================
+SV_ClientMapPurge
+
+Deletes all entries which do not point to a client with this address anymore
+==================
+*/
+static void SV_ClientMapPurge( )
+{
+	client_t *cl;
+	int i;
+
+	for(i = 0; i < CLIENTMAP_SIZE; i++)
+	{
+		// deleting shifts the next entry into this index, so look at it again
+		while(sv_clientMap[i].slot != -1)
+		{
+			cl = &svs.clients[sv_clientMap[i].slot];
+
+			if(sv_clientMap[i].slot < sv_maxclients->integer && cl->state != CS_FREE
+			&& SV_ClientMapKeyEqual(sv_clientMap[i].type, sv_clientMap[i].ip6, sv_clientMap[i].qport, &cl->netchan.remoteAddress, cl->netchan.qport))
+			{
+				break;
+			}
+			SV_ClientMapDeleteIndex(i);
+		}
+	}
+}
+
+/*
+==================
+SV_ClientMapInsert
+
+Makes a client known to the address lookup. Must be called whenever
+netchan.remoteAddress or netchan.qport of a client got a new value.
+==================
+*/
+void SV_ClientMapInsert( client_t *cl )
+{
+	static int lastWarning;
+	int index, now;
+	netadr_t *adr = &cl->netchan.remoteAddress;
+	unsigned short qport = cl->netchan.qport;
+
+	if(!sv_clientMapInitialized)
+		SV_ClientMapInit( );
+
+	if(SV_ClientMapAddrLen(adr->type) == 0)
+		return;		// loopback and bots don't go through here
+
+	SV_ClientMapRemoveNeg(adr, qport);
+
+	index = SV_ClientMapFindIndex(adr, qport);
+	if(index >= 0)
+	{
+		sv_clientMap[index].slot = cl - svs.clients;
+		return;
+	}
+
+	if(SV_ClientMapInsertIndex(adr, qport, cl - svs.clients))
+		return;
+
+	// entries of clients which are gone only get removed when a packet hits them
+	SV_ClientMapPurge( );
+
+	if(SV_ClientMapInsertIndex(adr, qport, cl - svs.clients))
+		return;
+
+	now = Sys_Milliseconds();
+	if(now - lastWarning >= 10000 || lastWarning == 0)
+	{
+		lastWarning = now;
+		Com_PrintWarning("SV_ClientMapInsert: Client address lookup is full\n");
+	}
+}
+
+/*
+==================
+SV_ClientMapAllowDisconnectReply
+
+Returns qtrue if the sender of a sequenced packet from an unknown address
+should be told to disconnect. Every sender gets only one reply per second.
+==================
+*/
+qboolean SV_ClientMapAllowDisconnectReply( netadr_t *from, unsigned int qport )
+{
+	clientMapNegEntry_t *neg;
+	int now;
+
+	if(!sv_clientMapInitialized)
+		SV_ClientMapInit( );
+
+	now = Sys_Milliseconds();
+	neg = SV_ClientMapNegEntry(from, qport);
+
+	if(neg->valid && SV_ClientMapKeyEqual(neg->type, neg->ip6, neg->qport, from, qport) && now - neg->time < CLIENTMAP_NEGCACHE_TIME)
+	{
+		return qfalse;
+	}
+	neg->type = from->type;
+	Com_Memcpy(neg->ip6, from->ip6, sizeof(neg->ip6));
+	neg->qport = qport;
+	neg->time = now;
+	neg->valid = qtrue;
+	return qtrue;
+}
+
+static client_t* SV_ReadPacketsScan(netadr_t *from, unsigned int qport)
 {
 	int i;
 	client_t *cl;
 
-	// find which client the message is from
 	for (i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
 	{
 		
@@ -2703,16 +3419,60 @@ client_t* SV_ReadPackets(netadr_t *from, unsigned int qport)
 		if ( cl->netchan.qport != qport ) {
 			continue;
 		}
-		
-		// the IP port can't be used to differentiate them, because
-		// some address translating routers periodically change UDP
-		// port assignments
-		if ( cl->netchan.remoteAddress.port != from->port ) {
-			Com_Printf( "SV_ReceiveStats: fixing up a translated port\n" );
-			cl->netchan.remoteAddress.port = from->port;
-		}
 		return cl;
-	
 	}
 	return NULL;
 }
+
+client_t* SV_ReadPackets(netadr_t *from, unsigned int qport)
+{
+	int index;
+	client_t *cl;
+	clientMapNegEntry_t *neg;
+
+	if(!sv_clientMapInitialized)
+		SV_ClientMapInit( );
+
+	// find which client the message is from
+	cl = NULL;
+	index = SV_ClientMapFindIndex(from, qport);
+
+	if(index >= 0)
+	{
+		cl = &svs.clients[sv_clientMap[index].slot];
+
+		if(sv_clientMap[index].slot >= sv_maxclients->integer || cl->state == CS_FREE
+		|| !NET_CompareBaseAdr( from, &cl->netchan.remoteAddress ) || cl->netchan.qport != qport)
+		{
+			// the client is gone
+			SV_ClientMapDeleteIndex(index);
+			cl = NULL;
+		}
+	}else{
+		// senders which got told to disconnect recently are known to be no clients
+		neg = SV_ClientMapNegEntry(from, qport);
+		if(neg->valid && SV_ClientMapKeyEqual(neg->type, neg->ip6, neg->qport, from, qport)
+		&& Sys_Milliseconds() - neg->time < CLIENTMAP_NEGCACHE_TIME)
+		{
+			return NULL;
+		}
+		// nothing should miss the lookup, the scan is only a safety net
+		cl = SV_ReadPacketsScan(from, qport);
+		if(cl)
+		{
+			SV_ClientMapInsert(cl);
+		}
+	}
+
+	if(cl == NULL)
+		return NULL;
+
+	// the IP port can't be used to differentiate them, because
+	// some address translating routers periodically change UDP
+	// port assignments
+	if ( cl->netchan.remoteAddress.port != from->port ) {
+		Com_Printf( "SV_ReceiveStats: fixing up a translated port\n" );
+		cl->netchan.remoteAddress.port = from->port;
+	}
+	return cl;
+}
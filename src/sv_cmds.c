@@ -43,6 +43,8 @@ These commands can only be entered from stdin or by a remote operator datagram
 #include "qcommon_mem.h"
 #include "sys_thread.h"
 #include "sys_main.h"
+#include "net_game.h"
+#include "varstorage.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -1329,6 +1331,73 @@ static void SV_StopRecord_f( void ) {
 }
 
 
+/*
+====================
+SV_ServerRecord_f
+
+serverrecord <demoname>
+Records all players into one server demo
+====================
+*/
+static void SV_ServerRecord_f( void ) {
+
+	if ( Cmd_Argc() > 2 ) {
+		Com_Printf( "serverrecord <demoname>\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() == 2 ) {
+		SV_ServerRecord( Cmd_Argv( 1 ) );
+	} else {
+		SV_ServerRecord( NULL );
+	}
+}
+
+static void SV_StopServerRecord_f( void ) {
+
+	SV_StopServerRecord( );
+}
+
+/*
+====================
+SV_DumpDemo_f
+
+dumpdemo <client> <demoname>
+Saves the rolling demo buffer of a client
+====================
+*/
+static void SV_DumpDemo_f( void ) {
+
+	char name[MAX_QPATH];
+	clanduid_t cl;
+
+	if ( Cmd_Argc() > 3 || Cmd_Argc() < 2) {
+		Com_Printf( "dumpdemo <client> <demoname>\n" );
+		return;
+	}
+
+	if(sv_demoBuffer->integer <= 0)
+	{
+		Com_Printf( "The demo buffer is disabled. Set sv_demoBuffer to the minutes to keep\n" );
+		return;
+	}
+
+	cl = SV_Cmd_GetPlayerByHandle();
+	if(!cl.cl){
+		Com_Printf("Error: This player is not online\n");
+		return;
+	}
+
+	if ( Cmd_Argc() == 3 ) {
+		Q_strncpyz(name, Cmd_Argv( 2 ), sizeof(name));
+	}else if(cl.cl->uid > 0){
+		Com_sprintf(name, sizeof(name), "demobuffer_%i_", cl.cl->uid);
+	}else{
+		Com_sprintf(name, sizeof(name), "demobuffer_%s_", cl.cl->pbguid);
+	}
+	SV_DemoBufferDump(cl.cl, name);
+}
+
 /*
 ====================
 SV_Record_f
@@ -1829,60 +1898,30 @@ void SV_DemoCompletedExec(const char* mapname)
 	Sys_TermProcess();
 }
 
-void SV_DownloadMapThread(char *inurl)
+typedef struct
 {
-	int len;
-	
 	char url[MAX_STRING_CHARS];
-	char dlurl[MAX_STRING_CHARS];
-	char *mapname;
-	char filename[MAX_OSPATH];
-	static qboolean downloadActive = 0;
-
-	
-	Q_strncpyz(url, inurl, sizeof(url));
-	Z_Free(inurl);
-	
-	
-	Sys_EnterCriticalSection(CRIT_MISC);
+	char mapname[MAX_QPATH];
+	qboolean success;
+	job_t *done;
+}mapDownload_t;
 
-	if(downloadActive)
-	{
-		Com_Printf("There is already a map download running. Won't download this.\n");
-		Sys_LeaveCriticalSection(CRIT_MISC);		
-		return;
-	}
-	downloadActive = qtrue;
-	
-	Sys_LeaveCriticalSection(CRIT_MISC);
+static qboolean sv_mapDownloadActive;
 
-	
-	len = strlen(url);
-	
-	if(url[len -1] == '/')
-		url[len -1] = '\0';
-	
-	mapname = strrchr(url, '/');
+static void SV_DownloadMapFiles(mapDownload_t *dl)
+{
+	char dlurl[MAX_STRING_CHARS];
+	char filename[MAX_OSPATH];
+	const char *mapname = dl->mapname;
 
-	if(mapname == NULL)
-	{
-		Com_Printf("Invalid map download path\n");
-		downloadActive = qfalse;
-		return;
-	}
-	
-	mapname++;
-		
-	
 	Com_sprintf(filename, sizeof(filename), "usermaps/%s/%s%s", mapname ,mapname, ".ff" );
-	Com_sprintf(dlurl, sizeof(dlurl), "%s/%s%s", url, mapname, ".ff");
+	Com_sprintf(dlurl, sizeof(dlurl), "%s/%s%s", dl->url, mapname, ".ff");
 	
 	Com_Printf("Begin downloading of file: \"%s\"\n", filename );
 	
 	if(SV_RunDownload(dlurl, filename) == qfalse)
 	{
 		Com_Printf("Aborted map download\n");
-		downloadActive = qfalse;
 		return;
 	}
 	Com_Printf("Received file: %s\n", filename );
@@ -1891,14 +1930,13 @@ void SV_DownloadMapThread(char *inurl)
 	
 	
 	Com_sprintf(filename, sizeof(filename), "usermaps/%s/%s%s", mapname ,mapname, "_load.ff" );
-	Com_sprintf(dlurl, sizeof(dlurl), "%s/%s%s", url, mapname, "_load.ff");
+	Com_sprintf(dlurl, sizeof(dlurl), "%s/%s%s", dl->url, mapname, "_load.ff");
 	
 	Com_Printf("Begin downloading of file: \"%s\"\n", filename );
 	
 	if(SV_RunDownload(dlurl, filename) == qfalse)
 	{
 		Com_Printf("Aborted map download\n");
-		downloadActive = qfalse;
 		return;
 	}
 	Com_Printf("Received file: %s\n", filename );
@@ -1906,7 +1944,7 @@ void SV_DownloadMapThread(char *inurl)
 	
 	
 	Com_sprintf(filename, sizeof(filename), "usermaps/%s/%s%s", mapname ,mapname, ".iwd" );
-	Com_sprintf(dlurl, sizeof(dlurl), "%s/%s%s", url, mapname, ".iwd");
+	Com_sprintf(dlurl, sizeof(dlurl), "%s/%s%s", dl->url, mapname, ".iwd");
 	
 	Com_Printf("Begin downloading of file: \"%s\"\n", filename );
 	
@@ -1917,17 +1955,34 @@ void SV_DownloadMapThread(char *inurl)
 		Com_Printf("Received file: %s\n", filename );
         }
 	Com_Printf("Download of map \"%s\" has been completed\n", mapname);
-	downloadActive = qfalse;
+	dl->success = qtrue;
+}
 
-	Sys_SetupThreadCallback(SV_DemoCompletedExec, mapname);
+/* Runs on its own thread as the downloads block until they are done */
+void SV_DownloadMapThread(void *arg)
+{
+	mapDownload_t *dl = arg;
 
+	SV_DownloadMapFiles(dl);
+	Sys_JobComplete(dl->done);
+}
+
+/* Runs on the main thread once the download thread is done */
+void SV_DownloadMapDone(void *arg)
+{
+	mapDownload_t *dl = arg;
+
+	sv_mapDownloadActive = qfalse;
+	if(dl->success)
+		SV_DemoCompletedExec(dl->mapname);
+	Z_Free(dl);
 }
 
 void SV_DownloadMap_f()
 {
-	char *url;
+	mapDownload_t *dl;
+	char *mapname;
 	int len;
-	char buf[128];
 	
 	if ( Cmd_Argc() != 2 )
 	{
@@ -1937,27 +1992,47 @@ void SV_DownloadMap_f()
 	
 	len = strlen(Cmd_Argv(1));
 	
-	Cmd_Args(buf, sizeof(buf));
-	
-	if(len < 3 || len > MAX_STRING_CHARS)
+	if(len < 3 || len >= MAX_STRING_CHARS)
 	{
 		Com_Printf( "Usage: downloadmap <\"url\">\n" );
 		return;
 	}
-	
-	url = Z_Malloc(len +1);
-	if(url == NULL)
+
+	if(sv_mapDownloadActive)
 	{
-		Com_PrintError("SV_DownloadMap_f(): Out of memory\n");
+		Com_Printf("There is already a map download running. Won't download this.\n");
 		return;
 	}
 	
-	Q_strncpyz(url, Cmd_Argv(1), len +1);
+	dl = Z_Malloc(sizeof(mapDownload_t));
+	Q_strncpyz(dl->url, Cmd_Argv(1), sizeof(dl->url));
+
+	len = strlen(dl->url);
+	if(dl->url[len -1] == '/')
+		dl->url[len -1] = '\0';
+	
+	mapname = strrchr(dl->url, '/');
+	if(mapname == NULL || mapname[1] == '\0')
+	{
+		Com_Printf("Invalid map download path\n");
+		Z_Free(dl);
+		return;
+	}
+	Q_strncpyz(dl->mapname, mapname +1, sizeof(dl->mapname));
+
+	dl->done = Sys_JobCreate(NULL, SV_DownloadMapDone, dl);
+	if(dl->done == NULL)
+	{
+		Com_PrintError("SV_DownloadMap_f(): Failed to start the download\n");
+		Z_Free(dl);
+		return;
+	}
+	sv_mapDownloadActive = qtrue;
 
-	if(Sys_CreateCallbackThread(SV_DownloadMapThread, url) == qfalse)
+	if(Sys_CreateCallbackThread(SV_DownloadMapThread, dl) == qfalse)
 	{
-		Com_PrintError("SV_DownloadMap_f(): Failed to start download thread\n");
-		Z_Free(url);
+		Com_PrintError("SV_DownloadMap_f(): Failed to start the download\n");
+		Sys_JobComplete(dl->done);
 	}
 }
 
@@ -2031,7 +2106,17 @@ void SV_AddOperatorCommands(){
 	Cmd_AddCommand ("scriptUsage", SV_ScriptUsage_f);
 	
 	Cmd_AddPCommand("stoprecord", SV_StopRecord_f, 70);
+	Cmd_AddPCommand("dumpdemo", SV_DumpDemo_f, 50);
 	Cmd_AddPCommand("record", SV_Record_f, 50);
+	Cmd_AddPCommand("serverrecord", SV_ServerRecord_f, 50);
+	Cmd_AddPCommand("stopserverrecord", SV_StopServerRecord_f, 70);
+	Cmd_AddCommand ("netcapture", NET_Capture_f);
+	Cmd_AddCommand ("netreplay", NET_Replay_f);
+	Cmd_AddCommand ("gamestatetimes", SV_GamestateTimes_f);
+	Cmd_AddCommand ("storagetables", HStorage_TableList_f);
+#ifndef COD4X17A
+	Cmd_AddCommand ("reliablebench", ReliableMessageBench_f);
+#endif
 	
 	if(Com_IsDeveloper()){
 		Cmd_AddCommand ("showconfigstring", SV_ShowConfigstring_f);
@@ -32,18 +32,31 @@
 #include "sys_main.h"
 #include "net_game_conf.h"
 
+#include "sys_thread.h"
+
 #include <stdint.h>
 #include <string.h>
-
-#define FS_DEMOWRITEBUF_SIZE NETCHAN_UNSENTBUFFER_SIZE
+#include <stdlib.h>
+#include <ctype.h>
 
 
 int FS_DemoWrite( const void *buffer, int len, fileHandleData_t* h );
+void FS_DemoWriteBuffer( byte *buffer, int len, fileHandleData_t* h );
 qboolean FS_FOpenDemoFileWrite( const char *filename, fileHandleData_t* h );
-qboolean FS_FCloseDemoFile( fileHandleData_t* f );
+qboolean FS_FCloseDemoFile( fileHandleData_t* f, const char* completedCmd );
 qboolean FS_DemoFileExists( const char *file );
-void FS_DemoForceFlush(fileHandleData_t *fh);
-int FS_DemoFlush( fileHandleData_t *fh );
+static void SV_DemoSystemWaitForWriter( void );
+static void SV_ServerDemoShutdown( void );
+static void SV_DemoBufferWriter( client_t* cl, const void* data, int len );
+static void SV_DemoBufferWriteArchive( client_t* cl );
+
+/* Client demo data can go to the demo file and into the rolling demo buffer */
+typedef void (*demoWriter_t)( client_t* cl, const void* data, int len );
+
+static void SV_DemoFileWriter( client_t* cl, const void* data, int len )
+{
+	FS_DemoWrite( data, len, &cl->demofile );
+}
 
 /*
 ====================
@@ -54,7 +67,7 @@ The only intention is maybe that the player self can create a demo with higher F
 ====================
 */
 
-void SV_WriteDemoArchive(client_t *client){
+static void SV_WriteDemoArchiveTo(client_t *client, int *archiveCount, demoWriter_t write){
 
 	byte bufData[72];
 	msg_t msg;
@@ -67,7 +80,7 @@ void SV_WriteDemoArchive(client_t *client){
 
 	MSG_WriteByte(&msg, 1);
 
-	archiveIndex = client->demoArchiveIndex % 256;
+	archiveIndex = *archiveCount % 256;
 	MSG_WriteLong(&msg, archiveIndex);
 	MSG_WriteVector(&msg, ps->origin);
 
@@ -77,9 +90,17 @@ void SV_WriteDemoArchive(client_t *client){
 	MSG_WriteLong(&msg, 0);
 	MSG_WriteLong(&msg, ps->commandTime);
 	MSG_WriteVector(&msg, ps->viewangles);
-	client->demoArchiveIndex++;
+	(*archiveCount)++;
+
+	write( client, msg.data, msg.cursize );
+}
+
+void SV_WriteDemoArchive(client_t *client){
+
+	if(client->demorecording && !client->demowaiting)
+		SV_WriteDemoArchiveTo(client, &client->demoArchiveIndex, SV_DemoFileWriter);
 
-	FS_DemoWrite( msg.data, msg.cursize, &client->demofile );
+	SV_DemoBufferWriteArchive(client);
 }
 
 /*
@@ -90,8 +111,7 @@ Dumps the current net message, prefixed by the length
 ====================
 */
 
-
-void SV_WriteDemoMessageForClient( byte *data, int dataLen, client_t *client ){
+static void SV_WriteDemoMessageTo( byte *data, int dataLen, client_t *client, demoWriter_t write ){
 
 	byte bufData[72];
 	msg_t msg;
@@ -105,12 +125,66 @@ void SV_WriteDemoMessageForClient( byte *data, int dataLen, client_t *client ){
 
 	// write the servermessagelength
 	MSG_WriteLong(&msg, LittleLong( dataLen ));
-	FS_DemoWrite( msg.data, msg.cursize, &client->demofile );
+	write( client, msg.data, msg.cursize );
 
-	FS_DemoWrite( data, dataLen, &client->demofile );
+	write( client, data, dataLen );
 //	Com_DPrintf("Writing: %i bytes of demodata\n", dataLen+ msg.cursize);
 }
 
+void SV_WriteDemoMessageForClient( byte *data, int dataLen, client_t *client ){
+
+	if(client->demorecording && !client->demowaiting)
+		SV_WriteDemoMessageTo( data, dataLen, client, SV_DemoFileWriter );
+
+	SV_WriteDemoMessageTo( data, dataLen, client, SV_DemoBufferWriter );
+}
+
+/*
+====================
+SV_WriteDemoGameStateTo
+
+Writes the gamestate a demo starts with
+====================
+*/
+static void SV_WriteDemoGameStateTo( client_t* cl, demoWriter_t write ) {
+	byte bufData[MAX_MSGLEN];
+	msg_t msg;
+	int len, compLen, swlen;
+
+	// write out the gamestate message
+	MSG_Init( &msg, bufData, sizeof( bufData ) );
+
+	// NOTE, MRE: all server->client messages now acknowledge
+	MSG_WriteLong( &msg, cl->lastClientCommand );
+
+	SV_WriteGameState(&msg, cl);
+
+	// write the client num
+	MSG_WriteLong( &msg, cl - svs.clients );
+	// write the checksum feed
+	MSG_WriteLong( &msg, sv.checksumFeed );
+
+	// finished writing the client packet
+	MSG_WriteByte( &msg, svc_EOF );
+
+	*(int32_t*)0x13f39080 = *(int32_t*)msg.data;
+	compLen = 4 + MSG_WriteBitsCompress( 0, msg.data + 4 ,(byte*)0x13f39084 ,msg.cursize - 4);
+
+	len = 0;
+	write( cl, &len, 1 );
+
+	// write it to the demo file
+
+	// write the packet sequence
+	len = cl->netchan.outgoingSequence;
+	swlen = LittleLong( len );
+	write( cl, &swlen, 4 );
+
+	len = LittleLong( compLen );
+	write( cl, &len, 4 );
+	write( cl, (byte*)0x13f39080, compLen );
+}
+
 
 /*
 ====================
@@ -139,19 +213,16 @@ void SV_StopRecord( client_t *cl ) {
 	FS_DemoWrite( &len, 4, &cl->demofile );
 	FS_DemoWrite( &len, 4, &cl->demofile );
 
-	FS_FCloseDemoFile( &cl->demofile );
+	if(*sv_demoCompletedCmd->string)
+	{
+		Com_sprintf(cmdline, sizeof(cmdline), "\"%s/%s\" \"%s/%s\"", fs_homepath->string, sv_demoCompletedCmd->string, fs_homepath->string, cl->demoName);
+		// runs after the writer thread has closed the file
+		FS_FCloseDemoFile( &cl->demofile, cmdline );
+	}else{
+		FS_FCloseDemoFile( &cl->demofile, NULL );
+	}
 	cl->demorecording = qfalse;
 	Com_Printf( "Stopped demo for: %s\n", cl->name);
-
-	if(!*sv_demoCompletedCmd->string)
-		return;
-
-	Com_sprintf(cmdline, sizeof(cmdline), "\"%s/%s\" \"%s/%s\"", fs_homepath->string, sv_demoCompletedCmd->string, fs_homepath->string, cl->demoName);
-
-	Sys_DoStartProcess(cmdline);
-
-	Sys_TermProcess();
-
 }
 
 /*
@@ -178,6 +249,154 @@ void SV_DemoFilename( int number, const char* basename, char *fileName ) {
 	Com_sprintf( fileName, MAX_OSPATH, "%s%i%i%i%i", basename, a, b, c, d );
 }
 
+/*
+==================
+SV_DemoNextNumber
+
+Returns the number for the next demo of this basename. The demos directory
+gets scanned only once, afterwards the highest used number of every
+basename is remembered.
+==================
+*/
+#define DEMONUMBER_HASH_SIZE 1024
+
+typedef struct demoNumber_s{
+	struct demoNumber_s *next;
+	int number;
+	char basename[MAX_QPATH];
+}demoNumber_t;
+
+static demoNumber_t *demo_numbers[DEMONUMBER_HASH_SIZE];
+static qboolean demo_numbersScanned;
+
+static demoNumber_t* SV_DemoNumberEntry( const char* basename, qboolean create )
+{
+	demoNumber_t *entry;
+	unsigned int hash;
+	const char *s;
+
+	for(hash = 0, s = basename; *s; s++)
+	{
+		hash = hash * 31 + tolower(*s);
+	}
+	hash &= (DEMONUMBER_HASH_SIZE -1);
+
+	for(entry = demo_numbers[hash]; entry; entry = entry->next)
+	{
+		if(!Q_stricmp(entry->basename, basename))
+			return entry;
+	}
+	if(!create)
+		return NULL;
+
+	entry = Z_Malloc(sizeof(demoNumber_t));
+	if(entry == NULL)
+		return NULL;
+
+	Q_strncpyz(entry->basename, basename, sizeof(entry->basename));
+	entry->number = -1;
+	entry->next = demo_numbers[hash];
+	demo_numbers[hash] = entry;
+	return entry;
+}
+
+static void SV_DemoScanExtension( const char* path, const char* extension )
+{
+	char basename[MAX_QPATH];
+	char **list;
+	int numfiles, i, len, number;
+	demoNumber_t *entry;
+
+	list = Sys_ListFiles( path, extension, NULL, &numfiles, qfalse );
+	if(list == NULL)
+		return;
+
+	for(i = 0; i < numfiles; i++)
+	{
+		// name is <basename><4 digits><extension>
+		len = strlen(list[i]) - strlen(extension);
+		if(len < 4 || len - 4 >= sizeof(basename))
+			continue;
+
+		if(!isdigit(list[i][len -4]) || !isdigit(list[i][len -3]) || !isdigit(list[i][len -2]) || !isdigit(list[i][len -1]))
+			continue;
+
+		number = atoi(&list[i][len -4]);
+		Q_strncpyz(basename, list[i], len -4 +1);
+
+		entry = SV_DemoNumberEntry(basename, qtrue);
+		if(entry && entry->number < number)
+			entry->number = number;
+	}
+	Sys_FreeFileList( list );
+}
+
+static void SV_DemoScanNumbers( )
+{
+	char path[MAX_OSPATH];
+
+	demo_numbersScanned = qtrue;
+
+	FS_BuildOSPathForThread( fs_homepath->string, "demos", "", path, 0 );
+	path[strlen(path)-1] = '\0';
+
+	// client and server demos share the counter of their basename
+	SV_DemoScanExtension( path, ".dm_1" );
+	SV_DemoScanExtension( path, ".svdm" );
+}
+
+static int SV_DemoNextNumber( const char* basename )
+{
+	demoNumber_t *entry;
+
+	if(!demo_numbersScanned)
+		SV_DemoScanNumbers( );
+
+	entry = SV_DemoNumberEntry(basename, qtrue);
+	if(entry == NULL)
+		return 10000;
+
+	if(entry->number < 10000)
+		entry->number++;
+
+	return entry->number;
+}
+
+/*
+====================
+SV_DemoPickName
+
+Finds the next free demo filename for this basename
+====================
+*/
+static void SV_DemoPickName( const char* basename, char* name, int size ) {
+	char demoName[MAX_QPATH];
+	int number;
+
+	if(!basename)
+	{
+		basename = "demo";
+	}
+
+	number = SV_DemoNextNumber( basename );
+
+	if(number <= 9999)
+	{
+		SV_DemoFilename( number, basename, demoName );
+		Com_sprintf( name, size, "demos/%s.dm_%d", demoName, 1 );
+	}else{
+		// all numbers after the highest one are taken, scan for a gap
+		for ( number = 0 ; number <= 9999 ; number++ ) {
+			SV_DemoFilename( number, basename, demoName );
+			Com_sprintf( name, size, "demos/%s.dm_%d", demoName, 1 );
+
+			if ( !FS_DemoFileExists( name ) ) {
+				break;  // file doesn't exist
+			}
+		}
+	}
+}
+
 /*
 ====================
 SV_RecordClient
@@ -188,10 +407,6 @@ Begins recording a demo from the current position
 
 void SV_RecordClient( client_t* cl, char* basename ) {
 	char name[MAX_OSPATH];
-	byte bufData[MAX_MSGLEN];
-	msg_t msg;
-	int len, compLen, swlen;
-	char demoName[MAX_QPATH];
 
 	if ( cl->demorecording ) {
 		Com_Printf( "Already recording.\n" );
@@ -203,22 +418,7 @@ void SV_RecordClient( client_t* cl, char* basename ) {
 		return;
 	}
 
-	int number;
-
-	if(!basename)
-	{
-		basename = "demo";
-	}
-
-	// scan for a free demo name
-	for ( number = 0 ; number <= 9999 ; number++ ) {
-		SV_DemoFilename( number, basename, demoName );
-		Com_sprintf( name, sizeof( name ), "demos/%s.dm_%d", demoName, 1 );
-
-		if ( !FS_DemoFileExists( name ) ) {
-			break;  // file doesn't exist
-		}
-	}
+	SV_DemoPickName( basename, name, sizeof( name ) );
 
 	// open the demo file
 	Com_Printf( "recording to %s.\n", name );
@@ -228,9 +428,6 @@ void SV_RecordClient( client_t* cl, char* basename ) {
 		return;
 	}
 
-	//For fwrite debug purpose only
-	FS_DemoForceFlush(&cl->demofile);
-
 
 	cl->demorecording = qtrue;
 	Q_strncpyz( cl->demoName, name, sizeof( cl->demoName ));
@@ -241,141 +438,925 @@ void SV_RecordClient( client_t* cl, char* basename ) {
 	cl->demoMaxDeltaFrames = 1;
 	cl->demoDeltaFrameCount = 0;
 
-	// write out the gamestate message
-	MSG_Init( &msg, bufData, sizeof( bufData ) );
+	SV_WriteDemoGameStateTo( cl, SV_DemoFileWriter );
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	MSG_WriteLong( &msg, cl->lastClientCommand );
+	// the rest of the demo file will be copied from net messages
+}
 
-	SV_WriteGameState(&msg, cl);
 
-	// write the client num
-	MSG_WriteLong( &msg, cl - svs.clients );
-	// write the checksum feed
-	MSG_WriteLong( &msg, sv.checksumFeed );
+/*
+===============================================================================
 
-	// finished writing the client packet
-	MSG_WriteByte( &msg, svc_EOF );
+Rolling demo buffer
 
-	*(int32_t*)0x13f39080 = *(int32_t*)msg.data;
-	compLen = 4 + MSG_WriteBitsCompress( 0, msg.data + 4 ,(byte*)0x13f39084 ,msg.cursize - 4);
+Keeps the last sv_demoBuffer minutes of every client in memory so a demo can
+be saved after something happened. The buffer is split into segments which
+start at a keyframe: a gamestate followed by a non-delta snapshot. The oldest
+segments get dropped when the buffer runs out of time or memory, so a dump
+always starts at a point a demo can be played back from.
+The buffer starts over with every level.
 
-	len = 0;
-	FS_DemoWrite( &len, 1, &cl->demofile );
+===============================================================================
+*/
 
-	// write it to the demo file
+#define DEMOBUFFER_MAX_SEGMENTS 256
+
+typedef struct{
+	unsigned int start;
+	unsigned int snapStart; //End of the gamestate. Only the first segment of a dump needs it
+	int time;
+}demoSegment_t;
+
+typedef struct{
+	byte* data;
+	unsigned int size; //Power of two
+	unsigned int start; //Offsets only ever grow and wrap around with size
+	unsigned int end;
+	demoSegment_t segments[DEMOBUFFER_MAX_SEGMENTS];
+	int firstSegment;
+	int numSegments;
+	int nextKeyframeTime;
+	int archiveIndex;
+	qboolean waiting; //Nothing gets stored until the next keyframe
+	qboolean wantKeyframe;
+}demoBuffer_t;
 
-	// write the packet sequence
-	len = cl->netchan.outgoingSequence;
-	swlen = LittleLong( len );
-	FS_DemoWrite( &swlen, 4, &cl->demofile );
+static demoBuffer_t sv_demoBuffers[MAX_CLIENTS];
 
-	len = LittleLong( compLen );
-	FS_DemoWrite( &len, 4, &cl->demofile );
-	FS_DemoWrite((byte*)0x13f39080, compLen, &cl->demofile );
 
-	// the rest of the demo file will be copied from net messages
+static void SV_DemoBufferReset( demoBuffer_t* buf )
+{
+	buf->start = buf->end;
+	buf->firstSegment = 0;
+	buf->numSegments = 0;
+	buf->waiting = qtrue;
+	buf->wantKeyframe = qtrue;
 }
 
-
-/*
-====================
-SV_DemoSystemShutdown
-
-stop recording of all demos
-====================
-*/
-void SV_DemoSystemShutdown( ) {
-
-	client_t *cl;
-	int i;
-
-	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+static void SV_DemoBufferDropSegment( demoBuffer_t* buf )
+{
+	if(buf->numSegments <= 1)
 	{
-		if(cl->demorecording)
-			SV_StopRecord(cl);
+		SV_DemoBufferReset( buf );
+		return;
 	}
+	buf->firstSegment = (buf->firstSegment + 1) % DEMOBUFFER_MAX_SEGMENTS;
+	buf->numSegments--;
+	buf->start = buf->segments[buf->firstSegment].start;
 }
 
+static void SV_DemoBufferWriter( client_t* cl, const void* data, int len )
+{
+	demoBuffer_t* buf = &sv_demoBuffers[cl - svs.clients];
+	unsigned int ofs, chunk;
+
+	if(buf->data == NULL || buf->waiting || len <= 0 || cl->state != CS_ACTIVE)
+	{
+		return;
+	}
 
+	while(buf->end - buf->start + len > buf->size)
+	{
+		SV_DemoBufferDropSegment( buf );
+		if(buf->waiting)
+		{
+			// the current segment alone does not fit
+			return;
+		}
+	}
 
+	ofs = buf->end & (buf->size -1);
+	chunk = buf->size - ofs;
+	if(chunk > len)
+		chunk = len;
 
-/*
-================
-FS_DemoFileExists
+	Com_Memcpy(buf->data + ofs, data, chunk);
+	Com_Memcpy(buf->data, (const byte*)data + chunk, len - chunk);
+	buf->end += len;
+}
 
-Tests if the file exists in the current gamedir, this DOES NOT
-search the paths.  This is to determine if opening a file to write
-(which always goes into the current gamedir) will cause any overwrites.
-NOTE TTimo: this goes with FS_FOpenFileWrite for opening the file afterwards
-================
-*/
-qboolean FS_DemoFileExists( const char *file )
+static void SV_DemoBufferWriteArchive( client_t* cl )
 {
-	FILE *f;
-	char testpath[MAX_OSPATH];
-
-	FS_BuildOSPathForThread( fs_homepath->string, file, "", testpath, 0 );
-	testpath[strlen(testpath)-1] = '\0';
+	demoBuffer_t* buf = &sv_demoBuffers[cl - svs.clients];
 
-	f = fopen( testpath, "rb" );
-	if (f) {
-		fclose( f );
-		return qtrue;
+	if(buf->data == NULL || buf->waiting)
+	{
+		return;
 	}
-	return qfalse;
+	SV_WriteDemoArchiveTo( cl, &buf->archiveIndex, SV_DemoBufferWriter );
 }
 
 /*
-==============
-FS_DemoFileOpened
-Returns true if this filehandle is an opened file
-==============
+====================
+SV_DemoBufferFree
+====================
 */
+void SV_DemoBufferFree( client_t* cl )
+{
+	demoBuffer_t* buf = &sv_demoBuffers[cl - svs.clients];
 
-qboolean FS_DemoFileOpened( fileHandleData_t *fh ) {
-	if (fh->handleFiles.file.o) {
-	    return qtrue;
+	if(buf->data)
+	{
+		free(buf->data);
 	}
-	return qfalse;
+	Com_Memset(buf, 0, sizeof(demoBuffer_t));
 }
 
-
-
 /*
-==============
-FS_FCloseDemoFile
-
-If the FILE pointer is an open pak file, leave it open.
+====================
+SV_DemoBufferStart
 
-For some reason, other dll's can't just cal fclose()
-on files returned by FS_FOpenFile...
-==============
+Called when a client enters a level. Starts an empty buffer which waits for
+the first keyframe
+====================
 */
-qboolean FS_FCloseDemoFile( fileHandleData_t *fh ) {
-	// we didn't find it as a pak, so close it as a unique file
+void SV_DemoBufferStart( client_t* cl )
+{
+	demoBuffer_t* buf = &sv_demoBuffers[cl - svs.clients];
+	unsigned int size;
 
-	if (fh->handleFiles.file.o) {
-	    FS_DemoFlush( fh );
-	    if(fh->writebuffer){
-		Z_Free(fh->writebuffer);
-	    }
-	    fclose (fh->handleFiles.file.o);
-	    Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
-	    return qtrue;
+	if(sv_demoBuffer->integer <= 0 || (cl->netchan.remoteAddress.type != NA_IP && cl->netchan.remoteAddress.type != NA_IP6))
+	{
+		SV_DemoBufferFree( cl );
+		return;
+	}
+
+	for(size = 1; size <= (unsigned int)sv_demoBufferSize->integer / 2; size <<= 1);
+	size *= 1024;
+
+	if(buf->data && buf->size != size)
+	{
+		SV_DemoBufferFree( cl );
 	}
 
-	if(fh->writebuffer){
-		Z_Free(fh->writebuffer);
+	if(buf->data == NULL)
+	{
+		buf->data = malloc(size);
+		if(buf->data == NULL)
+		{
+			Com_PrintWarning("SV_DemoBufferStart: Out of memory for the demo buffer of %s\n", cl->name);
+			return;
+		}
+		buf->size = size;
 	}
 
-	Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
-	return qfalse;
+	SV_DemoBufferReset( buf );
 }
 
-
 /*
-===========
+====================
+SV_DemoBufferNeedsKeyframe
+
+Returns true if the next snapshot of this client should be a non-delta one
+====================
+*/
+qboolean SV_DemoBufferNeedsKeyframe( client_t* cl )
+{
+	demoBuffer_t* buf = &sv_demoBuffers[cl - svs.clients];
+
+	if(buf->data == NULL)
+	{
+		return qfalse;
+	}
+	if(sv_demoBuffer->integer <= 0)
+	{
+		// got disabled during the level
+		SV_DemoBufferFree( cl );
+		return qfalse;
+	}
+	if(cl->state != CS_ACTIVE)
+	{
+		// nothing gets buffered before the client is in the game
+		return qfalse;
+	}
+
+	if(buf->nextKeyframeTime - svs.time <= 0)
+	{
+		buf->wantKeyframe = qtrue;
+	}
+	return buf->wantKeyframe;
+}
+
+/*
+====================
+SV_DemoBufferKeyframe
+
+Called for each non-delta snapshot. Starts a new segment with the current
+gamestate if one is due. Non-delta snapshots the client needed anyway start
+a segment early, which saves a forced one
+====================
+*/
+void SV_DemoBufferKeyframe( client_t* cl )
+{
+	demoBuffer_t* buf = &sv_demoBuffers[cl - svs.clients];
+	demoSegment_t* seg;
+	int keepTime;
+
+	if(buf->data == NULL || cl->state != CS_ACTIVE)
+	{
+		return;
+	}
+	if(!buf->wantKeyframe && buf->nextKeyframeTime - svs.time > 500 * sv_demoBufferKeyframe->integer)
+	{
+		return;
+	}
+
+	if(buf->numSegments == DEMOBUFFER_MAX_SEGMENTS)
+	{
+		SV_DemoBufferDropSegment( buf );
+	}
+
+	// drop segments which are fully older than the time to keep
+	keepTime = svs.time - 60000 * sv_demoBuffer->integer;
+	while(buf->numSegments > 1 && buf->segments[(buf->firstSegment + 1) % DEMOBUFFER_MAX_SEGMENTS].time - keepTime <= 0)
+	{
+		SV_DemoBufferDropSegment( buf );
+	}
+
+	if(buf->numSegments == 0)
+	{
+		buf->start = buf->end;
+	}
+	seg = &buf->segments[(buf->firstSegment + buf->numSegments) % DEMOBUFFER_MAX_SEGMENTS];
+	seg->start = buf->end;
+	seg->snapStart = buf->end;
+	seg->time = svs.time;
+	buf->numSegments++;
+
+	buf->waiting = qfalse;
+	buf->wantKeyframe = qfalse;
+	buf->archiveIndex = 0;
+	buf->nextKeyframeTime = svs.time + 1000 * sv_demoBufferKeyframe->integer;
+
+	SV_WriteDemoGameStateTo( cl, SV_DemoBufferWriter );
+
+	if(!buf->waiting)
+	{
+		seg->snapStart = buf->end;
+	}
+}
+
+static byte* SV_DemoBufferCopy( demoBuffer_t* buf, byte* dest, unsigned int from, unsigned int to )
+{
+	unsigned int ofs, len, chunk;
+
+	ofs = from & (buf->size -1);
+	len = to - from;
+	chunk = buf->size - ofs;
+	if(chunk > len)
+		chunk = len;
+
+	Com_Memcpy(dest, buf->data + ofs, chunk);
+	Com_Memcpy(dest + chunk, buf->data, len - chunk);
+	return dest + len;
+}
+
+/*
+====================
+SV_DemoBufferDump
+
+Writes the buffered demo of this client into a new demo file. The buffer is
+copied once and the writer thread takes it from there. Only the first segment
+keeps its gamestate, the others continue with their non-delta snapshot
+====================
+*/
+qboolean SV_DemoBufferDump( client_t* cl, const char* basename )
+{
+	demoBuffer_t* buf = &sv_demoBuffers[cl - svs.clients];
+	demoSegment_t* seg;
+	fileHandleData_t fh;
+	char name[MAX_OSPATH];
+	unsigned int len, next;
+	byte *data, *pos;
+	int i, end;
+
+	if(buf->data == NULL || buf->waiting || buf->numSegments < 1)
+	{
+		Com_Printf( "No demo buffered for %s\n", cl->name );
+		return qfalse;
+	}
+
+	len = buf->end - buf->start + 9;
+	for(i = 1; i < buf->numSegments; i++)
+	{
+		seg = &buf->segments[(buf->firstSegment + i) % DEMOBUFFER_MAX_SEGMENTS];
+		len -= seg->snapStart - seg->start;
+	}
+
+	data = malloc(len);
+	if(data == NULL)
+	{
+		Com_PrintError( "SV_DemoBufferDump: Out of memory\n" );
+		return qfalse;
+	}
+
+	pos = data;
+	for(i = 0; i < buf->numSegments; i++)
+	{
+		seg = &buf->segments[(buf->firstSegment + i) % DEMOBUFFER_MAX_SEGMENTS];
+		next = i +1 < buf->numSegments ? buf->segments[(buf->firstSegment + i +1) % DEMOBUFFER_MAX_SEGMENTS].start : buf->end;
+		pos = SV_DemoBufferCopy( buf, pos, i == 0 ? seg->start : seg->snapStart, next );
+	}
+
+	*pos++ = 0;
+	end = -1;
+	Com_Memcpy(pos, &end, 4);
+	Com_Memcpy(pos +4, &end, 4);
+
+	SV_DemoPickName( basename, name, sizeof( name ) );
+
+	Com_Memset(&fh, 0, sizeof(fh));
+	if(!FS_FOpenDemoFileWrite( name, &fh ))
+	{
+		free(data);
+		Com_Printf( "ERROR: couldn't open %s.\n", name );
+		return qfalse;
+	}
+
+	FS_DemoWriteBuffer( data, len, &fh );
+	FS_FCloseDemoFile( &fh, NULL );
+
+	Com_Printf( "Saving %d seconds of %s to %s\n", (svs.time - buf->segments[buf->firstSegment].time) / 1000, cl->name, name );
+	return qtrue;
+}
+
+
+/*
+====================
+SV_DemoSystemShutdown
+
+stop recording of all demos
+====================
+*/
+void SV_DemoSystemShutdown( ) {
+
+	client_t *cl;
+	int i;
+
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		if(cl->demorecording)
+			SV_StopRecord(cl);
+	}
+	for(i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++)
+	{
+		SV_DemoBufferFree(cl);
+	}
+	SV_ServerDemoShutdown( );
+	SV_DemoSystemWaitForWriter( );
+}
+
+
+
+
+/*
+=============================================================================
+
+Server demo
+
+Records the whole server into one file instead of one demo per client.
+Every frame SV_SendClientMessages archives a snapshot of the complete
+server state for killcams, this is what gets saved together with all
+configstrings at the start and all reliable server commands. The point of
+view of any player can then be rebuilt offline.
+
+File layout, all integers little endian:
+	header:		"SVDM" version protocol maxclients checksumFeed serverId mapname[64] startTime
+	records:	byte type, followed by
+				SVDEMO_CONFIGSTRING:	short index, int len, data
+				SVDEMO_SNAPSHOT:		int time, int archived frame, int len, data
+				SVDEMO_SERVERCMD:		int clientnum (-1 = all), int cmdtype, int len, data
+				SVDEMO_END:				nothing
+	index:		int count, count * (int time, int fileoffset of a snapshot record)
+	footer:		int fileoffset of the index, "SVDX"
+=============================================================================
+*/
+
+#define SVDEMO_VERSION			1
+#define SVDEMO_INDEX_INTERVAL	1000	// msec between two index entries
+
+typedef enum{
+	SVDEMO_END,
+	SVDEMO_CONFIGSTRING,
+	SVDEMO_SNAPSHOT,
+	SVDEMO_SERVERCMD
+}svDemoRecord_t;
+
+typedef struct{
+	int time;
+	int offset;
+}svDemoIndex_t;
+
+typedef struct{
+	qboolean recording;
+	fileHandleData_t file;
+	char name[MAX_QPATH];
+	int serverId;
+	int offset;
+	int lastIndexTime;
+	svDemoIndex_t *index;
+	int numIndex;
+	int maxIndex;
+}svDemo_t;
+
+static svDemo_t sv_serverDemo;
+
+static void SV_ServerDemoWrite( const void* data, int len )
+{
+	if(FS_DemoWrite( data, len, &sv_serverDemo.file ) != len)
+	{
+		Com_PrintError("Server demo write error. Stopped recording %s\n", sv_serverDemo.name);
+		FS_FCloseDemoFile( &sv_serverDemo.file, NULL );
+		if(sv_serverDemo.index)
+			Z_Free(sv_serverDemo.index);
+		Com_Memset(&sv_serverDemo, 0, sizeof(sv_serverDemo));
+		return;
+	}
+	sv_serverDemo.offset += len;
+}
+
+static void SV_ServerDemoWriteInt( int value )
+{
+	value = LittleLong(value);
+	SV_ServerDemoWrite( &value, 4 );
+}
+
+static void SV_ServerDemoAddIndex( )
+{
+	svDemoIndex_t *newindex;
+
+	if(sv_serverDemo.numIndex == sv_serverDemo.maxIndex)
+	{
+		newindex = Z_Malloc((sv_serverDemo.maxIndex + 1024) * sizeof(svDemoIndex_t));
+		if(newindex == NULL)
+			return;
+
+		if(sv_serverDemo.index)
+		{
+			Com_Memcpy(newindex, sv_serverDemo.index, sv_serverDemo.numIndex * sizeof(svDemoIndex_t));
+			Z_Free(sv_serverDemo.index);
+		}
+		sv_serverDemo.index = newindex;
+		sv_serverDemo.maxIndex += 1024;
+	}
+	sv_serverDemo.index[sv_serverDemo.numIndex].time = svs.time;
+	sv_serverDemo.index[sv_serverDemo.numIndex].offset = sv_serverDemo.offset;
+	sv_serverDemo.numIndex++;
+	sv_serverDemo.lastIndexTime = svs.time;
+}
+
+/*
+====================
+SV_StopServerRecord
+====================
+*/
+void SV_StopServerRecord( )
+{
+	int i, indexOffset;
+	byte type;
+	char cmdline[1024];
+
+	if(!sv_serverDemo.recording)
+	{
+		Com_Printf( "Not recording a server demo.\n" );
+		return;
+	}
+
+	type = SVDEMO_END;
+	SV_ServerDemoWrite( &type, 1 );
+
+	indexOffset = sv_serverDemo.offset;
+	SV_ServerDemoWriteInt( sv_serverDemo.numIndex );
+	for(i = 0; i < sv_serverDemo.numIndex && sv_serverDemo.recording; i++)
+	{
+		SV_ServerDemoWriteInt( sv_serverDemo.index[i].time );
+		SV_ServerDemoWriteInt( sv_serverDemo.index[i].offset );
+	}
+	SV_ServerDemoWriteInt( indexOffset );
+	SV_ServerDemoWrite( "SVDX", 4 );
+
+	if(!sv_serverDemo.recording)
+		return;	// write error, everything got closed already
+
+	if(*sv_demoCompletedCmd->string)
+	{
+		Com_sprintf(cmdline, sizeof(cmdline), "\"%s/%s\" \"%s/%s\"", fs_homepath->string, sv_demoCompletedCmd->string, fs_homepath->string, sv_serverDemo.name);
+		FS_FCloseDemoFile( &sv_serverDemo.file, cmdline );
+	}else{
+		FS_FCloseDemoFile( &sv_serverDemo.file, NULL );
+	}
+	Com_Printf( "Stopped server demo %s\n", sv_serverDemo.name );
+
+	if(sv_serverDemo.index)
+		Z_Free(sv_serverDemo.index);
+
+	Com_Memset(&sv_serverDemo, 0, sizeof(sv_serverDemo));
+}
+
+/*
+====================
+SV_ServerRecord
+
+Starts recording the whole server into one demo
+====================
+*/
+void SV_ServerRecord( const char* basename )
+{
+	char name[MAX_OSPATH];
+	char demoName[MAX_QPATH];
+	char mapname[64];
+	char cs[MAX_STRING_CHARS];
+	int number, i, len;
+	byte type;
+	short index;
+
+	if(sv_serverDemo.recording)
+	{
+		Com_Printf( "Already recording a server demo.\n" );
+		return;
+	}
+
+	if(sv.state != SS_GAME)
+	{
+		Com_Printf( "Server must be in a level to record.\n" );
+		return;
+	}
+
+	if(!basename)
+		basename = "serverdemo";
+
+	// never truncate an existing recording
+	do
+	{
+		number = SV_DemoNextNumber( basename );
+		if(number > 9999)
+		{
+			Com_Printf( "No free demo number left for %s\n", basename );
+			return;
+		}
+		SV_DemoFilename( number, basename, demoName );
+		Com_sprintf( name, sizeof( name ), "demos/%s.svdm", demoName );
+	}while( FS_DemoFileExists( name ) );
+
+	Com_Printf( "recording server demo to %s.\n", name );
+	if(!FS_FOpenDemoFileWrite( name, &sv_serverDemo.file ))
+	{
+		Com_Printf( "ERROR: couldn't open.\n" );
+		return;
+	}
+
+	sv_serverDemo.recording = qtrue;
+	sv_serverDemo.serverId = sv.serverId;
+	sv_serverDemo.offset = 0;
+	sv_serverDemo.lastIndexTime = 0;
+	Q_strncpyz( sv_serverDemo.name, name, sizeof( sv_serverDemo.name ));
+
+	SV_ServerDemoWrite( "SVDM", 4 );
+	SV_ServerDemoWriteInt( SVDEMO_VERSION );
+	SV_ServerDemoWriteInt( sv_protocol->integer );
+	SV_ServerDemoWriteInt( sv_maxclients->integer );
+	SV_ServerDemoWriteInt( sv.checksumFeed );
+	SV_ServerDemoWriteInt( sv.serverId );
+	Com_Memset( mapname, 0, sizeof(mapname) );
+	Q_strncpyz( mapname, sv_mapname->string, sizeof(mapname) );
+	SV_ServerDemoWrite( mapname, sizeof(mapname) );
+	SV_ServerDemoWriteInt( svs.time );
+
+	// all configstrings the gamestate would carry
+	for(i = 0; i < MAX_CONFIGSTRINGS && sv_serverDemo.recording; i++)
+	{
+		SV_GetConfigstring( i, cs, sizeof(cs) );
+		if(!cs[0])
+			continue;
+
+		len = strlen(cs);
+		type = SVDEMO_CONFIGSTRING;
+		index = LittleShort( i );
+		SV_ServerDemoWrite( &type, 1 );
+		SV_ServerDemoWrite( &index, 2 );
+		SV_ServerDemoWriteInt( len );
+		SV_ServerDemoWrite( cs, len );
+	}
+}
+
+static void SV_ServerDemoShutdown( )
+{
+	if(sv_serverDemo.recording)
+		SV_StopServerRecord( );
+}
+
+/*
+====================
+SV_ServerDemoWriteSnapshot
+
+Saves the snapshot which just got archived by SV_SendClientMessages
+====================
+*/
+void SV_ServerDemoWriteSnapshot( byte* data, int len, int frame )
+{
+	byte type;
+
+	if(!sv_serverDemo.recording)
+		return;
+
+	if(sv_serverDemo.serverId != sv.serverId)
+	{
+		// snapshot numbers and configstrings start over with a new level
+		SV_StopServerRecord( );
+		return;
+	}
+
+	if(sv_serverDemo.numIndex == 0 || svs.time - sv_serverDemo.lastIndexTime >= SVDEMO_INDEX_INTERVAL)
+		SV_ServerDemoAddIndex( );
+
+	type = SVDEMO_SNAPSHOT;
+	SV_ServerDemoWrite( &type, 1 );
+	SV_ServerDemoWriteInt( svs.time );
+	SV_ServerDemoWriteInt( frame );
+	SV_ServerDemoWriteInt( len );
+	SV_ServerDemoWrite( data, len );
+}
+
+/*
+====================
+SV_ServerDemoWriteCommand
+
+Saves a reliable server command. Configstring updates come as commands too
+====================
+*/
+void SV_ServerDemoWriteCommand( client_t* cl, int cmdtype, const char* cmd )
+{
+	byte type;
+	int len;
+
+	if(!sv_serverDemo.recording)
+		return;
+
+	len = strlen(cmd);
+	type = SVDEMO_SERVERCMD;
+	SV_ServerDemoWrite( &type, 1 );
+	SV_ServerDemoWriteInt( cl ? cl - svs.clients : -1 );
+	SV_ServerDemoWriteInt( cmdtype );
+	SV_ServerDemoWriteInt( len );
+	SV_ServerDemoWrite( cmd, len );
+}
+
+/*
+================
+FS_DemoFileExists
+
+Tests if the file exists in the current gamedir, this DOES NOT
+search the paths.  This is to determine if opening a file to write
+(which always goes into the current gamedir) will cause any overwrites.
+NOTE TTimo: this goes with FS_FOpenFileWrite for opening the file afterwards
+================
+*/
+qboolean FS_DemoFileExists( const char *file )
+{
+	FILE *f;
+	char testpath[MAX_OSPATH];
+
+	FS_BuildOSPathForThread( fs_homepath->string, file, "", testpath, 0 );
+	testpath[strlen(testpath)-1] = '\0';
+
+	f = fopen( testpath, "rb" );
+	if (f) {
+		fclose( f );
+		return qtrue;
+	}
+	return qfalse;
+}
+
+/*
+==============
+FS_DemoFileOpened
+Returns true if this filehandle is an opened file
+==============
+*/
+
+qboolean FS_DemoFileOpened( fileHandleData_t *fh ) {
+	if (fh->handleFiles.file.o) {
+	    return qtrue;
+	}
+	return qfalse;
+}
+
+
+/*
+=============================================================================
+
+Demo writer thread
+
+The main thread never touches the disk while recording. Every open demo
+file owns a stream with a ring buffer. The main thread is the only producer
+and the writer thread the only consumer of a ring, so the read and write
+positions are enough to hand over data without any lock. The writer thread
+also closes the files, batches the fsync() calls of all streams and leaves
+the start of sv_demoCompletedCmd to the main thread.
+
+A stream can also carry one large malloced block which the writer thread
+writes ahead of the ring and frees.
+
+The writebuffer of a fileHandleData_t points to its stream.
+=============================================================================
+*/
+
+#define DEMO_MAX_STREAMS		(MAX_CLIENTS + 16)
+#define DEMO_STREAM_RINGSIZE	(256 * 1024)	// Must be a power of 2
+#define DEMO_WRITER_IDLE_MSEC	5
+
+typedef enum{
+	DEMOSTREAM_FREE,		// can be taken by the main thread
+	DEMOSTREAM_OPEN,		// main thread writes, writer thread drains
+	DEMOSTREAM_CLOSING,		// main thread is done, writer thread drains and closes
+	DEMOSTREAM_CLOSED		// file is complete, main thread runs sv_demoCompletedCmd
+}demoStreamState_t;
+
+typedef struct{
+	volatile demoStreamState_t state;
+	FILE* file;
+	byte* ring;
+	volatile unsigned int writePos;
+	volatile unsigned int readPos;
+	volatile qboolean error;
+	byte* volatile block;	// written ahead of the ring, owned by the writer thread
+	unsigned int blockLen;
+	unsigned int blockPos;
+	qboolean dirty;
+	char completedCmd[1024];
+}demoStream_t;
+
+static demoStream_t demo_streams[DEMO_MAX_STREAMS];
+static qboolean demo_writerStarted;
+static threadid_t demo_writerThread;
+
+static void* SV_DemoWriterThread( void* arg )
+{
+	demoStream_t *stream;
+	unsigned int readPos, writePos, chunk, lastSync, now;
+	int i, written;
+	qboolean busy;
+
+	lastSync = Sys_Milliseconds();
+
+	while(qtrue)
+	{
+		busy = qfalse;
+
+		for(i = 0, stream = demo_streams; i < DEMO_MAX_STREAMS; i++, stream++)
+		{
+			if(stream->state != DEMOSTREAM_OPEN && stream->state != DEMOSTREAM_CLOSING)
+				continue;
+
+			__sync_synchronize();
+
+			if(stream->block && !stream->error)
+			{
+				// one ring size per pass so the other streams don't wait for it
+				chunk = stream->blockLen - stream->blockPos;
+				if(chunk > DEMO_STREAM_RINGSIZE)
+					chunk = DEMO_STREAM_RINGSIZE;
+
+				written = fwrite(stream->block + stream->blockPos, 1, chunk, stream->file);
+				if(written <= 0)
+				{
+					stream->error = qtrue;
+				}else{
+					stream->blockPos += written;
+					stream->dirty = qtrue;
+				}
+				busy = qtrue;
+				if(stream->blockPos < stream->blockLen && !stream->error)
+					continue;
+
+				free(stream->block);
+				stream->block = NULL;
+			}
+
+			readPos = stream->readPos;
+			writePos = stream->writePos;
+
+			while(readPos != writePos && !stream->error)
+			{
+				// write the contiguous part up to the end of the ring
+				chunk = writePos - readPos;
+				if(chunk > DEMO_STREAM_RINGSIZE - (readPos & (DEMO_STREAM_RINGSIZE -1)))
+					chunk = DEMO_STREAM_RINGSIZE - (readPos & (DEMO_STREAM_RINGSIZE -1));
+
+				written = fwrite(stream->ring + (readPos & (DEMO_STREAM_RINGSIZE -1)), 1, chunk, stream->file);
+				if(written <= 0)
+				{
+					stream->error = qtrue;
+					break;
+				}
+				readPos += written;
+				stream->dirty = qtrue;
+				busy = qtrue;
+			}
+			__sync_synchronize();
+			stream->readPos = readPos;
+
+			if(stream->state == DEMOSTREAM_CLOSING && (stream->readPos == stream->writePos || stream->error))
+			{
+				if(stream->block)
+				{
+					free(stream->block);
+					stream->block = NULL;
+				}
+				fclose(stream->file);
+				stream->file = NULL;
+				stream->dirty = qfalse;
+				__sync_synchronize();
+				stream->state = DEMOSTREAM_CLOSED;
+			}
+		}
+
+		// batch the fsync of all streams so the disk sees few large flushes
+		now = Sys_Milliseconds();
+		if(sv_demoSyncInterval->integer > 0 && now - lastSync >= 1000 * sv_demoSyncInterval->integer)
+		{
+			for(i = 0, stream = demo_streams; i < DEMO_MAX_STREAMS; i++, stream++)
+			{
+				if(stream->state == DEMOSTREAM_OPEN && stream->dirty)
+				{
+					Sys_FileSync(stream->file);
+					stream->dirty = qfalse;
+				}
+			}
+			lastSync = now;
+		}
+
+		if(!busy)
+			Sys_SleepMSec(DEMO_WRITER_IDLE_MSEC);
+	}
+	return NULL;
+}
+
+
+/*
+==================
+SV_DemoSystemFrame
+
+Runs sv_demoCompletedCmd for demos the writer thread has closed
+==================
+*/
+void SV_DemoSystemFrame( )
+{
+	demoStream_t *stream;
+	int i;
+
+	if(!demo_writerStarted)
+		return;
+
+	for(i = 0, stream = demo_streams; i < DEMO_MAX_STREAMS; i++, stream++)
+	{
+		if(stream->state != DEMOSTREAM_CLOSED)
+			continue;
+
+		if(stream->error)
+			Com_PrintWarning("Demo file write error. Demo might be incomplete\n");
+
+		if(stream->completedCmd[0])
+		{
+			Sys_DoStartProcess(stream->completedCmd);
+			Sys_TermProcess();
+		}
+		stream->state = DEMOSTREAM_FREE;
+	}
+}
+
+
+/*
+==============
+FS_FCloseDemoFile
+
+Hands the file over to the writer thread which closes it once all data is
+on the disk. completedCmd gets executed afterwards and can be NULL.
+==============
+*/
+qboolean FS_FCloseDemoFile( fileHandleData_t *fh, const char* completedCmd ) {
+
+	demoStream_t *stream = fh->writebuffer;
+
+	if (fh->handleFiles.file.o && stream) {
+		if(completedCmd)
+			Q_strncpyz(stream->completedCmd, completedCmd, sizeof(stream->completedCmd));
+		else
+			stream->completedCmd[0] = '\0';
+
+		__sync_synchronize();
+		stream->state = DEMOSTREAM_CLOSING;
+		Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
+		return qtrue;
+	}
+
+	Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
+	return qfalse;
+}
+
+
+/*
+===========
 FS_FOpenDemoFileWrite
 
 ===========
@@ -383,11 +1364,37 @@ FS_FOpenDemoFileWrite
 qboolean FS_FOpenDemoFileWrite( const char *filename, fileHandleData_t *fh ) {
 	
 	char ospath[MAX_OSPATH];
+	demoStream_t *stream;
+	int i;
 
 	if ( !FS_Initialized() ) {
 		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
 	}
 
+	if(!demo_writerStarted)
+	{
+		if(!Sys_CreateNewThread(SV_DemoWriterThread, &demo_writerThread, NULL))
+		{
+			Com_PrintError("FS_FOpenDemoFileWrite: Couldn't start the demo writer thread\n");
+			return qfalse;
+		}
+		demo_writerStarted = qtrue;
+	}
+
+	// finished streams get freed only once per frame
+	SV_DemoSystemFrame( );
+
+	for(i = 0, stream = demo_streams; i < DEMO_MAX_STREAMS; i++, stream++)
+	{
+		if(stream->state == DEMOSTREAM_FREE)
+			break;
+	}
+	if(i == DEMO_MAX_STREAMS)
+	{
+		Com_PrintError("FS_FOpenDemoFileWrite: Exceeded limit of %d open demo files\n", DEMO_MAX_STREAMS);
+		return qfalse;
+	}
+
 	FS_BuildOSPathForThread( fs_homepath->string, filename, "", ospath, 0 );
 	ospath[strlen(ospath)-1] = '\0';
 
@@ -409,8 +1416,33 @@ qboolean FS_FOpenDemoFileWrite( const char *filename, fileHandleData_t *fh ) {
 	if (!fh->handleFiles.file.o) {
 		return qfalse;
 	}
-	fh->writebuffer = Z_Malloc(FS_DEMOWRITEBUF_SIZE);
-	fh->bufferSize = FS_DEMOWRITEBUF_SIZE;
+	//the ring buffer does all the buffering, stdio buffering has corrupted the written files
+	setvbuf( fh->handleFiles.file.o, NULL, _IONBF, 0 );
+
+	if(stream->ring == NULL)
+	{
+		// the ring is kept for the next demo
+		stream->ring = malloc(DEMO_STREAM_RINGSIZE);
+		if(stream->ring == NULL)
+		{
+			fclose(fh->handleFiles.file.o);
+			Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
+			Com_PrintError("FS_FOpenDemoFileWrite: Out of memory\n");
+			return qfalse;
+		}
+	}
+	stream->file = fh->handleFiles.file.o;
+	stream->readPos = 0;
+	stream->writePos = 0;
+	stream->error = qfalse;
+	stream->block = NULL;
+	stream->dirty = qfalse;
+	stream->completedCmd[0] = '\0';
+	__sync_synchronize();
+	stream->state = DEMOSTREAM_OPEN;
+
+	fh->writebuffer = stream;
+	fh->bufferSize = DEMO_STREAM_RINGSIZE;
 	return qtrue;
 }
 
@@ -418,110 +1450,134 @@ qboolean FS_FOpenDemoFileWrite( const char *filename, fileHandleData_t *fh ) {
 =================
 FS_DemoWrite
 
-Properly handles partial writes
+Queues the data for the writer thread. Only waits for the disk if the
+ring buffer of this file is full.
 =================
 */
 int FS_DemoWrite( const void *buffer, int len, fileHandleData_t *fh ) {
 
-	byte* wb;
-	int oldBufferPos;
+	demoStream_t *stream;
+	const byte *data = buffer;
+	unsigned int writePos, space, chunk;
+	int remaining;
+	qboolean warned = qfalse;
 
 	if ( !fh || !fh->handleFiles.file.o) {
 		return 0;
 	}
 
-	wb = (byte*)fh->writebuffer;
+	stream = fh->writebuffer;
 
-	if(wb == NULL){
+	if(stream->error)
+	{
+		Com_Printf("Demo file write error. Closing file %s\n", fh->name);
+		FS_FCloseDemoFile( fh, NULL );
+		return 0;
+	}
 
-		fh->writebuffer = (void*)buffer;
-		fh->bufferPos = len;
-		oldBufferPos = fh->bufferPos;
+	writePos = stream->writePos;
+	remaining = len;
 
-		if(FS_DemoFlush( fh ) != oldBufferPos){ //Fatal file write error
-			Com_Printf("Demo file write error. Closing file %s\n", fh->name);
-			FS_FCloseDemoFile( fh );
-			return 0;
+	while(remaining > 0)
+	{
+		__sync_synchronize();
+		space = DEMO_STREAM_RINGSIZE - (writePos - stream->readPos);
+
+		if(space == 0)
+		{
+			if(stream->error)
+			{
+				Com_Printf("Demo file write error. Closing file %s\n", fh->name);
+				FS_FCloseDemoFile( fh, NULL );
+				return 0;
+			}
+			if(!warned)
+			{
+				Com_PrintWarning("Disk can not keep up with demo %s\n", fh->name);
+				warned = qtrue;
+			}
+			Sys_SleepMSec(1);
+			continue;
 		}
 
-		fh->writebuffer = NULL;
-		return len;
-	}
+		chunk = remaining;
+		if(chunk > space)
+			chunk = space;
+		if(chunk > DEMO_STREAM_RINGSIZE - (writePos & (DEMO_STREAM_RINGSIZE -1)))
+			chunk = DEMO_STREAM_RINGSIZE - (writePos & (DEMO_STREAM_RINGSIZE -1));
 
-	oldBufferPos = fh->bufferPos;
+		Com_Memcpy(stream->ring + (writePos & (DEMO_STREAM_RINGSIZE -1)), data, chunk);
+		data += chunk;
+		remaining -= chunk;
+		writePos += chunk;
 
-	if(len + fh->bufferPos > fh->bufferSize){ //If the buffer is too small to take more data flush it
-		if(FS_DemoFlush( fh ) != oldBufferPos){ //Fatal file write error
-			Com_Printf("Demo file write error. Closing file %s\n", fh->name);
-			FS_FCloseDemoFile( fh );
-			return 0;
-		}
+		// publish the data only after it has been copied
+		__sync_synchronize();
+		stream->writePos = writePos;
 	}
 
-	Com_Memcpy(wb + fh->bufferPos, buffer, len);
-	fh->bufferPos += len;
-
 	return len;
 }
 
+
 /*
 =================
-FS_DemoFlush
+FS_DemoWriteBuffer
 
-Writting buffer to file
+Hands a malloced buffer to the writer thread which writes and frees it. It
+goes to the file ahead of anything written with FS_DemoWrite, so call it
+right after the file got opened.
 =================
 */
-int FS_DemoFlush( fileHandleData_t *fh ) {
-	int	block, remaining;
-	int	written, overallwritten;
-	byte	*buf;
-	int	tries;
-	FILE	*f;
-	const void *buffer = fh->writebuffer;
-	int len = fh->bufferPos;
-
-	if ( !fh ) {
-		return 0;
-	}
+void FS_DemoWriteBuffer( byte *buffer, int len, fileHandleData_t *fh ) {
 
-	f = fh->handleFiles.file.o;
-	buf = (byte *)buffer;
+	demoStream_t *stream;
 
-	remaining = len;
-	tries = 0;
-	overallwritten = 0;
-	while (remaining) {
-		block = remaining;
-		written = fwrite (buf, 1, block, f);
-		overallwritten += written;
-		if (written == 0) {
-			if (!tries) {
-				tries = 1;
-			} else {
-				Com_Printf( "FS_DemoFlush: 0 bytes written\n" );
-				return 0;
-			}
-		}
-
-		if (written == -1) {
-			Com_Printf( "FS_DemoFlush: -1 bytes written\n" );
-			return 0;
-		}
-
-		remaining -= written;
-		buf += written;
+	if ( !fh || !fh->handleFiles.file.o || fh->writebuffer == NULL ) {
+		free(buffer);
+		return;
 	}
 
-	fh->bufferPos = 0; //Reset the buffer offset to the beginning
+	stream = fh->writebuffer;
 
-	return overallwritten;
+	if(stream->block || len <= 0)
+	{
+		free(buffer);
+		return;
+	}
+	stream->blockLen = len;
+	stream->blockPos = 0;
+	// publish the buffer only after its length
+	__sync_synchronize();
+	stream->block = buffer;
 }
 
 
+/*
+==================
+SV_DemoSystemWaitForWriter
 
-void FS_DemoForceFlush(fileHandleData_t *fh){
+Waits until the writer thread has closed all files
+==================
+*/
+static void SV_DemoSystemWaitForWriter( )
+{
+	int i, waited;
 
-	setvbuf( fh->handleFiles.file.o, NULL, _IONBF, 0 );
+	if(!demo_writerStarted)
+		return;
 
-}
+	for(waited = 0; waited < 10000; waited++)
+	{
+		for(i = 0; i < DEMO_MAX_STREAMS; i++)
+		{
+			if(demo_streams[i].state == DEMOSTREAM_OPEN || demo_streams[i].state == DEMOSTREAM_CLOSING)
+				break;
+		}
+		if(i == DEMO_MAX_STREAMS)
+			break;
 
+		Sys_SleepMSec(1);
+	}
+	SV_DemoSystemFrame( );
+}
@@ -0,0 +1,451 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+    Copyright (C) 1999-2005 Id Software, Inc.
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "server.h"
+#include "g_shared.h"
+#include "cvar.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+/*
+========================================================================================
+
+Entity grid
+
+The origins of all entities in use get sorted into square cells on the x/y plane.
+Cells are hashed into a fixed number of buckets, so the size of the map does not matter.
+The grid gets updated after every game frame. Only entities which have changed their cell
+are moved to another bucket. Queries see the origins from the end of the last game frame.
+
+========================================================================================
+*/
+
+#define GRID_CELL_SHIFT     8       // 256 units per cell
+#define GRID_BUCKETS        1024
+#define GRID_UNLINKED       -1
+#define GRID_MAX_RADIUS     (256*1024)  // Further than any map reaches
+
+typedef struct
+{
+	short bucketHead[GRID_BUCKETS];
+	short next[MAX_GENTITIES];
+	short prev[MAX_GENTITIES];
+	short bucket[MAX_GENTITIES];
+	int cellX[MAX_GENTITIES];
+	int cellY[MAX_GENTITIES];
+	vec3_t origin[MAX_GENTITIES];
+	byte isPlayer[MAX_GENTITIES];
+	int numLinked;
+	int maxLinked;          // One past the highest linked entity number
+	int serverid;
+}entityGrid_t;
+
+static entityGrid_t sv_entityGrid;
+
+static int SV_EntityGridCell( float coord )
+{
+	// Script and plugin values can be anything, converting them unclamped to int is undefined
+	if(!(coord > -GRID_MAX_RADIUS))
+		coord = -GRID_MAX_RADIUS;
+	else if(coord > GRID_MAX_RADIUS)
+		coord = GRID_MAX_RADIUS;
+
+	return (int)floorf(coord) >> GRID_CELL_SHIFT;
+}
+
+static int SV_EntityGridBucket( int cx, int cy )
+{
+	return ((unsigned int)cx * 73856093u ^ (unsigned int)cy * 19349663u) & (GRID_BUCKETS -1);
+}
+
+static void SV_EntityGridUnlink( entityGrid_t* grid, int num )
+{
+	if(grid->prev[num] != GRID_UNLINKED)
+		grid->next[grid->prev[num]] = grid->next[num];
+	else
+		grid->bucketHead[grid->bucket[num]] = grid->next[num];
+
+	if(grid->next[num] != GRID_UNLINKED)
+		grid->prev[grid->next[num]] = grid->prev[num];
+
+	grid->bucket[num] = GRID_UNLINKED;
+	grid->numLinked--;
+}
+
+static void SV_EntityGridLink( entityGrid_t* grid, int num, int cx, int cy )
+{
+	int b = SV_EntityGridBucket(cx, cy);
+
+	grid->bucket[num] = b;
+	grid->cellX[num] = cx;
+	grid->cellY[num] = cy;
+	grid->prev[num] = GRID_UNLINKED;
+	grid->next[num] = grid->bucketHead[b];
+	if(grid->bucketHead[b] != GRID_UNLINKED)
+		grid->prev[grid->bucketHead[b]] = num;
+	grid->bucketHead[b] = num;
+	grid->numLinked++;
+}
+
+static void SV_EntityGridClear( entityGrid_t* grid )
+{
+	memset(grid->bucketHead, GRID_UNLINKED, sizeof(grid->bucketHead));
+	memset(grid->bucket, GRID_UNLINKED, sizeof(grid->bucket));
+	grid->numLinked = 0;
+	grid->maxLinked = 0;
+	grid->serverid = sv_serverid->integer;
+}
+
+static qboolean SV_EntityGridIsPlayer( gentity_t* ent, int num )
+{
+	if(num >= level.maxclients || ent->client == NULL)
+		return qfalse;
+
+	if(ent->client->pers.connected != CON_CONNECTED || ent->client->sess.sessionTeam == TEAM_SPECTATOR)
+		return qfalse;
+
+	return qtrue;
+}
+
+/*
+================
+SV_EntityGridUpdate
+
+Called after every G_RunFrame
+================
+*/
+void SV_EntityGridUpdate( void )
+{
+	entityGrid_t* grid = &sv_entityGrid;
+	gentity_t* ent;
+	int i, cx, cy, numEntities, maxLinked;
+
+	if(grid->serverid != sv_serverid->integer)
+		SV_EntityGridClear(grid);
+
+	numEntities = level.num_entities;
+	if(numEntities > MAX_GENTITIES)
+		numEntities = MAX_GENTITIES;
+
+	maxLinked = 0;
+
+	for(i = 0; i < numEntities || i < grid->maxLinked; i++)
+	{
+		ent = &g_entities[i];
+
+		if(i >= numEntities || !ent->inuse)
+		{
+			if(grid->bucket[i] != GRID_UNLINKED)
+				SV_EntityGridUnlink(grid, i);
+			continue;
+		}
+
+		cx = SV_EntityGridCell(ent->r.currentOrigin[0]);
+		cy = SV_EntityGridCell(ent->r.currentOrigin[1]);
+
+		if(grid->bucket[i] == GRID_UNLINKED)
+		{
+			SV_EntityGridLink(grid, i, cx, cy);
+		}
+		else if(grid->cellX[i] != cx || grid->cellY[i] != cy)
+		{
+			SV_EntityGridUnlink(grid, i);
+			SV_EntityGridLink(grid, i, cx, cy);
+		}
+
+		VectorCopy(ent->r.currentOrigin, grid->origin[i]);
+		grid->isPlayer[i] = SV_EntityGridIsPlayer(ent, i);
+		maxLinked = i + 1;
+	}
+	grid->maxLinked = maxLinked;
+}
+
+
+typedef struct
+{
+	vec3_t mins;
+	vec3_t maxs;
+	vec3_t center;
+	float radiusSq;         // 0 for a box query
+	qboolean playersOnly;
+	int ignoreNum;
+	int* list;
+	float* distSq;
+	int maxCount;
+	int count;
+}gridQuery_t;
+
+static void SV_EntityGridTest( gridQuery_t* q, int num )
+{
+	entityGrid_t* grid = &sv_entityGrid;
+	float* org = grid->origin[num];
+	vec3_t delta;
+	float d;
+
+	if(num == q->ignoreNum || (q->playersOnly && !grid->isPlayer[num]))
+		return;
+
+	if(org[0] < q->mins[0] || org[1] < q->mins[1] || org[2] < q->mins[2]
+		|| org[0] > q->maxs[0] || org[1] > q->maxs[1] || org[2] > q->maxs[2])
+		return;
+
+	if(q->radiusSq > 0)
+	{
+		VectorSubtract(org, q->center, delta);
+		d = DotProduct(delta, delta);
+		if(d > q->radiusSq)
+			return;
+	}else{
+		d = 0;
+	}
+
+	// The entity could have been freed by a script since the last update
+	if(!g_entities[num].inuse)
+		return;
+
+	if(q->count < q->maxCount)
+	{
+		q->list[q->count] = num;
+		if(q->distSq)
+			q->distSq[q->count] = d;
+		q->count++;
+	}
+}
+
+static void SV_EntityGridRun( gridQuery_t* q )
+{
+	entityGrid_t* grid = &sv_entityGrid;
+	int cx, cy, mincx, mincy, maxcx, maxcy, num;
+
+	if(grid->serverid != sv_serverid->integer)
+		SV_EntityGridUpdate();
+
+	q->count = 0;
+
+	mincx = SV_EntityGridCell(q->mins[0]);
+	mincy = SV_EntityGridCell(q->mins[1]);
+	maxcx = SV_EntityGridCell(q->maxs[0]);
+	maxcy = SV_EntityGridCell(q->maxs[1]);
+
+	// A huge area is faster to test entity by entity
+	if((double)(maxcx - mincx + 1) * (maxcy - mincy + 1) > grid->numLinked)
+	{
+		for(num = 0; num < grid->maxLinked; num++)
+		{
+			if(grid->bucket[num] != GRID_UNLINKED)
+				SV_EntityGridTest(q, num);
+		}
+		return;
+	}
+
+	for(cx = mincx; cx <= maxcx; cx++)
+	{
+		for(cy = mincy; cy <= maxcy; cy++)
+		{
+			for(num = grid->bucketHead[SV_EntityGridBucket(cx, cy)]; num != GRID_UNLINKED; num = grid->next[num])
+			{
+				// Other cells can share this bucket
+				if(grid->cellX[num] == cx && grid->cellY[num] == cy)
+					SV_EntityGridTest(q, num);
+			}
+		}
+	}
+}
+
+/* Moves the nearest maxCount entries sorted to the front. Returns how many that are */
+static int SV_EntityGridSortByDistance( int* list, float* distSq, int count, int maxCount )
+{
+	int i, j, num, sorted;
+	float d;
+
+	// Results are usually few, insertion sort is fine. Anything further than the
+	// furthest of maxCount sorted entries can be dropped right away
+	sorted = 0;
+	for(i = 0; i < count; i++)
+	{
+		num = list[i];
+		d = distSq[i];
+		if(sorted < maxCount)
+		{
+			j = sorted++;
+		}else{
+			if(d >= distSq[sorted -1])
+				continue;
+			j = sorted -1;
+		}
+		for(; j > 0 && distSq[j -1] > d; j--)
+		{
+			list[j] = list[j -1];
+			distSq[j] = distSq[j -1];
+		}
+		list[j] = num;
+		distSq[j] = d;
+	}
+	return sorted;
+}
+
+/*
+================
+SV_EntityGridRadius
+
+Fills list with the numbers of all entities, or only players, within radius of origin. Nearest first.
+Returns the number of entities found
+================
+*/
+int SV_EntityGridRadius( const vec3_t origin, float radius, qboolean playersOnly, int* list, int maxCount )
+{
+	gridQuery_t q;
+	int hits[MAX_GENTITIES];
+	float distSq[MAX_GENTITIES];
+	int count;
+
+	if(!(radius > 0) || maxCount <= 0)
+		return 0;
+
+	if(radius > GRID_MAX_RADIUS)
+		radius = GRID_MAX_RADIUS;
+
+	VectorCopy(origin, q.center);
+	q.mins[0] = origin[0] - radius;
+	q.mins[1] = origin[1] - radius;
+	q.mins[2] = origin[2] - radius;
+	q.maxs[0] = origin[0] + radius;
+	q.maxs[1] = origin[1] + radius;
+	q.maxs[2] = origin[2] + radius;
+	q.radiusSq = radius * radius;
+	q.playersOnly = playersOnly;
+	q.ignoreNum = -1;
+	// All hits are needed to know which ones are nearest
+	q.list = hits;
+	q.distSq = distSq;
+	q.maxCount = MAX_GENTITIES;
+
+	SV_EntityGridRun(&q);
+	count = SV_EntityGridSortByDistance(hits, distSq, q.count, maxCount);
+	Com_Memcpy(list, hits, count * sizeof(int));
+	return count;
+}
+
+/*
+================
+SV_EntityGridBox
+
+Fills list with the numbers of all entities, or only players, whose origin is inside the box.
+Returns the number of entities found
+================
+*/
+int SV_EntityGridBox( const vec3_t mins, const vec3_t maxs, qboolean playersOnly, int* list, int maxCount )
+{
+	gridQuery_t q;
+
+	if(maxCount <= 0)
+		return 0;
+
+	VectorCopy(mins, q.mins);
+	VectorCopy(maxs, q.maxs);
+	q.center[0] = q.center[1] = q.center[2] = 0;
+	q.radiusSq = 0;
+	q.playersOnly = playersOnly;
+	q.ignoreNum = -1;
+	q.list = list;
+	q.distSq = NULL;
+	q.maxCount = maxCount;
+
+	SV_EntityGridRun(&q);
+	return q.count;
+}
+
+/*
+================
+SV_EntityGridNearestPlayer
+
+Returns the number of the nearest player to origin or -1 if there is none within maxDist.
+A maxDist of 0 or less does not limit the distance. ignoreNum is skipped, -1 skips no one
+================
+*/
+int SV_EntityGridNearestPlayer( const vec3_t origin, float maxDist, int ignoreNum )
+{
+	entityGrid_t* grid = &sv_entityGrid;
+	gridQuery_t q;
+	int list[MAX_CLIENTS];
+	float distSq[MAX_CLIENTS];
+	float radius;
+	int i, best;
+
+	VectorCopy(origin, q.center);
+	q.playersOnly = qtrue;
+	q.ignoreNum = ignoreNum;
+	q.list = list;
+	q.distSq = distSq;
+	q.maxCount = MAX_CLIENTS;
+
+	// Grow the searched area until a player is found. At the latest when it covers more cells than
+	// there are entities the query tests every entity, so this ends quickly on an empty map
+	radius = 1 << GRID_CELL_SHIFT;
+
+	for(;;)
+	{
+		if(maxDist > 0 && radius > maxDist)
+			radius = maxDist;
+
+		q.mins[0] = origin[0] - radius;
+		q.mins[1] = origin[1] - radius;
+		q.mins[2] = origin[2] - radius;
+		q.maxs[0] = origin[0] + radius;
+		q.maxs[1] = origin[1] + radius;
+		q.maxs[2] = origin[2] + radius;
+		q.radiusSq = radius * radius;
+
+		SV_EntityGridRun(&q);
+
+		if(q.count > 0)
+		{
+			best = 0;
+			for(i = 1; i < q.count; i++)
+			{
+				if(distSq[i] < distSq[best])
+					best = i;
+			}
+			return list[best];
+		}
+
+		if((maxDist > 0 && radius >= maxDist) || radius >= GRID_MAX_RADIUS)
+			return -1;
+
+		if((double)(2 * SV_EntityGridCell(radius) + 1) * (2 * SV_EntityGridCell(radius) + 1) > grid->numLinked)
+		{
+			// Covered every entity already, only the radius limited the result
+			if(maxDist > 0)
+				radius = maxDist;
+			else
+				radius = GRID_MAX_RADIUS;
+			continue;
+		}
+		radius *= 2;
+	}
+}
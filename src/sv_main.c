@@ -42,6 +42,10 @@
 #include "xassets.h"
 #include "nvconfig.h"
 #include "hl2rcon.h"
+#include "qcommon_profile.h"
+#include "httpftp.h"
+#include "varstorage.h"
+#include "scr_vm_profile.h"
 
 #include <string.h>
 #include <stdarg.h>
@@ -59,8 +63,14 @@ cvar_t	*sv_queryIgnoreMegs;
 cvar_t	*sv_queryIgnoreTime;
 cvar_t	*sv_privatePassword;		// password for the privateClient slots
 cvar_t	*sv_allowDownload;
+cvar_t	*sv_downloadWindow;
+cvar_t	*sv_fragmentPacing;
+cvar_t	*sv_downloadCacheSize;
 cvar_t	*sv_wwwDownload;
 cvar_t	*sv_wwwBaseURL;
+cvar_t	*sv_wwwServe;
+cvar_t	*sv_wwwServeMaxPerIP;
+cvar_t	*sv_wwwServeRate;
 cvar_t	*sv_wwwDlDisconnected;
 cvar_t	*sv_voice;
 cvar_t	*sv_voiceQuality;
@@ -88,6 +98,10 @@ cvar_t	*g_friendlyPlayerCanBlock;
 cvar_t	*g_FFAPlayerCanBlock;
 cvar_t	*sv_autodemorecord;
 cvar_t	*sv_demoCompletedCmd;
+cvar_t	*sv_demoSyncInterval;
+cvar_t	*sv_demoBuffer;
+cvar_t	*sv_demoBufferSize;
+cvar_t	*sv_demoBufferKeyframe;
 cvar_t	*sv_mapDownloadCompletedCmd;
 cvar_t	*sv_master[MAX_MASTER_SERVERS];	// master server ip address
 cvar_t	*g_mapstarttime;
@@ -153,6 +167,7 @@ int serverBansCount = 0;
 
 static netadr_t	master_adr[MAX_MASTER_SERVERS][2];
 static char masterServerSecret[MASTERSERVERSECRETLENGTH +1];
+static unsigned int sv_fpsFrameUsec;
 
 /*
 =============================================================================
@@ -374,6 +389,8 @@ void QDECL SV_SendServerCommandString(client_t *cl, int type, char *message)
 	client_t	*client;
 	int		j;
 
+	SV_ServerDemoWriteCommand(cl, type, message);
+
 	if ( cl != NULL ){
 		SV_AddServerCommand(cl, type, (char *)message );
 		return;
@@ -490,7 +507,7 @@ static void SVC_RateLimitInit( ){
 
 	int totalsize = querylimit.max_buckets * sizeof(leakyBucket_t) + querylimit.max_hashes * sizeof(leakyBucket_t*);
 
-	querylimit.buckets = Z_Malloc(totalsize);
+	querylimit.buckets = Z_TagMallocZero(totalsize, TAG_NETWORK);
 
 	if(!querylimit.buckets)
 	{
@@ -1924,7 +1941,8 @@ __optimize3 __regparm2 void SV_PacketEvent( netadr_t *from, msg_t *msg ) {
 	{
 		// if we received a sequenced packet from an address we don't recognize,
 		// send an out of band disconnect packet to it
-		NET_OutOfBandPrint( NS_SERVER, from, "disconnect" );
+		if(SV_ClientMapAllowDisconnectReply( from, qport ))
+			NET_OutOfBandPrint( NS_SERVER, from, "disconnect" );
 		return;
 	}
 #ifndef COD4X17A	
@@ -2237,6 +2255,7 @@ __cdecl void SV_Shutdown( const char *finalmsg ) {
 
 //	SV_RemoveOperatorCommands();
 	SV_MasterShutdown();
+	HStorage_TablesShutdown();
 	SV_ShutdownGameProgs();
 	SV_DisconnectAllClients();
 	SV_DemoSystemShutdown();
@@ -2526,6 +2545,19 @@ void SV_CopyCvars()
 }
 
 
+/* Called by the cvar system when sv_wwwServe got changed */
+static void SV_WWWServeChanged(cvar_t* var, void* arg){
+
+	if(var->boolean)
+		HTTPServer_InitDownloads();
+}
+
+/* Called by the cvar system when sv_fps got changed */
+static void SV_FpsChanged(cvar_t* var, void* arg){
+
+	sv_fpsFrameUsec = 1000000 / var->integer;
+}
+
 
 void SV_InitCvarsOnce(void){
 
@@ -2547,8 +2579,14 @@ void SV_InitCvarsOnce(void){
 	sv_rconPassword = Cvar_RegisterString("rcon_password", "", 0, "Password for the server remote control console");
 
 	sv_allowDownload = Cvar_RegisterBool("sv_allowDownload", qtrue, 1, "Allow clients to download gamefiles from server");
+	sv_downloadWindow = Cvar_RegisterInt("sv_downloadWindow", 16, 1, 64, 0, "Number of download blocks a client can have unacknowledged");
+	sv_fragmentPacing = Cvar_RegisterBool("sv_fragmentPacing", qtrue, 0, "Send fragmented messages like the gamestate as fast as the client's rate allows instead of one fragment per snapshot");
+	sv_downloadCacheSize = Cvar_RegisterInt("sv_downloadCacheSize", 128, 0, 1024, 0, "Memory in MB for files shared between downloading clients. 0 disables the cache");
 	sv_wwwDownload = Cvar_RegisterBool("sv_wwwDownload", qfalse, 1, "Enable http download");
 	sv_wwwBaseURL = Cvar_RegisterString("sv_wwwBaseURL", "", 1, "The base url to files for downloading from the HTTP-Server");
+	sv_wwwServe = Cvar_RegisterBool("sv_wwwServe", qfalse, 1, "Serve downloads over HTTP on the game port. Set sv_wwwBaseURL to http://<public address>:<port> of this server so clients get pointed to it");
+	sv_wwwServeMaxPerIP = Cvar_RegisterInt("sv_wwwServeMaxPerIP", 2, 1, 16, 0, "Maximum concurrent HTTP downloads from one address");
+	sv_wwwServeRate = Cvar_RegisterInt("sv_wwwServeRate", 0, 0, 1048576, 0, "Maximum HTTP download rate per address in KB/s. 0 is unlimited");
 	sv_wwwDlDisconnected = Cvar_RegisterBool("sv_wwwDlDisconnected", qfalse, 1, "Should clients stay connected while downloading from a HTTP-Server?");
 
 	sv_voice = Cvar_RegisterBool("sv_voice", qfalse, 0xd, "Allow serverside voice communication");
@@ -2580,6 +2618,10 @@ void SV_InitCvarsOnce(void){
 	sv_uptime = Cvar_RegisterString("uptime", "", CVAR_SERVERINFO | CVAR_ROM, "Time the server is running since last restart");
 	sv_autodemorecord = Cvar_RegisterBool("sv_autodemorecord", qfalse, 0, "Automatically start from each connected client a demo.");
 	sv_demoCompletedCmd = Cvar_RegisterString("sv_demoCompletedCmd", "", com_securemode ? CVAR_INIT : 0 , "This program will be executed when a demo has been completed. The demofilename will be passed as argument.");
+	sv_demoSyncInterval = Cvar_RegisterInt("sv_demoSyncInterval", 10, 0, 3600, 0, "Interval in seconds in which recorded demo data gets forced onto the disk. 0 leaves it to the operating system");
+	sv_demoBuffer = Cvar_RegisterInt("sv_demoBuffer", 0, 0, 60, 0, "Minutes of gameplay kept in memory for every client which can be saved later with dumpdemo. 0 disables it");
+	sv_demoBufferSize = Cvar_RegisterInt("sv_demoBufferSize", 4096, 256, 65536, 0, "Maximum memory in KB used by the demo buffer of a single client");
+	sv_demoBufferKeyframe = Cvar_RegisterInt("sv_demoBufferKeyframe", 15, 1, 300, 0, "Interval in seconds in which the demo buffer starts a new segment a saved demo can begin with");
 	sv_mapDownloadCompletedCmd = Cvar_RegisterString("sv_mapDownloadCompletedCmd", "", com_securemode ? CVAR_INIT : 0 , "This program will be executed when a downloaded map was received. The usermaps/mapname will be passed as argument.");
 	sv_consayname = Cvar_RegisterString("sv_consayname", "^2Server: ^7", CVAR_ARCHIVE, "If the server broadcast text-messages this name will be used");
 	sv_contellname = Cvar_RegisterString("sv_contellname", "^5Server^7->^5PM: ^7", CVAR_ARCHIVE, "If the server broadcast text-messages this name will be used");
@@ -2612,6 +2654,9 @@ void SV_InitCvarsOnce(void){
 	sv_serverid = Cvar_RegisterInt("sv_serverid", 0, 0x80000000, 0x7fffffff, 0x48, "Voice quality");
 	sv_pure = Cvar_RegisterBool("sv_pure", qtrue, 0xc, "Cannot use modified IWD files");
 	sv_fps = Cvar_RegisterInt("sv_fps", 20, 1, 250, 0, "Server frames per second");
+	Cvar_AddChangeCallback(sv_fps, SV_FpsChanged, NULL);
+	Cvar_AddChangeCallback(sv_wwwServe, SV_WWWServeChanged, NULL);
+	SV_FpsChanged(sv_fps, NULL);
 	sv_showAverageBPS = Cvar_RegisterBool("sv_showAverageBPS", qfalse, 0, "Show average bytes per second for net debugging");
 	sv_botsPressAttackBtn = Cvar_RegisterBool("sv_botsPressAttackBtn", qtrue, 0, "Allow testclients to press attack button");
 	sv_debugRate = Cvar_RegisterBool("sv_debugRate", qfalse, 0, "Enable snapshot rate debugging info");
@@ -2631,6 +2676,7 @@ void SV_Init(){
         SV_InitBanlist();
         Init_CallVote();
         SV_InitServerId();
+        Scr_ProfInit();
         Com_RandomBytes((byte*)&psvs.randint, sizeof(psvs.randint));
 
 }
@@ -3036,7 +3082,10 @@ void SV_InitArchivedSnapshot(){
 
 void SV_RunFrame(){
 	SV_ResetSekeletonCache();
+	Scr_ProfBeginFrame();
 	G_RunFrame(svs.time);
+	Scr_ProfEndFrame();
+	SV_EntityGridUpdate();
 }
 
 
@@ -3122,6 +3171,8 @@ void SV_PostLevelLoad(){
 	PHandler_Event(PLUGINS_ONSPAWNSERVER, NULL);
 	sv.frameusec = 1000000 / sv_fps->integer;
 	sv.serverId = com_frameTime;
+	Mem_ReportHighWater();
+	Z_LevelReport();
 }
 
 void SV_LoadLevel(const char* levelname)
@@ -3360,6 +3411,7 @@ void SV_CheckTimeouts( void ) {
 		if ( cl->state == CS_ZOMBIE && cl->lastPacketTime < zombiepoint ) {
 			// using the client id cause the cl->name is empty at this point
 			Com_DPrintf( "Going from CS_ZOMBIE to CS_FREE for client %d\n", i );
+			SV_ClientMapRemove( cl );
 			cl->state = CS_FREE;    // can now be reused
 			continue;
 		}
@@ -3369,11 +3421,13 @@ void SV_CheckTimeouts( void ) {
 			// cause a timeout
 			if ( ++cl->timeoutCount > 5 ) {
 				SV_DropClient( cl, "EXE_TIMEDOUT" );
+				SV_ClientMapRemove( cl );
 				cl->state = CS_FREE;    // don't bother with zombie state
 			}
 		} else if ( cl->state == CS_CONNECTED && cl->lastPacketTime < connectdroppoint ) {
 			if ( ++cl->timeoutCount > 5 ) {
 				SV_DropClient( cl, "EXE_TIMEDOUT" );
+				SV_ClientMapRemove( cl );
 				cl->state = CS_FREE;    // don't bother with zombie state
 			}
 		} else if ( cl->state == CS_PRIMED && cl->lastPacketTime < primeddroppoint ) {
@@ -3381,6 +3435,7 @@ void SV_CheckTimeouts( void ) {
 			// cause a timeout
 			if ( ++cl->timeoutCount > 5 ) {
 				SV_DropClient( cl, "EXE_TIMEDOUT" );
+				SV_ClientMapRemove( cl );
 				cl->state = CS_FREE;    // don't bother with zombie state
 			}
 		} else {
@@ -3427,16 +3482,12 @@ Return time in millseconds until processing of the next server frame.
 */
 unsigned int SV_FrameUsec()
 {
-	if(sv_fps)
+	if(sv_fpsFrameUsec)
 	{
-		unsigned int frameUsec;
-		
-		frameUsec = 1000000 / sv_fps->integer;
-		
-		if(frameUsec < sv.timeResidual)
+		if(sv_fpsFrameUsec < sv.timeResidual)
 			return 0;
 		else
-			return frameUsec - sv.timeResidual;
+			return sv_fpsFrameUsec - sv.timeResidual;
 	}
 	else
 		return 1;
@@ -3452,10 +3503,12 @@ happen before SV_Frame is called
 */
 __optimize3 __regparm1 qboolean SV_Frame( unsigned int usec ) {
 	unsigned int frameUsec;
+	unsigned int sleepUsec, paceUsec;
 	char mapname[MAX_QPATH];
 	client_t* client;
 	int i;
     static qboolean underattack = qfalse;
+	unsigned long long profStart;
 	mvabuf;
 
 
@@ -3486,7 +3539,13 @@ __optimize3 __regparm1 qboolean SV_Frame( unsigned int usec ) {
 	if ( sv.timeResidual < frameUsec ) {
 		// NET_Sleep will give the OS time slices until either get a packet
 		// or time enough for a server frame has gone by
-		underattack = NET_Sleep( frameUsec - sv.timeResidual );
+		// wake up early if a paced fragment is due before that
+		sleepUsec = frameUsec - sv.timeResidual;
+		paceUsec = SV_PaceFragments( );
+		if ( paceUsec && paceUsec < sleepUsec ) {
+			sleepUsec = paceUsec;
+		}
+		underattack = NET_Sleep( sleepUsec );
 		return qfalse;
 	}
 
@@ -3495,30 +3554,50 @@ __optimize3 __regparm1 qboolean SV_Frame( unsigned int usec ) {
 
 	SV_PreFrame( );
 
+	profStart = Prof_Begin();
 	// run the game simulation in chunks
 	while ( sv.timeResidual >= frameUsec ) {
 		sv.timeResidual -= frameUsec;
 		svs.time += frameUsec / 1000;
 
 		// let everything in the world think and move
+		Scr_ProfBeginFrame( );
 		G_RunFrame( svs.time );
+		Scr_ProfEndFrame( );
+		SV_EntityGridUpdate( );
 	}
+	Prof_End(PROF_GAME, profStart);
 
 	// send messages back to the clients
+	profStart = Prof_Begin();
 	SV_SendClientMessages();
+	Prof_End(PROF_SNAPSHOTS, profStart);
 
 	Scr_SetLoading(0);
 
 	// update ping based on the all received frames
+	profStart = Prof_Begin();
 	SV_CalcPings();
+	Prof_End(PROF_PINGS, profStart);
 
 	// check timeouts
+	profStart = Prof_Begin();
 	SV_CheckTimeouts();
+	Prof_End(PROF_TIMEOUTS, profStart);
+
+	// write out changes of the script storage tables
+	HStorage_TablesFrame();
+
+	SV_DemoSystemFrame();
 
 	// send a heartbeat to the master if needed
+	profStart = Prof_Begin();
 	SV_MasterHeartbeat( HEARTBEAT_GAME );
+	Prof_End(PROF_HEARTBEAT, profStart);
 #ifdef PUNKBUSTER
+	profStart = Prof_Begin();
 	PbServerProcessEvents( 0 );
+	Prof_End(PROF_PUNKBUSTER, profStart);
 #endif
 	// if time is about to hit the 32nd bit, kick all clients
 	// and clear sv.time, rather
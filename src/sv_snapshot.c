@@ -148,6 +148,11 @@ __cdecl void SV_WriteSnapshotToClient(client_t* client, msg_t* msg){
         }
         client->demoDeltaFrameCount = client->demoMaxDeltaFrames;
 
+    } else if(SV_DemoBufferNeedsKeyframe(client)){
+
+        oldframe = NULL;
+        lastframe = 0;
+        var_x = 0;
 
     } else {
         oldframe = &client->frames[client->deltaMessage & PACKET_MASK];
@@ -172,6 +177,11 @@ __cdecl void SV_WriteSnapshotToClient(client_t* client, msg_t* msg){
         }
     }
 
+    if(oldframe == NULL) {
+        // a non-delta snapshot can start a new segment of the demo buffer
+        SV_DemoBufferKeyframe(client);
+    }
+
 
     MSG_WriteByte(msg, svc_snapshot);
     MSG_WriteLong(msg, svsHeader.time);
@@ -345,15 +355,10 @@ TTimo - use sv_maxRate or sv_dl_maxRate depending on regular or downloading clie
 */
 #define HEADER_RATE_BYTES   48      // include our header, IP header, and some overhead
 
-static int SV_RateMsec( client_t *client, int messageSize ) {
+static int SV_ClientRate( client_t *client ) {
 	int rate;
-	int rateMsec;
 	int maxRate;
 
-	// individual messages will never be larger than fragment size
-	if ( messageSize > 1500 ) {
-		messageSize = 1500;
-	}
 	// low watermark for sv_maxRate, never 0 < sv_maxRate < 1000 (0 is no limitation)
 	if ( sv_maxRate->integer && sv_maxRate->integer < 1000 ) {
 		Cvar_SetInt( sv_maxRate, 1000 );
@@ -366,12 +371,235 @@ static int SV_RateMsec( client_t *client, int messageSize ) {
 			rate = maxRate;
 		}
 	}
+	if ( rate < 1000 ) {
+		rate = 1000;
+	}
+	return rate;
+}
+
+static int SV_RateMsec( client_t *client, int messageSize ) {
+	int rate;
+	int rateMsec;
+
+	// individual messages will never be larger than fragment size
+	if ( messageSize > 1500 ) {
+		messageSize = 1500;
+	}
+	rate = SV_ClientRate( client );
 	rateMsec = ( messageSize + HEADER_RATE_BYTES ) * 1000 / rate;
 
 	return rateMsec;
 }
 
 
+
+/*
+=============================================================================
+
+Fragment pacing
+
+Fragmented messages (gamestates, large reliable bursts) used to go out one
+fragment per snapshot interval no matter how fast the client is. Instead every
+client gets a token bucket that refills at its rate and holds about one round
+trip worth of data. SV_SendClientMessages drains it once per frame and
+SV_PaceFragments drains it between frames, so the fragments are spread over
+the frame instead of being sent as one burst.
+
+=============================================================================
+*/
+
+#define PACER_MIN_RTT		50		// msec, floor for the bucket depth of LAN clients
+#define PACER_CREDIT_SCALE	1000000LL	// credit is kept in bytes * usec/sec to avoid rounding loss
+
+typedef struct{
+	long long credit;
+	unsigned long long lastRefill;
+	int gamestateStart;
+	int gamestateMsec;
+	int handshakeRtt;	// client->ping is only measured once the client is active
+}fragmentPacer_t;
+
+static fragmentPacer_t sv_fragmentPacers[MAX_CLIENTS];
+
+static int sv_gamestateCount;
+static int sv_gamestateTotalMsec;
+static int sv_gamestateMaxMsec;
+
+static int SV_FragmentCost( netchan_t *chan ) {
+	int length = chan->unsentLength - chan->unsentFragmentStart;
+
+	if ( length > FRAGMENT_SIZE ) {
+		length = FRAGMENT_SIZE;
+	}
+	return length + HEADER_RATE_BYTES;
+}
+
+/*
+==================
+SV_PaceClientFragments
+
+Sends as many pending fragments as the client's bucket allows.
+Returns the number of usec until the next fragment can go out, 0 if nothing is pending
+==================
+*/
+static unsigned int SV_PaceClientFragments( client_t *client, unsigned long long now ) {
+	fragmentPacer_t *pacer = &sv_fragmentPacers[client - svs.clients];
+	unsigned long long elapsed;
+	long long depth, cost;
+	int rate, rtt;
+
+	rate = SV_ClientRate( client );
+
+	rtt = client->ping;
+	if ( client->state != CS_ACTIVE || rtt < 0 ) {
+		rtt = pacer->handshakeRtt;
+	}
+	if ( rtt < PACER_MIN_RTT ) {
+		rtt = PACER_MIN_RTT;
+	}
+	depth = (long long)rate * rtt * (PACER_CREDIT_SCALE / 1000);
+	if ( depth < 2 * (FRAGMENT_SIZE + HEADER_RATE_BYTES) * PACER_CREDIT_SCALE ) {
+		depth = 2 * (FRAGMENT_SIZE + HEADER_RATE_BYTES) * PACER_CREDIT_SCALE;
+	}
+
+	elapsed = now - pacer->lastRefill;
+	if ( pacer->lastRefill == 0 || elapsed > 1000000 ) {
+		elapsed = 1000000;
+	}
+	pacer->lastRefill = now;
+	pacer->credit += (long long)rate * elapsed;
+	if ( pacer->credit > depth ) {
+		pacer->credit = depth;
+	}
+
+	while ( client->state != CS_FREE && client->netchan.unsentFragments ) {
+		cost = SV_FragmentCost( &client->netchan ) * PACER_CREDIT_SCALE;
+		if ( pacer->credit < cost ) {
+			return ( cost - pacer->credit ) / rate + 1;
+		}
+		pacer->credit -= cost;
+		SV_Netchan_TransmitNextFragment( client );
+	}
+	return 0;
+}
+
+/*
+==================
+SV_PaceFragments
+
+Called while the server is idle between frames.
+Returns the number of usec until the next fragment of any client is due, 0 if nothing is pending
+==================
+*/
+unsigned int SV_PaceFragments( void ) {
+	client_t *c;
+	int i;
+	unsigned int wait, minWait;
+	unsigned long long now;
+
+	if ( !sv_fragmentPacing->boolean ) {
+		return 0;
+	}
+
+	now = Sys_MicrosecondsMonotonic();
+	minWait = 0;
+
+	for ( i = 0, c = svs.clients ; i < sv_maxclients->integer ; i++, c++ ) {
+		if ( !c->state || c->netchan.remoteAddress.type == NA_BOT || !c->netchan.unsentFragments ) {
+			continue;
+		}
+		wait = SV_PaceClientFragments( c, now );
+		if ( wait && ( minWait == 0 || wait < minWait ) ) {
+			minWait = wait;
+		}
+	}
+	return minWait;
+}
+
+/*
+==================
+SV_PacerClientConnected
+
+Resets the bucket of a reused client slot. rtt is the round trip of the
+challenge handshake in msec, -1 if it is unknown
+==================
+*/
+void SV_PacerClientConnected( client_t *client, int rtt ) {
+	fragmentPacer_t *pacer = &sv_fragmentPacers[client - svs.clients];
+
+	Com_Memset( pacer, 0, sizeof( fragmentPacer_t ) );
+	pacer->handshakeRtt = rtt;
+}
+
+/*
+==================
+SV_GamestateBegin / SV_GamestateComplete
+
+Measures the time from the first gamestate transmission until the client enters the world
+==================
+*/
+void SV_GamestateBegin( client_t *client ) {
+	fragmentPacer_t *pacer = &sv_fragmentPacers[client - svs.clients];
+
+	pacer->gamestateStart = Sys_Milliseconds();
+	if ( pacer->gamestateStart == 0 ) {
+		pacer->gamestateStart = 1;
+	}
+}
+
+void SV_GamestateComplete( client_t *client ) {
+	fragmentPacer_t *pacer = &sv_fragmentPacers[client - svs.clients];
+	int msec;
+
+	if ( pacer->gamestateStart == 0 ) {
+		return;
+	}
+	msec = Sys_Milliseconds() - pacer->gamestateStart;
+	pacer->gamestateStart = 0;
+	pacer->gamestateMsec = msec;
+
+	sv_gamestateCount++;
+	sv_gamestateTotalMsec += msec;
+	if ( msec > sv_gamestateMaxMsec ) {
+		sv_gamestateMaxMsec = msec;
+	}
+	Com_DPrintf( "Gamestate for %s completed in %i msec\n", client->name, msec );
+}
+
+/*
+==================
+SV_GamestateTimes_f
+
+Lists how long every connected client took to receive its gamestate
+==================
+*/
+void SV_GamestateTimes_f( void ) {
+	client_t *c;
+	fragmentPacer_t *pacer;
+	int i;
+
+	Com_Printf( "num rate   ping gamestate name\n" );
+	Com_Printf( "--- ------ ---- --------- ---------------\n" );
+
+	for ( i = 0, c = svs.clients ; i < sv_maxclients->integer ; i++, c++ ) {
+		if ( !c->state || c->netchan.remoteAddress.type == NA_BOT ) {
+			continue;
+		}
+		pacer = &sv_fragmentPacers[i];
+		if ( pacer->gamestateStart ) {
+			Com_Printf( "%3i %6i %4i %7i*  %s\n", i, SV_ClientRate( c ), c->ping, Sys_Milliseconds() - pacer->gamestateStart, c->name );
+		} else {
+			Com_Printf( "%3i %6i %4i %7i   %s\n", i, SV_ClientRate( c ), c->ping, pacer->gamestateMsec, c->name );
+		}
+	}
+
+	if ( sv_gamestateCount ) {
+		Com_Printf( "\n%i gamestates, average %i msec, worst %i msec. * = still in progress\n",
+			sv_gamestateCount, sv_gamestateTotalMsec / sv_gamestateCount, sv_gamestateMaxMsec );
+	}
+}
+
+
 int irand()
 {
 
@@ -416,14 +644,11 @@ __cdecl void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 		SV_DropClient(client, client->delayDropMsg);
 	}
 
-	if(client->demorecording && !client->demowaiting)
-	{
 #ifdef COD4X17A
-		SV_WriteDemoMessageForClient((byte*)0x13f39080, len, client);
+	SV_WriteDemoMessageForClient((byte*)0x13f39080, len, client);
 #else
-		SV_WriteDemoMessageForClient(msg->data, msg->cursize, client);
+	SV_WriteDemoMessageForClient(msg->data, msg->cursize, client);
 #endif
-	}
 
 	// record information about the message
 #ifdef COD4X17A
@@ -592,6 +817,13 @@ void SV_SendClientMessages( void ) {
 		ReliableMessagesTransmitNextFragment(&c->relmsg);
 		Net_TestingFunction(&c->relmsg);
 #endif
+		// paced fragments don't wait for the snapshot interval
+		if ( c->netchan.unsentFragments && sv_fragmentPacing->boolean ) {
+			SV_PaceClientFragments( c, Sys_MicrosecondsMonotonic() );
+			snapClients[i] = 0;
+			continue;
+		}
+
 		if ( svs.time < c->nextSnapshotTime ) {
 			snapClients[i] = 0;	
 			continue; // not time yet
@@ -695,6 +927,8 @@ void SV_SendClientMessages( void ) {
 		return;
 	}
 		
+	SV_ServerDemoWriteSnapshot(msg.data, msg.cursize, svs.nextArchivedSnapshotFrames);
+
 	svs.archiveSnaps[svs.nextArchivedSnapshotFrames % 1200].buffer = svs.nextArchivedSnapshotBuffer;
 	svs.archiveSnaps[svs.nextArchivedSnapshotFrames % 1200].msgsize = msg.cursize;
 
@@ -32,6 +32,7 @@
 unsigned int Sys_Milliseconds( void );
 unsigned long long Sys_MillisecondsLong( void );
 unsigned long long Sys_MicrosecondsLong( void );
+unsigned long long Sys_MicrosecondsMonotonic( void );
 
 void Sys_TimerInit( void );
 unsigned long long Sys_Microseconds( void );
@@ -83,6 +84,10 @@ void  __attribute__ ((noreturn)) Sys_ExitForOS( int exitCode );
 
 
 void Sys_SleepSec(int seconds);
+void Sys_SleepMSec(int msec);
+void Sys_FileSync(FILE* f);
+void* Sys_MemoryReserve(unsigned int size, qboolean hugepages);
+int Sys_MemoryResidentBytes(void* start, unsigned int size);
 int Sys_Backtrace(void** buffer, int size);
 void Sys_EventLoop(void);
 uint32_t Sys_MillisecondsRaw();
@@ -97,6 +97,9 @@ static qboolean	winsockInitialized = qfalse;
 #	if !defined(__sun) && !defined(__sgi)
 #		include <ifaddrs.h>
 #	endif
+#	ifdef __linux__
+#		include <sys/sendfile.h>
+#	endif
 
 #	ifdef __sun
 #		include <sys/filio.h>
@@ -2362,6 +2365,58 @@ int NET_TcpSendData( int sock, const void *data, int length ) {
 	return state;
 }
 
+/*
+==================
+NET_TcpSendFile
+Only for Stream sockets (TCP)
+Sends up to length bytes of the file starting at offset. On Linux sendfile()
+hands the data from the page cache straight to the socket
+Returns the number of bytes sent, 0 if the socket can't take more data right
+now and -1 if the socket got closed
+==================
+*/
+
+int NET_TcpSendFile( int sock, FILE* file, int offset, int length ) {
+
+#ifdef __linux__
+	off_t fileofs;
+	int state;
+
+	if(sock < 1)
+		return -1;
+
+	fileofs = offset;
+	state = sendfile( sock, fileno(file), &fileofs, length );
+
+	if(state == SOCKET_ERROR)
+	{
+		if( socketError == EAGAIN )
+		{
+			return 0;
+		}
+		Com_PrintWarningNoRedirect ("NET_TcpSendFile: Couldn't send data to remote host: %s\n", NET_ErrorString());
+		NET_TcpCloseSocket(sock);
+		return -1;
+	}
+	return state;
+#else
+	byte buf[16384];
+	int len;
+
+	if(length > sizeof(buf))
+		length = sizeof(buf);
+
+	if(fseek( file, offset, SEEK_SET ) != 0 || (len = fread( buf, 1, length, file )) <= 0)
+	{
+		Com_PrintWarningNoRedirect ("NET_TcpSendFile: Couldn't read the file\n");
+		NET_TcpCloseSocket(sock);
+		return -1;
+	}
+	// unsent data simply gets read again with the next call
+	return NET_TcpSendData( sock, buf, len );
+#endif
+}
+
 /*========================================================================================================
 Functions for TCP networking which can be used only by server
 */
@@ -117,6 +117,7 @@ qboolean	Sys_IsLANAddress (netadr_t *adr);
 void		Sys_ShowIP(void);
 
 int NET_TcpSendData( int sock, const void *data, int length );
+int NET_TcpSendFile( int sock, FILE* file, int offset, int length );
 void NET_TcpServerPacketEventLoop();
 void NET_TcpServerRebuildFDList(void);
 void NET_TcpServerInit(void);
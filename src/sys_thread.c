@@ -27,11 +27,14 @@
 #include "sys_thread.h"
 #include "qcommon.h"
 #include "qcommon_io.h"
+#include "cvar.h"
+#include "cmd.h"
 #ifdef THREAD_DEBUG	
 #include "sys_main.h"
 #endif
 #include <string.h>
 #include <stdarg.h>
+#include <stdlib.h>
 
 
 
@@ -132,6 +135,8 @@ void Sys_RunThreadCallbacks()
 		Com_Memset(&thread_callbacks[i], 0, sizeof(thread_callback_t));
 		
 	}
+
+	Sys_RunJobCompletions();
 }
 
 
@@ -229,3 +234,431 @@ qboolean Sys_CreateCallbackThread(void* threadMain,...)
 		tcb->isActive = qtrue;
 	return success;
 }
+
+
+/*
+==============================================================================
+
+JOB SYSTEM
+
+A pool of persistent worker threads, sized by sys_workerThreads, runs jobs
+which get offloaded from the main thread. Each worker owns a deque: it pushes
+and pops its own work at the bottom while idle workers steal from the top of
+the others. Jobs submitted by the main thread are spread round robin.
+
+A job can depend on other jobs and becomes runnable once all of them have
+finished. Its completion function runs on the main thread from
+Sys_RunThreadCallbacks, so it may use everything a frame may use. The job
+function itself runs on a worker and must not touch game, server or script
+state.
+
+A job handle stays valid until its completion function has been called.
+Without workers the job runs right away on the main thread and its
+completion still gets delivered on the next frame.
+
+Jobs are meant for work which keeps a CPU busy. Anything that blocks for a
+long time, like a network transfer, belongs on its own thread. Such a thread
+can still hand its result to the main thread with a job that has no function
+and gets finished by Sys_JobComplete.
+
+==============================================================================
+*/
+
+#define MAX_WORKERS 16
+#define JOB_DEQUE_SIZE 256			//Must be a power of 2
+#define JOB_MAX_DEPENDENTS 8
+
+struct job_s
+{
+	jobFunc_t func;
+	jobFunc_t done;
+	void* arg;
+	volatile int pending;			//Unfinished dependencies, plus one until the job got submitted
+	volatile int lock;
+	qboolean finished;
+	int numDependents;
+	struct job_s* dependents[JOB_MAX_DEPENDENTS];
+	struct job_s* nextDone;
+};
+
+typedef struct
+{
+	volatile int lock;
+	unsigned int top;				//Thieves take from here
+	unsigned int bottom;			//The owner pushes and pops here
+	job_t* jobs[JOB_DEQUE_SIZE];
+	threadid_t tid;
+	unsigned int executed;
+	unsigned int stolen;
+}jobWorker_t;
+
+static jobWorker_t job_workers[MAX_WORKERS];
+static int job_numWorkers;
+static unsigned int job_nextWorker;
+static void* job_semaphore;
+static job_t* volatile job_doneList;
+static volatile int job_running;
+static cvar_t* sys_workerThreads;
+
+static void Sys_JobLock(volatile int* lock)
+{
+	while(__sync_lock_test_and_set(lock, 1))
+		;
+}
+
+static void Sys_JobUnlock(volatile int* lock)
+{
+	__sync_lock_release(lock);
+}
+
+static jobWorker_t* Sys_JobCurrentWorker( void )
+{
+	int i;
+
+	for(i = 0; i < job_numWorkers; i++)
+	{
+		if(Sys_ThreadisSame(job_workers[i].tid))
+			return &job_workers[i];
+	}
+	return NULL;
+}
+
+static qboolean Sys_JobPush(jobWorker_t* worker, job_t* job)
+{
+	Sys_JobLock(&worker->lock);
+	if(worker->bottom - worker->top >= JOB_DEQUE_SIZE)
+	{
+		Sys_JobUnlock(&worker->lock);
+		return qfalse;
+	}
+	worker->jobs[worker->bottom & (JOB_DEQUE_SIZE -1)] = job;
+	worker->bottom++;
+	Sys_JobUnlock(&worker->lock);
+	return qtrue;
+}
+
+static job_t* Sys_JobPop(jobWorker_t* worker)
+{
+	job_t* job = NULL;
+
+	Sys_JobLock(&worker->lock);
+	if(worker->bottom != worker->top)
+	{
+		worker->bottom--;
+		job = worker->jobs[worker->bottom & (JOB_DEQUE_SIZE -1)];
+	}
+	Sys_JobUnlock(&worker->lock);
+	return job;
+}
+
+static job_t* Sys_JobSteal(jobWorker_t* victim)
+{
+	job_t* job = NULL;
+
+	if(victim->bottom == victim->top)
+		return NULL;
+
+	Sys_JobLock(&victim->lock);
+	if(victim->bottom != victim->top)
+	{
+		job = victim->jobs[victim->top & (JOB_DEQUE_SIZE -1)];
+		victim->top++;
+	}
+	Sys_JobUnlock(&victim->lock);
+	return job;
+}
+
+static void Sys_JobFinish(job_t* job);
+
+/* Queues a job whose dependencies are all done */
+static void Sys_JobEnqueue(job_t* job)
+{
+	jobWorker_t* worker;
+	int i;
+
+	if(job_numWorkers == 0)
+	{
+		job->func(job->arg);
+		Sys_JobFinish(job);
+		return;
+	}
+
+	worker = Sys_JobCurrentWorker();
+	if(worker == NULL || !Sys_JobPush(worker, job))
+	{
+		for(i = 0; i < job_numWorkers; i++)
+		{
+			worker = &job_workers[__sync_fetch_and_add(&job_nextWorker, 1) % job_numWorkers];
+			if(Sys_JobPush(worker, job))
+				break;
+		}
+		if(i == job_numWorkers)
+		{
+			//Every deque is full, better run it here than losing it
+			job->func(job->arg);
+			Sys_JobFinish(job);
+			return;
+		}
+	}
+	Sys_SemaphorePost(job_semaphore);
+}
+
+static void Sys_JobFinish(job_t* job)
+{
+	job_t* dependents[JOB_MAX_DEPENDENTS];
+	job_t* head;
+	int i, count;
+
+	Sys_JobLock(&job->lock);
+	job->finished = qtrue;
+	count = job->numDependents;
+	Com_Memcpy(dependents, job->dependents, count * sizeof(job_t*));
+	Sys_JobUnlock(&job->lock);
+
+	for(i = 0; i < count; i++)
+	{
+		if(__sync_sub_and_fetch(&dependents[i]->pending, 1) == 0)
+			Sys_JobEnqueue(dependents[i]);
+	}
+
+	do
+	{
+		head = job_doneList;
+		job->nextDone = head;
+	}while(!__sync_bool_compare_and_swap(&job_doneList, head, job));
+}
+
+static void* Sys_JobWorkerMain(void* arg)
+{
+	jobWorker_t* self = arg;
+	job_t* job;
+	int i, start;
+
+	start = self - job_workers;
+
+	while(qtrue)
+	{
+		job = Sys_JobPop(self);
+
+		for(i = 1; job == NULL && i < job_numWorkers; i++)
+		{
+			job = Sys_JobSteal(&job_workers[(start + i) % job_numWorkers]);
+			if(job)
+				self->stolen++;
+		}
+
+		if(job == NULL)
+		{
+			//Queued jobs still get done at shutdown
+			if(!job_running)
+				break;
+			Sys_SemaphoreWait(job_semaphore);
+			continue;
+		}
+
+		job->func(job->arg);
+		self->executed++;
+		Sys_JobFinish(job);
+	}
+	return NULL;
+}
+
+/*
+=================
+Sys_JobCreate
+
+The job does not run before Sys_JobSubmit, so dependencies can be added first
+=================
+*/
+job_t* Sys_JobCreate(jobFunc_t func, jobFunc_t done, void* arg)
+{
+	job_t* job;
+
+	job = malloc(sizeof(job_t));
+	if(job == NULL)
+	{
+		Com_PrintError("Sys_JobCreate: Out of memory\n");
+		return NULL;
+	}
+	Com_Memset(job, 0, sizeof(job_t));
+	job->func = func;
+	job->done = done;
+	job->arg = arg;
+	job->pending = 1;
+	return job;
+}
+
+/*
+=================
+Sys_JobDepend
+
+Job won't start before dependency has finished. Both have to be created by the
+same thread and job must not be submitted yet
+=================
+*/
+qboolean Sys_JobDepend(job_t* job, job_t* dependency)
+{
+	Sys_JobLock(&dependency->lock);
+	if(dependency->finished)
+	{
+		Sys_JobUnlock(&dependency->lock);
+		return qtrue;
+	}
+	if(dependency->numDependents == JOB_MAX_DEPENDENTS)
+	{
+		Sys_JobUnlock(&dependency->lock);
+		Com_PrintError("Sys_JobDepend: Too many jobs depend on one job\n");
+		return qfalse;
+	}
+	__sync_add_and_fetch(&job->pending, 1);
+	dependency->dependents[dependency->numDependents++] = job;
+	Sys_JobUnlock(&dependency->lock);
+	return qtrue;
+}
+
+void Sys_JobSubmit(job_t* job)
+{
+	if(__sync_sub_and_fetch(&job->pending, 1) == 0)
+		Sys_JobEnqueue(job);
+}
+
+job_t* Sys_JobRun(jobFunc_t func, jobFunc_t done, void* arg)
+{
+	job_t* job = Sys_JobCreate(func, done, arg);
+
+	if(job)
+		Sys_JobSubmit(job);
+	return job;
+}
+
+/*
+=================
+Sys_JobComplete
+
+Finishes a job which got created without a function instead of submitting it.
+Can be called from any thread, the completion function runs on the main thread
+=================
+*/
+void Sys_JobComplete(job_t* job)
+{
+	if(__sync_sub_and_fetch(&job->pending, 1) == 0)
+		Sys_JobFinish(job);
+}
+
+/*
+=================
+Sys_RunJobCompletions
+
+Calls the completion functions of the finished jobs in the order they finished
+=================
+*/
+void Sys_RunJobCompletions( void )
+{
+	job_t* list;
+	job_t* next;
+	job_t* ordered = NULL;
+
+	if(job_doneList == NULL)
+		return;
+
+	list = __sync_lock_test_and_set(&job_doneList, NULL);
+
+	while(list)
+	{
+		next = list->nextDone;
+		list->nextDone = ordered;
+		ordered = list;
+		list = next;
+	}
+
+	while(ordered)
+	{
+		next = ordered->nextDone;
+		if(ordered->done)
+			ordered->done(ordered->arg);
+		free(ordered);
+		ordered = next;
+	}
+}
+
+static void Sys_Jobs_f( void )
+{
+	int i;
+
+	if(job_numWorkers == 0)
+	{
+		Com_Printf("No worker threads are running, jobs run on the main thread\n");
+		return;
+	}
+	for(i = 0; i < job_numWorkers; i++)
+	{
+		Com_Printf("worker %2d: %u jobs executed, %u of them stolen, %u queued\n", i, job_workers[i].executed,
+					job_workers[i].stolen, job_workers[i].bottom - job_workers[i].top);
+	}
+}
+
+void Sys_InitJobs( void )
+{
+	int i, count;
+
+	sys_workerThreads = Cvar_RegisterInt("sys_workerThreads", -1, -1, MAX_WORKERS, CVAR_LATCH, "Number of worker threads for offloaded jobs. -1 uses one less than the number of cores, 0 runs jobs on the main thread");
+	Cmd_AddCommand("jobs", Sys_Jobs_f);
+
+	count = sys_workerThreads->integer;
+	if(count < 0)
+	{
+		count = Sys_GetNumCPUs() -1;
+		if(count > MAX_WORKERS)
+			count = MAX_WORKERS;
+	}
+	if(count <= 0)
+		return;
+
+	job_semaphore = Sys_SemaphoreCreate();
+	if(job_semaphore == NULL)
+		return;
+
+	job_running = qtrue;
+	for(i = 0; i < count; i++)
+	{
+		//Published before the thread starts, Sys_JobCurrentWorker relies on it
+		job_numWorkers = i +1;
+		if(!Sys_CreateNewThread(Sys_JobWorkerMain, &job_workers[i].tid, &job_workers[i]))
+		{
+			job_numWorkers = i;
+			break;
+		}
+	}
+	Com_Printf("Started %d worker threads\n", job_numWorkers);
+}
+
+/*
+=================
+Sys_ShutdownJobs
+
+Lets the workers finish the queued jobs and waits for them to exit. Jobs
+submitted afterwards run on the main thread. Completions which have not been
+delivered yet are dropped
+=================
+*/
+void Sys_ShutdownJobs( void )
+{
+	int i, count;
+
+	if(job_numWorkers == 0)
+		return;
+
+	count = job_numWorkers;
+	job_running = qfalse;
+	__sync_synchronize();
+
+	for(i = 0; i < count; i++)
+	{
+		Sys_SemaphorePost(job_semaphore);
+	}
+	for(i = 0; i < count; i++)
+	{
+		Sys_JoinThread(job_workers[i].tid);
+	}
+	job_numWorkers = 0;
+}
@@ -70,11 +70,28 @@ void Com_InitThreadData(void);
 const void* __cdecl Sys_GetValue(int key);
 void __cdecl Sys_SetValue(int key, const void* value);
 qboolean Sys_CreateNewThread(void* (*ThreadMain)(void*), threadid_t*, void*);
+void Sys_JoinThread(threadid_t tid);
 qboolean Sys_ThreadisSame(threadid_t threadid);
 qboolean Sys_SetupThreadCallback(void* callbackMain,...);
 qboolean Sys_CreateCallbackThread(void* threadMain,...);
 void Sys_RunThreadCallbacks();
 void Sys_ExitThread(int code);
+int Sys_GetNumCPUs( void );
+void* Sys_SemaphoreCreate( void );
+void Sys_SemaphorePost( void* sem );
+void Sys_SemaphoreWait( void* sem );
+
+typedef struct job_s job_t;
+typedef void (*jobFunc_t)(void* arg);
+
+void Sys_InitJobs( void );
+job_t* Sys_JobCreate(jobFunc_t func, jobFunc_t done, void* arg);
+qboolean Sys_JobDepend(job_t* job, job_t* dependency);
+void Sys_JobSubmit(job_t* job);
+job_t* Sys_JobRun(jobFunc_t func, jobFunc_t done, void* arg);
+void Sys_JobComplete(job_t* job);
+void Sys_ShutdownJobs( void );
+void Sys_RunJobCompletions( void );
 
 
 void Sys_RunDelegatedEvents();
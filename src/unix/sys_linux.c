@@ -47,6 +47,7 @@
 #include <pwd.h>
 #include <execinfo.h>
 #include <wait.h>
+#include <time.h>
 
 char** ELF32_GetStrTable(void* buff, int len, sharedlib_data_t *text);
 
@@ -174,6 +175,23 @@ void Sys_TermProcess( )
     wait(&status);
 }
 
+/*
+==============
+Sys_MicrosecondsMonotonic
+
+Cheap monotonic clock for profiling. Unlike gettimeofday() it is not
+affected by ntp adjustments and is served from the vdso
+==============
+*/
+unsigned long long Sys_MicrosecondsMonotonic( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
 char** GetStrTable(void* buff, int len, sharedlib_data_t *text)
 {
 		return ELF32_GetStrTable(buff, len, text);
@@ -46,6 +46,7 @@
 #include <sys/stat.h>
 #include <pwd.h>
 #include <execinfo.h>
+#include <mach/mach_time.h>
 
 
 static char homePath[MAX_OSPATH];
@@ -118,6 +119,24 @@ void Sys_PlatformInit( void )
 	
 	Sys_InitCrashDumps();
 }
+/*
+==============
+Sys_MicrosecondsMonotonic
+
+Cheap monotonic clock for profiling
+==============
+*/
+unsigned long long Sys_MicrosecondsMonotonic( void )
+{
+	static mach_timebase_info_data_t timebase;
+
+	if(timebase.denom == 0)
+	{
+		mach_timebase_info(&timebase);
+	}
+	return (mach_absolute_time() * timebase.numer / timebase.denom) / 1000;
+}
+
 /*
 =================
 Sys_StripAppBundle
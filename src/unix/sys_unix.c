@@ -258,7 +258,7 @@ void Sys_ListFilteredFiles( const char *basedir, char *subdirs, char *filter, ch
 		Com_sprintf( filename, sizeof(filename), "%s/%s", subdirs, d->d_name );
 		if (!Com_FilterPath( filter, filename, qfalse ))
 			continue;
-		list[ *numfiles ] = CopyString( filename );
+		list[ *numfiles ] = CopyStringTag( filename, TAG_FILESYSTEM );
 		(*numfiles)++;
 	}
 
@@ -305,7 +305,7 @@ char **Sys_ListFiles( const char *directory, const char *extension, char *filter
 		if (!nfiles)
 			return NULL;
 
-		listCopy = Z_Malloc( ( nfiles + 1 ) * sizeof( *listCopy ) );
+		listCopy = Z_TagMallocZero( ( nfiles + 1 ) * sizeof( *listCopy ), TAG_FILESYSTEM );
 		for ( i = 0 ; i < nfiles ; i++ ) {
 			listCopy[i] = list[i];
 		}
@@ -352,7 +352,7 @@ char **Sys_ListFiles( const char *directory, const char *extension, char *filter
 		}
 		if ( nfiles == MAX_FOUND_FILES - 1 )
 			break;
-		list[ nfiles ] = CopyString( d->d_name );
+		list[ nfiles ] = CopyStringTag( d->d_name, TAG_FILESYSTEM );
 		nfiles++;
 	}
 
@@ -367,7 +367,7 @@ char **Sys_ListFiles( const char *directory, const char *extension, char *filter
 		return NULL;
 	}
 
-	listCopy = Z_Malloc( ( nfiles + 1 ) * sizeof( *listCopy ) );
+	listCopy = Z_TagMallocZero( ( nfiles + 1 ) * sizeof( *listCopy ), TAG_FILESYSTEM );
 	for ( i = 0 ; i < nfiles ; i++ ) {
 		listCopy[i] = list[i];
 	}
@@ -525,6 +525,100 @@ void Sys_SleepSec(int seconds)
     sleep(seconds);
 }
 
+/*
+==================
+Sys_SleepMSec
+==================
+*/
+
+void Sys_SleepMSec(int msec)
+{
+    usleep(msec * 1000);
+}
+
+/*
+==================
+Sys_FileSync
+
+Forces the data of an open file onto the disk
+==================
+*/
+
+void Sys_FileSync(FILE* f)
+{
+    fflush(f);
+    fsync(fileno(f));
+}
+
+/*
+==================
+Sys_MemoryReserve
+
+Maps zeroed memory without reserving swap for it. Pages take up physical
+memory only once they get touched
+==================
+*/
+
+void* Sys_MemoryReserve(unsigned int size, qboolean hugepages)
+{
+    void* mem;
+
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(mem == MAP_FAILED)
+    {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if(hugepages && madvise(mem, size, MADV_HUGEPAGE) != 0)
+    {
+        Com_PrintWarning("Sys_MemoryReserve: madvise(MADV_HUGEPAGE) failed: %s\n", strerror(errno));
+    }
+#else
+    if(hugepages)
+    {
+        Com_PrintWarning("Sys_MemoryReserve: Huge pages are not supported on this system\n");
+    }
+#endif
+    return mem;
+}
+
+/*
+==================
+Sys_MemoryResidentBytes
+
+Returns how much of this page aligned memory is in physical memory or -1
+==================
+*/
+
+int Sys_MemoryResidentBytes(void* start, unsigned int size)
+{
+    void* vec;
+    unsigned char* pages;
+    int pagesize, numpages, i, resident;
+
+    pagesize = getpagesize();
+    numpages = (size + pagesize -1) / pagesize;
+
+    vec = malloc(numpages);
+    if(vec == NULL)
+    {
+        return -1;
+    }
+    if(mincore(start, size, vec) != 0)
+    {
+        free(vec);
+        return -1;
+    }
+    pages = vec;
+    for(i = 0, resident = 0; i < numpages; i++)
+    {
+        if(pages[i] & 1)
+            resident++;
+    }
+    free(vec);
+    return resident * pagesize;
+}
+
 /*
 ==================
 Sys_Backtrace
@@ -597,6 +691,59 @@ qboolean Sys_CreateNewThread(void* (*ThreadMain)(void*), threadid_t *tid, void*
 	return qtrue;
 }
 
+void Sys_JoinThread(threadid_t tid)
+{
+	pthread_join(tid, NULL);
+}
+
+
+typedef struct{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int count;
+}sys_semaphore_t;
+
+void* Sys_SemaphoreCreate( void )
+{
+	sys_semaphore_t* sem = malloc(sizeof(sys_semaphore_t));
+
+	if(sem == NULL)
+		return NULL;
+
+	pthread_mutex_init(&sem->mutex, NULL);
+	pthread_cond_init(&sem->cond, NULL);
+	sem->count = 0;
+	return sem;
+}
+
+void Sys_SemaphorePost( void* s )
+{
+	sys_semaphore_t* sem = s;
+
+	pthread_mutex_lock(&sem->mutex);
+	sem->count++;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+void Sys_SemaphoreWait( void* s )
+{
+	sys_semaphore_t* sem = s;
+
+	pthread_mutex_lock(&sem->mutex);
+	while(sem->count == 0)
+		pthread_cond_wait(&sem->cond, &sem->mutex);
+	sem->count--;
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+int Sys_GetNumCPUs( void )
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return count > 0 ? count : 1;
+}
+
 
 static pthread_mutex_t crit_sections[CRIT_SIZE];
 threadid_t mainthread;
@@ -2,31 +2,16 @@
 #include "filesystem.h"
 #include "qcommon_io.h"
 #include "murmurhash1.h"
+#include "varstorage.h"
+#include "sys_main.h"
+#include "sys_thread.h"
 
 #include <string.h>
+#include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 
-typedef enum
-{
-    VSVAR_BAD,
-    VSVAR_STRING,
-    VSVAR_BOOLEAN,
-    VSVAR_INTEGER,
-    VSVAR_FLOAT,
-    VSVAR_VECTOR
-}varType_t;
-
-typedef union
-{
-    char* string;
-    qboolean boolean;
-    int32_t integer;
-    float floatVar;
-    vec3_t vector;
-}vsValue_t;
-
-
 typedef struct
 {
     byte type;
@@ -46,7 +31,6 @@ typedef union
 }vsMemUnit_t;
 
 
-#define MAX_VARNAME 32
 
 typedef struct
 {
@@ -79,19 +63,13 @@ typedef struct
 
 }memStorage_t;
 
-typedef struct
+struct vsMemObj_s
 {
     memStorage_t store;
     table_t table;
     iterator_t iter;
     const char* lastError;
-}vsMemObj_t;
-
-typedef struct
-{
-    vsMemObj_t* memObj;
-    int relocationCount;
-}varStorage_t;
+};
 
 #define VSINITIAL_STORAGE_SIZE 4096
 
@@ -530,11 +508,16 @@ int HStorage_EndDataInternal( vsMemObj_t* obj )
 
     if(tableindex == -1)
     {
+        /* Hashtable is full of deleted fields. Relocating rebuilds it */
         obj->lastError = "HStorage_EndData: Invalid index";
-        return -1;
+        return 0;
     }
 
     index = hashtable[tableindex];
+    if(index == -1)
+    {
+        ++obj->table.numInUseFields;
+    }
 
     if(index != -1)
     {
@@ -551,6 +534,10 @@ int HStorage_EndDataInternal( vsMemObj_t* obj )
     numUnits = HStorage_GetNumberOfUnitsFromDatasize( tmpheader->dataSize );
     if(index + numUnits >= obj->table.numUnits)
     {
+        if(hashtable[tableindex] == -1)
+        {
+            --obj->table.numInUseFields;
+        }
         obj->table.overflowed = qtrue;
         obj->lastError = "HStorage_EndData: Available variable storage has exceeded. Requires to relocate 1st on a larger amount of memory";
         return 0;
@@ -563,13 +550,34 @@ int HStorage_EndDataInternal( vsMemObj_t* obj )
     /* Beginning modifying of our dataset */
     /* Sets the hashtable entry to our saving location */
     hashtable[tableindex] = index;
-    ++obj->table.numInUseFields;
     /* copy our temp dataset to the final destination */
     memcpy( &(units[index]), &(obj->iter.tempunits[0]), tmpheader->dataSize + HStorage_GetHeaderSize());
     obj->lastError = "HStorage_EndData: Success";
     return 1;
 }
 
+/* Removes a field. Its units stay allocated until the next relocation */
+qboolean HStorage_DeleteInternal( vsMemObj_t* obj, char* name )
+{
+    int tableindex;
+    int *hashtable;
+
+    hashtable = (int*)&HStorage_GetMemoryStart(obj)[ obj->store.hashtableOffset ];
+
+    tableindex = HStorage_GetTableDataIndex( obj, name );
+
+    if(tableindex == -1 || hashtable[tableindex] < 0)
+    {
+        obj->lastError = "HStorage_Delete: The element which is requested is not found";
+        return qfalse;
+    }
+
+    hashtable[tableindex] = -2;
+    --obj->table.numInUseFields;
+    obj->lastError = "HStorage_Delete: Success";
+    return qtrue;
+}
+
 /* Functions to retrieve an object */
 qboolean HStorage_GetBeginDataSetupIterInternal( vsMemObj_t* obj, int tableindex )
 {
@@ -756,16 +764,43 @@ const char* HStorage_GetLastErrorInternal( vsMemObj_t* obj )
 }
 
 
+/* Number of units the live fields plus the pending tempdata need after relocation */
+int HStorage_GetLiveUnits( vsMemObj_t* obj )
+{
+    int i, liveunits;
+    int *hashtable;
+    vsMemUnit_t *units;
+
+    hashtable = (int*)&HStorage_GetMemoryStart(obj)[ obj->store.hashtableOffset ];
+    units = (vsMemUnit_t*)&HStorage_GetMemoryStart(obj)[ obj->store.memUnitsOffset ];
+
+    liveunits = HStorage_GetNumberOfUnitsFromDatasize( obj->iter.tempunits[0].header.dataSize );
+
+    for(i = 0; i < obj->table.numFields; ++i)
+    {
+        if(hashtable[i] < 0)
+        {
+            continue;
+        }
+        liveunits += HStorage_GetNumberOfUnitsFromDatasize( units[hashtable[i]].header.dataSize );
+    }
+    return liveunits;
+}
+
 vsMemObj_t* HStorage_Relocate( vsMemObj_t* obj )
 {
     int i, count;
     qboolean addsuc;
-    char name[32];
+    char name[MAX_VARNAME];
     varType_t type;
     vsValue_t value;
     vsMemObj_t* newobj;
 
-    if(obj->store.length == VSINITIAL_STORAGE_SIZE)
+    if(2 * HStorage_GetLiveUnits( obj ) < obj->table.numUnits)
+    {
+        /* Mostly overwritten or deleted fields. Compacting on the same size is enough */
+        newobj = HStorage_NewObjectInternal( obj->store.length );
+    }else if(obj->store.length == VSINITIAL_STORAGE_SIZE)
     {
         newobj = HStorage_NewObjectInternal( 4 * obj->store.length );
     }else{
@@ -819,7 +854,7 @@ vsMemObj_t* HStorage_Relocate( vsMemObj_t* obj )
                 case 0:
                     obj->lastError = "HStorage_Relocate: Not enough space after relocation. This is considered as fatal";
                     free(newobj);
-                    return obj;
+                    return NULL;
                 case 1:
                     /* Usual success case */
                     break;
@@ -836,16 +871,50 @@ vsMemObj_t* HStorage_Relocate( vsMemObj_t* obj )
 }
 
 
+/*
+Writes the field which has been selected with GetBeginData or IterGetNextInfo as one line.
+This is the format LoadDataFromFile reads back
+*/
+int HStorage_InfoStringInternal( vsMemObj_t* obj, const char* name, varType_t type, int count, char* infostring, int len )
+{
+    char buf[128];
+    int i;
+    char *string;
+    vsValue_t value;
+    mvabuf;
+
+    *infostring = 0;
+    BigInfo_SetValueForKey(infostring, "name", name);
+    BigInfo_SetValueForKey(infostring, "type", HStorage_EnumToVarType(type));
+    BigInfo_SetValueForKey(infostring, "count", va("%d", count));
+
+    for(i = 0; i < count; i++)
+    {
+        if(HStorage_GetDataInternal(obj, &value) == 0)
+        {
+            break;
+        }
+
+        if(type == VSVAR_STRING)
+        {
+            string = HStorage_ValueToString(type, &value, buf, sizeof(buf));
+            BigInfo_SetEncodedValueForKey(infostring, va("v%d", i), string, strlen(string));
+        }else{
+            BigInfo_SetValueForKey(infostring, va("v%d", i), HStorage_ValueToString(type, &value, buf, sizeof(buf)));
+        }
+    }
+
+    Q_strcat(infostring, len, "\\\n");
+    return strlen(infostring);
+}
+
 void HStorage_WriteDataToFile(varStorage_t* vobj, const char* filename){
 
     fileHandle_t file;
-    char infostring[8192], buf[128];
-    int i;
+    char infostring[8192];
     char name[MAX_VARNAME];
-    char *string;
     int count;
     vsMemObj_t* obj;
-    vsValue_t value;
     varType_t type;
     mvabuf;
 
@@ -868,28 +937,7 @@ void HStorage_WriteDataToFile(varStorage_t* vobj, const char* filename){
                 continue;
             }
 
-            *infostring = 0;
-            BigInfo_SetValueForKey(infostring, "name", name);
-            BigInfo_SetValueForKey(infostring, "type", HStorage_EnumToVarType(type));
-            BigInfo_SetValueForKey(infostring, "count", va("%d", count));
-
-            for(i = 0; i < count; i++)
-            {
-                if(HStorage_GetDataInternal(obj, &value) == 0)
-                {
-                    break;
-                }
-
-                if(type == VSVAR_STRING)
-                {
-                    string = HStorage_ValueToString(type, &value, buf, sizeof(buf));
-                    BigInfo_SetEncodedValueForKey(infostring, va("v%d", i), string, strlen(string));
-                }else{
-                    BigInfo_SetValueForKey(infostring, va("v%d", i), HStorage_ValueToString(type, &value, buf, sizeof(buf)));
-                }
-            }
-
-            Q_strcat(infostring, sizeof(infostring), "\\\n");
+            HStorage_InfoStringInternal( obj, name, type, count, infostring, sizeof(infostring) );
             FS_Write(infostring, strlen(infostring), file);
     }
     FS_FCloseFile(file);
@@ -904,12 +952,19 @@ qboolean HStorage_ParseLine(varStorage_t* vobj ,char* line, int linenumber){
     vsMemObj_t* newobj;
     vsMemObj_t* obj;
     char queryString[32];
-    char varname[32];
+    char varname[MAX_VARNAME];
     char outbuf[8192];
     qboolean suc;
 
     obj = vobj->memObj;
 
+    if(Info_ValueForKey(line, "del")[0] == '1')
+    {
+        Q_strncpyz(varname, Info_ValueForKey(line, "name"), sizeof(varname));
+        HStorage_DeleteInternal( obj, varname );
+        return qtrue;
+    }
+
     varType = HStorage_VarTypeToEnum( Info_ValueForKey(line, "type") );
 
     if(varType == VSVAR_BAD)
@@ -955,8 +1010,8 @@ qboolean HStorage_ParseLine(varStorage_t* vobj ,char* line, int linenumber){
 
         }else{
             varValue = Info_ValueForKey(line, queryString);
+            suc = HStorage_AddDataFromStringInternal( obj, varValue );
         }
-        suc = HStorage_AddDataFromStringInternal( obj, varValue );
         if(suc != qtrue)
         {
             Com_PrintError("HStorage_ParseLine: %s\n", HStorage_GetLastErrorInternal( obj ));
@@ -974,7 +1029,7 @@ qboolean HStorage_ParseLine(varStorage_t* vobj ,char* line, int linenumber){
             newobj = HStorage_Relocate( obj );
             if(newobj == NULL)
             {
-                Com_PrintError("HStorage_ParseLine: %s\n", HStorage_GetLastErrorInternal( newobj ));
+                Com_PrintError("HStorage_ParseLine: %s\n", HStorage_GetLastErrorInternal( obj ));
                 return qfalse;
             }
             obj = newobj;
@@ -1132,3 +1187,707 @@ const char* HStorage_GetLastError(varStorage_t* obj)
 {
     return HStorage_GetLastErrorInternal( obj->memObj );
 }
+
+qboolean HStorage_Delete( varStorage_t* obj, char* name )
+{
+    return HStorage_DeleteInternal( obj->memObj, name );
+}
+
+
+/*
+========================================================================================
+
+Named tables
+
+Scripts and plugins keep their data in named tables which live in memory. Every change
+is appended as one line to storage/<table>.log. The log is written on a worker thread
+about once a second. When the log has grown to more than twice the number of fields it
+gets compacted into storage/<table>.db and truncated. Loading replays the .db file and
+then the .log file.
+
+========================================================================================
+*/
+
+#define MAX_STORAGE_TABLES          16
+#define MAX_STORAGE_TABLENAME       32
+#define MAX_STORAGE_FILESIZE        (64*1024*1024)
+#define STORAGE_FLUSH_MSEC          1000
+#define STORAGE_COMPACT_MINLINES    1024
+#define MAX_STORAGE_STRINGLEN       2048
+
+typedef struct
+{
+    char name[MAX_STORAGE_TABLENAME];
+    varStorage_t vars;
+    char dbpath[MAX_OSPATH];
+    char logpath[MAX_OSPATH];
+    /* Log lines which have not been handed to a job yet */
+    char* pending;
+    int pendingLen;
+    int pendingSize;
+    int logLines;
+    unsigned int lastFlush;
+    /* Newest job of this table. Jobs of one table run in the order they were made */
+    job_t* lastJob;
+}storageTable_t;
+
+typedef struct storageJob_s
+{
+    /* NULL once the table got closed */
+    storageTable_t* table;
+    char* data;
+    int len;
+    /* Compaction only: lines which were still pending and the number of lines in the log */
+    char* log;
+    int logLen;
+    int logLines;
+    qboolean compact;
+    qboolean success;
+    qboolean logged;
+    /* Set by the worker, the completion function may run much later */
+    volatile qboolean finished;
+    job_t* job;
+    struct storageJob_s* next;
+}storageJob_t;
+
+static storageTable_t* storageTables[MAX_STORAGE_TABLES];
+/* Jobs whose completion function has not been called yet */
+static storageJob_t* storageJobs;
+
+
+static qboolean HStorage_ValidTableName( const char* name )
+{
+    int i;
+
+    for(i = 0; name[i]; i++)
+    {
+        if(i >= MAX_STORAGE_TABLENAME -1)
+        {
+            return qfalse;
+        }
+        if(!isalnum(name[i]) && name[i] != '_' && name[i] != '-')
+        {
+            return qfalse;
+        }
+    }
+    return i > 0;
+}
+
+/* Keys end up as info string values */
+static qboolean HStorage_ValidKey( const char* key )
+{
+    if(key[0] == '\0' || strlen(key) >= MAX_VARNAME)
+    {
+        return qfalse;
+    }
+    if(strpbrk(key, "\\\";\n\r"))
+    {
+        return qfalse;
+    }
+    return qtrue;
+}
+
+static qboolean HStorage_AppendBuffer( char** buf, int* len, int* size, const char* data, int datalen )
+{
+    char* newbuf;
+    int newsize;
+
+    if(*len + datalen > *size)
+    {
+        newsize = *size ? *size : 4096;
+        while(newsize < *len + datalen)
+        {
+            newsize *= 2;
+        }
+        newbuf = realloc(*buf, newsize);
+        if(newbuf == NULL)
+        {
+            return qfalse;
+        }
+        *buf = newbuf;
+        *size = newsize;
+    }
+    memcpy(*buf + *len, data, datalen);
+    *len += datalen;
+    return qtrue;
+}
+
+/* Returns the number of parsed lines or -1 if the file could not be read */
+static int HStorage_ReplayFile( storageTable_t* table, const char* ospath )
+{
+    FILE* fh;
+    char *data, *line, *end;
+    int len, lines, errors;
+
+    fh = fopen(ospath, "rb");
+    if(fh == NULL)
+    {
+        return -1;
+    }
+
+    fseek(fh, 0, SEEK_END);
+    len = ftell(fh);
+    fseek(fh, 0, SEEK_SET);
+
+    if(len < 0 || len > MAX_STORAGE_FILESIZE)
+    {
+        Com_PrintError("HStorage_ReplayFile: %s has an invalid size\n", ospath);
+        fclose(fh);
+        return -1;
+    }
+
+    data = malloc(len +1);
+    if(data == NULL || fread(data, 1, len, fh) != len)
+    {
+        Com_PrintError("HStorage_ReplayFile: Can not read from %s\n", ospath);
+        free(data);
+        fclose(fh);
+        return -1;
+    }
+    fclose(fh);
+    data[len] = '\0';
+
+    lines = 0;
+    errors = 0;
+
+    for(line = data; *line; line = end +1)
+    {
+        end = strchr(line, '\n');
+        if(end)
+        {
+            *end = '\0';
+        }
+        if(*line && *line != '/')
+        {
+            if(HStorage_ParseLine(&table->vars, line, lines +1))
+            {
+                ++lines;
+            }else{
+                ++errors;
+            }
+        }
+        if(end == NULL)
+        {
+            break;
+        }
+    }
+    free(data);
+
+    if(errors > 0)
+    {
+        /* A line cut off by a crash is expected at the end of the log */
+        Com_PrintWarning("%i lines of %s could not be parsed\n", errors, ospath);
+    }
+    return lines;
+}
+
+static storageTable_t* HStorage_OpenTable( const char* name )
+{
+    storageTable_t* table;
+    int i, slot, lines;
+    mvabuf;
+
+    slot = -1;
+
+    for(i = 0; i < MAX_STORAGE_TABLES; i++)
+    {
+        if(storageTables[i] == NULL)
+        {
+            if(slot == -1)
+            {
+                slot = i;
+            }
+            continue;
+        }
+        if(!Q_stricmp(storageTables[i]->name, name))
+        {
+            return storageTables[i];
+        }
+    }
+
+    if(!HStorage_ValidTableName( name ))
+    {
+        Com_PrintError("HStorage_OpenTable: Invalid table name \"%s\"\n", name);
+        return NULL;
+    }
+    if(slot == -1)
+    {
+        Com_PrintError("HStorage_OpenTable: Exceeded limit of %d tables\n", MAX_STORAGE_TABLES);
+        return NULL;
+    }
+
+    table = malloc(sizeof(storageTable_t));
+    if(table == NULL)
+    {
+        return NULL;
+    }
+    memset(table, 0, sizeof(storageTable_t));
+    Q_strncpyz(table->name, name, sizeof(table->name));
+
+    if(HStorage_InitObject( &table->vars, VSINITIAL_STORAGE_SIZE ) == qfalse)
+    {
+        free(table);
+        return NULL;
+    }
+
+    FS_BuildOSPathForThread( fs_homepath->string, "", va("storage/%s.db", name), table->dbpath, 0);
+    FS_BuildOSPathForThread( fs_homepath->string, "", va("storage/%s.log", name), table->logpath, 0);
+
+    /* Done right here on the main thread. The table has to be complete before its first lookup */
+    HStorage_ReplayFile( table, table->dbpath );
+    lines = HStorage_ReplayFile( table, table->logpath );
+    if(lines > 0)
+    {
+        table->logLines = lines;
+    }
+
+    table->lastFlush = Sys_Milliseconds();
+    storageTables[slot] = table;
+
+    Com_DPrintf("Opened storage table %s with %d fields\n", name, table->vars.memObj->table.numInUseFields);
+    return table;
+}
+
+static qboolean HStorage_AppendLog( const char* path, const char* data, int len )
+{
+    FILE* fh;
+    qboolean success;
+
+    fh = fopen(path, "ab");
+    if(fh == NULL)
+    {
+        return qfalse;
+    }
+    success = fwrite(data, 1, len, fh) == len;
+    if(fclose(fh) != 0)
+    {
+        success = qfalse;
+    }
+    return success;
+}
+
+static void HStorage_WriteFiles( storageJob_t* sjob )
+{
+    storageTable_t* table = sjob->table;
+    char tmppath[MAX_OSPATH];
+    FILE* fh;
+
+    if(FS_CreatePath( table->logpath ))
+    {
+        return;
+    }
+
+    if(sjob->compact == qfalse)
+    {
+        sjob->success = HStorage_AppendLog( table->logpath, sjob->data, sjob->len );
+        return;
+    }
+
+    /* The log has to hold every change before the database gets replaced.
+       If the compaction fails nothing is lost and a crash in between replays the log
+       on top of the new database which gives the same result */
+    sjob->logged = sjob->logLen == 0 || HStorage_AppendLog( table->logpath, sjob->log, sjob->logLen );
+
+    Com_sprintf(tmppath, sizeof(tmppath), "%s.tmp", table->dbpath);
+
+    fh = fopen(tmppath, "wb");
+    if(fh == NULL)
+    {
+        return;
+    }
+    if(fwrite(sjob->data, 1, sjob->len, fh) != sjob->len)
+    {
+        fclose(fh);
+        return;
+    }
+    if(fclose(fh) != 0)
+    {
+        return;
+    }
+
+    /* rename replaces the old database atomically, only Windows refuses to overwrite it */
+#ifdef _WIN32
+    remove(table->dbpath);
+#endif
+    if(rename(tmppath, table->dbpath) != 0)
+    {
+        return;
+    }
+    fh = fopen(table->logpath, "wb");
+    if(fh)
+    {
+        fclose(fh);
+    }
+    sjob->success = qtrue;
+}
+
+static void HStorage_WriteJob( void* arg )
+{
+    storageJob_t* sjob = arg;
+
+    HStorage_WriteFiles( sjob );
+    __sync_synchronize();
+    sjob->finished = qtrue;
+}
+
+static void HStorage_WriteDone( void* arg )
+{
+    storageJob_t* sjob = arg;
+    storageTable_t* table = sjob->table;
+    storageJob_t** link;
+    int size;
+
+    for(link = &storageJobs; *link; link = &(*link)->next)
+    {
+        if(*link == sjob)
+        {
+            *link = sjob->next;
+            break;
+        }
+    }
+
+    if(table)
+    {
+        if(table->lastJob == sjob->job)
+        {
+            table->lastJob = NULL;
+        }
+        if(sjob->success == qfalse)
+        {
+            Com_PrintError("HStorage: Failed to write %s\n", sjob->compact ? table->dbpath : table->logpath);
+        }
+        if(sjob->compact && sjob->success == qfalse)
+        {
+            table->logLines += sjob->logLines;
+            /* Lines which did not make it into the log go out again ahead of the newer ones */
+            if(sjob->logged == qfalse)
+            {
+                size = sjob->logLen;
+                if(table->pendingLen > 0 && HStorage_AppendBuffer( &sjob->log, &sjob->logLen, &size, table->pending, table->pendingLen ) == qfalse)
+                {
+                    Com_PrintError("HStorage: Out of memory. Changes of table %s are not saved\n", table->name);
+                }
+                else
+                {
+                    free(table->pending);
+                    table->pending = sjob->log;
+                    table->pendingLen = sjob->logLen;
+                    table->pendingSize = size;
+                    sjob->log = NULL;
+                }
+            }
+        }
+    }
+    free(sjob->data);
+    free(sjob->log);
+    free(sjob);
+}
+
+static storageJob_t* HStorage_AllocWrite( storageTable_t* table )
+{
+    storageJob_t* sjob;
+
+    sjob = malloc(sizeof(storageJob_t));
+    if(sjob == NULL)
+    {
+        Com_PrintError("HStorage_AllocWrite: Out of memory for table %s\n", table->name);
+        return NULL;
+    }
+    memset(sjob, 0, sizeof(storageJob_t));
+    sjob->table = table;
+
+    sjob->job = Sys_JobCreate(HStorage_WriteJob, HStorage_WriteDone, sjob);
+    if(sjob->job == NULL)
+    {
+        Com_PrintError("HStorage_AllocWrite: Can not create a job for table %s\n", table->name);
+        free(sjob);
+        return NULL;
+    }
+    return sjob;
+}
+
+static void HStorage_SubmitWrite( storageJob_t* sjob )
+{
+    storageTable_t* table = sjob->table;
+
+    if(table->lastJob)
+    {
+        Sys_JobDepend(sjob->job, table->lastJob);
+    }
+    table->lastJob = sjob->job;
+    sjob->next = storageJobs;
+    storageJobs = sjob;
+    Sys_JobSubmit(sjob->job);
+}
+
+/* Snapshot of all fields. Everything which is still pending is part of it */
+static void HStorage_CompactTable( storageTable_t* table )
+{
+    char infostring[8192];
+    char name[MAX_VARNAME];
+    char* data;
+    int len, size, count;
+    varType_t type;
+    vsMemObj_t* obj;
+    storageJob_t* sjob;
+
+    obj = table->vars.memObj;
+    data = NULL;
+    len = 0;
+    size = 0;
+
+    HStorage_IterInit( obj );
+
+    while(HStorage_IterHasNext( obj ))
+    {
+        count = HStorage_IterGetNextInfo( obj, name, &type );
+        if(count == 0)
+        {
+            continue;
+        }
+        HStorage_InfoStringInternal( obj, name, type, count, infostring, sizeof(infostring) );
+        if(HStorage_AppendBuffer( &data, &len, &size, infostring, strlen(infostring) ) == qfalse)
+        {
+            /* Keep on appending to the log instead */
+            free(data);
+            return;
+        }
+    }
+
+    sjob = HStorage_AllocWrite( table );
+    if(sjob == NULL)
+    {
+        free(data);
+        return;
+    }
+
+    /* The job owns the pending lines now and hands the line count back if it fails */
+    sjob->data = data;
+    sjob->len = len;
+    sjob->compact = qtrue;
+    sjob->log = table->pending;
+    sjob->logLen = table->pendingLen;
+    sjob->logLines = table->logLines;
+    table->pending = NULL;
+    table->pendingLen = 0;
+    table->pendingSize = 0;
+    table->logLines = 0;
+    HStorage_SubmitWrite( sjob );
+}
+
+static void HStorage_FlushTable( storageTable_t* table )
+{
+    storageJob_t* sjob;
+
+    table->lastFlush = Sys_Milliseconds();
+
+    if(table->pendingLen == 0)
+    {
+        return;
+    }
+
+    if(table->logLines > STORAGE_COMPACT_MINLINES && table->logLines > 2 * table->vars.memObj->table.numInUseFields)
+    {
+        HStorage_CompactTable( table );
+        if(table->pendingLen == 0)
+        {
+            return;
+        }
+    }
+
+    sjob = HStorage_AllocWrite( table );
+    if(sjob == NULL)
+    {
+        return;
+    }
+    /* The job owns the buffer, a new one gets allocated with the next change */
+    sjob->data = table->pending;
+    sjob->len = table->pendingLen;
+    table->pending = NULL;
+    table->pendingLen = 0;
+    table->pendingSize = 0;
+    HStorage_SubmitWrite( sjob );
+}
+
+static qboolean HStorage_LogLine( storageTable_t* table, const char* line )
+{
+    if(HStorage_AppendBuffer( &table->pending, &table->pendingLen, &table->pendingSize, line, strlen(line) ) == qfalse)
+    {
+        Com_PrintError("HStorage_LogLine: Out of memory. Change of table %s is not saved\n", table->name);
+        return qfalse;
+    }
+    ++table->logLines;
+    return qtrue;
+}
+
+qboolean HStorage_TableSet( const char* tablename, const char* key, varType_t type, vsValue_t* value )
+{
+    storageTable_t* table;
+    char infostring[8192];
+    char name[MAX_VARNAME];
+    int count;
+
+    if(!HStorage_ValidKey( key ))
+    {
+        Com_PrintError("HStorage_TableSet: Invalid key \"%s\"\n", key);
+        return qfalse;
+    }
+    /* Has to fit into one log line after encoding */
+    if(type == VSVAR_STRING && strlen(value->string) >= MAX_STORAGE_STRINGLEN)
+    {
+        Com_PrintError("HStorage_TableSet: String for key %s exceeds %d characters\n", key, MAX_STORAGE_STRINGLEN -1);
+        return qfalse;
+    }
+    table = HStorage_OpenTable( tablename );
+    if(table == NULL)
+    {
+        return qfalse;
+    }
+
+    if(HStorage_BeginData( &table->vars, type, key ) == qfalse || HStorage_AddData( &table->vars, value ) == qfalse
+        || HStorage_EndData( &table->vars ) == qfalse)
+    {
+        Com_PrintError("HStorage_TableSet: %s\n", HStorage_GetLastError( &table->vars ));
+        return qfalse;
+    }
+
+    /* The line is built from the stored field, so the log holds exactly what got saved */
+    Q_strncpyz(name, key, sizeof(name));
+    count = HStorage_GetBeginData( &table->vars, name, &type );
+    if(count == 0)
+    {
+        return qfalse;
+    }
+    HStorage_InfoStringInternal( table->vars.memObj, name, type, count, infostring, sizeof(infostring) );
+    return HStorage_LogLine( table, infostring );
+}
+
+/* Strings returned point into the table and are only valid until its next change */
+qboolean HStorage_TableGet( const char* tablename, const char* key, varType_t* type, vsValue_t* value )
+{
+    storageTable_t* table;
+    char name[MAX_VARNAME];
+
+    if(!HStorage_ValidKey( key ))
+    {
+        return qfalse;
+    }
+    table = HStorage_OpenTable( tablename );
+    if(table == NULL)
+    {
+        return qfalse;
+    }
+
+    Q_strncpyz(name, key, sizeof(name));
+    if(HStorage_GetBeginData( &table->vars, name, type ) == 0)
+    {
+        return qfalse;
+    }
+    return HStorage_GetData( &table->vars, value ) == 1;
+}
+
+qboolean HStorage_TableRemove( const char* tablename, const char* key )
+{
+    storageTable_t* table;
+    char name[MAX_VARNAME];
+    char infostring[MAX_INFO_STRING];
+
+    if(!HStorage_ValidKey( key ))
+    {
+        return qfalse;
+    }
+    table = HStorage_OpenTable( tablename );
+    if(table == NULL)
+    {
+        return qfalse;
+    }
+
+    Q_strncpyz(name, key, sizeof(name));
+    if(HStorage_Delete( &table->vars, name ) == qfalse)
+    {
+        return qfalse;
+    }
+
+    *infostring = 0;
+    Info_SetValueForKey(infostring, "name", name);
+    Info_SetValueForKey(infostring, "del", "1");
+    Q_strcat(infostring, sizeof(infostring), "\\\n");
+    return HStorage_LogLine( table, infostring );
+}
+
+/* Called every server frame */
+void HStorage_TablesFrame( void )
+{
+    int i;
+    unsigned int now;
+
+    now = Sys_Milliseconds();
+
+    for(i = 0; i < MAX_STORAGE_TABLES; i++)
+    {
+        if(storageTables[i] && now - storageTables[i]->lastFlush >= STORAGE_FLUSH_MSEC)
+        {
+            HStorage_FlushTable( storageTables[i] );
+        }
+    }
+}
+
+/* Writes out all pending changes, waits for it and closes all tables.
+   Other completions are left alone as their owners may be gone already */
+void HStorage_TablesShutdown( void )
+{
+    int i;
+    storageJob_t* sjob;
+
+    for(i = 0; i < MAX_STORAGE_TABLES; i++)
+    {
+        if(storageTables[i])
+        {
+            HStorage_FlushTable( storageTables[i] );
+        }
+    }
+
+    for(sjob = storageJobs; sjob; sjob = sjob->next)
+    {
+        while(sjob->finished == qfalse)
+        {
+            Sys_SleepMSec( 1 );
+        }
+        /* The completion runs after the table is gone */
+        sjob->table = NULL;
+    }
+
+    for(i = 0; i < MAX_STORAGE_TABLES; i++)
+    {
+        if(storageTables[i] == NULL)
+        {
+            continue;
+        }
+        free(storageTables[i]->vars.memObj);
+        free(storageTables[i]->pending);
+        free(storageTables[i]);
+        storageTables[i] = NULL;
+    }
+}
+
+void HStorage_TableList_f( void )
+{
+    int i, count;
+    storageTable_t* table;
+
+    Com_Printf("name                             fields  memory  loglines  pending\n");
+    Com_Printf("-------------------------------- ------- ------- --------- --------\n");
+
+    for(i = 0, count = 0; i < MAX_STORAGE_TABLES; i++)
+    {
+        table = storageTables[i];
+        if(table == NULL)
+        {
+            continue;
+        }
+        Com_Printf("%-32s %7d %7d %9d %8d\n", table->name, table->vars.memObj->table.numInUseFields,
+                   table->vars.memObj->store.length, table->logLines, table->pendingLen);
+        ++count;
+    }
+    Com_Printf("%d storage tables opened\n", count);
+}
@@ -1,3 +1,6 @@
+#ifndef __VARSTORAGE_H__
+#define __VARSTORAGE_H__
+
 #include "q_shared.h"
 #include "q_math.h"
 #include <stdint.h>
@@ -23,7 +26,9 @@ typedef union
     vec3_t vector;
 }vsValue_t;
 
-typedef void vsMemObj_t;
+#define MAX_VARNAME 64
+
+typedef struct vsMemObj_s vsMemObj_t;
 
 typedef struct
 {
@@ -45,11 +50,22 @@ qboolean HStorage_AddData( varStorage_t* obj, vsValue_t* value );
 
 qboolean HStorage_EndData( varStorage_t* obj );
 
-int HStorage_GetBeginData( varStorage_t* obj, const char* name, varType_t* type);
+int HStorage_GetBeginData( varStorage_t* obj, char* name, varType_t* type);
 /* Gets one element */
 int HStorage_GetData(varStorage_t* obj, vsValue_t* value );
 
 void HStorage_WriteDataToFile(varStorage_t* obj, const char* filename);
-vsMemObj_t* HStorage_LoadDataFromFile(varStorage_t* obj, const char* filename);
+qboolean HStorage_LoadDataFromFile(varStorage_t* obj, const char* filename);
+
+const char* HStorage_GetLastError(varStorage_t* obj);
+qboolean HStorage_Delete( varStorage_t* obj, char* name );
+
+/* Named tables which are persisted to storage/<name>.db and storage/<name>.log */
+qboolean HStorage_TableSet( const char* tablename, const char* key, varType_t type, vsValue_t* value );
+qboolean HStorage_TableGet( const char* tablename, const char* key, varType_t* type, vsValue_t* value );
+qboolean HStorage_TableRemove( const char* tablename, const char* key );
+void HStorage_TablesFrame( void );
+void HStorage_TablesShutdown( void );
+void HStorage_TableList_f( void );
 
-const char* HStorage_GetLastError(varStorage_t* obj);
\ No newline at end of file
+#endif
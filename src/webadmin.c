@@ -709,6 +709,18 @@ void Webadmin_BuildMessage(msg_t* msg, const char* username, qboolean invalidlog
 						{
 							uid = Auth_GetUID(username);
 							Webadmin_BuildAdminList(xmlobj, uid);
+						}else if(!Q_strncmp(url +9, "/profile", 8)){
+							uid = Auth_GetUID(username);
+							XO("h3");XA("Frame Profile");XC;
+							XO("hr");XC;
+							XO1("div","class","well");
+								Webadmin_ConsoleCommand(xmlobj, "profile", uid);
+							XC;
+							XO("h3");XA("Slow Frames");XC;
+							XO("hr");XC;
+							XO1("div","class","well");
+								Webadmin_ConsoleCommand(xmlobj, "slowframes", uid);
+							XC;
 						}else {
 
 							uid = Auth_GetUID(username);
@@ -827,7 +839,7 @@ qboolean HTTPCreateWebadminMessage(ftRequest_t* request, msg_t* msg, char* sessi
 	
 	len = 0x20000;
 	
-	buf = Z_Malloc(len);
+	buf = Z_TagMallocZero(len, TAG_NETWORK);
 	if(buf == NULL)
 	{
 		return qfalse;
@@ -169,6 +169,56 @@ void Sys_SleepSec(int seconds)
     Sleep(seconds);
 }
 
+/*
+==================
+Sys_SleepMSec
+==================
+*/
+
+void Sys_SleepMSec(int msec)
+{
+    Sleep(msec);
+}
+
+/*
+==================
+Sys_FileSync
+
+Forces the data of an open file onto the disk
+==================
+*/
+
+void Sys_FileSync(FILE* f)
+{
+    fflush(f);
+    _commit(_fileno(f));
+}
+
+/*
+==================
+Sys_MemoryReserve
+
+Committed pages are zeroed and get backed by physical memory only once they
+get touched. Large pages need a privilege a server usually does not have
+==================
+*/
+
+void* Sys_MemoryReserve(unsigned int size, qboolean hugepages)
+{
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+/*
+==================
+Sys_MemoryResidentBytes
+==================
+*/
+
+int Sys_MemoryResidentBytes(void* start, unsigned int size)
+{
+    return -1;
+}
+
 int Sys_GetPageSize()
 {
 	SYSTEM_INFO SystemInfo;
@@ -302,7 +352,7 @@ void Sys_ListFilteredFiles( const char *basedir, char *subdirs, char *filter, ch
 		Com_sprintf( filename, sizeof(filename), "%s\\%s", subdirs, findinfo.name );
 		if (!Com_FilterPath( filter, filename, qfalse ))
 			continue;
-		list[ *numfiles ] = CopyString( filename );
+		list[ *numfiles ] = CopyStringTag( filename, TAG_FILESYSTEM );
 		(*numfiles)++;
 	} while ( _findnext (findhandle, &findinfo) != -1 );
 
@@ -364,7 +414,7 @@ char **Sys_ListFiles( const char *directory, const char *extension, char *filter
 		if (!nfiles)
 		return NULL;
 
-		listCopy = Z_Malloc( ( nfiles + 1 ) * sizeof( *listCopy ) );
+		listCopy = Z_TagMallocZero( ( nfiles + 1 ) * sizeof( *listCopy ), TAG_FILESYSTEM );
 		for ( i = 0 ; i < nfiles ; i++ ) {
 			listCopy[i] = list[i];
 		}
@@ -401,7 +451,7 @@ char **Sys_ListFiles( const char *directory, const char *extension, char *filter
 			if ( nfiles == MAX_FOUND_FILES - 1 ) {
 				break;
 			}
-			list[ nfiles ] = CopyString( findinfo.name );
+			list[ nfiles ] = CopyStringTag( findinfo.name, TAG_FILESYSTEM );
 			nfiles++;
 		}
 	} while ( _findnext (findhandle, &findinfo) != -1 );
@@ -417,7 +467,7 @@ char **Sys_ListFiles( const char *directory, const char *extension, char *filter
 		return NULL;
 	}
 
-	listCopy = Z_Malloc( ( nfiles + 1 ) * sizeof( *listCopy ) );
+	listCopy = Z_TagMallocZero( ( nfiles + 1 ) * sizeof( *listCopy ), TAG_FILESYSTEM );
 	for ( i = 0 ; i < nfiles ; i++ ) {
 		listCopy[i] = list[i];
 	}
@@ -505,6 +555,27 @@ uint32_t Sys_MillisecondsRaw()
 {
 	return timeGetTime();
 }
+
+/*
+================
+Sys_MicrosecondsMonotonic
+
+Cheap monotonic clock for profiling
+================
+*/
+unsigned long long Sys_MicrosecondsMonotonic( void )
+{
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if(frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&counter);
+
+	return (counter.QuadPart / frequency.QuadPart) * 1000000ULL + ((counter.QuadPart % frequency.QuadPart) * 1000000ULL) / frequency.QuadPart;
+}
 /*
 ================
 Sys_GetCurrentUser
@@ -683,6 +754,40 @@ qboolean Sys_CreateNewThread(void* (*ThreadMain)(void*), threadid_t *tid, void*
 	return qtrue;
 }
 
+void Sys_JoinThread(threadid_t tid)
+{
+	HANDLE thread = OpenThread(SYNCHRONIZE, FALSE, tid);
+
+	if(thread == NULL)
+		return;
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+
+void* Sys_SemaphoreCreate( void )
+{
+	return CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+}
+
+void Sys_SemaphorePost( void* sem )
+{
+	ReleaseSemaphore(sem, 1, NULL);
+}
+
+void Sys_SemaphoreWait( void* sem )
+{
+	WaitForSingleObject(sem, INFINITE);
+}
+
+int Sys_GetNumCPUs( void )
+{
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
 
 qboolean __cdecl Sys_IsMainThread( void )
 {	
@@ -314,7 +314,7 @@ void DB_CustomAllocOnce(XAssetType_t type)
 	int typesize = DB_GetXAssetTypeSize(type);
 	void *alloc;
 
-	alloc = Z_Malloc(count * typesize);
+	alloc = Z_TagMallocZero(count * typesize, TAG_ASSET);
 	if(alloc)
 	{
 		DB_XAssetPool[type] = alloc;
@@ -344,7 +344,7 @@ void DB_RelocateXAssetMem()
 		count = XAssetRequestedCount[i];
 		typesize = DB_GetXAssetTypeSize(i);
 		
-		newmem = Z_Malloc(count * typesize);
+		newmem = Z_TagMallocZero(count * typesize, TAG_ASSET);
 		
 		if(newmem == NULL)
 		{